@@ -0,0 +1,283 @@
+﻿#include "archive.h"
+#include "protocol.h"
+
+#include <algorithm>
+
+namespace fs = std::filesystem;
+
+std::vector<archive_entry> collect_archive_entries(const fs::path& base, const std::vector<std::string>& roots) {
+    std::vector<archive_entry> entries;
+    auto add = [&](const fs::path& file) {
+        std::error_code ec;
+        archive_entry entry;
+        entry.path = file.lexically_relative(base).generic_u8string();
+        entry.size = fs::file_size(file, ec);
+        entry.mode = static_cast<uint32_t>(fs::status(file, ec).permissions()) & 0777;
+        if (!ec) entries.push_back(std::move(entry));
+    };
+
+    for (const std::string& root : roots) {
+        fs::path path = base / fs::u8path(root);
+        std::error_code ec;
+        if (fs::is_regular_file(path, ec)) {
+            add(path);
+            continue;
+        }
+        std::vector<fs::path> files;
+        for (fs::recursive_directory_iterator it(path, ec), end; !ec && it != end; it.increment(ec)) {
+            if (it->is_regular_file(ec)) files.push_back(it->path());
+        }
+        // 같은 폴더의 파일끼리 붙어 있어야 수신측 디스크 접근이 덜 흩어진다
+        std::sort(files.begin(), files.end());
+        for (const fs::path& file : files) add(file);
+    }
+
+    uint64_t offset = 0;
+    for (archive_entry& entry : entries) {
+        entry.offset = offset;
+        offset += entry.size;
+    }
+    return entries;
+}
+
+uint64_t archive_size(const std::vector<archive_entry>& entries) {
+    return entries.empty() ? 0 : entries.back().offset + entries.back().size;
+}
+
+void append_manifest(const std::vector<archive_entry>& entries, rtc::binary& out) {
+    for (const archive_entry& entry : entries) {
+        size_t at = out.size();
+        size_t path_length = std::min<size_t>(entry.path.size(), UINT16_MAX);
+        out.resize(at + manifest_entry_header_size + path_length);
+        std::byte* p = out.data() + at;
+        p[0] = static_cast<std::byte>(path_length & 0xFF);
+        p[1] = static_cast<std::byte>(path_length >> 8);
+        put_u32(p + 2, entry.mode);
+        put_u64(p + 6, entry.size);
+        std::copy_n(reinterpret_cast<const std::byte*>(entry.path.data()), path_length, p + manifest_entry_header_size);
+    }
+}
+
+// 받는 쪽 루트 밖으로 나가는 경로는 받지 않는다
+static bool safe_relative_path(const std::string& text) {
+    if (text.empty()) return false;
+    fs::path path = fs::u8path(text);
+    if (path.has_root_name() || path.has_root_directory()) return false;
+    for (const fs::path& part : path) {
+        if (part == "..") return false;
+    }
+    return true;
+}
+
+bool parse_manifest(const std::byte* data, size_t length, std::vector<archive_entry>& out) {
+    uint64_t offset = archive_size(out);
+    size_t at = 0;
+    while (at < length) {
+        if (length - at < manifest_entry_header_size) return false;
+        const std::byte* p = data + at;
+        size_t path_length = std::to_integer<size_t>(p[0]) | (std::to_integer<size_t>(p[1]) << 8);
+        if (length - at - manifest_entry_header_size < path_length) return false;
+
+        archive_entry entry;
+        entry.mode = get_u32(p + 2);
+        entry.size = get_u64(p + 6);
+        entry.path.assign(reinterpret_cast<const char*>(p + manifest_entry_header_size), path_length);
+        entry.offset = offset;
+        if (!safe_relative_path(entry.path)) return false;
+
+        offset += entry.size;
+        out.push_back(std::move(entry));
+        at += manifest_entry_header_size + path_length;
+    }
+    return true;
+}
+
+namespace {
+
+class archive_source : public chunk_source {
+public:
+    archive_source(fs::path base, std::vector<archive_entry> entries)
+        : base_(std::move(base)), entries_(std::move(entries)), size_(archive_size(entries_)) {}
+
+    uint64_t size() const override { return size_; }
+
+    // 파일 경계를 넘어 length 바이트를 채운다. 작은 파일 여러 개가 한 청크에 들어간다.
+    size_t append(uint64_t offset, size_t length, rtc::binary& out) override {
+        size_t before = out.size();
+        while (length > 0 && offset < size_) {
+            size_t index = entry_at(offset);
+            const archive_entry& entry = entries_[index];
+            if (!open(index)) break;
+
+            size_t want = static_cast<size_t>(std::min<uint64_t>(length, entry.offset + entry.size - offset));
+            size_t at = out.size();
+            out.resize(at + want);
+            size_t got = file_.pread(out.data() + at, want, offset - entry.offset);
+            out.resize(at + got);
+            if (got < want) break; // 보내는 도중 파일이 줄었다
+            offset += got;
+            length -= got;
+        }
+        return out.size() - before;
+    }
+
+private:
+    // offset 을 담고 있는 (크기가 0 이 아닌) 항목
+    size_t entry_at(uint64_t offset) const {
+        auto it = std::upper_bound(entries_.begin(), entries_.end(), offset,
+                                   [](uint64_t value, const archive_entry& e) { return value < e.offset + e.size; });
+        return static_cast<size_t>(it - entries_.begin());
+    }
+
+    bool open(size_t index) {
+        if (current_ == index) return true;
+        current_ = SIZE_MAX;
+        if (!file_.open_read(base_ / fs::u8path(entries_[index].path))) return false;
+        current_ = index;
+        return true;
+    }
+
+    fs::path base_;
+    std::vector<archive_entry> entries_;
+    uint64_t size_;
+    file_io file_;
+    size_t current_ = SIZE_MAX;
+};
+
+} // namespace
+
+std::unique_ptr<chunk_source> open_archive_source(const fs::path& base, std::vector<archive_entry> entries) {
+    return std::make_unique<archive_source>(base, std::move(entries));
+}
+
+archive_writer::~archive_writer() {
+    close();
+}
+
+bool archive_writer::open(const fs::path& root, std::vector<archive_entry> entries, bool fresh) {
+    close();
+    root_ = root;
+    entries_ = std::move(entries);
+    size_ = archive_size(entries_);
+
+    // 빈 파일도 만들어야 하므로 목록 전체를 한 번 훑는다
+    for (const archive_entry& entry : entries_) {
+        fs::path path = root_ / fs::u8path(entry.path);
+        std::error_code ec;
+        fs::create_directories(path.parent_path(), ec);
+        if (!fresh && fs::exists(path, ec)) continue;
+        file_io file;
+        if (!file.open_write(path, true)) return false;
+    }
+    return true;
+}
+
+void archive_writer::close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    open_.clear();
+    open_order_.clear();
+    dirty_.clear();
+    for (const archive_entry& entry : entries_) {
+        if (entry.mode == 0) continue;
+        std::error_code ec;
+        fs::permissions(root_ / fs::u8path(entry.path), static_cast<fs::perms>(entry.mode & 0777), ec);
+    }
+    entries_.clear();
+}
+
+file_io* archive_writer::handle(size_t index) const {
+    auto it = open_.find(index);
+    if (it != open_.end()) {
+        open_order_.splice(open_order_.end(), open_order_, it->second.order);
+        return it->second.file.get();
+    }
+
+    if (open_.size() >= max_open_files) {
+        open_.erase(open_order_.front());
+        open_order_.pop_front();
+    }
+    auto file = std::make_unique<file_io>();
+    if (!file->open_write(root_ / fs::u8path(entries_[index].path), false)) return nullptr;
+    auto order = open_order_.insert(open_order_.end(), index);
+    return open_.emplace(index, open_file{ std::move(file), order }).first->second.file.get();
+}
+
+size_t archive_writer::entry_at(uint64_t offset) const {
+    auto it = std::upper_bound(entries_.begin(), entries_.end(), offset,
+                               [](uint64_t value, const archive_entry& e) { return value < e.offset + e.size; });
+    return static_cast<size_t>(it - entries_.begin());
+}
+
+size_t archive_writer::pread(void* buffer, size_t length, uint64_t offset) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto* out = static_cast<std::byte*>(buffer);
+    size_t done = 0;
+    while (done < length && offset < size_) {
+        const archive_entry& entry = entries_[entry_at(offset)];
+        file_io* file = handle(static_cast<size_t>(&entry - entries_.data()));
+        if (!file) break;
+        size_t want = static_cast<size_t>(std::min<uint64_t>(length - done, entry.offset + entry.size - offset));
+        size_t got = file->pread(out + done, want, offset - entry.offset);
+        done += got;
+        offset += got;
+        if (got < want) break;
+    }
+    return done;
+}
+
+bool archive_writer::pwrite(const void* buffer, size_t length, uint64_t offset) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto* in = static_cast<const std::byte*>(buffer);
+    while (length > 0) {
+        if (offset >= size_) return false;
+        size_t index = entry_at(offset);
+        const archive_entry& entry = entries_[index];
+        file_io* file = handle(index);
+        size_t n = static_cast<size_t>(std::min<uint64_t>(length, entry.offset + entry.size - offset));
+        if (!file || !file->pwrite(in, n, offset - entry.offset)) return false;
+        dirty_.insert(index);
+        in += n;
+        offset += n;
+        length -= n;
+    }
+    return true;
+}
+
+// 파일마다 크기가 다르므로 여기서는 잡지 않는다
+bool archive_writer::preallocate(uint64_t, uint64_t) {
+    return false;
+}
+
+// 파일 경계마다 나눠 각 파일에 구멍을 낸다
+bool archive_writer::zero_range(uint64_t offset, uint64_t length) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (length > 0) {
+        if (offset >= size_) return false;
+        size_t index = entry_at(offset);
+        const archive_entry& entry = entries_[index];
+        file_io* file = handle(index);
+        uint64_t n = std::min(length, entry.offset + entry.size - offset);
+        if (!file || !file->zero_range(offset - entry.offset, n)) return false;
+        dirty_.insert(index);
+        offset += n;
+        length -= n;
+    }
+    return true;
+}
+
+// 마지막 sync() 뒤에 쓴 파일을 모두 fsync 한다. 핸들 수 제한으로 이미 닫힌 파일은 다시 열어서 한다
+bool archive_writer::sync() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool ok = true;
+    for (size_t index : dirty_) {
+        auto it = open_.find(index);
+        if (it != open_.end()) {
+            ok = it->second.file->sync() && ok;
+            continue;
+        }
+        file_io file;
+        ok = file.open_write(root_ / fs::u8path(entries_[index].path), false) && file.sync() && ok;
+    }
+    dirty_.clear();
+    return ok;
+}
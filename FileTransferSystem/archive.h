@@ -0,0 +1,83 @@
+﻿#pragma once
+
+#include <rtc/rtc.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "fileio.h"
+#include "source.h"
+
+// 여러 파일을 한 세션으로 보내는 묶음 전송.
+// 파일 목록(경로, 크기, 권한)을 먼저 보내고, 내용은 목록 순서대로 이어 붙인 하나의 스트림으로 보낸다.
+// 스트림은 보통 파일처럼 청크로 잘려 나가므로 작은 파일 여러 개가 청크 하나에 같이 실린다.
+
+struct archive_entry {
+    std::string path;     // 묶음 루트 기준 상대 경로, '/' 구분
+    uint64_t size = 0;
+    uint32_t mode = 0;    // POSIX 권한 비트
+    uint64_t offset = 0;  // 스트림 안에서 내용이 시작하는 위치
+};
+
+// 목록 항목 (little endian): [0..1] path 길이  [2..5] mode  [6..13] size  [14..] path (UTF-8)
+constexpr size_t manifest_entry_header_size = 14;
+
+// base 아래의 roots(파일 또는 폴더)를 모은다. 폴더는 하위 파일 전체가 들어간다.
+std::vector<archive_entry> collect_archive_entries(const std::filesystem::path& base,
+                                                   const std::vector<std::string>& roots);
+uint64_t archive_size(const std::vector<archive_entry>& entries);
+
+void append_manifest(const std::vector<archive_entry>& entries, rtc::binary& out);
+// 절대 경로나 ".." 가 섞인 항목이 있으면 false
+bool parse_manifest(const std::byte* data, size_t length, std::vector<archive_entry>& out);
+
+// 목록 순서대로 파일 내용을 이어 읽는 청크 공급원
+std::unique_ptr<chunk_source> open_archive_source(const std::filesystem::path& base,
+                                                  std::vector<archive_entry> entries);
+
+// 묶음 스트림의 오프셋을 각 파일 위치로 나눠 쓰는 저장소.
+// 파일이 많을 수 있으므로 핸들은 가장 최근에 쓴 max_open_files 개만 열어 둔다.
+class archive_writer : public random_access_file {
+public:
+    static constexpr size_t max_open_files = 64;
+
+    ~archive_writer() override;
+
+    // root 아래에 폴더와 파일을 만든다. fresh 면 이미 있던 파일 내용을 비운다
+    bool open(const std::filesystem::path& root, std::vector<archive_entry> entries, bool fresh);
+    // 열린 핸들을 닫고 권한을 적용한다
+    void close();
+
+    size_t file_count() const { return entries_.size(); }
+
+    size_t pread(void* buffer, size_t length, uint64_t offset) const override;
+    bool pwrite(const void* buffer, size_t length, uint64_t offset) override;
+    bool preallocate(uint64_t offset, uint64_t length) override;
+    bool zero_range(uint64_t offset, uint64_t length) override;
+    bool sync() override;
+
+private:
+    // mutex_ 를 잡은 채로 부른다
+    file_io* handle(size_t index) const;
+    size_t entry_at(uint64_t offset) const;
+
+    std::filesystem::path root_;
+    std::vector<archive_entry> entries_;
+    uint64_t size_ = 0;
+
+    mutable std::mutex mutex_;
+    struct open_file {
+        std::unique_ptr<file_io> file;
+        std::list<size_t>::iterator order;
+    };
+    mutable std::unordered_map<size_t, open_file> open_;
+    mutable std::list<size_t> open_order_; // 앞이 가장 오래 쓰지 않은 파일
+    std::unordered_set<size_t> dirty_;     // 마지막 sync() 뒤에 쓴 파일. 이미 닫혔어도 sync() 가 다시 열어 fsync 한다
+};
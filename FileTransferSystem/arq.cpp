@@ -0,0 +1,252 @@
+﻿#include "arq.h"
+#include "hashing.h"
+#include "protocol.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// acc ^= data. acc 가 짧으면 0 으로 늘린다. 8 바이트씩 묶어 컴파일러가 벡터화할 수 있게 한다
+void xor_into(std::vector<std::byte>& acc, const std::byte* data, size_t length) {
+    if (acc.size() < length) acc.resize(length, std::byte{ 0 });
+    std::byte* out = acc.data();
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t a, b;
+        std::memcpy(&a, out + i, 8);
+        std::memcpy(&b, data + i, 8);
+        a ^= b;
+        std::memcpy(out + i, &a, 8);
+    }
+    for (; i < length; ++i) out[i] ^= data[i];
+}
+
+} // namespace
+
+void arq_sender::on_sent(uint64_t begin, uint64_t end, bool retransmit, clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    in_flight_[begin] = { end, now, retransmit };
+}
+
+void arq_sender::on_ack(const range_set& have, clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    last_heard_ = now;
+    clock::time_point sample_sent{};
+    for (auto it = in_flight_.begin(); it != in_flight_.end();) {
+        if (!have.contains(it->first, it->second.end)) {
+            ++it;
+            continue;
+        }
+        latest_acked_ = std::max(latest_acked_, it->second.sent);
+        if (!it->second.retransmit) sample_sent = std::max(sample_sent, it->second.sent);
+        it = in_flight_.erase(it);
+    }
+    if (sample_sent == clock::time_point{}) return;
+
+    // 가장 늦게 보낸 것 하나만 표본으로 쓴다. 수신측이 모아서 확인하므로 앞의 것은 그만큼 길게 잰다
+    double r = static_cast<double>(std::chrono::duration_cast<std::chrono::microseconds>(now - sample_sent).count());
+    if (!has_rtt_) {
+        srtt_us_ = r;
+        rttvar_us_ = r / 2;
+        has_rtt_ = true;
+    }
+    else {
+        rttvar_us_ = 0.75 * rttvar_us_ + 0.25 * std::abs(srtt_us_ - r);
+        srtt_us_ = 0.875 * srtt_us_ + 0.125 * r;
+    }
+    double lo = static_cast<double>(std::chrono::microseconds(min_rto).count());
+    double hi = static_cast<double>(std::chrono::microseconds(max_rto).count());
+    rto_us_ = std::clamp(srtt_us_ + 4 * rttvar_us_, lo, hi);
+}
+
+std::vector<range_set::range> arq_sender::take_lost(clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto rto = std::chrono::microseconds(static_cast<int64_t>(rto_us_));
+    auto reorder = std::max<std::chrono::microseconds>(min_reorder, std::chrono::microseconds(static_cast<int64_t>(srtt_us_ / 4)));
+    range_set lost;
+    bool timed_out = false;
+    for (auto it = in_flight_.begin(); it != in_flight_.end();) {
+        bool overtaken = latest_acked_ > it->second.sent + reorder;
+        bool expired = now - it->second.sent > rto;
+        if (!overtaken && !expired) {
+            ++it;
+            continue;
+        }
+        timed_out = timed_out || !overtaken;
+        lost.add(it->first, it->second.end);
+        it = in_flight_.erase(it);
+    }
+    // 시간이 다 되어 잃어버렸으면 링크가 막혔을 수 있으므로 다음 RTO 를 늘린다
+    if (timed_out)
+        rto_us_ = std::min(rto_us_ * 2, static_cast<double>(std::chrono::microseconds(max_rto).count()));
+    return lost.to_vector();
+}
+
+bool arq_sender::pending() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !in_flight_.empty();
+}
+
+bool arq_sender::poll_due(clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (in_flight_.empty()) return false;
+    if (now - last_heard_ < std::chrono::microseconds(static_cast<int64_t>(rto_us_ / 2))) return false;
+    last_heard_ = now;
+    return true;
+}
+
+std::chrono::microseconds arq_sender::rto() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::chrono::microseconds(static_cast<int64_t>(rto_us_));
+}
+
+fec_encoder::fec_encoder(size_t group_size) : group_size_(std::clamp<size_t>(group_size, 2, fec_max_group)) {
+}
+
+uint32_t fec_encoder::add(uint64_t offset, const std::byte* data, size_t length, uint64_t hash) {
+    uint32_t group = group_;
+    members_.push_back({ offset, static_cast<uint32_t>(length), hash });
+    xor_into(parity_, data, length);
+    if (members_.size() >= group_size_) flush();
+    return group;
+}
+
+void fec_encoder::flush() {
+    if (members_.empty()) return;
+    rtc::binary body(chunk_header_size + 4 + members_.size() * fec_member_size);
+    std::byte* p = body.data() + chunk_header_size;
+    put_u32(p, static_cast<uint32_t>(members_.size()));
+    p += 4;
+    for (const fec_member& m : members_) {
+        put_u64(p, m.offset);
+        put_u32(p + 8, m.length);
+        put_u64(p + 12, m.hash);
+        p += fec_member_size;
+    }
+    body.insert(body.end(), parity_.begin(), parity_.end());
+    ready_.emplace_back(group_, std::move(body));
+    members_.clear();
+    parity_.clear();
+    ++group_;
+}
+
+bool fec_encoder::take_parity(rtc::binary& out, uint32_t& group) {
+    if (ready_.empty()) return false;
+    group = ready_.front().first;
+    out = std::move(ready_.front().second);
+    ready_.pop_front();
+    return true;
+}
+
+uint64_t arq_receiver::on_data(uint64_t offset, const std::byte* data, size_t length, uint32_t group,
+                               std::vector<recovered_chunk>& recovered) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++since_ack_;
+    uint64_t fresh = mark_locked(offset, offset + length);
+    if (group == 0) return fresh;
+
+    group_state* g = group_locked(group);
+    if (!g || g->done || std::find(g->got.begin(), g->got.end(), offset) != g->got.end()) return fresh;
+    xor_into(g->acc, data, length);
+    g->got.push_back(offset);
+    try_recover_locked(*g, recovered);
+    return fresh;
+}
+
+uint64_t arq_receiver::on_range(uint64_t begin, uint64_t end) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++since_ack_;
+    return mark_locked(begin, end);
+}
+
+bool arq_receiver::on_parity(uint32_t group, const std::byte* body, size_t length,
+                             std::vector<recovered_chunk>& recovered) {
+    if (group == 0 || length < 4) return false;
+    size_t count = get_u32(body);
+    if (count == 0 || count > fec_max_group || length < 4 + count * fec_member_size) return false;
+    std::vector<fec_member> members(count);
+    size_t longest = 0;
+    const std::byte* p = body + 4;
+    for (fec_member& m : members) {
+        m.offset = get_u64(p);
+        m.length = get_u32(p + 8);
+        m.hash = get_u64(p + 12);
+        longest = std::max<size_t>(longest, m.length);
+        p += fec_member_size;
+    }
+    if (length != 4 + count * fec_member_size + longest) return false;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++since_ack_;
+    group_state* g = group_locked(group);
+    if (!g || g->done || g->has_parity) return true;
+    g->members = std::move(members);
+    g->parity.assign(p, body + length);
+    g->has_parity = true;
+    try_recover_locked(*g, recovered);
+    return true;
+}
+
+bool arq_receiver::ack_due() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (since_ack_ < arq_ack_every) return false;
+    since_ack_ = 0;
+    return true;
+}
+
+std::string arq_receiver::ack() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return have_.to_string();
+}
+
+uint64_t arq_receiver::recovered() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return recovered_;
+}
+
+// 창에서 이미 밀려난 묶음이면 nullptr
+arq_receiver::group_state* arq_receiver::group_locked(uint32_t group) {
+    auto it = groups_.find(group);
+    if (it != groups_.end()) return &it->second;
+    // 번호는 늘어나기만 하므로 가장 작은 번호가 가장 오래된 묶음이다
+    if (groups_.size() >= fec_window) {
+        if (group < groups_.begin()->first) return nullptr;
+        groups_.erase(groups_.begin());
+    }
+    return &groups_[group];
+}
+
+uint64_t arq_receiver::mark_locked(uint64_t begin, uint64_t end) {
+    if (have_.contains(begin, end)) return 0;
+    uint64_t before = have_.covered();
+    have_.add(begin, end);
+    return have_.covered() - before;
+}
+
+// 패리티와 나머지 청크가 다 있고 하나만 빠졌으면 그 청크를 되살린다
+void arq_receiver::try_recover_locked(group_state& g, std::vector<recovered_chunk>& recovered) {
+    if (!g.has_parity) return;
+    const fec_member* lost = nullptr;
+    for (const fec_member& m : g.members) {
+        if (std::find(g.got.begin(), g.got.end(), m.offset) != g.got.end()) continue;
+        if (lost) return; // 둘 이상 빠졌으면 재전송을 기다린다
+        lost = &m;
+    }
+    g.done = true;
+    if (!lost || have_.contains(lost->offset, lost->offset + lost->length)) {
+        std::vector<std::byte>().swap(g.acc);
+        return;
+    }
+
+    recovered_chunk chunk;
+    chunk.offset = lost->offset;
+    chunk.data = std::move(g.acc);
+    xor_into(chunk.data, g.parity.data(), g.parity.size());
+    chunk.data.resize(lost->length);
+    if (chunk_hash(chunk.data.data(), chunk.data.size()) != lost->hash) return;
+    chunk.fresh = mark_locked(chunk.offset, chunk.offset + lost->length);
+    ++recovered_;
+    recovered.push_back(std::move(chunk));
+}
@@ -0,0 +1,140 @@
+﻿#pragma once
+
+#include <rtc/rtc.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ranges.h"
+
+// 부분 신뢰(partial reliability) 전송.
+// 데이터 채널을 순서 없이, 재전송 없이(maxRetransmits = 0) 열면 잃어버린 메시지를 SCTP 가 다시 보내느라
+// 뒤 메시지를 붙잡지 않는다. 대신 수신측이 받은 구간을 __ACK__ 로 알려 주고 송신측이 빠진 구간만 다시 보낸다.
+// FEC 를 켜면 청크 group_size 개마다 XOR 패리티를 하나 보내 묶음에서 하나가 빠지면 재전송 없이 되살린다.
+
+constexpr size_t arq_ack_every = 16;  // 수신측은 메시지 이만큼마다 __ACK__ 를 보낸다
+constexpr size_t fec_window = 256;    // 수신측이 기억하는 FEC 묶음 수. 이보다 오래된 묶음은 버린다
+constexpr size_t fec_max_group = 64;
+
+// 패리티 메시지 본문 (little endian)
+//   [0..3] 묶음 청크 수  그 뒤 청크마다 [offset u64][length u32][hash u64]  그 뒤 XOR (가장 긴 청크 길이)
+constexpr size_t fec_member_size = 20;
+
+struct fec_member {
+    uint64_t offset = 0;
+    uint32_t length = 0;
+    uint64_t hash = 0;  // 원본 본문의 chunk_hash. 되살린 청크를 검증한다
+};
+
+// 보낸 뒤 아직 __ACK__ 에 들어오지 않은 구간과 왕복 시간을 관리한다. 여러 스레드에서 불러도 된다.
+// 나중에 보낸 메시지가 먼저 확인되면(순서 어긋남 여유 reorder 를 넘겨서) 앞의 것은 잃어버린 것으로 보고,
+// 확인이 RTO 동안 오지 않아도 잃어버린 것으로 본다. RTO 는 RFC 6298 처럼 srtt + 4 * rttvar 이고
+// 다시 보낸 구간의 확인은 왕복 시간 표본으로 쓰지 않는다 (Karn).
+class arq_sender {
+public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr std::chrono::milliseconds initial_rto{ 200 };
+    static constexpr std::chrono::milliseconds min_rto{ 20 };
+    static constexpr std::chrono::milliseconds max_rto{ 2000 };
+    static constexpr std::chrono::milliseconds min_reorder{ 2 };
+
+    void on_sent(uint64_t begin, uint64_t end, bool retransmit, clock::time_point now = clock::now());
+    // have: 수신측이 지금까지 받은 구간 전체
+    void on_ack(const range_set& have, clock::time_point now = clock::now());
+    // 잃어버린 것으로 보이는 구간을 목록에서 빼 돌려준다. 호출한 쪽이 다시 보낸다
+    std::vector<range_set::range> take_lost(clock::time_point now = clock::now());
+
+    bool pending() const;
+    // 보낸 것이 남았는데 RTO 의 절반 넘게 소식이 없으면 true. __POLL__ 로 __ACK__ 를 재촉할 때다
+    bool poll_due(clock::time_point now = clock::now());
+    std::chrono::microseconds rto() const;
+
+private:
+    struct flight {
+        uint64_t end = 0;
+        clock::time_point sent;
+        bool retransmit = false;
+    };
+
+    mutable std::mutex mutex_;
+    std::map<uint64_t, flight> in_flight_;  // 시작 위치 -> 보낸 구간
+    clock::time_point latest_acked_;        // 확인된 메시지 중 가장 늦게 보낸 시각
+    clock::time_point last_heard_;          // 마지막 __ACK__ 또는 __POLL__ 시각
+    bool has_rtt_ = false;
+    double srtt_us_ = 0;
+    double rttvar_us_ = 0;
+    double rto_us_ = static_cast<double>(std::chrono::microseconds(initial_rto).count());
+};
+
+// 처음 보내는 청크를 group_size 개씩 묶어 XOR 패리티를 만든다. 송신측 읽기 잠금 안에서만 부른다.
+class fec_encoder {
+public:
+    explicit fec_encoder(size_t group_size);
+
+    // 청크를 지금 묶음에 넣고 묶음 번호(1 부터)를 돌려준다. 묶음이 차면 패리티가 준비된다
+    uint32_t add(uint64_t offset, const std::byte* data, size_t length, uint64_t hash);
+    // 덜 찬 묶음도 패리티를 만든다. 보낼 것이 다 떨어졌을 때 부른다
+    void flush();
+    // 준비된 패리티 본문을 헤더 자리(chunk_header_size) 뒤에 채운다. 없으면 false
+    bool take_parity(rtc::binary& out, uint32_t& group);
+
+private:
+    size_t group_size_;
+    uint32_t group_ = 1;
+    std::vector<fec_member> members_;
+    std::vector<std::byte> parity_;
+    std::deque<std::pair<uint32_t, rtc::binary>> ready_;
+};
+
+// 처음 받은 청크를 골라내고, 받은 구간을 __ACK__ 로 알리고, FEC 패리티로 빠진 청크를 되살린다.
+// 여러 채널 스레드에서 불러도 된다.
+class arq_receiver {
+public:
+    struct recovered_chunk {
+        uint64_t offset = 0;
+        std::vector<std::byte> data;
+        uint64_t fresh = 0;  // 처음 받은 바이트 수
+    };
+
+    // [offset, offset + length) 중 처음 받은 바이트 수를 돌려준다. 0 이면 중복이다.
+    // group 이 0 이 아니면 FEC 묶음에 넣고, 그 덕에 되살아난 청크를 recovered 에 붙인다
+    uint64_t on_data(uint64_t offset, const std::byte* data, size_t length, uint32_t group,
+                     std::vector<recovered_chunk>& recovered);
+    // 본문 없이 구간만 오는 메시지 (zero)
+    uint64_t on_range(uint64_t begin, uint64_t end);
+    // 패리티 메시지. 본문이 잘못되었으면 false
+    bool on_parity(uint32_t group, const std::byte* body, size_t length, std::vector<recovered_chunk>& recovered);
+
+    // 메시지를 arq_ack_every 개 받을 때마다 한 번 true
+    bool ack_due();
+    // __ACK__ 에 실을 받은 구간
+    std::string ack() const;
+    uint64_t recovered() const;
+
+private:
+    struct group_state {
+        std::vector<std::byte> acc;   // 받은 청크들의 XOR
+        std::vector<uint64_t> got;    // acc 에 들어간 청크 위치
+        std::vector<fec_member> members;
+        rtc::binary parity;
+        bool has_parity = false;
+        bool done = false;
+    };
+
+    group_state* group_locked(uint32_t group);
+    uint64_t mark_locked(uint64_t begin, uint64_t end);
+    void try_recover_locked(group_state& g, std::vector<recovered_chunk>& recovered);
+
+    mutable std::mutex mutex_;
+    range_set have_;
+    std::map<uint32_t, group_state> groups_;
+    size_t since_ack_ = 0;
+    uint64_t recovered_ = 0;
+};
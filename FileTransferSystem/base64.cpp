@@ -0,0 +1,311 @@
+﻿#include "base64.h"
+
+#include <array>
+#include <cstdint>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define FTS_BASE64_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC/Clang 은 함수마다 명령어 집합을 열어 줘야 한다. MSVC 는 그냥 쓸 수 있다
+#if defined(__GNUC__) || defined(__clang__)
+#define FTS_TARGET(isa) __attribute__((target(isa)))
+#else
+#define FTS_TARGET(isa)
+#endif
+
+namespace {
+
+constexpr char encode_table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+constexpr std::array<int8_t, 256> make_decode_table() {
+    std::array<int8_t, 256> table{};
+    for (auto& v : table) v = -1;
+    for (int i = 0; i < 64; ++i) table[static_cast<unsigned char>(encode_table[i])] = static_cast<int8_t>(i);
+    return table;
+}
+
+constexpr std::array<int8_t, 256> decode_table = make_decode_table();
+
+// 3 바이트씩 끊어 인코딩하고 남은 1~2 바이트는 '=' 로 채운다
+size_t encode_scalar(const uint8_t* in, size_t length, char* out) {
+    char* start = out;
+    size_t i = 0;
+    for (; i + 3 <= length; i += 3) {
+        uint32_t v = (uint32_t(in[i]) << 16) | (uint32_t(in[i + 1]) << 8) | in[i + 2];
+        *out++ = encode_table[(v >> 18) & 0x3F];
+        *out++ = encode_table[(v >> 12) & 0x3F];
+        *out++ = encode_table[(v >> 6) & 0x3F];
+        *out++ = encode_table[v & 0x3F];
+    }
+    if (i < length) {
+        uint32_t v = uint32_t(in[i]) << 16;
+        if (i + 1 < length) v |= uint32_t(in[i + 1]) << 8;
+        *out++ = encode_table[(v >> 18) & 0x3F];
+        *out++ = encode_table[(v >> 12) & 0x3F];
+        *out++ = i + 1 < length ? encode_table[(v >> 6) & 0x3F] : '=';
+        *out++ = '=';
+    }
+    return static_cast<size_t>(out - start);
+}
+
+// 4 글자 단위로 풀고, 마지막 2~3 글자는 들어온 비트만큼만 쓴다
+size_t decode_scalar(const char* in, size_t length, uint8_t* out, size_t* consumed) {
+    uint8_t* start = out;
+    uint32_t v = 0;
+    int bits = 0;
+    size_t i = 0;
+    for (; i < length; ++i) {
+        int8_t d = decode_table[static_cast<unsigned char>(in[i])];
+        if (d < 0) break;
+        v = (v << 6) | static_cast<uint32_t>(d);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            *out++ = static_cast<uint8_t>(v >> bits);
+        }
+    }
+    if (consumed) *consumed = i;
+    return static_cast<size_t>(out - start);
+}
+
+#ifdef FTS_BASE64_X86
+
+// 12 바이트(3x4)를 6 비트 인덱스 16 개로 펼친다 (W. Muła 의 pshufb + mulhi/mullo 방식)
+FTS_TARGET("ssse3") inline __m128i encode_indices(__m128i in) {
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+// 인덱스 -> 글자. 구간마다 더할 값을 pshufb 로 고른다
+FTS_TARGET("ssse3") inline __m128i encode_chars(__m128i indices) {
+    __m128i offset = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    const __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    offset = _mm_or_si128(offset, _mm_and_si128(upper, _mm_set1_epi8(13)));
+    const __m128i shift = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    return _mm_add_epi8(_mm_shuffle_epi8(shift, offset), indices);
+}
+
+// lo <= c <= hi 인 바이트만 0xFF. 0x80 이상은 음수라 어느 구간에도 들지 않는다
+inline __m128i between(__m128i c, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(static_cast<char>(lo - 1))),
+                         _mm_cmpgt_epi8(_mm_set1_epi8(static_cast<char>(hi + 1)), c));
+}
+
+FTS_TARGET("avx2") inline __m256i between(__m256i c, char lo, char hi) {
+    return _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8(static_cast<char>(lo - 1))),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(hi + 1)), c));
+}
+
+// 16 글자를 6 비트 값으로 바꾼다. 알파벳이 아닌 글자가 있으면 false
+FTS_TARGET("ssse3") inline bool decode_values(__m128i in, __m128i& values) {
+    const __m128i upper = between(in, 'A', 'Z');
+    const __m128i lower = between(in, 'a', 'z');
+    const __m128i digit = between(in, '0', '9');
+    const __m128i plus = _mm_cmpeq_epi8(in, _mm_set1_epi8('+'));
+    const __m128i slash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+
+    const __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(_mm_or_si128(digit, plus), slash));
+    if (_mm_movemask_epi8(valid) != 0xFFFF) return false;
+
+    __m128i shift = _mm_and_si128(upper, _mm_set1_epi8(-65));
+    shift = _mm_or_si128(shift, _mm_and_si128(lower, _mm_set1_epi8(-71)));
+    shift = _mm_or_si128(shift, _mm_and_si128(digit, _mm_set1_epi8(4)));
+    shift = _mm_or_si128(shift, _mm_and_si128(plus, _mm_set1_epi8(19)));
+    shift = _mm_or_si128(shift, _mm_and_si128(slash, _mm_set1_epi8(16)));
+    values = _mm_add_epi8(in, shift);
+    return true;
+}
+
+// 6 비트 값 16 개를 12 바이트로 모은다 (앞 12 바이트만 유효)
+FTS_TARGET("ssse3") inline __m128i decode_pack(__m128i values) {
+    const __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    const __m128i words = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(words, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+FTS_TARGET("ssse3") size_t encode_ssse3(const uint8_t* in, size_t length, char* out) {
+    char* start = out;
+    // 16 바이트를 읽어 12 바이트만 쓰므로 끝에서 4 바이트는 남겨 둔다
+    while (length >= 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), encode_chars(encode_indices(block)));
+        in += 12;
+        length -= 12;
+        out += 16;
+    }
+    return static_cast<size_t>(out - start) + encode_scalar(in, length, out);
+}
+
+FTS_TARGET("ssse3") size_t decode_ssse3(const char* in, size_t length, uint8_t* out) {
+    uint8_t* start = out;
+    // 16 바이트를 저장하므로 뒤에 적어도 8 글자(6 바이트)가 더 있을 때만 벡터로 돈다
+    while (length >= 24) {
+        __m128i values;
+        if (!decode_values(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in)), values)) break;
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), decode_pack(values));
+        in += 16;
+        length -= 16;
+        out += 12;
+    }
+    return static_cast<size_t>(out - start) + decode_scalar(in, length, out, nullptr);
+}
+
+FTS_TARGET("avx2") size_t encode_avx2(const uint8_t* in, size_t length, char* out) {
+    char* start = out;
+    const __m256i spread = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+                                            1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    const __m256i shift = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                                           'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    // 두 레인에 12 바이트씩 싣는다. 두 번째 로드가 28 바이트까지 읽는다
+    while (length >= 28) {
+        __m256i block = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 12)), 1);
+        block = _mm256_shuffle_epi8(block, spread);
+        const __m256i t0 = _mm256_and_si256(block, _mm256_set1_epi32(0x0fc0fc00));
+        const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        const __m256i t2 = _mm256_and_si256(block, _mm256_set1_epi32(0x003f03f0));
+        const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        const __m256i indices = _mm256_or_si256(t1, t3);
+
+        __m256i offset = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        const __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        offset = _mm256_or_si256(offset, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+        const __m256i chars = _mm256_add_epi8(_mm256_shuffle_epi8(shift, offset), indices);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), chars);
+        in += 24;
+        length -= 24;
+        out += 32;
+    }
+    return static_cast<size_t>(out - start) + encode_ssse3(in, length, out);
+}
+
+FTS_TARGET("avx2") size_t decode_avx2(const char* in, size_t length, uint8_t* out) {
+    uint8_t* start = out;
+    const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    // 32 바이트를 저장하므로 뒤에 적어도 16 글자(12 바이트)가 더 있을 때만 벡터로 돈다
+    while (length >= 48) {
+        const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in));
+        const __m256i upper = between(c, 'A', 'Z');
+        const __m256i lower = between(c, 'a', 'z');
+        const __m256i digit = between(c, '0', '9');
+        const __m256i plus = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('+'));
+        const __m256i slash = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('/'));
+        const __m256i valid = _mm256_or_si256(_mm256_or_si256(upper, lower),
+                                              _mm256_or_si256(_mm256_or_si256(digit, plus), slash));
+        if (_mm256_movemask_epi8(valid) != -1) break;
+
+        __m256i shift = _mm256_and_si256(upper, _mm256_set1_epi8(-65));
+        shift = _mm256_or_si256(shift, _mm256_and_si256(lower, _mm256_set1_epi8(-71)));
+        shift = _mm256_or_si256(shift, _mm256_and_si256(digit, _mm256_set1_epi8(4)));
+        shift = _mm256_or_si256(shift, _mm256_and_si256(plus, _mm256_set1_epi8(19)));
+        shift = _mm256_or_si256(shift, _mm256_and_si256(slash, _mm256_set1_epi8(16)));
+        const __m256i values = _mm256_add_epi8(c, shift);
+
+        const __m256i pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+        const __m256i words = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+        // 레인마다 앞 12 바이트가 유효하므로 두 레인을 이어 붙인다
+        const __m256i packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(words, pack),
+                                                           _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), packed);
+        in += 32;
+        length -= 32;
+        out += 24;
+    }
+    return static_cast<size_t>(out - start) + decode_ssse3(in, length, out);
+}
+
+struct cpu_features {
+    bool ssse3 = false;
+    bool avx2 = false;
+};
+
+cpu_features detect_cpu() {
+    cpu_features f;
+#ifdef _MSC_VER
+    int r[4];
+    __cpuid(r, 0);
+    int max_leaf = r[0];
+    __cpuid(r, 1);
+    f.ssse3 = (r[2] & (1 << 9)) != 0;
+    bool os_avx = (r[2] & (1 << 27)) && (r[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+    if (max_leaf >= 7 && os_avx) {
+        __cpuidex(r, 7, 0);
+        f.avx2 = (r[1] & (1 << 5)) != 0;
+    }
+#else
+    __builtin_cpu_init();
+    f.ssse3 = __builtin_cpu_supports("ssse3");
+    f.avx2 = __builtin_cpu_supports("avx2");
+#endif
+    return f;
+}
+
+#endif
+
+using encode_fn = size_t (*)(const uint8_t*, size_t, char*);
+using decode_fn = size_t (*)(const char*, size_t, uint8_t*);
+
+size_t decode_scalar_all(const char* in, size_t length, uint8_t* out) {
+    return decode_scalar(in, length, out, nullptr);
+}
+
+struct base64_impl {
+    encode_fn encode = encode_scalar;
+    decode_fn decode = decode_scalar_all;
+
+    base64_impl() {
+#ifdef FTS_BASE64_X86
+        cpu_features cpu = detect_cpu();
+        if (cpu.avx2) {
+            encode = encode_avx2;
+            decode = decode_avx2;
+        }
+        else if (cpu.ssse3) {
+            encode = encode_ssse3;
+            decode = decode_ssse3;
+        }
+#endif
+    }
+};
+
+const base64_impl& impl() {
+    static const base64_impl instance;
+    return instance;
+}
+
+} // namespace
+
+size_t base64_encode(const void* data, size_t length, char* out) {
+    return impl().encode(static_cast<const uint8_t*>(data), length, out);
+}
+
+size_t base64_decode(const char* data, size_t length, void* out) {
+    return impl().decode(data, length, static_cast<uint8_t*>(out));
+}
+
+std::string base64_encode(const std::string& input) {
+    std::string out(base64_encoded_size(input.size()), '\0');
+    out.resize(base64_encode(input.data(), input.size(), &out[0]));
+    return out;
+}
+
+std::string base64_decode(const std::string& input) {
+    std::string out(base64_decoded_max_size(input.size()), '\0');
+    out.resize(base64_decode(input.data(), input.size(), &out[0]));
+    return out;
+}
@@ -0,0 +1,27 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Base64 (RFC 4648, '+' '/' 와 '=' 패딩).
+// x86-64 에서는 실행 시점에 AVX2/SSSE3 구현을 고르고, 그 밖에는 스칼라 구현을 쓴다.
+
+// 인코딩 결과 길이 ('=' 패딩 포함)
+constexpr size_t base64_encoded_size(size_t length) {
+    return (length + 2) / 3 * 4;
+}
+
+// length 글자를 디코딩했을 때 나올 수 있는 최대 바이트 수
+constexpr size_t base64_decoded_max_size(size_t length) {
+    return length / 4 * 3 + (length % 4) * 3 / 4;
+}
+
+// out 에 base64_encoded_size(length) 글자를 쓰고 그 길이를 돌려준다
+size_t base64_encode(const void* data, size_t length, char* out);
+
+// out 에는 base64_decoded_max_size(length) 바이트 자리가 있어야 한다.
+// 알파벳이 아닌 첫 글자('=' 포함)에서 멈추고, 쓴 바이트 수를 돌려준다.
+size_t base64_decode(const char* data, size_t length, void* out);
+
+std::string base64_encode(const std::string& input);
+std::string base64_decode(const std::string& input);
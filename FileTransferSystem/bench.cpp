@@ -0,0 +1,1633 @@
+﻿#include <rtc/rtc.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "archive.h"
+#include "base64.h"
+#include "cdc.h"
+#include "fanout.h"
+#include "hashing.h"
+#include "log.h"
+#include "peer_link.h"
+#include "scheduler.h"
+#include "session.h"
+#include "shaper.h"
+#include "store.h"
+#include "tuner.h"
+
+namespace fs = std::filesystem;
+using bench_clock = std::chrono::steady_clock;
+
+// 한 프로세스 안에서 PeerConnection 두 개를 이어 전송 경로를 잰다.
+// 송신/수신 세션을 같은 session_manager 에 올리고 SDP 를 곧바로 서로에게 넘기므로 사람이 붙여넣을 필요가 없다.
+// 후보는 127.0.0.1 만 쓰고 STUN 은 쓰지 않는다. 결과는 JSON 으로 stdout(또는 --out)에 쓴다.
+//
+//   fts_bench [--sizes 1M,64M,512M] [--chunks auto,16K,64K,128K] [--contents zero,random,text,mixed,tree,sparse]
+//             [--channels 1-8] [--read stream|mmap|async] [--compress off|auto|on] [--micro] [--tuner]
+//             [--fanout N] [--swarm N] [--dedup] [--lossy 1/50,3/100] [--shaping] [--link N] [--sources 4G] [--out file]
+//
+// 파일은 미리 만들어 두므로 읽기는 페이지 캐시에서 나온다 (디스크가 아니라 엔진을 재는 것이다).
+// --sources 4G 는 그 크기의 파일을 stream/mmap/async 공급원으로 네트워크 없이 끝까지 읽어 GB/s 와 GB 당 CPU 시간을 비교한다.
+// --channels 1-8 (또는 1,2,4,8) 은 같은 크기/청크/내용을 채널 수마다 보내 채널 수에 따른 MB/s 를 나란히 적는다.
+// sparse 는 16MB 마다 1MB 만 데이터가 있는 구멍 난 파일로, 양쪽 파일이 디스크에서 실제로 차지하는 크기도 적는다.
+// --fanout N 은 같은 파일을 N 개의 수신 세션에 동시에 보내 합산 송신 속도와 디스크 읽기 배율을 잰다.
+// --swarm N 은 속도를 swarm_rate, 그 절반, 그 절반... 으로 묶은 송신자 N 명에게서 나눠 받아
+// 가장 빠른 송신자 하나에게서 받을 때와 시간을 비교한다. 어느 크기든 swarm_min_speedup 배 넘게 빠르지 않으면 끝 코드 1 로 끝난다.
+// --dedup 은 편집한 사본을 원본이 든 저장소에 대 보아 내용 기반 청크와 고정 블록의 재사용 비율을 비교하고,
+// 청크 색인에 항목 dedup_index_entries 개를 넣고 찾는 속도를 잰다.
+// --lossy 손실%/왕복ms,... 는 두 PeerConnection 사이에 UDP 중계기(udp_relay)를 끼워 패킷을 버리고 늦추며
+// 같은 파일을 신뢰 채널, 부분 신뢰(send_options::lossy), 부분 신뢰 + FEC 로 보내 goodput 을 비교한다.
+// --shaping 은 bandwidth_shaper 를 가상 시계 위에서 돌려 속도 오차와 흐름 사이의 공정성(Jain 지수)을 보고,
+// transfer_scheduler 로 두 전송을 루프백에 동시에 올려 실제 속도가 전체 제한과 우선순위 몫을 따르는지 잰다.
+// 대기열에서 max_active 를 넘지 않고 높은 우선순위부터 시작하는지도 보며, 하나라도 어기면 끝 코드 1 로 끝난다.
+// --link N 은 작은 파일 N 개를 파일마다 새 세션으로 보낼 때와 지속 연결(peer_link) 하나로 차례로 당겨 받을 때의
+// 첫 바이트 시간을 비교한다. 새 세션은 SDP 교환, ICE, DTLS, SCTP 를 매번 거치고 당겨 받기는 채널만 연다.
+// 루프백은 링크가 하나뿐이므로 --tuner 는 chunk_tuner 를 여러 가상 링크 위에서 돌려 고정 크기와 비교한다.
+
+namespace {
+
+struct bench_case {
+    uint64_t size = 0;
+    size_t chunk = 0; // 0 이면 chunk_tuner 가 고른다
+    std::string content;
+    int channels = 1;
+};
+
+struct bench_result {
+    bool ok = false;
+    double setup_ms = 0;      // 시작 -> PeerConnection 연결
+    double first_byte_ms = 0; // 시작 -> 송신기가 첫 본문을 읽음
+    double total_ms = 0;      // 시작 -> 수신측 검증 완료
+    double mb_per_s = 0;      // 첫 본문 ~ 완료 구간의 속도
+    uint64_t peak_rss_kb = 0;
+    double cpu_s_per_gb = 0;
+    uint64_t final_chunk = 0; // 전송이 끝났을 때 송신기가 쓰던 청크 크기
+    uint64_t retransmitted = 0; // 부분 신뢰 전송에서 다시 보낸 바이트
+    uint64_t wire_bytes = 0;    // 압축 뒤 채널에 넘긴 메시지 (헤더 포함)
+    uint64_t fec_recovered = 0;
+};
+
+struct fanout_result {
+    bool ok = false;
+    size_t peers = 0;
+    double total_ms = 0;        // 시작 -> 마지막 수신측 검증 완료
+    double egress_mb_per_s = 0; // 수신자 전체가 받은 양 / total_ms
+    double read_amplification = 0;
+    uint64_t cache_hits = 0;
+    uint64_t cache_misses = 0;
+};
+
+struct shaping_result {
+    bool ok = false;
+    std::vector<double> job_mb_per_s; // 모든 작업이 함께 도는 동안의 작업별 속도
+    size_t peak_active = 0;           // 한꺼번에 대기열을 벗어나 있던 작업 수의 최댓값
+    std::vector<size_t> start_order;  // 작업(names 의 색인)이 대기열을 벗어난 차례
+};
+
+struct link_bench_result {
+    bool ok = false;
+    double setup_ms = 0;                 // 시작 -> 지속 연결이 열림
+    std::vector<double> first_byte_ms;   // 당겨 받기마다 요청 -> 첫 바이트
+    std::vector<double> total_ms;        // 당겨 받기마다 요청 -> 검증 완료
+};
+
+struct swarm_result {
+    bool ok = false;
+    size_t peers = 0;
+    double single_ms = 0;   // 가장 빠른 송신자 하나에게서 받은 시간
+    double swarm_ms = 0;    // peers 명에게서 나눠 받은 시간
+    double speedup = 0;     // single_ms / swarm_ms
+    double ideal = 0;       // 송신자 속도 합 / 가장 빠른 속도
+};
+
+constexpr double swarm_rate = 32.0 * 1024 * 1024; // 가장 빠른 송신자의 초당 바이트
+constexpr double swarm_min_speedup = 1.05;          // 연결과 해시 목록 교환에 드는 시간을 감안한 여유
+
+constexpr uint64_t dedup_file_size = 128 << 20;
+constexpr int dedup_edits = 64;
+constexpr uint64_t dedup_index_entries = 2000000;
+
+constexpr uint64_t lossy_file_size = 32 << 20;
+constexpr size_t lossy_fec_group = 8;
+
+constexpr uint64_t link_file_size = 256 << 10; // 첫 바이트 시간이 전체를 좌우하는 작은 파일
+
+constexpr double shaping_rate = 8.0 * 1024 * 1024;  // 루프백 시험의 전체 제한
+constexpr uint64_t shaping_file_size = 24 << 20;
+constexpr uint64_t shaping_queue_file_size = 4 << 20; // 대기열 순서 시험은 작업이 차례로 끝나야 한다
+// 작업별 속도가 기대값에서 벗어나도 되는 비율. 가상 시계는 청크 하나의 오차만, 루프백은 SCTP 버퍼와 표본 간격까지 품는다
+constexpr double shaping_simulated_tolerance = 0.02;
+constexpr double shaping_loopback_tolerance = 0.25;
+
+bool parse_size(const std::string& text, uint64_t& out) {
+    char* end = nullptr;
+    double value = std::strtod(text.c_str(), &end);
+    if (end == text.c_str() || value < 0) return false;
+    switch (*end) {
+    case '\0': break;
+    case 'K': case 'k': value *= 1024; ++end; break;
+    case 'M': case 'm': value *= 1024 * 1024; ++end; break;
+    case 'G': case 'g': value *= 1024.0 * 1024 * 1024; ++end; break;
+    default: return false;
+    }
+    if (*end != '\0') return false;
+    out = static_cast<uint64_t>(value);
+    return true;
+}
+
+std::vector<std::string> split(const std::string& text, char separator) {
+    std::vector<std::string> out;
+    std::stringstream ss(text);
+    for (std::string item; std::getline(ss, item, separator);) {
+        if (!item.empty()) out.push_back(item);
+    }
+    return out;
+}
+
+// "1,2,4" 나 "1-8" 처럼 쓴 채널 수 목록. 잘못 썼으면 false
+bool parse_channels(const std::string& text, std::vector<int>& out) {
+    out.clear();
+    for (const auto& item : split(text, ',')) {
+        size_t dash = item.find('-');
+        int from = std::atoi(item.substr(0, dash).c_str());
+        int to = dash == std::string::npos ? from : std::atoi(item.substr(dash + 1).c_str());
+        if (from < 1 || to < from || to > 64) return false;
+        for (int n = from; n <= to; ++n) out.push_back(n);
+    }
+    return !out.empty();
+}
+
+// xorshift64*: 빠르고 압축되지 않는 내용
+struct random_bytes {
+    uint64_t state;
+    explicit random_bytes(uint64_t seed) : state(seed | 1) {}
+    void fill(char* data, size_t length) {
+        for (size_t i = 0; i < length; i += 8) {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            uint64_t v = state * 2685821657736338717ull;
+            std::memcpy(data + i, &v, std::min<size_t>(8, length - i));
+        }
+    }
+};
+
+// content: zero(전부 0), random(압축 불가), text(단어를 이어 붙인 압축 잘 되는 글), sparse(대부분 구멍),
+// mixed(1 MiB 마다 text 와 random 을 번갈아 놓아 auto 압축이 청크마다 판단을 바꾸게 한다)
+bool write_content(const fs::path& path, uint64_t size, const std::string& content, uint64_t seed) {
+    static const char* words[] = { "file", "transfer", "chunk", "session", "offer", "answer", "channel",
+                                   "digest", "buffer", "range", "peer", "stream", "the", "a", "of", "and" };
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    std::vector<char> block(1 << 20);
+    random_bytes rng(seed);
+    if (content == "sparse") {
+        // 건너뛴 곳은 쓰지 않았으므로 구멍으로 남는다
+        for (uint64_t at = 0; at < size; at += 16 << 20) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(block.size(), size - at));
+            rng.fill(block.data(), n);
+            out.seekp(static_cast<std::streamoff>(at));
+            out.write(block.data(), static_cast<std::streamsize>(n));
+        }
+        out.close();
+        std::error_code ec;
+        fs::resize_file(path, size, ec);
+        return !ec;
+    }
+    for (uint64_t written = 0; written < size;) {
+        size_t n = static_cast<size_t>(std::min<uint64_t>(block.size(), size - written));
+        bool random_block = content == "random" || (content == "mixed" && (written / block.size()) % 2 == 1);
+        if (content == "zero") {
+            std::fill(block.begin(), block.begin() + n, '\0');
+        }
+        else if (random_block) {
+            rng.fill(block.data(), n);
+        }
+        else {
+            size_t at = 0;
+            while (at < n) {
+                uint64_t pick = 0;
+                rng.fill(reinterpret_cast<char*>(&pick), sizeof(pick));
+                const char* word = words[pick % (sizeof(words) / sizeof(words[0]))];
+                for (const char* c = word; *c && at < n; ++c) block[at++] = *c;
+                if (at < n) block[at++] = (pick >> 32) % 12 == 0 ? '\n' : ' ';
+            }
+        }
+        out.write(block.data(), static_cast<std::streamsize>(n));
+        written += n;
+    }
+    return static_cast<bool>(out);
+}
+
+// 디스크에서 실제로 차지하는 바이트 (구멍은 빠진다)
+uint64_t allocated_bytes(const fs::path& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return 0;
+    return static_cast<uint64_t>(st.st_blocks) * 512;
+}
+
+uint64_t current_rss_kb() {
+    std::ifstream statm("/proc/self/statm");
+    uint64_t pages = 0, resident = 0;
+    if (!(statm >> pages >> resident)) return 0;
+    return resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE)) / 1024;
+}
+
+double cpu_seconds() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    auto seconds = [](const timeval& tv) { return tv.tv_sec + tv.tv_usec / 1e6; };
+    return seconds(usage.ru_utime) + seconds(usage.ru_stime);
+}
+
+double elapsed_ms(bench_clock::time_point from, bench_clock::time_point to) {
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+// 송신기가 처음 본문을 읽는 시각을 남긴다
+class timed_source : public chunk_source {
+public:
+    timed_source(std::unique_ptr<chunk_source> inner, std::shared_ptr<std::atomic<int64_t>> first_read)
+        : inner_(std::move(inner)), first_read_(std::move(first_read)) {}
+
+    uint64_t size() const override { return inner_->size(); }
+
+    size_t append(uint64_t offset, size_t length, rtc::binary& out) override {
+        int64_t expected = 0;
+        first_read_->compare_exchange_strong(expected, bench_clock::now().time_since_epoch().count());
+        return inner_->append(offset, length, out);
+    }
+
+private:
+    std::unique_ptr<chunk_source> inner_;
+    std::shared_ptr<std::atomic<int64_t>> first_read_; // 시간 초과로 세션이 남아도 run() 의 지역 변수를 건드리지 않게
+};
+
+// 본문 읽기를 bytes_per_s 로 묶어 느린 송신자를 흉내 낸다.
+// 스웜 송신자가 처음에 블록 해시를 구하려고 hash_block_size 씩 읽는 것은 묶지 않는다
+class throttled_source : public chunk_source {
+public:
+    throttled_source(std::unique_ptr<chunk_source> inner, double bytes_per_s)
+        : inner_(std::move(inner)), bytes_per_s_(bytes_per_s) {}
+
+    uint64_t size() const override { return inner_->size(); }
+
+    size_t append(uint64_t offset, size_t length, rtc::binary& out) override {
+        size_t n = inner_->append(offset, length, out);
+        if (length >= hash_block_size || n == 0) return n;
+        auto now = bench_clock::now();
+        if (next_ < now) next_ = now;
+        next_ += std::chrono::duration_cast<bench_clock::duration>(std::chrono::duration<double>(n / bytes_per_s_));
+        std::this_thread::sleep_until(next_);
+        return n;
+    }
+
+private:
+    std::unique_ptr<chunk_source> inner_;
+    const double bytes_per_s_;
+    bench_clock::time_point next_;
+};
+
+// 한 매니저 안의 송수신 세션 두 개를 서로 잇는다
+class loopback {
+public:
+    loopback() {
+        rtc::Configuration config;
+        config.bindAddress = "127.0.0.1";
+        sessions_ = std::make_unique<session_manager>(config);
+        // 수신 세션을 먼저 만들어 두고 Offer 가 나올 때마다 놀고 있는 수신 세션과 짝을 지어 준다
+        sessions_->set_on_local_description([this](uint64_t id, session_role role, const std::string& sdp) {
+            uint64_t peer = 0;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (role == session_role::send && !idle_receivers_.empty()) {
+                    peer = idle_receivers_.front();
+                    idle_receivers_.pop_front();
+                    peer_of_[peer] = id;
+                }
+                else if (role == session_role::receive && peer_of_.count(id)) {
+                    peer = peer_of_[id];
+                }
+            }
+            if (peer == 0) return;
+            std::function<std::string(const std::string&)> filter;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                filter = sdp_filter_;
+            }
+            sessions_->deliver_remote_description(peer, filter ? filter(sdp) : sdp);
+        });
+        sessions_->set_on_state([this](uint64_t id, session_state state) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                auto now = bench_clock::now();
+                if (state == session_state::transferring && connected_ == bench_clock::time_point{}) connected_ = now;
+                if (state == session_state::finished || state == session_state::failed) {
+                    states_[id] = state;
+                    if (receive_ids_.count(id)) received_ = std::max(received_, now);
+                    cv_.notify_all();
+                }
+            }
+            if (transfer_scheduler* scheduler = scheduler_.load()) scheduler->on_session_state(id, state);
+        });
+    }
+
+    // 상대에게 넘기기 전에 SDP 를 바꾼다 (udp_relay::rewrite). 비우면 그대로 넘긴다
+    void set_sdp_filter(std::function<std::string(const std::string&)> filter) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sdp_filter_ = std::move(filter);
+    }
+
+    // base/name 을 보낸다. 폴더면 묶음으로 보낸다
+    bench_result run(const fs::path& base, const std::string& name, uint64_t size, send_options options,
+                     const fs::path& download_dir) {
+        bench_result result;
+        auto first_read = std::make_shared<std::atomic<int64_t>>(0);
+        reset();
+
+        std::unique_ptr<chunk_source> source;
+        rtc::binary manifest;
+        if (fs::is_directory(base / name)) {
+            auto entries = collect_archive_entries(base, { name });
+            append_manifest(entries, manifest);
+            source = open_archive_source(base, std::move(entries));
+        }
+        else {
+            source = open_chunk_source(base / name, options.source);
+        }
+        if (!source) return result;
+        source = std::make_unique<timed_source>(std::move(source), first_read);
+
+        std::atomic<bool> sampling{ true };
+        uint64_t peak_rss = current_rss_kb();
+        std::thread sampler([&]() {
+            while (sampling) {
+                peak_rss = std::max(peak_rss, current_rss_kb());
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+        });
+
+        double cpu_before = cpu_seconds();
+        auto start = bench_clock::now();
+        uint64_t receive_id = add_receiver(download_dir);
+        uint64_t send_id = sessions_->start_send(std::move(source), name, options, std::move(manifest));
+
+        // 느린 기계에서도 끝날 만큼 넉넉히 (1 MB/s + 30 초)
+        auto deadline = start + std::chrono::seconds(30 + size / (1 << 20));
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait_until(lock, deadline, [&]() { return states_.count(send_id) && states_.count(receive_id); });
+            result.ok = states_.count(receive_id) && states_[receive_id] == session_state::finished;
+            if (connected_ != bench_clock::time_point{}) result.setup_ms = elapsed_ms(start, connected_);
+            if (result.ok) result.total_ms = elapsed_ms(start, received_);
+        }
+        double cpu_after = cpu_seconds();
+        sampling = false;
+        sampler.join();
+
+        if (int64_t ticks = first_read->load()) {
+            bench_clock::time_point first{ bench_clock::duration(ticks) };
+            result.first_byte_ms = elapsed_ms(start, first);
+            double transfer_ms = result.total_ms - result.first_byte_ms;
+            if (result.ok && transfer_ms > 0) result.mb_per_s = size / (1024.0 * 1024.0) / (transfer_ms / 1000.0);
+        }
+        for (const auto& m : sessions_->metrics().snapshot()) {
+            if (m.id == send_id) {
+                result.final_chunk = m.chunk_size;
+                result.retransmitted = m.bytes_retransmitted;
+                result.wire_bytes = m.bytes_wire;
+            }
+            if (m.id == receive_id) result.fec_recovered = m.fec_recovered;
+        }
+        result.peak_rss_kb = peak_rss;
+        if (size > 0) result.cpu_s_per_gb = (cpu_after - cpu_before) / (size / (1024.0 * 1024.0 * 1024.0));
+        return result;
+    }
+
+    // base/name 을 수신 세션 peers 개에게 한꺼번에 보낸다. 각자 download_dir/<n> 에 받는다
+    fanout_result run_fanout(const fs::path& base, const std::string& name, uint64_t size, send_options options,
+                             size_t peers, const fs::path& download_dir) {
+        fanout_result result;
+        result.peers = peers;
+        reset();
+
+        auto start = bench_clock::now();
+        std::vector<uint64_t> receive_ids;
+        for (size_t i = 0; i < peers; ++i) {
+            fs::path dir = download_dir / std::to_string(i);
+            fs::create_directories(dir);
+            receive_ids.push_back(add_receiver(dir));
+        }
+        // session_manager::start_fanout 과 같지만 캐시 통계를 보려고 직접 잇는다
+        auto source = open_chunk_source(base / name, options.source);
+        if (!source) return result;
+        auto cache = shared_chunk_cache::create(std::move(source));
+        for (size_t i = 0; i < peers; ++i) sessions_->start_send(cache->open_reader(), name, options);
+
+        auto deadline = start + std::chrono::seconds(30 + peers * size / (1 << 20));
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait_until(lock, deadline, [&]() { return states_.size() == 2 * peers; });
+        result.ok = true;
+        for (uint64_t id : receive_ids) result.ok &= states_.count(id) && states_[id] == session_state::finished;
+        if (result.ok) {
+            result.total_ms = elapsed_ms(start, received_);
+            // 연결 설정을 빼고 보면 좋겠지만 세션마다 연결 시각이 다르므로 전체 시간으로 잰다
+            result.egress_mb_per_s = peers * size / (1024.0 * 1024.0) / (result.total_ms / 1000.0);
+        }
+        auto stats = cache->stats();
+        result.read_amplification = stats.read_amplification();
+        result.cache_hits = stats.hits;
+        result.cache_misses = stats.misses;
+        return result;
+    }
+
+    // base/name 을 rates 의 속도로 묶은 스웜 송신자들에게서 download_dir 로 나눠 받는다. 걸린 시간(ms), 실패면 0
+    double run_swarm(const fs::path& base, const std::string& name, const file_digest& digest, uint64_t size,
+                     send_options options, const std::vector<double>& rates, const fs::path& download_dir) {
+        reset();
+        options.seed = true;
+        auto start = bench_clock::now();
+        std::vector<uint64_t> receive_ids = sessions_->start_swarm(download_dir, digest, rates.size());
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (uint64_t id : receive_ids) {
+                receive_ids_.insert(id);
+                idle_receivers_.push_back(id);
+            }
+        }
+        for (double rate : rates) {
+            auto source = open_chunk_source(base / name, options.source);
+            if (!source) return 0;
+            sessions_->start_send(std::make_unique<throttled_source>(std::move(source), rate), name, options);
+        }
+
+        auto deadline = start + std::chrono::seconds(30 + size / (1 << 20));
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait_until(lock, deadline, [&]() { return states_.size() == 2 * rates.size(); });
+        bool ok = false;
+        for (uint64_t id : receive_ids) ok |= states_.count(id) && states_[id] == session_state::finished;
+        return ok ? elapsed_ms(start, received_) : 0;
+    }
+
+    // names 를 transfer_scheduler 에 작업 하나씩(priorities, ceils 순서대로) 넣어 전체 rate 로 묶고 max_active 개씩 보낸다.
+    // 작업별 보낸 바이트와 상태를 50 ms 마다 보고, 모든 작업이 보내고 있던 구간의 속도와 시작 순서를 잰다
+    shaping_result run_scheduled(const fs::path& base, const std::vector<std::string>& names, send_options options,
+                                 double rate, const std::vector<transfer_priority>& priorities,
+                                 const std::vector<double>& ceils, size_t max_active, const fs::path& download_dir) {
+        shaping_result result;
+        reset();
+        transfer_scheduler scheduler(max_active, rate, [this](std::function<void()> task) { sessions_->run(std::move(task)); });
+        scheduler_ = &scheduler;
+        uint64_t total = 0;
+        for (size_t i = 0; i < names.size(); ++i) {
+            total += fs::file_size(base / names[i]);
+            transfer_job job;
+            job.name = names[i];
+            job.priority = priorities[i];
+            job.rate_limit = ceils[i];
+            job.start = [this, base, name = names[i], options, download_dir](const std::shared_ptr<shaped_flow>& flow) {
+                send_options o = options;
+                o.flow = flow;
+                add_receiver(download_dir);
+                auto source = open_chunk_source(base / name, o.source);
+                if (!source) return std::vector<uint64_t>{};
+                return std::vector<uint64_t>{ sessions_->start_send(std::move(source), name, o) };
+            };
+            scheduler.enqueue(std::move(job));
+        }
+
+        struct sample {
+            bench_clock::time_point at;
+            std::vector<uint64_t> bytes; // 작업 순서대로. 끝난 작업은 빠지므로 모두 있을 때만 남긴다
+        };
+        std::vector<sample> samples;
+        auto deadline = bench_clock::now() + std::chrono::seconds(30) +
+                        std::chrono::duration_cast<bench_clock::duration>(std::chrono::duration<double>(total / rate * 2));
+        while (bench_clock::now() < deadline) {
+            std::vector<job_info> jobs = scheduler.jobs();
+            if (jobs.empty()) break;
+            std::sort(jobs.begin(), jobs.end(), [](const job_info& a, const job_info& b) { return a.id < b.id; });
+            size_t active = 0;
+            for (const job_info& j : jobs) {
+                if (j.state == job_state::queued) continue;
+                ++active;
+                size_t index = static_cast<size_t>(std::find(names.begin(), names.end(), j.name) - names.begin());
+                if (std::find(result.start_order.begin(), result.start_order.end(), index) == result.start_order.end())
+                    result.start_order.push_back(index);
+            }
+            result.peak_active = std::max(result.peak_active, active);
+            if (jobs.size() == names.size()) {
+                sample s{ bench_clock::now(), {} };
+                for (const job_info& j : jobs) s.bytes.push_back(j.bytes);
+                samples.push_back(std::move(s));
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        scheduler_ = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait_until(lock, deadline, [&]() { return states_.size() == 2 * names.size(); });
+            result.ok = states_.size() == 2 * names.size();
+            for (const auto& [id, state] : states_) result.ok &= state == session_state::finished;
+        }
+
+        // 모두 첫 바이트를 보낸 뒤 0.5 초부터 누군가 끝나기 직전까지
+        size_t from = 0;
+        while (from < samples.size() &&
+               std::find(samples[from].bytes.begin(), samples[from].bytes.end(), 0) != samples[from].bytes.end())
+            ++from;
+        if (from < samples.size()) {
+            auto settle = samples[from].at + std::chrono::milliseconds(500);
+            while (from < samples.size() && samples[from].at < settle) ++from;
+        }
+        size_t to = samples.empty() ? 0 : samples.size() - 1;
+        if (from >= to) return result;
+        double seconds = std::chrono::duration<double>(samples[to].at - samples[from].at).count();
+        for (size_t i = 0; i < names.size(); ++i) {
+            double mb = (samples[to].bytes[i] - samples[from].bytes[i]) / (1024.0 * 1024.0);
+            result.job_mb_per_s.push_back(mb / seconds);
+        }
+        return result;
+    }
+
+    // base 를 내놓는 지속 연결 하나를 열고 names 를 차례로 download_dir 로 당겨 받는다
+    link_bench_result run_link(const fs::path& base, const std::vector<std::string>& names, const fs::path& download_dir) {
+        link_bench_result result;
+        reset();
+        auto start = bench_clock::now();
+        uint64_t client_id = sessions_->start_link_client(download_dir);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            receive_ids_.insert(client_id);
+            idle_receivers_.push_back(client_id);
+        }
+        uint64_t host_id = sessions_->start_link_host(base);
+        std::shared_ptr<peer_link> client = sessions_->link(client_id);
+
+        auto deadline = start + std::chrono::seconds(30);
+        while (client && !client->connected() && bench_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (client && client->connected()) {
+            result.setup_ms = elapsed_ms(start, bench_clock::now());
+            result.ok = true;
+            for (const std::string& name : names) {
+                uint64_t id = client->pull(name);
+                pull_info info;
+                while (bench_clock::now() < deadline + std::chrono::seconds(30)) {
+                    for (const pull_info& p : client->pulls()) {
+                        if (p.id == id) info = p;
+                    }
+                    if (info.state == pull_state::finished || info.state == pull_state::failed) break;
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                result.ok &= info.state == pull_state::finished;
+                result.first_byte_ms.push_back(info.first_byte_ms);
+                result.total_ms.push_back(info.done_ms);
+            }
+        }
+        sessions_->stop(client_id);
+        sessions_->stop(host_id);
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait_for(lock, std::chrono::seconds(5), [&]() { return states_.count(client_id) && states_.count(host_id); });
+        return result;
+    }
+
+private:
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        states_.clear();
+        receive_ids_.clear();
+        idle_receivers_.clear();
+        peer_of_.clear();
+        connected_ = received_ = bench_clock::time_point{};
+    }
+
+    uint64_t add_receiver(const fs::path& download_dir) {
+        uint64_t id = sessions_->start_receive(download_dir);
+        std::lock_guard<std::mutex> lock(mutex_);
+        receive_ids_.insert(id);
+        idle_receivers_.push_back(id);
+        return id;
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::map<uint64_t, session_state> states_;
+    std::set<uint64_t> receive_ids_;
+    std::deque<uint64_t> idle_receivers_;  // 아직 Offer 를 받지 않은 수신 세션
+    std::map<uint64_t, uint64_t> peer_of_; // 수신 세션 -> 짝지은 송신 세션
+    std::function<std::string(const std::string&)> sdp_filter_;
+    bench_clock::time_point connected_;
+    bench_clock::time_point received_;
+    std::atomic<transfer_scheduler*> scheduler_{ nullptr }; // run_scheduled 동안 세션 상태를 넘길 곳
+    std::unique_ptr<session_manager> sessions_; // 풀 스레드가 위 멤버를 쓰므로 가장 먼저 소멸한다
+};
+
+// 두 PeerConnection 사이에서 UDP 패킷을 loss 확률로 버리고 남은 것은 delay 만큼 늦게 넘기는 중계기.
+// 양쪽 SDP 의 후보를 이 중계기의 주소로 바꿔 두면 ICE, DTLS, SCTP 가 모두 이 소켓 하나를 지난다.
+// 처음 바꾼 SDP 가 한쪽 끝, 두 번째가 다른 끝이고, 보낸 포트를 보고 반대쪽으로 넘긴다.
+class udp_relay {
+public:
+    udp_relay(double loss, std::chrono::microseconds delay, uint64_t seed) : loss_(loss), delay_(delay), rng_(seed) {
+        fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd_ < 0) return;
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        timeval timeout = { 0, 100000 }; // 멈출 때 기다리는 최대 시간
+        int buffer = 8 << 20;
+        setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+        setsockopt(fd_, SOL_SOCKET, SO_SNDBUF, &buffer, sizeof(buffer));
+        if (bind(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+            getsockname(fd_, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+            close(fd_);
+            fd_ = -1;
+            return;
+        }
+        port_ = ntohs(addr.sin_port);
+        receiver_ = std::thread([this]() { receive_loop(); });
+        sender_ = std::thread([this]() { send_loop(); });
+    }
+
+    ~udp_relay() {
+        stop_ = true;
+        cv_.notify_all();
+        if (receiver_.joinable()) receiver_.join();
+        if (sender_.joinable()) sender_.join();
+        if (fd_ >= 0) close(fd_);
+    }
+
+    bool ok() const { return fd_ >= 0; }
+    uint64_t dropped() const { return dropped_; }
+
+    // IPv4 UDP 후보 하나만 남겨 주소를 중계기로 바꾼다. 원래 포트는 끝점으로 기억한다
+    std::string rewrite(const std::string& sdp) {
+        int end = seen_++;
+        std::istringstream iss(sdp);
+        std::ostringstream oss;
+        bool kept = false;
+        for (std::string line; std::getline(iss, line);) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.rfind("a=candidate:", 0) == 0) {
+                //   a=candidate:<foundation> <component> <transport> <priority> <ip> <port> typ <type> ...
+                std::vector<std::string> f = split(line, ' ');
+                if (kept || end > 1 || f.size() < 8 || (f[2] != "UDP" && f[2] != "udp") || f[4].find('.') == std::string::npos)
+                    continue;
+                ends_[end] = static_cast<uint16_t>(std::atoi(f[5].c_str()));
+                f[4] = "127.0.0.1";
+                f[5] = std::to_string(port_);
+                line.clear();
+                for (size_t i = 0; i < f.size(); ++i) line += (i ? " " : "") + f[i];
+                kept = true;
+            }
+            oss << line << "\r\n";
+        }
+        return oss.str();
+    }
+
+private:
+    struct packet {
+        bench_clock::time_point due;
+        uint16_t to = 0;
+        std::vector<char> data;
+    };
+
+    void receive_loop() {
+        std::vector<char> buffer(65536);
+        std::uniform_real_distribution<double> coin(0.0, 1.0);
+        while (!stop_) {
+            sockaddr_in from = {};
+            socklen_t len = sizeof(from);
+            ssize_t n = recvfrom(fd_, buffer.data(), buffer.size(), 0, reinterpret_cast<sockaddr*>(&from), &len);
+            if (n <= 0) continue;
+            uint16_t port = ntohs(from.sin_port);
+            uint16_t to = port == ends_[0] ? ends_[1].load() : port == ends_[1] ? ends_[0].load() : 0;
+            if (to == 0) continue;
+            if (coin(rng_) < loss_) {
+                ++dropped_;
+                continue;
+            }
+            // 지연이 일정하므로 큐는 늘 도착 순서 = 보낼 순서다
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back({ bench_clock::now() + delay_, to, std::vector<char>(buffer.begin(), buffer.begin() + n) });
+            cv_.notify_one();
+        }
+    }
+
+    void send_loop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stop_) {
+            if (queue_.empty()) {
+                cv_.wait(lock);
+                continue;
+            }
+            if (bench_clock::now() < queue_.front().due) {
+                cv_.wait_until(lock, queue_.front().due);
+                continue;
+            }
+            packet p = std::move(queue_.front());
+            queue_.pop_front();
+            lock.unlock();
+            sockaddr_in addr = {};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port = htons(p.to);
+            sendto(fd_, p.data.data(), p.data.size(), 0, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+            lock.lock();
+        }
+    }
+
+    double loss_;
+    std::chrono::microseconds delay_;
+    std::mt19937_64 rng_;
+    int fd_ = -1;
+    uint16_t port_ = 0;
+    std::atomic<int> seen_{ 0 };
+    std::atomic<uint16_t> ends_[2] = { { 0 }, { 0 } };
+    std::atomic<uint64_t> dropped_{ 0 };
+    std::atomic<bool> stop_{ false };
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<packet> queue_;
+    std::thread receiver_;
+    std::thread sender_;
+};
+
+// 청크 공급원마다 송신기처럼 헤더 뒤에 청크를 덧붙여 파일 끝까지 읽는다. 네트워크 없이 읽기 경로만 잰다.
+// 첫 바퀴는 페이지 캐시를 채우는 데 쓰고 두 번째 바퀴를 적는다
+void run_sources(std::ostream& out, const fs::path& work, uint64_t size) {
+    fs::path path = work / "sources.bin";
+    write_content(path, size, "random", 99);
+    out << "  \"sources\": [";
+    bool first = true;
+    for (source_kind kind : { source_kind::stream, source_kind::mmap, source_kind::async }) {
+        double ms = 0, cpu = 0;
+        uint64_t read = 0;
+        for (int pass = 0; pass < 2; ++pass) {
+            auto source = open_chunk_source(path, kind);
+            if (!source) break;
+            read = 0;
+            double cpu_before = cpu_seconds();
+            auto start = bench_clock::now();
+            for (uint64_t offset = 0; offset < size;) {
+                rtc::binary message;
+                message.reserve(chunk_header_size + chunk_tuner::max_chunk);
+                message.resize(chunk_header_size);
+                size_t n = source->append(offset, chunk_tuner::max_chunk, message);
+                if (n == 0) break;
+                offset += n;
+                read += n;
+            }
+            ms = elapsed_ms(start, bench_clock::now());
+            cpu = cpu_seconds() - cpu_before;
+        }
+        double gb = read / (1024.0 * 1024.0 * 1024.0);
+        out << (first ? "\n" : ",\n") << "    {\"read\": \"" << source_kind_name(kind) << "\", \"size\": " << size
+            << ", \"ok\": " << (read == size ? "true" : "false") << ", \"gb_per_s\": " << (ms > 0 ? gb / (ms / 1000) : 0)
+            << ", \"cpu_s_per_gb\": " << (gb > 0 ? cpu / gb : 0) << "}";
+        out.flush();
+        first = false;
+    }
+    out << "\n  ],\n";
+    std::error_code ec;
+    fs::remove(path, ec);
+}
+
+// base64 인코딩/디코딩과 해시(파일 다이제스트, 청크 해시) 처리량 (GB/s), 경합 중인 로그 호출 수 (초당).
+// 해시 처리량은 runs 의 mb_per_s 와 견주어 무결성 검사가 전송을 늦추는지 본다
+void run_micro(std::ostream& out) {
+    std::string raw(64 << 20, '\0');
+    random_bytes(7).fill(raw.data(), raw.size());
+    std::string encoded(base64_encoded_size(raw.size()), '\0');
+    std::string decoded(base64_decoded_max_size(encoded.size()), '\0');
+
+    auto measure = [](auto&& body) {
+        auto start = bench_clock::now();
+        for (int i = 0; i < 8; ++i) body();
+        return elapsed_ms(start, bench_clock::now()) / 8;
+    };
+    double encode_ms = measure([&]() { base64_encode(raw.data(), raw.size(), encoded.data()); });
+    double decode_ms = measure([&]() { base64_decode(encoded.data(), encoded.size(), decoded.data()); });
+    // 송신기처럼 청크 크기로 나눠 넣는다
+    const size_t chunk = 64 << 10;
+    volatile uint64_t sink = 0;
+    double tree_ms = measure([&]() {
+        tree_hasher hasher;
+        for (size_t at = 0; at < raw.size(); at += chunk) hasher.update(raw.data() + at, std::min(chunk, raw.size() - at));
+        sink = sink + hasher.finish().to_hex().size();
+    });
+    double chunk_ms = measure([&]() {
+        for (size_t at = 0; at < raw.size(); at += chunk) sink = sink + chunk_hash(raw.data() + at, std::min(chunk, raw.size() - at));
+    });
+    double gb = raw.size() / (1024.0 * 1024.0 * 1024.0);
+    out << "  \"micro\": {\"base64_encode_gb_per_s\": " << gb / (encode_ms / 1000)
+        << ", \"base64_decode_gb_per_s\": " << gb / (decode_ms / 1000)
+        << ", \"tree_hash_gb_per_s\": " << gb / (tree_ms / 1000) << ", \"chunk_hash_gb_per_s\": " << gb / (chunk_ms / 1000)
+        << ", \"log_calls_per_s\": {";
+
+    // add_log 를 여러 스레드에서 두드리는 동안 한 스레드가 GUI 처럼 계속 읽어 간다
+    bool first = true;
+    for (int producers : { 1, 4, 8 }) {
+        const int calls = 200000;
+        std::atomic<bool> reading{ true };
+        std::thread reader([&]() {
+            std::vector<log_record> records;
+            uint64_t cursor = 0;
+            while (reading) {
+                records.clear();
+                cursor = read_log(cursor, records);
+            }
+        });
+        auto start = bench_clock::now();
+        std::vector<std::thread> threads;
+        for (int t = 0; t < producers; ++t) {
+            threads.emplace_back([t]() {
+                for (int i = 0; i < calls; ++i) add_log(log_level::debug, static_cast<uint64_t>(t), "bench log line");
+            });
+        }
+        for (auto& t : threads) t.join();
+        double ms = elapsed_ms(start, bench_clock::now());
+        reading = false;
+        reader.join();
+        out << (first ? "" : ", ") << "\"" << producers << "\": " << producers * static_cast<double>(calls) / (ms / 1000);
+        first = false;
+    }
+    out << "}},\n";
+}
+
+// 가상 링크: 대역폭, 메시지 하나와 바이트 하나에 드는 송신측 CPU 시간, 메시지마다 붙는 선 위의 바이트
+// 원본 파일과 군데군데 끼워 넣고, 지우고, 덮어쓴 사본을 만들어 저장소로 얼마나 되살리는지 본다
+void run_dedup(std::ostream& out, const fs::path& work) {
+    fs::path root = work / "dedup";
+    fs::create_directories(root / "store");
+    std::string base(dedup_file_size, '\0');
+    random_bytes rng(2024);
+    rng.fill(base.data(), base.size());
+
+    std::vector<uint64_t> cuts;
+    for (int i = 0; i < dedup_edits; ++i) {
+        uint64_t at = 0;
+        rng.fill(reinterpret_cast<char*>(&at), sizeof(at));
+        cuts.push_back(at % base.size());
+    }
+    std::sort(cuts.begin(), cuts.end());
+    std::string variant;
+    variant.reserve(base.size() + dedup_edits * 4096);
+    uint64_t from = 0;
+    for (size_t i = 0; i < cuts.size(); ++i) {
+        uint64_t at = std::max(from, cuts[i]);
+        variant.append(base, from, at - from);
+        std::string patch(1 + at % 4096, '\0');
+        rng.fill(patch.data(), patch.size());
+        if (i % 3 == 0) { // 끼워 넣기
+            variant += patch;
+            from = at;
+        }
+        else if (i % 3 == 1) { // 지우기
+            from = std::min<uint64_t>(base.size(), at + patch.size());
+        }
+        else { // 덮어쓰기
+            variant += patch;
+            from = std::min<uint64_t>(base.size(), at + patch.size());
+        }
+    }
+    variant.append(base, from, std::string::npos);
+    {
+        std::ofstream(root / "store" / "base.bin", std::ios::binary).write(base.data(), static_cast<std::streamsize>(base.size()));
+        std::ofstream(root / "variant.bin", std::ios::binary).write(variant.data(), static_cast<std::streamsize>(variant.size()));
+    }
+
+    auto store = chunk_store::open(root / "store");
+    auto start = bench_clock::now();
+    if (store) store->scan();
+    double scan_ms = elapsed_ms(start, bench_clock::now());
+
+    auto source = open_chunk_source(root / "variant.bin", source_kind::stream);
+    start = bench_clock::now();
+    std::vector<cdc_chunk> chunks = source ? cdc_split(*source) : std::vector<cdc_chunk>{};
+    double split_ms = elapsed_ms(start, bench_clock::now());
+    uint64_t reused = 0;
+    std::vector<std::byte> buffer;
+    for (const auto& chunk : chunks) {
+        if (store && store->read(chunk.digest, chunk.length, buffer)) reused += chunk.length;
+    }
+
+    // 같은 편집에서 64KB 고정 블록이 얼마나 살아남는지
+    const size_t block = 64 << 10;
+    std::unordered_set<uint64_t> base_blocks;
+    for (size_t at = 0; at < base.size(); at += block)
+        base_blocks.insert(chunk_hash(base.data() + at, std::min(block, base.size() - at)));
+    uint64_t fixed_reused = 0;
+    for (size_t at = 0; at < variant.size(); at += block) {
+        size_t n = std::min(block, variant.size() - at);
+        if (base_blocks.count(chunk_hash(variant.data() + at, n))) fixed_reused += n;
+    }
+
+    // 색인만 따로: 무작위 키를 넣고, 있는 키와 없는 키를 찾는다
+    chunk_index index;
+    index.open(root / "index-bench");
+    random_bytes keys(99);
+    auto key_of = [](random_bytes& r) {
+        file_digest key;
+        r.fill(reinterpret_cast<char*>(&key.low), sizeof(key.low));
+        r.fill(reinterpret_cast<char*>(&key.high), sizeof(key.high));
+        return key;
+    };
+    start = bench_clock::now();
+    for (uint64_t i = 0; i < dedup_index_entries; ++i) index.insert(key_of(keys), { 0, 65536, i * 65536 });
+    double insert_ms = elapsed_ms(start, bench_clock::now());
+
+    const uint64_t lookups = dedup_index_entries / 2;
+    random_bytes present(99);
+    uint64_t found = 0;
+    chunk_index::location at;
+    start = bench_clock::now();
+    for (uint64_t i = 0; i < lookups; ++i) {
+        found += index.find(key_of(present), at); // 넣은 순서대로 앞쪽 절반
+    }
+    double hit_ms = elapsed_ms(start, bench_clock::now());
+    random_bytes absent(12345);
+    start = bench_clock::now();
+    for (uint64_t i = 0; i < lookups; ++i) found += index.find(key_of(absent), at);
+    double miss_ms = elapsed_ms(start, bench_clock::now());
+    std::error_code ec;
+    uint64_t index_bytes = fs::file_size(root / "index-bench", ec);
+
+    out << "  \"dedup\": {\"size\": " << variant.size() << ", \"edits\": " << dedup_edits << ", \"chunks\": " << chunks.size()
+        << ", \"avg_chunk\": " << (chunks.empty() ? 0 : variant.size() / chunks.size())
+        << ", \"chunk_mb_per_s\": " << variant.size() / (1024.0 * 1024.0) / (split_ms / 1000)
+        << ", \"scan_mb_per_s\": " << base.size() / (1024.0 * 1024.0) / (scan_ms / 1000)
+        << ", \"cdc_ratio\": " << static_cast<double>(reused) / variant.size()
+        << ", \"fixed_ratio\": " << static_cast<double>(fixed_reused) / variant.size()
+        << ", \"index_entries\": " << index.entries() << ", \"index_bytes\": " << index_bytes
+        << ", \"insert_per_s\": " << dedup_index_entries / (insert_ms / 1000)
+        << ", \"hit_lookup_per_s\": " << lookups / (hit_ms / 1000)
+        << ", \"miss_lookup_per_s\": " << lookups / (miss_ms / 1000) << ", \"found\": " << found << "},\n";
+    out.flush();
+    index.close();
+    store.reset();
+    fs::remove_all(root, ec);
+}
+
+struct link_profile {
+    const char* name;
+    double bytes_per_s;
+    double per_message_s;
+    double per_byte_s;
+    double overhead_bytes;
+};
+
+struct link_result {
+    double mb_per_s = 0;     // 뒤쪽 절반 구간의 속도
+    size_t chunk = 0;        // 끝났을 때의 청크 크기
+    double settled_s = 0;    // 마지막으로 크기가 바뀐 시각
+    double queue_ms = 0;     // 뒤쪽 절반 동안 버퍼에 쌓인 양을 속도로 나눈 평균 지연
+};
+
+// file_sender::pump 와 같은 워터마크 규칙으로 보내며 50 us 단위로 시간을 흘린다
+link_result simulate_link(const link_profile& p, size_t pinned, double seconds) {
+    const double step = 50e-6;
+    const uint64_t high_watermark = 1 << 20, low_watermark = 256 << 10;
+    chunk_tuner tuner(pinned);
+    tuner.set_max_message(256 << 10, chunk_header_size);
+
+    std::deque<uint64_t> queue;
+    uint64_t buffered = 0, sent = 0, delivered = 0, delivered_at_half = 0;
+    double busy_until = 0, credit = 0, queued_sum = 0;
+    bool waiting_low = false;
+    size_t samples = 0, last_chunk = tuner.chunk_size();
+    link_result result;
+
+    for (double t = 0; t < seconds; t += step) {
+        credit += p.bytes_per_s * step;
+        while (!queue.empty() && credit >= queue.front() + p.overhead_bytes) {
+            credit -= queue.front() + p.overhead_bytes;
+            buffered -= queue.front();
+            delivered += queue.front();
+            queue.pop_front();
+        }
+        if (queue.empty()) credit = std::min(credit, p.bytes_per_s * step);
+        if (waiting_low && buffered < low_watermark) waiting_low = false;
+
+        if (t >= busy_until && !waiting_low) {
+            if (buffered >= high_watermark) {
+                waiting_low = true;
+            }
+            else {
+                auto now = chunk_tuner::clock::time_point(
+                    std::chrono::duration_cast<chunk_tuner::clock::duration>(std::chrono::duration<double>(t)));
+                tuner.observe(sent, buffered, now);
+                size_t chunk = tuner.chunk_size();
+                busy_until = t + p.per_message_s + chunk * p.per_byte_s;
+                queue.push_back(chunk);
+                buffered += chunk;
+                sent += chunk;
+                if (chunk != last_chunk) {
+                    last_chunk = chunk;
+                    result.settled_s = t;
+                }
+            }
+        }
+        if (t >= seconds / 2) {
+            if (samples++ == 0) delivered_at_half = delivered;
+            queued_sum += static_cast<double>(buffered);
+        }
+    }
+    double rate = (delivered - delivered_at_half) / (seconds / 2);
+    result.mb_per_s = rate / (1024.0 * 1024.0);
+    result.chunk = tuner.chunk_size();
+    if (rate > 0 && samples > 0) result.queue_ms = queued_sum / samples / rate * 1000;
+    return result;
+}
+
+void run_tuner(std::ostream& out) {
+    static const link_profile profiles[] = {
+        { "lan-10g", 1.25e9, 20e-6, 0.3e-9, 60 },
+        { "lan-1g", 125e6, 20e-6, 0.3e-9, 60 },
+        { "wifi-slow-cpu", 12.5e6, 2e-3, 1e-9, 60 },
+        { "wan-10m", 1.25e6, 20e-6, 0.3e-9, 60 },
+        { "dsl-1m", 125e3, 20e-6, 0.3e-9, 60 },
+    };
+    out << "  \"tuner\": [";
+    bool first = true;
+    for (const link_profile& p : profiles) {
+        link_result tuned = simulate_link(p, 0, 20);
+        out << (first ? "\n" : ",\n") << "    {\"link\": \"" << p.name << "\", \"chunk\": " << tuned.chunk
+            << ", \"mb_per_s\": " << tuned.mb_per_s << ", \"settled_s\": " << tuned.settled_s
+            << ", \"queue_ms\": " << tuned.queue_ms << ", \"pinned_mb_per_s\": {";
+        bool first_pinned = true;
+        for (size_t pinned : { 4 << 10, 16 << 10, 64 << 10, 256 << 10 }) {
+            link_result fixed = simulate_link(p, pinned, 10);
+            out << (first_pinned ? "" : ", ") << "\"" << (pinned >> 10) << "K\": " << fixed.mb_per_s;
+            first_pinned = false;
+        }
+        out << "}}";
+        first = false;
+    }
+    out << "\n  ],\n";
+}
+
+// 가상 시계 위에서 욕심 많은 송신자들이 1 ms 마다 흐름이 허락하는 만큼 chunk 바이트씩 보낸다.
+// senders 는 보내는 흐름의 수 (뒤쪽 흐름은 쉰다). 흐름마다 초당 MB 를 돌려준다
+std::vector<double> simulate_shaper(const std::vector<std::shared_ptr<shaped_flow>>& flows, size_t senders,
+                                    bench_clock::time_point& now, double seconds, size_t chunk) {
+    std::vector<uint64_t> before;
+    for (const auto& f : flows) before.push_back(f->bytes());
+    auto step = std::chrono::milliseconds(1);
+    for (int64_t ms = 0; ms < static_cast<int64_t>(seconds * 1000); ++ms) {
+        now += step;
+        for (bool sent = true; sent;) {
+            sent = false;
+            for (size_t i = 0; i < senders; ++i) {
+                if (flows[i]->ready(now) != shaped_flow::clock::duration::zero()) continue;
+                flows[i]->consume(chunk, now);
+                sent = true;
+            }
+        }
+    }
+    std::vector<double> rates;
+    for (size_t i = 0; i < flows.size(); ++i) rates.push_back((flows[i]->bytes() - before[i]) / (1024.0 * 1024.0) / seconds);
+    return rates;
+}
+
+// 기대값에 맞춘 비율의 Jain 공정성 지수. 1 이면 모두 정확히 제 몫을 받았다
+double jain_index(const std::vector<double>& measured, const std::vector<double>& expected) {
+    double sum = 0, squares = 0;
+    size_t n = 0;
+    for (size_t i = 0; i < measured.size(); ++i) {
+        if (expected[i] <= 0) continue;
+        double x = measured[i] / expected[i];
+        sum += x;
+        squares += x * x;
+        ++n;
+    }
+    return n == 0 || squares == 0 ? 0 : sum * sum / (n * squares);
+}
+
+// 어긴 검사를 stderr 에 남기고 false. main 은 하나라도 어기면 실패로 끝난다
+bool shaping_check(bool ok, const std::string& scenario, const std::string& what) {
+    if (!ok) std::cerr << "shaping " << scenario << ": " << what << "\n";
+    return ok;
+}
+
+// 작업마다 기대 속도의 tolerance 안에 들고, 기대 몫이 큰 작업이 실제로도 더 빨라야 통과한다.
+// 몫이 아주 작은 작업(low 가중치, 쉬는 흐름)은 청크 몇 개로도 비율이 크게 흔들리므로 가장 큰 몫의 1/4 을 기준으로 삼는다
+bool write_shaping(std::ostream& out, const std::string& scenario, const std::vector<double>& expected,
+                   const std::vector<double>& measured, double tolerance, bool first) {
+    double worst = 0;
+    double largest = expected.empty() ? 0 : *std::max_element(expected.begin(), expected.end());
+    bool ok = shaping_check(measured.size() == expected.size(), scenario, "작업 수가 다름");
+    out << (first ? "\n" : ",\n") << "      {\"scenario\": \"" << scenario << "\", \"expected_mb_per_s\": [";
+    for (size_t i = 0; i < expected.size(); ++i) out << (i ? ", " : "") << expected[i];
+    out << "], \"mb_per_s\": [";
+    for (size_t i = 0; i < measured.size() && i < expected.size(); ++i) {
+        out << (i ? ", " : "") << measured[i];
+        double error = expected[i] > 0 ? std::abs(measured[i] - expected[i]) / expected[i] : measured[i] > 0 ? 1 : 0;
+        worst = std::max(worst, error);
+        double allowed = tolerance * std::max(expected[i], largest / 4);
+        ok &= shaping_check(std::abs(measured[i] - expected[i]) <= allowed, scenario,
+                            "작업 " + std::to_string(i) + " 속도 오차 " + std::to_string(error * 100) + "%");
+        for (size_t j = 0; j < measured.size() && j < expected.size(); ++j) {
+            if (expected[i] > expected[j])
+                ok &= shaping_check(measured[i] > measured[j], scenario,
+                                    "작업 " + std::to_string(i) + " 이 작업 " + std::to_string(j) + " 보다 느림");
+        }
+    }
+    out << "], \"max_error_pct\": " << worst * 100 << ", \"tolerance_pct\": " << tolerance * 100
+        << ", \"jain\": " << jain_index(measured, expected) << ", \"ok\": " << (ok ? "true" : "false") << "}";
+    return ok;
+}
+
+// 어긴 시나리오 수를 돌려준다. 같은 시나리오를 tests/shaper_test.cpp 가 ctest 에서 검사한다
+int run_shaping_simulated(std::ostream& out) {
+    const double mb = 1024.0 * 1024.0;
+    const double rate = 10 * mb;
+    const double high = transfer_priority_weight(transfer_priority::high);
+    const double normal = transfer_priority_weight(transfer_priority::normal);
+    const double low = transfer_priority_weight(transfer_priority::low);
+    bench_clock::time_point now = bench_clock::time_point{} + std::chrono::hours(1);
+    bool first = true;
+    int failures = 0;
+    auto check = [&](const char* scenario, const std::vector<double>& expected, const std::vector<double>& measured) {
+        failures += !write_shaping(out, scenario, expected, measured, shaping_simulated_tolerance, first);
+        first = false;
+    };
+    out << "    \"simulated\": [";
+
+    {
+        // 청크 크기가 토큰 단위와 맞지 않아도 평균이 맞는지
+        auto shaper = bandwidth_shaper::create(rate, false);
+        std::vector<std::shared_ptr<shaped_flow>> flows = { shaper->add_flow() };
+        check("single", { 10 }, simulate_shaper(flows, 1, now, 10, 50000));
+    }
+    {
+        auto shaper = bandwidth_shaper::create(rate, false);
+        std::vector<std::shared_ptr<shaped_flow>> flows = { shaper->add_flow(normal), shaper->add_flow(normal) };
+        check("equal", { 5, 5 }, simulate_shaper(flows, 2, now, 10, 64 << 10));
+    }
+    {
+        auto shaper = bandwidth_shaper::create(rate, false);
+        std::vector<std::shared_ptr<shaped_flow>> flows = { shaper->add_flow(high), shaper->add_flow(low) };
+        double share = 10 * high / (high + low);
+        check("high_vs_low", { share, 10 - share }, simulate_shaper(flows, 2, now, 10, 64 << 10));
+    }
+    {
+        // 상한 2 MB/s 인 흐름은 상한만 받고 남는 8 MB/s 를 나머지 둘이 나눈다
+        auto shaper = bandwidth_shaper::create(rate, false);
+        std::vector<std::shared_ptr<shaped_flow>> flows = { shaper->add_flow(normal, 2 * mb), shaper->add_flow(normal),
+                                                             shaper->add_flow(normal) };
+        check("ceil", { 2, 4, 4 }, simulate_shaper(flows, 3, now, 10, 64 << 10));
+    }
+    {
+        // 쉬는 흐름의 몫은 보내는 흐름이 빌려 쓴다. 멈춘 흐름은 몫을 내놓고, 다시 돌면 되찾는다
+        auto shaper = bandwidth_shaper::create(rate, false);
+        std::vector<std::shared_ptr<shaped_flow>> flows = { shaper->add_flow(normal), shaper->add_flow(normal) };
+        check("borrow_idle", { 10, 0 }, simulate_shaper(flows, 1, now, 5, 64 << 10));
+        flows[1]->set_paused(true);
+        check("paused", { 10, 0 }, simulate_shaper(flows, 2, now, 5, 64 << 10));
+        flows[1]->set_paused(false);
+        check("resumed", { 5, 5 }, simulate_shaper(flows, 2, now, 5, 64 << 10));
+        flows[0]->set_weight(low);
+        flows[1]->set_weight(high);
+        double share = 10 * low / (high + low);
+        check("reprioritized", { share, 10 - share }, simulate_shaper(flows, 2, now, 5, 64 << 10));
+        shaper->set_rate(4 * mb);
+        share = 4 * low / (high + low);
+        check("rate_changed", { share, 4 - share }, simulate_shaper(flows, 2, now, 5, 64 << 10));
+    }
+    out << "\n    ],\n";
+    return failures;
+}
+
+void usage() {
+    std::cerr << "usage: fts_bench [--sizes 1M,64M,512M] [--chunks auto,16K,64K,128K]\n"
+                 "                 [--contents zero,random,text,mixed,tree,sparse] [--channels N|1,2,4|1-8]\n"
+                 "                 [--read stream|mmap|async] [--compress off|auto|on] [--micro] [--tuner]\n"
+                 "                 [--fanout N] [--swarm N] [--dedup] [--lossy <loss%>/<rtt ms>,...] [--shaping]\n"
+                 "                 [--link N] [--sources 4G] [--out file]\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::vector<std::string> sizes = { "1M", "64M", "512M" };
+    std::vector<std::string> chunks = { "auto", "16K", "64K", "128K" };
+    std::vector<std::string> contents = { "zero", "random", "text", "tree" };
+    std::vector<int> channel_counts = { 1 };
+    send_options options;
+    bool micro = false;
+    bool tuner = false;
+    bool dedup = false;
+    bool shaping = false;
+    size_t fanout = 0;
+    size_t swarm = 0;
+    size_t link_files = 0;
+    uint64_t sources_size = 0;
+    std::vector<std::string> lossy;
+    std::string out_path;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--sizes" && has_value) sizes = split(argv[++i], ',');
+        else if (arg == "--chunks" && has_value) chunks = split(argv[++i], ',');
+        else if (arg == "--contents" && has_value) contents = split(argv[++i], ',');
+        else if (arg == "--channels" && has_value) {
+            if (!parse_channels(argv[++i], channel_counts)) {
+                usage();
+                return 2;
+            }
+        }
+        else if (arg == "--read" && has_value) {
+            std::string kind = argv[++i];
+            options.source = kind == "mmap" ? source_kind::mmap : kind == "async" ? source_kind::async : source_kind::stream;
+        }
+        else if (arg == "--compress" && has_value) {
+            std::string mode = argv[++i];
+            options.compression = mode == "off" ? compression_mode::off
+                                : mode == "on" ? compression_mode::always : compression_mode::automatic;
+        }
+        else if (arg == "--micro") micro = true;
+        else if (arg == "--tuner") tuner = true;
+        else if (arg == "--dedup") dedup = true;
+        else if (arg == "--shaping") shaping = true;
+        else if (arg == "--fanout" && has_value) fanout = static_cast<size_t>(std::max(0, std::atoi(argv[++i])));
+        else if (arg == "--swarm" && has_value) swarm = static_cast<size_t>(std::max(0, std::atoi(argv[++i])));
+        else if (arg == "--lossy" && has_value) lossy = split(argv[++i], ',');
+        else if (arg == "--link" && has_value) link_files = static_cast<size_t>(std::max(0, std::atoi(argv[++i])));
+        else if (arg == "--sources" && has_value) {
+            if (!parse_size(argv[++i], sources_size) || sources_size == 0) {
+                usage();
+                return 2;
+            }
+        }
+        else if (arg == "--out" && has_value) out_path = argv[++i];
+        else {
+            usage();
+            return 2;
+        }
+    }
+
+    // 팬아웃, 스웜 같은 다른 시험은 첫 채널 수로 돈다
+    options.channels = channel_counts.front();
+
+    std::vector<bench_case> cases;
+    std::vector<uint64_t> fanout_sizes;
+    for (const auto& size_text : sizes) {
+        uint64_t size = 0;
+        if (parse_size(size_text, size)) fanout_sizes.push_back(size);
+        for (const auto& chunk_text : chunks) {
+            for (const auto& content : contents) {
+                for (int channels : channel_counts) {
+                    bench_case c;
+                    uint64_t chunk = 0; // auto 는 0
+                    if (!parse_size(size_text, c.size) || (chunk_text != "auto" && (!parse_size(chunk_text, chunk) || chunk == 0))) {
+                        usage();
+                        return 2;
+                    }
+                    c.chunk = static_cast<size_t>(chunk);
+                    c.content = content;
+                    c.channels = channels;
+                    cases.push_back(c);
+                }
+            }
+        }
+    }
+
+    rtc::InitLogger(rtc::LogLevel::Error);
+
+    fs::path work = fs::temp_directory_path() / ("fts-bench-" + std::to_string(getpid()));
+    fs::create_directories(work / "src");
+
+    std::ofstream file_out;
+    if (!out_path.empty()) file_out.open(out_path, std::ios::trunc);
+    std::ostream& out = out_path.empty() ? std::cout : file_out;
+
+    out << "{\n";
+    if (micro) run_micro(out);
+    if (tuner) run_tuner(out);
+    if (dedup) run_dedup(out, work);
+    if (sources_size > 0) run_sources(out, work, sources_size);
+
+    loopback link;
+    uint64_t seed = 1;
+    if (fanout > 0) {
+        // 크기마다 random 파일 하나를 fanout 명에게 동시에 보낸다
+        out << "  \"fanout\": [";
+        for (size_t i = 0; i < fanout_sizes.size(); ++i, ++seed) {
+            std::string name = "fanout-" + std::to_string(seed);
+            fs::path download_dir = work / ("dst-" + std::to_string(seed));
+            write_content(work / "src" / name, fanout_sizes[i], "random", seed);
+            fanout_result r = link.run_fanout(work / "src", name, fanout_sizes[i], options, fanout, download_dir);
+            out << (i ? ",\n" : "\n") << "    {\"size\": " << fanout_sizes[i] << ", \"peers\": " << r.peers
+                << ", \"ok\": " << (r.ok ? "true" : "false") << ", \"total_ms\": " << r.total_ms
+                << ", \"egress_mb_per_s\": " << r.egress_mb_per_s << ", \"read_amplification\": " << r.read_amplification
+                << ", \"cache_hits\": " << r.cache_hits << ", \"cache_misses\": " << r.cache_misses << "}";
+            out.flush();
+            std::error_code ec;
+            fs::remove(work / "src" / name, ec);
+            fs::remove_all(download_dir, ec);
+        }
+        out << "\n  ],\n";
+    }
+
+    int swarm_failures = 0;
+    if (swarm > 0) {
+        // 크기마다 random 파일 하나를 가장 빠른 송신자 하나, 그리고 swarm 명에게서 받는다
+        out << "  \"swarm\": [";
+        for (size_t i = 0; i < fanout_sizes.size(); ++i, ++seed) {
+            std::string name = "swarm-" + std::to_string(seed);
+            fs::path download_dir = work / ("dst-" + std::to_string(seed));
+            write_content(work / "src" / name, fanout_sizes[i], "random", seed);
+            file_digest digest;
+            digest_file(work / "src" / name, digest);
+
+            swarm_result r;
+            r.peers = swarm;
+            std::vector<double> rates;
+            for (size_t p = 0; p < swarm; ++p) {
+                rates.push_back(swarm_rate / static_cast<double>(uint64_t(1) << std::min<size_t>(p, 30)));
+                r.ideal += rates.back() / swarm_rate;
+            }
+            std::error_code ec;
+            fs::create_directories(download_dir / "single");
+            fs::create_directories(download_dir / "swarm");
+            r.single_ms = link.run_swarm(work / "src", name, digest, fanout_sizes[i], options, { swarm_rate }, download_dir / "single");
+            r.swarm_ms = link.run_swarm(work / "src", name, digest, fanout_sizes[i], options, rates, download_dir / "swarm");
+            if (r.single_ms > 0 && r.swarm_ms > 0) r.speedup = r.single_ms / r.swarm_ms;
+            // 송신자가 하나면 나눠 받을 것이 없으므로 받기만 하면 된다
+            r.ok = r.speedup > 0 && (swarm < 2 || r.speedup > swarm_min_speedup);
+            swarm_failures += !r.ok;
+
+            out << (i ? ",\n" : "\n") << "    {\"size\": " << fanout_sizes[i] << ", \"peers\": " << r.peers
+                << ", \"ok\": " << (r.ok ? "true" : "false") << ", \"single_ms\": " << r.single_ms
+                << ", \"swarm_ms\": " << r.swarm_ms << ", \"speedup\": " << r.speedup << ", \"ideal\": " << r.ideal << "}";
+            out.flush();
+            fs::remove(work / "src" / name, ec);
+            fs::remove_all(download_dir, ec);
+        }
+        out << "\n  ],\n";
+    }
+
+    if (!lossy.empty()) {
+        // 링크마다 random 파일 하나를 신뢰 채널, 부분 신뢰, 부분 신뢰 + FEC 로 보낸다
+        out << "  \"lossy\": [";
+        bool first_link = true;
+        for (const auto& profile : lossy) {
+            std::vector<std::string> parts = split(profile, '/');
+            if (parts.size() != 2) {
+                usage();
+                return 2;
+            }
+            double loss = std::atof(parts[0].c_str()) / 100.0;
+            double rtt_ms = std::atof(parts[1].c_str());
+            std::string name = "lossy-" + std::to_string(seed);
+            write_content(work / "src" / name, lossy_file_size, "random", seed);
+
+            const char* modes[] = { "reliable", "lossy", "lossy_fec" };
+            for (int mode = 0; mode < 3; ++mode, ++seed) {
+                fs::path download_dir = work / ("dst-" + std::to_string(seed));
+                fs::create_directories(download_dir);
+                send_options run_options = options;
+                run_options.lossy = mode > 0;
+                run_options.fec_group = mode == 2 ? lossy_fec_group : 0;
+
+                bench_result r;
+                uint64_t dropped = 0;
+                {
+                    udp_relay relay(loss, std::chrono::microseconds(static_cast<int64_t>(rtt_ms * 500)), seed);
+                    if (relay.ok()) {
+                        link.set_sdp_filter([&relay](const std::string& sdp) { return relay.rewrite(sdp); });
+                        r = link.run(work / "src", name, lossy_file_size, run_options, download_dir);
+                        link.set_sdp_filter(nullptr);
+                        dropped = relay.dropped();
+                    }
+                }
+                out << (first_link ? "\n" : ",\n") << "    {\"loss\": " << loss << ", \"rtt_ms\": " << rtt_ms
+                    << ", \"mode\": \"" << modes[mode] << "\", \"ok\": " << (r.ok ? "true" : "false")
+                    << ", \"total_ms\": " << r.total_ms << ", \"goodput_mb_per_s\": " << r.mb_per_s
+                    << ", \"retransmitted_bytes\": " << r.retransmitted << ", \"fec_recovered\": " << r.fec_recovered
+                    << ", \"dropped_packets\": " << dropped << "}";
+                out.flush();
+                first_link = false;
+                std::error_code ec;
+                fs::remove_all(download_dir, ec);
+            }
+            std::error_code ec;
+            fs::remove(work / "src" / name, ec);
+        }
+        out << "\n  ],\n";
+    }
+
+    int shaping_failures = 0;
+    if (shaping) {
+        // 가상 시계 시험 뒤 random 파일 두 개를 전체 shaping_rate 로 묶어 동시에 보낸다
+        out << "  \"shaping\": {\n";
+        shaping_failures += run_shaping_simulated(out);
+        out << "    \"loopback\": [";
+        struct scenario {
+            const char* name;
+            transfer_priority a, b;
+            double ceil_a;
+        };
+        const double mb = 1024.0 * 1024.0;
+        const double total = shaping_rate / mb;
+        const scenario scenarios[] = {
+            { "equal", transfer_priority::normal, transfer_priority::normal, 0 },
+            { "high_vs_low", transfer_priority::high, transfer_priority::low, 0 },
+            { "ceil", transfer_priority::normal, transfer_priority::normal, shaping_rate / 8 },
+        };
+        bool first_run = true;
+        for (const scenario& sc : scenarios) {
+            std::vector<std::string> names = { "shaping-" + std::to_string(seed) + "-a", "shaping-" + std::to_string(seed) + "-b" };
+            fs::path download_dir = work / ("dst-" + std::to_string(seed));
+            fs::create_directories(download_dir);
+            for (size_t i = 0; i < names.size(); ++i) write_content(work / "src" / names[i], shaping_file_size, "random", seed * 31 + i);
+            ++seed;
+
+            double wa = transfer_priority_weight(sc.a), wb = transfer_priority_weight(sc.b);
+            std::vector<double> expected = { total * wa / (wa + wb), total * wb / (wa + wb) };
+            if (sc.ceil_a > 0) expected = { sc.ceil_a / mb, total - sc.ceil_a / mb };
+            shaping_result r = link.run_scheduled(work / "src", names, options, shaping_rate, { sc.a, sc.b },
+                                                  { sc.ceil_a, 0 }, names.size(), download_dir);
+            if (!shaping_check(r.ok && r.job_mb_per_s.size() == 2, sc.name, "전송 실패 또는 함께 돈 구간이 없음")) {
+                out << (first_run ? "\n" : ",\n") << "      {\"scenario\": \"" << sc.name << "\", \"ok\": false}";
+                ++shaping_failures;
+            }
+            else {
+                shaping_failures += !write_shaping(out, sc.name, expected, r.job_mb_per_s, shaping_loopback_tolerance, first_run);
+            }
+            first_run = false;
+            out.flush();
+            std::error_code ec;
+            for (const auto& name : names) fs::remove(work / "src" / name, ec);
+            fs::remove_all(download_dir, ec);
+        }
+        out << "\n    ],\n";
+
+        {
+            // 한 번에 하나만 도는 대기열에 low, low, high 를 넣는다. 첫 작업은 넣자마자 시작하고,
+            // 그 뒤로는 먼저 넣은 low 보다 high 가 먼저 시작해야 한다
+            std::vector<std::string> names;
+            for (const char* suffix : { "-a", "-b", "-c" }) names.push_back("queue-" + std::to_string(seed) + suffix);
+            fs::path download_dir = work / ("dst-" + std::to_string(seed));
+            fs::create_directories(download_dir);
+            for (size_t i = 0; i < names.size(); ++i)
+                write_content(work / "src" / names[i], shaping_queue_file_size, "random", seed * 31 + i);
+            ++seed;
+
+            const size_t max_active = 1;
+            shaping_result r = link.run_scheduled(work / "src", names, options, shaping_rate,
+                                                  { transfer_priority::low, transfer_priority::low, transfer_priority::high },
+                                                  { 0, 0, 0 }, max_active, download_dir);
+            const std::vector<size_t> expected_order = { 0, 2, 1 };
+            bool ok = shaping_check(r.ok, "queue", "전송 실패");
+            ok &= shaping_check(r.peak_active <= max_active, "queue",
+                                "동시에 " + std::to_string(r.peak_active) + "개가 돎 (max_active " + std::to_string(max_active) + ")");
+            ok &= shaping_check(r.start_order == expected_order, "queue", "우선순위대로 시작하지 않음");
+            shaping_failures += !ok;
+            out << "    \"queue\": {\"max_active\": " << max_active << ", \"peak_active\": " << r.peak_active
+                << ", \"start_order\": [";
+            for (size_t i = 0; i < r.start_order.size(); ++i) out << (i ? ", " : "") << r.start_order[i];
+            out << "], \"ok\": " << (ok ? "true" : "false") << "}\n  },\n";
+            out.flush();
+            std::error_code ec;
+            for (const auto& name : names) fs::remove(work / "src" / name, ec);
+            fs::remove_all(download_dir, ec);
+        }
+    }
+
+    if (link_files > 0) {
+        // 같은 random 파일들을 파일마다 새 세션으로 한 번, 지속 연결 하나로 한 번 받는다.
+        // 새 세션의 첫 바이트는 송신기가 처음 읽은 시각이고 당겨 받기는 수신기가 받은 시각이므로 당겨 받기 쪽이 불리하게 잰다
+        std::vector<std::string> names;
+        fs::path base = work / ("link-" + std::to_string(seed));
+        fs::create_directories(base);
+        for (size_t i = 0; i < link_files; ++i, ++seed) {
+            names.push_back("f" + std::to_string(i));
+            write_content(base / names.back(), link_file_size, "random", seed);
+        }
+
+        std::vector<double> cold;
+        bool cold_ok = true;
+        for (const std::string& name : names) {
+            fs::path download_dir = work / ("dst-" + std::to_string(seed++));
+            fs::create_directories(download_dir);
+            bench_result r = link.run(base, name, link_file_size, options, download_dir);
+            cold_ok &= r.ok;
+            cold.push_back(r.first_byte_ms);
+            std::error_code ec;
+            fs::remove_all(download_dir, ec);
+        }
+        fs::path download_dir = work / ("dst-" + std::to_string(seed++));
+        fs::create_directories(download_dir);
+        link_bench_result warm = link.run_link(base, names, download_dir);
+
+        auto mean = [](const std::vector<double>& v, size_t from) {
+            double sum = 0;
+            for (size_t i = from; i < v.size(); ++i) sum += v[i];
+            return v.size() > from ? sum / (v.size() - from) : 0.0;
+        };
+        auto list = [](const std::vector<double>& v) {
+            std::ostringstream oss;
+            for (size_t i = 0; i < v.size(); ++i) oss << (i ? ", " : "") << v[i];
+            return "[" + oss.str() + "]";
+        };
+        out << "  \"link\": {\"files\": " << link_files << ", \"size\": " << link_file_size
+            << ", \"ok\": " << (cold_ok && warm.ok ? "true" : "false")
+            << ", \"cold_first_byte_ms\": " << list(cold) << ", \"cold_mean_ms\": " << mean(cold, 0)
+            << ", \"link_setup_ms\": " << warm.setup_ms << ", \"pull_first_byte_ms\": " << list(warm.first_byte_ms)
+            << ", \"pull_total_ms\": " << list(warm.total_ms)
+            << ", \"pull_first_ms\": " << (warm.first_byte_ms.empty() ? 0.0 : warm.first_byte_ms.front())
+            << ", \"pull_rest_mean_ms\": " << mean(warm.first_byte_ms, 1) << "},\n";
+        out.flush();
+        std::error_code ec;
+        fs::remove_all(base, ec);
+        fs::remove_all(download_dir, ec);
+    }
+
+    out << "  \"runs\": [\n";
+    bool first = true;
+    for (const bench_case& c : cases) {
+        // 같은 이름의 파일이 남아 있으면 델타 전송이 되므로 받을 폴더를 매번 새로 만든다
+        fs::path download_dir = work / ("dst-" + std::to_string(seed));
+        fs::create_directories(download_dir);
+
+        std::string name = "bench-" + std::to_string(seed) + "-" + c.content;
+        size_t files = 1;
+        if (c.content == "tree") {
+            // 같은 총량을 작은 파일 여러 개로 나눈다 (초당 파일 수를 본다)
+            files = static_cast<size_t>(std::clamp<uint64_t>(c.size / (64 << 10), 1, 4096));
+            fs::create_directories(work / "src" / name);
+            for (size_t i = 0; i < files; ++i) {
+                write_content(work / "src" / name / ("f" + std::to_string(i)), c.size / files, "random", seed * 7919 + i);
+            }
+        }
+        else {
+            write_content(work / "src" / name, c.size, c.content, seed);
+        }
+
+        send_options run_options = options;
+        run_options.chunk_size = c.chunk;
+        run_options.channels = c.channels;
+        bench_result r = link.run(work / "src", name, c.size, run_options, download_dir);
+
+        out << (first ? "" : ",\n") << "    {\"size\": " << c.size << ", \"chunk\": " << c.chunk
+            << ", \"content\": \"" << c.content << "\", \"channels\": " << run_options.channels
+            << ", \"read\": \"" << source_kind_name(run_options.source)
+            << "\", \"compress\": \"" << compression_mode_name(run_options.compression)
+            << "\", \"ok\": " << (r.ok ? "true" : "false") << ", \"setup_ms\": " << r.setup_ms
+            << ", \"first_byte_ms\": " << r.first_byte_ms << ", \"total_ms\": " << r.total_ms
+            << ", \"mb_per_s\": " << r.mb_per_s << ", \"peak_rss_kb\": " << r.peak_rss_kb
+            << ", \"cpu_s_per_gb\": " << r.cpu_s_per_gb << ", \"final_chunk\": " << r.final_chunk
+            << ", \"wire_bytes\": " << r.wire_bytes;
+        // 원본 / 선로 바이트. 1 보다 작으면 헤더와 압축 시도가 이득보다 컸다
+        if (r.ok && r.wire_bytes > 0) out << ", \"compression_ratio\": " << static_cast<double>(c.size) / r.wire_bytes;
+        if (c.content == "tree" && r.ok && r.total_ms > 0)
+            out << ", \"files\": " << files << ", \"files_per_s\": " << files / (r.total_ms / 1000);
+        if (c.content == "sparse")
+            out << ", \"src_allocated\": " << allocated_bytes(work / "src" / name)
+                << ", \"dst_allocated\": " << allocated_bytes(download_dir / name);
+        out << "}";
+        out.flush();
+        first = false;
+
+        std::error_code ec;
+        fs::remove_all(work / "src" / name, ec);
+        fs::remove_all(download_dir, ec);
+        ++seed;
+    }
+    out << "\n  ]\n}\n";
+
+    std::error_code ec;
+    fs::remove_all(work, ec);
+    if (shaping_failures > 0) std::cerr << "shaping: " << shaping_failures << "개 시나리오 실패\n";
+    if (swarm_failures > 0) std::cerr << "swarm: " << swarm_failures << "개 크기에서 나눠 받기가 빠르지 않음\n";
+    return shaping_failures > 0 || swarm_failures > 0 ? 1 : 0;
+}
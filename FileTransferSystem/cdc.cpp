@@ -0,0 +1,112 @@
+﻿#include "cdc.h"
+#include "protocol.h"
+
+#include <algorithm>
+#include <array>
+
+namespace {
+
+// 바이트마다 임의의 64 비트 값. 양쪽이 같은 경계를 찾아야 하므로 고정된 씨앗(splitmix64)으로 만든다
+constexpr std::array<uint64_t, 256> make_gear() {
+    std::array<uint64_t, 256> table{};
+    uint64_t x = 0x6674732d63646321ull;
+    for (auto& v : table) {
+        x += 0x9e3779b97f4a7c15ull;
+        uint64_t z = x;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        v = z ^ (z >> 31);
+    }
+    return table;
+}
+
+constexpr std::array<uint64_t, 256> gear = make_gear();
+
+int log2_of(size_t v) {
+    int bits = 0;
+    while ((size_t(1) << (bits + 1)) <= v) ++bits;
+    return bits;
+}
+
+// 위쪽 bits 개 비트. fp 는 왼쪽으로 밀리므로 위쪽 비트가 최근 64 바이트를 모두 반영한다
+uint64_t top_mask(int bits) {
+    return bits <= 0 ? 0 : ~uint64_t(0) << (64 - std::min(bits, 63));
+}
+
+constexpr size_t read_window = 4 << 20;
+
+} // namespace
+
+size_t cdc_cut(const std::byte* data, size_t length, const cdc_params& params) {
+    if (length <= params.min_size) return length;
+    size_t end = std::min(length, params.max_size);
+    size_t normal = std::min(end, params.avg_size);
+    int bits = log2_of(params.avg_size);
+    const uint64_t mask_small = top_mask(bits + 2); // 평균 전: 경계가 잘 안 생긴다
+    const uint64_t mask_large = top_mask(bits - 2); // 평균 뒤: 경계가 잘 생긴다
+
+    uint64_t fp = 0;
+    size_t i = params.min_size;
+    for (; i < normal; ++i) {
+        fp = (fp << 1) + gear[static_cast<uint8_t>(data[i])];
+        if ((fp & mask_small) == 0) return i + 1;
+    }
+    for (; i < end; ++i) {
+        fp = (fp << 1) + gear[static_cast<uint8_t>(data[i])];
+        if ((fp & mask_large) == 0) return i + 1;
+    }
+    return end;
+}
+
+std::vector<cdc_chunk> cdc_split(chunk_source& source, const cdc_params& params, tree_hasher* hasher) {
+    std::vector<cdc_chunk> chunks;
+    const uint64_t size = source.size();
+    rtc::binary buffer;
+    uint64_t base = 0; // buffer[0] 의 파일 위치
+    size_t at = 0;
+    while (base + at < size) {
+        // 경계를 찾으려면 max_size 만큼은 있어야 한다. 파일 끝이면 남은 만큼으로 자른다
+        if (buffer.size() - at < params.max_size && base + buffer.size() < size) {
+            buffer.erase(buffer.begin(), buffer.begin() + at);
+            base += at;
+            at = 0;
+            size_t before = buffer.size();
+            size_t want = static_cast<size_t>(std::min<uint64_t>(read_window, size - base - before));
+            if (source.append(base + before, want, buffer) == 0) break;
+            if (hasher) hasher->update(buffer.data() + before, buffer.size() - before);
+            continue;
+        }
+        size_t n = cdc_cut(buffer.data() + at, buffer.size() - at, params);
+        cdc_chunk chunk;
+        chunk.offset = base + at;
+        chunk.length = static_cast<uint32_t>(n);
+        chunk.digest = chunk_digest(buffer.data() + at, n);
+        chunks.push_back(chunk);
+        at += n;
+    }
+    return chunks;
+}
+
+void append_cdc_chunks(const cdc_chunk* entries, size_t count, rtc::binary& out) {
+    size_t at = out.size();
+    out.resize(at + count * cdc_entry_size);
+    for (size_t i = 0; i < count; ++i, at += cdc_entry_size) {
+        put_u32(out.data() + at, entries[i].length);
+        put_u64(out.data() + at + 4, entries[i].digest.low);
+        put_u64(out.data() + at + 12, entries[i].digest.high);
+    }
+}
+
+bool parse_cdc_chunks(const std::byte* data, size_t length, uint64_t& next_offset, std::vector<cdc_chunk>& out) {
+    if (length % cdc_entry_size != 0) return false;
+    for (size_t at = 0; at < length; at += cdc_entry_size) {
+        cdc_chunk chunk;
+        chunk.offset = next_offset;
+        chunk.length = get_u32(data + at);
+        chunk.digest = { get_u64(data + at + 4), get_u64(data + at + 12) };
+        if (chunk.length == 0) return false;
+        next_offset += chunk.length;
+        out.push_back(chunk);
+    }
+    return true;
+}
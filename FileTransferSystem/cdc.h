@@ -0,0 +1,39 @@
+﻿#pragma once
+
+#include <rtc/rtc.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "hashing.h"
+#include "source.h"
+
+// FastCDC 방식의 내용 기반 청크 나누기.
+// gear 해시 fp = (fp << 1) + gear[byte] 는 마지막 64 바이트에만 좌우되므로, 앞쪽에 바이트가 끼어들거나 빠져도
+// 그 뒤의 경계는 같은 내용 위에 다시 생긴다. 고정 크기 블록과 달리 편집 뒤쪽의 청크가 모두 그대로 남는다.
+// 평균 크기 전에는 더 많은 비트를, 뒤에는 더 적은 비트를 보는 정규화로 청크 크기를 평균 근처에 모은다.
+struct cdc_params {
+    size_t min_size = 16 << 10;
+    size_t avg_size = 64 << 10; // 2 의 거듭제곱
+    size_t max_size = 256 << 10;
+};
+
+struct cdc_chunk {
+    uint64_t offset = 0;
+    uint32_t length = 0;
+    file_digest digest; // chunk_digest
+};
+
+// data 가 청크 시작이라고 보고 첫 청크의 길이를 돌려준다.
+// length 가 max_size 보다 짧으면 그 뒤가 파일 끝이라고 보고, 경계가 없으면 length 를 돌려준다
+size_t cdc_cut(const std::byte* data, size_t length, const cdc_params& params = {});
+
+// source 전체를 청크로 나눈다. hasher 가 있으면 읽는 김에 파일 다이제스트도 계산한다
+std::vector<cdc_chunk> cdc_split(chunk_source& source, const cdc_params& params = {}, tree_hasher* hasher = nullptr);
+
+// 청크 목록 메시지: 항목마다 length(u32) + digest(u64 low, u64 high). offset 은 앞 항목들의 길이 합이다
+constexpr size_t cdc_entry_size = 20;
+
+void append_cdc_chunks(const cdc_chunk* entries, size_t count, rtc::binary& out);
+// next_offset 에서 시작해 항목마다 offset 을 매기고 다음 offset 으로 옮긴다
+bool parse_cdc_chunks(const std::byte* data, size_t length, uint64_t& next_offset, std::vector<cdc_chunk>& out);
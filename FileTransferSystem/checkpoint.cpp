@@ -0,0 +1,83 @@
+﻿#include "checkpoint.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// 파일 형식: "FTSP" | version u32 | file_size u64 | block u32 | bitmap
+static const char checkpoint_magic[4] = { 'F', 'T', 'S', 'P' };
+static const uint32_t checkpoint_version = 1;
+
+fs::path checkpoint_path(const fs::path& file) {
+    fs::path p = file;
+    p += ".fts-part";
+    return p;
+}
+
+bool load_checkpoint(const fs::path& path, uint64_t file_size, range_set& have) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+
+    char magic[4];
+    uint32_t version = 0, block = 0;
+    uint64_t size = 0;
+    in.read(magic, 4);
+    in.read(reinterpret_cast<char*>(&version), sizeof(version));
+    in.read(reinterpret_cast<char*>(&size), sizeof(size));
+    in.read(reinterpret_cast<char*>(&block), sizeof(block));
+    if (!in || std::memcmp(magic, checkpoint_magic, 4) != 0 || version != checkpoint_version ||
+        size != file_size || block == 0)
+        return false;
+
+    uint64_t blocks = (size + block - 1) / block;
+    std::vector<uint8_t> bitmap(static_cast<size_t>((blocks + 7) / 8));
+    in.read(reinterpret_cast<char*>(bitmap.data()), bitmap.size());
+    if (in.gcount() != static_cast<std::streamsize>(bitmap.size())) return false;
+
+    have.clear();
+    for (uint64_t i = 0; i < blocks; ++i) {
+        if (bitmap[i / 8] & (1u << (i % 8)))
+            have.add(i * block, std::min<uint64_t>((i + 1) * block, size));
+    }
+    return true;
+}
+
+bool save_checkpoint(const fs::path& path, uint64_t file_size, const range_set& written) {
+    uint64_t blocks = (file_size + checkpoint_block - 1) / checkpoint_block;
+    std::vector<uint8_t> bitmap(static_cast<size_t>((blocks + 7) / 8), 0);
+    for (const auto& r : written.to_vector()) {
+        // 구간에 완전히 들어가는 블록만 표시한다
+        uint64_t first = (r.first + checkpoint_block - 1) / checkpoint_block;
+        for (uint64_t i = first; i < blocks; ++i) {
+            uint64_t end = std::min<uint64_t>((i + 1) * checkpoint_block, file_size);
+            if (end > r.second) break;
+            bitmap[i / 8] |= static_cast<uint8_t>(1u << (i % 8));
+        }
+    }
+
+    // 중간에 죽어도 이전 체크포인트가 남도록 임시 파일에 쓰고 바꿔 끼운다
+    fs::path tmp = path;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        uint32_t block = checkpoint_block;
+        out.write(checkpoint_magic, 4);
+        out.write(reinterpret_cast<const char*>(&checkpoint_version), sizeof(checkpoint_version));
+        out.write(reinterpret_cast<const char*>(&file_size), sizeof(file_size));
+        out.write(reinterpret_cast<const char*>(&block), sizeof(block));
+        out.write(reinterpret_cast<const char*>(bitmap.data()), bitmap.size());
+        if (!out) return false;
+    }
+    std::error_code ec;
+    fs::rename(tmp, path, ec);
+    return !ec;
+}
+
+void remove_checkpoint(const fs::path& path) {
+    std::error_code ec;
+    fs::remove(path, ec);
+}
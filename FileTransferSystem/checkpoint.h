@@ -0,0 +1,17 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <filesystem>
+
+#include "ranges.h"
+
+// 받다 만 파일 옆에 두는 이어받기 정보(<이름>.fts-part).
+// checkpoint_block 단위 비트맵으로, 블록 전체가 디스크에 쓰인 경우만 1 이다.
+constexpr uint32_t checkpoint_block = 64 << 10;
+
+std::filesystem::path checkpoint_path(const std::filesystem::path& file);
+
+// 저장된 크기가 file_size 와 같을 때만 have 를 채우고 true
+bool load_checkpoint(const std::filesystem::path& path, uint64_t file_size, range_set& have);
+bool save_checkpoint(const std::filesystem::path& path, uint64_t file_size, const range_set& written);
+void remove_checkpoint(const std::filesystem::path& path);
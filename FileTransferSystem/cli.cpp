@@ -0,0 +1,416 @@
+﻿#include <rtc/rtc.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hashing.h"
+#include "log.h"
+#include "session.h"
+#include "shaper.h"
+#include "signaling.h"
+
+namespace fs = std::filesystem;
+
+// 창 없이 돌리는 전송기. GUI 와 같은 세션/송수신 엔진을 쓰고 시그널링만 파일이나 표준 입출력으로 한다.
+//
+//   fts send [옵션] <경로>...       파일 하나, 폴더, 또는 여러 경로를 한 세션으로 보낸다
+//   fts recv [옵션] [받을 폴더]     기본은 ./Download
+//   fts serve [옵션] [내놓을 폴더]  지속 연결로 폴더를 내놓는다. 기본은 ./Upload. 끊기면 다시 연결하며 끌 때까지 돈다
+//   fts pull [옵션] <이름>...        지속 연결 하나로 내놓는측의 항목들을 차례로 받고, 항목마다 첫 바이트 시간을 쓴다
+//
+//   --signal stdio                 SDP 를 stdout 에 한 줄로 쓰고 stdin 에서 상대 줄을 읽는다 (기본)
+//   --signal file:<out>,<in>       <out> 에 SDP 를 쓰고 <in> 파일이 생기기를 기다린다
+//   --channels N  --read stream|mmap|async  --compress off|auto|on
+//   --chunk auto|<크기>            auto 면 링크에 맞춰 고른다 (기본). 64K 처럼 K/M 을 붙일 수 있다
+//   --peers N                      같은 내용을 N 명에게 보낸다. 파일은 한 번만 읽는다 (stdio 시그널링만)
+//   --seed                         (send) 파일 하나를 스웜 송신자로 내놓는다. 시작할 때 다이제스트를 stderr 에 쓴다
+//   --dedup                        (recv) 받을 폴더의 파일들에 이미 있는 청크는 받지 않는다
+//   --lossy                        (send) 데이터 채널을 재전송 없이 열고 빠진 청크만 다시 보낸다. 손실과 지연이 큰 링크용
+//   --fec N                        (send, --lossy) 청크 N 개마다 XOR 패리티를 보내 하나가 빠지면 재전송 없이 되살린다
+//   --rate <크기>                  (send, serve) 초당 이만큼만 보낸다. --peers 로 여럿에게 보내도 합쳐서 이만큼이다
+//   --swarm <다이제스트>           (recv) --peers 명의 송신자에게서 나눠 받는다 (stdio 시그널링만)
+//   --into <폴더>                  (pull) 받을 폴더. 기본은 ./Download
+//   --list                         (pull) 내놓는측의 목록을 stderr 에 쓴다. 이름이 없으면 목록만 보고 끝난다
+//   --stun <url>  --no-stun
+//   --verbose                      debug 로그도 stderr 에 쓴다
+//   --metrics <file>               1 초마다 지표를 쓴다 (.prom 이면 Prometheus 텍스트, 아니면 JSON)
+//
+// 세션이 모두 끝나면 0, 하나라도 실패하면 1 로 끝난다. 스웜 수신은 파일을 다 받았으면 0 이다.
+// pull 은 요청한 항목을 모두 받았으면 0 이다.
+
+namespace {
+
+void usage() {
+    std::cerr << "usage: fts send [options] <path>...\n"
+                 "       fts recv [options] [download dir]\n"
+                 "       fts serve [options] [upload dir]\n"
+                 "       fts pull [options] [--into <dir>] [--list] <name>...\n"
+                 "options:\n"
+                 "  --signal stdio | file:<out>,<in>\n"
+                 "  --channels N\n"
+                 "  --read stream|mmap|async\n"
+                 "  --compress off|auto|on\n"
+                 "  --chunk auto|<bytes>[K|M]\n"
+                 "  --peers N (stdio signaling)\n"
+                 "  --seed (send, single file)\n"
+                 "  --swarm <digest> (recv, with --peers)\n"
+                 "  --dedup (recv)\n"
+                 "  --lossy [--fec N] (send)\n"
+                 "  --rate <bytes>[K|M] (send, serve; per second)\n"
+                 "  --stun <url> | --no-stun\n"
+                 "  --metrics <file>\n"
+                 "  --verbose\n";
+}
+
+bool parse_source(const std::string& text, source_kind& out) {
+    for (source_kind kind : { source_kind::stream, source_kind::mmap, source_kind::async }) {
+        if (text == source_kind_name(kind)) {
+            out = kind;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parse_compression(const std::string& text, compression_mode& out) {
+    for (compression_mode mode : { compression_mode::off, compression_mode::automatic, compression_mode::always }) {
+        if (text == compression_mode_name(mode)) {
+            out = mode;
+            return true;
+        }
+    }
+    return false;
+}
+
+// 64K, 8M 처럼 K/M 을 붙일 수 있는 0 이 아닌 바이트 수
+bool parse_size(const std::string& text, size_t& out) {
+    char* end = nullptr;
+    unsigned long long value = std::strtoull(text.c_str(), &end, 10);
+    if (end == text.c_str()) return false;
+    switch (*end) {
+    case 'K': case 'k': value <<= 10; ++end; break;
+    case 'M': case 'm': value <<= 20; ++end; break;
+    }
+    if (*end != '\0' || value == 0) return false;
+    out = static_cast<size_t>(value);
+    return true;
+}
+
+// "auto" 는 0 (chunk_tuner 가 고른다)
+bool parse_chunk(const std::string& text, size_t& out) {
+    if (text == "auto") {
+        out = 0;
+        return true;
+    }
+    return parse_size(text, out);
+}
+
+std::unique_ptr<signaling> make_signaling(const std::string& spec) {
+    if (spec == "stdio") return std::make_unique<stdio_signaling>();
+    if (spec.rfind("file:", 0) == 0) {
+        std::string paths = spec.substr(5);
+        size_t comma = paths.find(',');
+        if (comma == std::string::npos || comma == 0 || comma + 1 == paths.size()) return nullptr;
+        return std::make_unique<file_signaling>(fs::u8path(paths.substr(0, comma)), fs::u8path(paths.substr(comma + 1)));
+    }
+    return nullptr;
+}
+
+// 경로 하나면 그 부모를 기준으로, 여러 개면 현재 폴더를 기준으로 묶는다
+bool split_send_paths(const std::vector<std::string>& args, fs::path& base, std::vector<std::string>& names) {
+    if (args.size() == 1) {
+        fs::path path = fs::absolute(fs::u8path(args.front())).lexically_normal();
+        if (!path.has_filename()) path = path.parent_path(); // "dir/" 처럼 끝에 구분자가 있을 때
+        base = path.parent_path();
+        names.push_back(path.filename().u8string());
+        return true;
+    }
+    base = fs::current_path();
+    for (const std::string& arg : args) {
+        fs::path relative = fs::absolute(fs::u8path(arg)).lexically_normal().lexically_relative(base);
+        if (relative.empty() || *relative.begin() == "..") {
+            std::cerr << "fts: " << arg << " is outside the current directory\n";
+            return false;
+        }
+        names.push_back(relative.generic_u8string());
+    }
+    return true;
+}
+
+void print_log(const log_record& record) {
+    std::string line = format_log_record(record);
+    if (record.level >= log_level::warning) line = std::string(log_level_name(record.level)) + ": " + line;
+    line += '\n';
+    std::fwrite(line.data(), 1, line.size(), stderr);
+}
+
+// --verbose 가 없으면 debug 줄은 보이지 않는다
+void print_log_quiet(const log_record& record) {
+    if (record.level != log_level::debug) print_log(record);
+}
+
+// 수집기가 반쯤 쓴 파일을 읽지 않도록 임시 파일에 쓰고 바꿔치기한다
+void write_metrics(const fs::path& path, const session_manager& sessions) {
+    auto snapshot = sessions.metrics().snapshot();
+    fs::path temp = path;
+    temp += ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        out << (path.extension() == ".prom" ? metrics_to_prometheus(snapshot) : metrics_to_json(snapshot));
+    }
+    std::error_code ec;
+    fs::rename(temp, path, ec);
+}
+
+// 지속 연결 하나로 names 를 차례로 받는다. 두 번째부터는 SDP 교환과 ICE 를 건너뛰므로 첫 바이트가 빨리 온다
+bool run_pull(session_manager& sessions, uint64_t id, const std::vector<std::string>& names, bool list,
+              const std::string& metrics_path) {
+    std::shared_ptr<peer_link> link = sessions.link(id);
+    if (!link) return false;
+    int ticks = 0;
+    auto tick = [&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        if (++ticks % 20 == 0 && !metrics_path.empty()) write_metrics(fs::u8path(metrics_path), sessions);
+    };
+    while (!link->connected() || (list && !link->listed())) tick();
+    if (list) {
+        for (const remote_entry& e : link->remote_files())
+            std::cerr << (e.directory ? "d " : "f ") << e.size << '\t' << e.name << '\n';
+    }
+
+    bool ok = true;
+    for (const std::string& name : names) {
+        uint64_t pull = link->pull(name);
+        pull_info info;
+        for (;;) {
+            tick();
+            for (const pull_info& p : link->pulls()) {
+                if (p.id == pull) info = p;
+            }
+            if (info.state == pull_state::finished || info.state == pull_state::failed) break;
+        }
+        ok &= info.state == pull_state::finished;
+        std::cerr << name << ": " << pull_state_name(info.state) << ", first byte " << info.first_byte_ms
+                  << " ms, total " << info.done_ms << " ms\n";
+    }
+    if (!metrics_path.empty()) write_metrics(fs::u8path(metrics_path), sessions);
+    return ok;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        usage();
+        return 2;
+    }
+    std::string command = argv[1];
+    if (command != "send" && command != "recv" && command != "serve" && command != "pull") {
+        usage();
+        return 2;
+    }
+
+    std::string signal_spec = "stdio";
+    std::string stun = "stun:stun.l.google.com:19302";
+    std::string metrics_path;
+    bool verbose = false;
+    size_t peers = 1;
+    bool swarm = false;
+    bool list = false;
+    size_t rate = 0;
+    std::string into;
+    file_digest digest;
+    send_options options;
+    receive_options receive;
+    std::vector<std::string> positional;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--signal" && has_value) signal_spec = argv[++i];
+        else if (arg == "--stun" && has_value) stun = argv[++i];
+        else if (arg == "--no-stun") stun.clear();
+        else if (arg == "--metrics" && has_value) metrics_path = argv[++i];
+        else if (arg == "--verbose") verbose = true;
+        else if (arg == "--peers" && has_value) peers = static_cast<size_t>(std::max(1, std::atoi(argv[++i])));
+        else if (arg == "--seed") options.seed = true;
+        else if (arg == "--dedup") receive.dedup = true;
+        else if (arg == "--lossy") options.lossy = true;
+        else if (arg == "--list") list = true;
+        else if (arg == "--into" && has_value) into = argv[++i];
+        else if (arg == "--fec" && has_value) options.fec_group = static_cast<size_t>(std::max(0, std::atoi(argv[++i])));
+        else if (arg == "--swarm" && has_value) {
+            if (!file_digest::from_hex(argv[++i], digest)) {
+                usage();
+                return 2;
+            }
+            swarm = true;
+        }
+        else if (arg == "--channels" && has_value) options.channels = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--read" && has_value) {
+            if (!parse_source(argv[++i], options.source)) {
+                usage();
+                return 2;
+            }
+        }
+        else if (arg == "--chunk" && has_value) {
+            if (!parse_chunk(argv[++i], options.chunk_size)) {
+                usage();
+                return 2;
+            }
+        }
+        else if (arg == "--rate" && has_value) {
+            if (!parse_size(argv[++i], rate)) {
+                usage();
+                return 2;
+            }
+        }
+        else if (arg == "--compress" && has_value) {
+            if (!parse_compression(argv[++i], options.compression)) {
+                usage();
+                return 2;
+            }
+        }
+        else if (arg.rfind("--", 0) == 0) {
+            usage();
+            return 2;
+        }
+        else positional.push_back(arg);
+    }
+
+    std::unique_ptr<signaling> channel = make_signaling(signal_spec);
+    if (!channel || (command == "send" && positional.empty()) ||
+        ((command == "recv" || command == "serve") && positional.size() > 1) ||
+        (command == "pull" && positional.empty() && !list)) {
+        usage();
+        return 2;
+    }
+    // 지속 연결은 상대 하나와만 맺는다
+    bool persistent = command == "serve" || command == "pull";
+    if (persistent && (peers > 1 || swarm || options.seed)) {
+        usage();
+        return 2;
+    }
+    if ((list || !into.empty()) && command != "pull") {
+        usage();
+        return 2;
+    }
+    // 파일 시그널링은 한 파일을 덮어쓰므로 Offer 를 여러 개 내보낼 수 없다
+    if (peers > 1 && signal_spec != "stdio") {
+        usage();
+        return 2;
+    }
+    // 수신은 스웜일 때만 여러 세션을 연다. 스웜 송신자는 파일 하나만 내놓는다
+    if ((command == "recv" && peers > 1 && !swarm) || (swarm && command != "recv") ||
+        (options.seed && (command != "send" || positional.size() != 1 || fs::is_directory(fs::u8path(positional.front()))))) {
+        usage();
+        return 2;
+    }
+    if (rate > 0 && command != "send" && command != "serve") {
+        usage();
+        return 2;
+    }
+    // 팬아웃 세션들이 흐름 하나를 나눠 쓰므로 합친 속도가 rate 를 넘지 않는다
+    std::shared_ptr<bandwidth_shaper> shaper;
+    if (rate > 0) {
+        shaper = bandwidth_shaper::create(static_cast<double>(rate));
+        options.flow = shaper->add_flow();
+    }
+
+    set_log_sink(verbose ? print_log : print_log_quiet);
+
+    rtc::InitLogger(rtc::LogLevel::Warning);
+    rtc::Configuration config;
+    if (!stun.empty()) config.iceServers.emplace_back(stun);
+
+    std::promise<session_state> done;
+    std::future<session_state> result = done.get_future();
+    std::mutex ended_mutex;
+    size_t ended = 0;
+    bool any_failed = false;
+    bool any_finished = false;
+
+    int code = 1;
+    {
+        session_manager sessions(config);
+        sessions.set_on_state([&](uint64_t, session_state state) {
+            if (state != session_state::finished && state != session_state::failed) return;
+            std::lock_guard<std::mutex> lock(ended_mutex);
+            any_failed |= state == session_state::failed;
+            any_finished |= state == session_state::finished;
+            // 스웜은 중간에 송신자가 떨어져도 나머지에게서 다 받았으면 성공이다
+            bool ok = swarm ? any_finished : !any_failed;
+            if (++ended == peers) done.set_value(ok ? session_state::finished : session_state::failed);
+        });
+        connect_signaling(sessions, *channel);
+
+        uint64_t id = 0;
+        if (command == "send") {
+            fs::path base;
+            std::vector<std::string> names;
+            if (options.seed) {
+                file_digest seed_digest;
+                if (digest_file(fs::u8path(positional.front()), seed_digest))
+                    add_log(u8"[seed] 다이제스트: " + seed_digest.to_hex());
+            }
+            if (split_send_paths(positional, base, names)) {
+                if (peers > 1) {
+                    auto ids = sessions.start_fanout(base, names, options, peers);
+                    if (!ids.empty()) id = ids.front();
+                }
+                else {
+                    id = sessions.start_send_paths(base, names, options);
+                }
+            }
+        }
+        else if (command == "serve") {
+            fs::path dir = positional.empty() ? fs::current_path() / "Upload" : fs::u8path(positional.front());
+            if (fs::is_directory(dir)) id = sessions.start_link_host(dir, options);
+            else std::cerr << "fts: " << dir.u8string() << " is not a directory\n";
+        }
+        else if (command == "pull") {
+            fs::path dir = into.empty() ? fs::current_path() / "Download" : fs::u8path(into);
+            std::error_code ec;
+            fs::create_directories(dir, ec);
+            id = sessions.start_link_client(dir, receive);
+            add_log(u8"[link] Offer 를 기다리는 중...");
+        }
+        else {
+            fs::path dir = positional.empty() ? fs::current_path() / "Download" : fs::u8path(positional.front());
+            std::error_code ec;
+            fs::create_directories(dir, ec);
+            if (swarm) {
+                auto ids = sessions.start_swarm(dir, digest, peers);
+                if (!ids.empty()) id = ids.front();
+                add_log(u8"[recv] 송신자 " + std::to_string(peers) + u8"명의 Offer 를 기다리는 중...");
+            }
+            else {
+                id = sessions.start_receive(dir, receive);
+                add_log(u8"[recv] Offer 를 기다리는 중...");
+            }
+        }
+
+        if (id != 0 && command == "pull") {
+            code = run_pull(sessions, id, positional, list, metrics_path) ? 0 : 1;
+            sessions.stop(id);
+        }
+        else if (id != 0) {
+            while (result.wait_for(std::chrono::seconds(1)) != std::future_status::ready) {
+                if (!metrics_path.empty()) write_metrics(fs::u8path(metrics_path), sessions);
+            }
+            if (!metrics_path.empty()) write_metrics(fs::u8path(metrics_path), sessions);
+            code = result.get() == session_state::finished ? 0 : 1;
+        }
+    }
+    set_log_sink(nullptr);
+    return code;
+}
@@ -0,0 +1,102 @@
+﻿#include "codec.h"
+#include "protocol.h"
+
+#include <lz4.h>
+
+const char* compression_mode_name(compression_mode mode) {
+    switch (mode) {
+    case compression_mode::off: return "off";
+    case compression_mode::automatic: return "auto";
+    case compression_mode::always: return "on";
+    }
+    return "?";
+}
+
+bool chunk_compressor::should_try(bool link_idle) {
+    if (mode_ == compression_mode::off) return false;
+    if (mode_ == compression_mode::always) return true;
+
+    // 링크가 연달아 비어 있으면 압축 때문에 못 채우고 있는 것이다
+    if (link_idle) {
+        if (++idle_streak_ >= sample_chunks) {
+            idle_streak_ = 0;
+            skip_left_ = skip_chunks;
+        }
+    }
+    else {
+        idle_streak_ = 0;
+    }
+
+    if (skip_left_ > 0) {
+        if (--skip_left_ == 0) sample_left_ = sample_chunks; // 다시 표본을 뜬다
+        return false;
+    }
+    return true;
+}
+
+void chunk_compressor::record_sample(size_t raw, size_t packed) {
+    if (mode_ != compression_mode::automatic || sample_left_ <= 0) return;
+    sample_raw_ += raw;
+    sample_packed_ += packed;
+    if (--sample_left_ > 0) return;
+
+    // 표본 전체가 stored_ratio 만큼도 안 줄면 한동안 압축하지 않는다
+    if (sample_packed_ >= sample_raw_ * stored_ratio) skip_left_ = skip_chunks;
+    sample_raw_ = 0;
+    sample_packed_ = 0;
+}
+
+void chunk_compressor::encode(rtc::binary& message, bool link_idle) {
+    chunk_header header;
+    if (!read_chunk_header(message, header) || header.type != message_type::data) return;
+    raw_bytes_ += header.length;
+
+    if (header.length == 0 || !should_try(link_idle)) {
+        wire_bytes_ += header.length;
+        ++stored_chunks_;
+        return;
+    }
+
+    const char* raw = reinterpret_cast<const char*>(message.data() + chunk_header_size);
+    int bound = LZ4_compressBound(static_cast<int>(header.length));
+    rtc::binary packed(chunk_header_size + static_cast<size_t>(bound));
+    int n = LZ4_compress_default(raw, reinterpret_cast<char*>(packed.data() + chunk_header_size),
+                                 static_cast<int>(header.length), bound);
+
+    size_t packed_size = n > 0 ? static_cast<size_t>(n) : header.length;
+    record_sample(header.length, packed_size);
+
+    if (n <= 0 || packed_size >= header.length * stored_ratio) {
+        wire_bytes_ += header.length;
+        ++stored_chunks_;
+        return;
+    }
+
+    header.flags |= chunk_flag_compressed;
+    header.raw_length = header.length;
+    header.length = static_cast<uint32_t>(packed_size);
+    packed.resize(chunk_header_size + packed_size);
+    write_chunk_header(packed.data(), header);
+    message.swap(packed);
+
+    wire_bytes_ += packed_size;
+    ++compressed_chunks_;
+}
+
+compression_stats chunk_compressor::stats() const {
+    compression_stats s;
+    s.raw_bytes = raw_bytes_;
+    s.wire_bytes = wire_bytes_;
+    s.compressed_chunks = compressed_chunks_;
+    s.stored_chunks = stored_chunks_;
+    return s;
+}
+
+bool decode_chunk(const std::byte* data, size_t length, size_t raw_length, rtc::binary& out) {
+    // LZ4 는 입력 1 바이트로 최대 255 바이트를 만든다
+    if (raw_length > max_decoded_chunk || raw_length / 255 > length) return false;
+    out.resize(raw_length);
+    int n = LZ4_decompress_safe(reinterpret_cast<const char*>(data), reinterpret_cast<char*>(out.data()),
+                                static_cast<int>(length), static_cast<int>(raw_length));
+    return n >= 0 && static_cast<size_t>(n) == raw_length;
+}
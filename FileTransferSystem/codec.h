@@ -0,0 +1,63 @@
+﻿#pragma once
+
+#include <rtc/rtc.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+enum class compression_mode {
+    off,
+    automatic, // 표본 청크의 압축률과 CPU/링크 상황을 보고 켜고 끈다
+    always,
+};
+
+const char* compression_mode_name(compression_mode mode);
+
+struct compression_stats {
+    uint64_t raw_bytes = 0;        // 압축 대상이 된 원본 바이트
+    uint64_t wire_bytes = 0;       // 실제로 나간 본문 바이트
+    uint64_t compressed_chunks = 0;
+    uint64_t stored_chunks = 0;
+};
+
+// 송신 청크를 LZ4 로 압축할지 정하고 압축한다. 여러 채널 스레드에서 동시에 불러도 된다.
+//  - 압축해도 stored_ratio 이상 남으면 그대로 보낸다 (flags 에 표시 없음)
+//  - automatic: sample_chunks 개를 압축해 보고 거의 줄지 않으면 skip_chunks 개 동안 압축을 쉰다.
+//    링크가 비어 있는데도(bufferedAmount == 0) 압축 중이면 CPU 가 병목이므로 역시 쉰다.
+class chunk_compressor {
+public:
+    static constexpr double stored_ratio = 0.95;
+    static constexpr int sample_chunks = 8;
+    static constexpr int skip_chunks = 256;
+
+    explicit chunk_compressor(compression_mode mode) : mode_(mode) {}
+
+    // message 는 헤더 + 원본 본문. 압축이 이득이면 제자리에서 압축본으로 바꾼다. data 가 아닌 메시지는 그대로 둔다.
+    // link_idle 은 보내기 직전 채널이 완전히 비어 있었는지 여부
+    void encode(rtc::binary& message, bool link_idle);
+
+    compression_stats stats() const;
+
+private:
+    bool should_try(bool link_idle);
+    void record_sample(size_t raw, size_t packed);
+
+    compression_mode mode_;
+    std::atomic<int> skip_left_{ 0 };
+    std::atomic<int> sample_left_{ sample_chunks };
+    std::atomic<uint64_t> sample_raw_{ 0 };
+    std::atomic<uint64_t> sample_packed_{ 0 };
+    std::atomic<int> idle_streak_{ 0 };
+
+    std::atomic<uint64_t> raw_bytes_{ 0 };
+    std::atomic<uint64_t> wire_bytes_{ 0 };
+    std::atomic<uint64_t> compressed_chunks_{ 0 };
+    std::atomic<uint64_t> stored_chunks_{ 0 };
+};
+
+// 풀었을 때 청크 본문의 상한. 청크는 메시지 하나에 실리므로 SCTP 최대 메시지 크기를 넘지 않는다
+constexpr size_t max_decoded_chunk = 16 << 20;
+
+// 압축된 청크 본문을 raw_length 바이트로 푼다. 실패하면 false.
+// raw_length 는 상대가 보낸 값이므로 max_decoded_chunk 나 LZ4 가 만들 수 있는 길이를 넘으면 할당 전에 거절한다
+bool decode_chunk(const std::byte* data, size_t length, size_t raw_length, rtc::binary& out);
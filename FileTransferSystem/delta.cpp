@@ -0,0 +1,161 @@
+﻿#include "delta.h"
+#include "protocol.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+size_t delta_block_size(uint64_t old_size) {
+    size_t block = 2048;
+    size_t target = static_cast<size_t>(std::sqrt(static_cast<double>(old_size)));
+    while (block < target && block < (64u << 10)) block <<= 1;
+    return block;
+}
+
+uint32_t weak_checksum(const std::byte* data, size_t length) {
+    uint32_t a = 0, b = 0;
+    for (size_t i = 0; i < length; ++i) {
+        uint32_t x = std::to_integer<uint32_t>(data[i]);
+        a += x;
+        b += static_cast<uint32_t>(length - i) * x;
+    }
+    return (a & 0xFFFF) | ((b & 0xFFFF) << 16);
+}
+
+std::vector<block_signature> compute_signatures(const file_io& file, uint64_t size, size_t block) {
+    std::vector<block_signature> out;
+    std::vector<std::byte> buffer(block);
+    for (uint64_t offset = 0; offset + block <= size; offset += block) {
+        if (file.pread(buffer.data(), block, offset) != block) break;
+        out.push_back({ weak_checksum(buffer.data(), block), chunk_hash(buffer.data(), block) });
+    }
+    return out;
+}
+
+delta_plan compute_delta(chunk_source& source, const std::vector<block_signature>& signatures, size_t block,
+                         tree_hasher* hasher) {
+    const size_t read_size = 4 << 20;
+    const uint64_t size = source.size();
+    delta_plan plan;
+
+    std::unordered_multimap<uint32_t, uint32_t> index;
+    index.reserve(signatures.size());
+    for (uint32_t i = 0; i < signatures.size(); ++i) index.emplace(signatures[i].weak, i);
+
+    // buffer[0] 은 파일의 base 위치. pos 앞쪽은 필요 없으므로 가끔 잘라 낸다
+    rtc::binary buffer;
+    uint64_t base = 0;
+    uint64_t pos = 0;
+    auto ensure = [&](uint64_t end) {
+        if (base + buffer.size() >= end) return true;
+        if (pos - base > read_size) {
+            buffer.erase(buffer.begin(), buffer.begin() + static_cast<ptrdiff_t>(pos - base));
+            base = pos;
+        }
+        uint64_t from = base + buffer.size();
+        size_t want = static_cast<size_t>(std::min<uint64_t>(std::max<uint64_t>(end - from, read_size), size - from));
+        size_t before = buffer.size();
+        source.append(from, want, buffer);
+        if (hasher) hasher->update(buffer.data() + before, buffer.size() - before);
+        return base + buffer.size() >= end;
+    };
+
+    uint64_t literal_start = 0;
+    bool rolling = false;
+    uint32_t a = 0, b = 0;
+
+    while (!index.empty() && pos + block <= size) {
+        if (!ensure(pos + block)) break;
+        const std::byte* window = buffer.data() + (pos - base);
+
+        if (!rolling) {
+            a = b = 0;
+            for (size_t i = 0; i < block; ++i) {
+                uint32_t x = std::to_integer<uint32_t>(window[i]);
+                a += x;
+                b += static_cast<uint32_t>(block - i) * x;
+            }
+            rolling = true;
+        }
+
+        uint32_t weak = (a & 0xFFFF) | ((b & 0xFFFF) << 16);
+        auto candidates = index.equal_range(weak);
+        if (candidates.first != candidates.second) {
+            uint64_t strong = chunk_hash(window, block);
+            bool matched = false;
+            for (auto it = candidates.first; it != candidates.second; ++it) {
+                if (signatures[it->second].strong != strong) continue;
+
+                if (literal_start < pos) plan.literals.add(literal_start, pos);
+                uint64_t src = static_cast<uint64_t>(it->second) * block;
+                delta_copy* last = plan.copies.empty() ? nullptr : &plan.copies.back();
+                if (last && last->dst + last->length == pos && last->src + last->length == src &&
+                    last->length <= UINT32_MAX - block) {
+                    last->length += static_cast<uint32_t>(block); // 이어지는 블록은 한 명령으로 합친다
+                }
+                else {
+                    plan.copies.push_back({ pos, src, static_cast<uint32_t>(block) });
+                }
+                plan.copied_bytes += block;
+                pos += block;
+                literal_start = pos;
+                rolling = false;
+                matched = true;
+                break;
+            }
+            if (matched) continue;
+        }
+
+        // 한 바이트 굴린다
+        if (pos + block < size) {
+            if (!ensure(pos + block + 1)) break;
+            window = buffer.data() + (pos - base);
+            uint32_t out = std::to_integer<uint32_t>(window[0]);
+            uint32_t in = std::to_integer<uint32_t>(window[block]);
+            a = a - out + in;
+            b = b - static_cast<uint32_t>(block) * out + a;
+        }
+        ++pos;
+    }
+
+    if (literal_start < size) plan.literals.add(literal_start, size);
+    // 남은 꼬리도 다이제스트에 넣는다
+    while (hasher && base + buffer.size() < size) {
+        pos = base + buffer.size();
+        if (!ensure(std::min<uint64_t>(size, pos + read_size))) break;
+    }
+    return plan;
+}
+
+void append_signatures(const block_signature* entries, size_t count, rtc::binary& out) {
+    size_t at = out.size();
+    out.resize(at + count * signature_entry_size);
+    for (size_t i = 0; i < count; ++i, at += signature_entry_size) {
+        put_u32(out.data() + at, entries[i].weak);
+        put_u64(out.data() + at + 4, entries[i].strong);
+    }
+}
+
+bool parse_signatures(const std::byte* data, size_t length, std::vector<block_signature>& out) {
+    if (length % signature_entry_size != 0) return false;
+    for (size_t at = 0; at < length; at += signature_entry_size)
+        out.push_back({ get_u32(data + at), get_u64(data + at + 4) });
+    return true;
+}
+
+void append_copies(const delta_copy* entries, size_t count, rtc::binary& out) {
+    size_t at = out.size();
+    out.resize(at + count * copy_entry_size);
+    for (size_t i = 0; i < count; ++i, at += copy_entry_size) {
+        put_u64(out.data() + at, entries[i].dst);
+        put_u64(out.data() + at + 8, entries[i].src);
+        put_u32(out.data() + at + 16, entries[i].length);
+    }
+}
+
+bool parse_copies(const std::byte* data, size_t length, std::vector<delta_copy>& out) {
+    if (length % copy_entry_size != 0) return false;
+    for (size_t at = 0; at < length; at += copy_entry_size)
+        out.push_back({ get_u64(data + at), get_u64(data + at + 8), get_u32(data + at + 16) });
+    return true;
+}
@@ -0,0 +1,52 @@
+﻿#pragma once
+
+#include <rtc/rtc.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "fileio.h"
+#include "hashing.h"
+#include "ranges.h"
+#include "source.h"
+
+// rsync 방식 델타 전송.
+// 수신측이 가진 옛 파일을 block 크기로 잘라 서명(약한 롤링 체크섬 + XXH3)을 보내면,
+// 송신측은 새 파일을 한 바이트씩 굴려 가며 같은 블록을 찾아 "복사" 명령으로 바꾸고 나머지만 보낸다.
+
+struct block_signature {
+    uint32_t weak = 0;
+    uint64_t strong = 0;
+};
+
+// 옛 파일의 src 위치에서 length 바이트를 새 파일의 dst 위치로 복사한다
+struct delta_copy {
+    uint64_t dst = 0;
+    uint64_t src = 0;
+    uint32_t length = 0;
+};
+
+struct delta_plan {
+    std::vector<delta_copy> copies;
+    range_set literals;        // 실제로 보내야 하는 새 파일 구간
+    uint64_t copied_bytes = 0;
+};
+
+constexpr size_t signature_entry_size = 12;
+constexpr size_t copy_entry_size = 20;
+
+// 옛 파일 크기에 맞춘 블록 크기 (대략 sqrt(size), 2KB ~ 64KB)
+size_t delta_block_size(uint64_t old_size);
+
+uint32_t weak_checksum(const std::byte* data, size_t length);
+
+std::vector<block_signature> compute_signatures(const file_io& file, uint64_t size, size_t block);
+
+// 새 파일을 훑어 델타를 만든다. hasher 가 있으면 읽는 김에 파일 다이제스트도 계산한다.
+delta_plan compute_delta(chunk_source& source, const std::vector<block_signature>& signatures, size_t block,
+                         tree_hasher* hasher);
+
+void append_signatures(const block_signature* entries, size_t count, rtc::binary& out);
+bool parse_signatures(const std::byte* data, size_t length, std::vector<block_signature>& out);
+void append_copies(const delta_copy* entries, size_t count, rtc::binary& out);
+bool parse_copies(const std::byte* data, size_t length, std::vector<delta_copy>& out);
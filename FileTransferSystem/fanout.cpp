@@ -0,0 +1,204 @@
+﻿#include "fanout.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cstdio>
+
+class shared_chunk_cache::reader : public chunk_source {
+public:
+    reader(std::shared_ptr<shared_chunk_cache> cache, uint64_t id) : cache_(std::move(cache)), id_(id) {}
+    ~reader() override { cache_->close_reader(id_); }
+
+    uint64_t size() const override { return cache_->size_; }
+
+    size_t append(uint64_t offset, size_t length, rtc::binary& out) override {
+        return cache_->read(id_, offset, length, out);
+    }
+
+    uint64_t hole_end(uint64_t offset) override { return cache_->hole_end(id_, offset); }
+    uint64_t data_end(uint64_t offset) override { return cache_->data_end(offset); }
+
+private:
+    std::shared_ptr<shared_chunk_cache> cache_;
+    uint64_t id_;
+};
+
+std::shared_ptr<shared_chunk_cache> shared_chunk_cache::create(std::unique_ptr<chunk_source> source, size_t capacity) {
+    return std::shared_ptr<shared_chunk_cache>(new shared_chunk_cache(std::move(source), capacity));
+}
+
+shared_chunk_cache::shared_chunk_cache(std::unique_ptr<chunk_source> source, size_t capacity)
+    : source_(std::move(source)), size_(source_->size()), capacity_(std::max(capacity, block_size)) {
+    stats_.source_size = size_;
+}
+
+shared_chunk_cache::~shared_chunk_cache() {
+    stats_t s = stats();
+    char amplification[32];
+    std::snprintf(amplification, sizeof(amplification), "%.2f", s.read_amplification());
+    add_log(u8"팬아웃: 수신자 " + std::to_string(s.readers) + u8"명 (뒤처짐 " + std::to_string(s.detached) + u8"명), 디스크 읽기 " + std::to_string(s.disk_bytes) +
+            u8" bytes (원본의 " + amplification + u8"배), 보낸 합 " + std::to_string(s.served_bytes) + " bytes, " +
+            std::to_string(static_cast<uint64_t>(s.egress_bytes_per_s() / (1024 * 1024))) + " MB/s");
+}
+
+std::unique_ptr<chunk_source> shared_chunk_cache::open_reader() {
+    uint64_t id;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        id = next_reader_++;
+        cursors_.emplace(id, 0);
+        ++stats_.readers;
+    }
+    return std::make_unique<reader>(shared_from_this(), id);
+}
+
+shared_chunk_cache::stats_t shared_chunk_cache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_t s = stats_;
+    for (const auto& [index, data] : blocks_) s.cached_bytes += data->size();
+    s.seconds = std::chrono::duration<double>(last_read_ - first_read_).count();
+    return s;
+}
+
+// 블록 경계를 넘는 요청은 여러 블록에서 이어 붙인다
+size_t shared_chunk_cache::read(uint64_t reader_id, uint64_t offset, size_t length, rtc::binary& out) {
+    bool detached;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        detached = detached_.count(reader_id) != 0;
+    }
+    size_t total = 0;
+    while (total < length && offset < size_) {
+        uint64_t index = offset / block_size;
+        block data = find(index);
+        if (!data && detached) {
+            // 떨어져 나간 reader 는 캐시를 채우지 않고 필요한 만큼만 읽는다
+            size_t want = static_cast<size_t>(std::min<uint64_t>(length - total, (index + 1) * block_size - offset));
+            size_t n = read_direct(offset, want, out);
+            if (n == 0) break;
+            offset += n;
+            total += n;
+            continue;
+        }
+        if (!data) data = load(index);
+        size_t at = static_cast<size_t>(offset - index * block_size);
+        if (!data || at >= data->size()) break;
+        size_t n = std::min(length - total, data->size() - at);
+        out.insert(out.end(), data->begin() + at, data->begin() + at + n);
+        offset += n;
+        total += n;
+    }
+    advance(reader_id, offset, total);
+    return total;
+}
+
+shared_chunk_cache::block shared_chunk_cache::find(uint64_t index) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = blocks_.find(index);
+    if (it == blocks_.end()) return nullptr;
+    ++stats_.hits;
+    return it->second;
+}
+
+shared_chunk_cache::block shared_chunk_cache::load(uint64_t index) {
+    // 같은 블록을 여러 reader 가 동시에 놓쳤으면 먼저 잡은 쪽만 읽는다
+    std::lock_guard<std::mutex> source_lock(source_mutex_);
+    if (block data = find(index)) return data;
+
+    auto data = std::make_shared<rtc::binary>();
+    data->reserve(block_size);
+    source_->append(index * block_size, block_size, *data);
+    if (data->empty()) return nullptr;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.misses;
+    stats_.disk_bytes += data->size();
+    blocks_[index] = data;
+    trim_locked();
+    return data;
+}
+
+size_t shared_chunk_cache::read_direct(uint64_t offset, size_t length, rtc::binary& out) {
+    size_t n;
+    {
+        std::lock_guard<std::mutex> source_lock(source_mutex_);
+        n = source_->append(offset, length, out);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.misses;
+    stats_.disk_bytes += n;
+    return n;
+}
+
+// 구멍은 읽지 않고 건너뛰므로 커서도 같이 옮겨야 다른 reader 를 붙잡지 않는다
+uint64_t shared_chunk_cache::hole_end(uint64_t reader_id, uint64_t offset) {
+    uint64_t end;
+    {
+        std::lock_guard<std::mutex> source_lock(source_mutex_);
+        end = source_->hole_end(offset);
+    }
+    if (end > offset) advance(reader_id, end, 0);
+    return end;
+}
+
+uint64_t shared_chunk_cache::data_end(uint64_t offset) {
+    std::lock_guard<std::mutex> source_lock(source_mutex_);
+    return source_->data_end(offset);
+}
+
+void shared_chunk_cache::advance(uint64_t reader_id, uint64_t offset, size_t served) {
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (served > 0) {
+        if (stats_.served_bytes == 0) first_read_ = now;
+        last_read_ = now;
+        stats_.served_bytes += served;
+    }
+    auto it = cursors_.find(reader_id);
+    if (it != cursors_.end() && offset > it->second) it->second = offset;
+    trim_locked();
+}
+
+void shared_chunk_cache::close_reader(uint64_t reader_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cursors_.erase(reader_id);
+    detached_.erase(reader_id);
+    trim_locked();
+}
+
+// mutex_ 를 잡은 채로 부른다. 모두가 지나간 블록을 버리고, 그래도 넘치면 가장 느린 reader 를 떼어 낸다
+void shared_chunk_cache::trim_locked() {
+    for (;;) {
+        uint64_t slowest = size_;
+        uint64_t slowest_id = 0;
+        for (const auto& [id, cursor] : cursors_) {
+            if (cursor < slowest) {
+                slowest = cursor;
+                slowest_id = id;
+            }
+        }
+        size_t cached = 0;
+        for (auto it = blocks_.begin(); it != blocks_.end();) {
+            uint64_t end = std::min(size_, (it->first + 1) * block_size);
+            if (end <= slowest) {
+                it = blocks_.erase(it);
+            }
+            else {
+                cached += it->second->size();
+                ++it;
+            }
+        }
+        if (cached <= capacity_) return;
+        if (cursors_.size() <= 1) {
+            // 남은 reader 가 하나면 지금 읽는 블록 말고는 앞쪽부터 버린다
+            while (cached > capacity_ && blocks_.size() > 1) {
+                cached -= blocks_.begin()->second->size();
+                blocks_.erase(blocks_.begin());
+            }
+            return;
+        }
+        cursors_.erase(slowest_id);
+        detached_.insert(slowest_id);
+        ++stats_.detached;
+    }
+}
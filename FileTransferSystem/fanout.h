@@ -0,0 +1,77 @@
+﻿#pragma once
+
+#include <rtc/rtc.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+
+#include "source.h"
+
+// 한 파일을 여러 수신자에게 보낼 때 디스크에서 한 번만 읽도록 블록 단위로 나눠 갖는 캐시.
+// 수신자마다 open_reader() 로 받은 chunk_source 를 각자의 송신기가 자기 속도로 읽는다.
+// 블록은 살아 있는 모든 reader 가 지나간 뒤에 버린다. 가장 느린 reader 때문에 capacity 를 넘게 되면
+// 그 reader 를 캐시에서 떼어 내 원본을 직접 읽게 하므로, 느린 수신자가 빠른 수신자를 붙잡지 않는다.
+class shared_chunk_cache : public std::enable_shared_from_this<shared_chunk_cache> {
+public:
+    static constexpr size_t block_size = 1 << 20;
+    static constexpr size_t default_capacity = 64 << 20;
+
+    static std::shared_ptr<shared_chunk_cache> create(std::unique_ptr<chunk_source> source,
+                                                      size_t capacity = default_capacity);
+    // 마지막 reader 가 닫히면 풀리며 요약을 로그에 남긴다
+    ~shared_chunk_cache();
+
+    // reader 는 캐시를 잡고 있으므로 캐시보다 오래 살아도 된다
+    std::unique_ptr<chunk_source> open_reader();
+
+    struct stats_t {
+        uint64_t source_size = 0;
+        uint64_t disk_bytes = 0;    // 원본에서 읽은 양
+        uint64_t served_bytes = 0;  // reader 들에게 넘긴 양의 합
+        uint64_t hits = 0;          // 캐시에 있던 블록 요청
+        uint64_t misses = 0;        // 디스크에서 읽은 요청
+        size_t detached = 0;        // 뒤처져 캐시에서 떨어져 나간 reader 수
+        size_t readers = 0;         // 지금까지 연 reader 수
+        size_t cached_bytes = 0;
+        double seconds = 0;         // 첫 읽기 ~ 마지막 읽기
+
+        // 원본 크기 대비 디스크에서 읽은 양. 캐시가 없으면 수신자 수만큼 나온다
+        double read_amplification() const { return source_size ? static_cast<double>(disk_bytes) / source_size : 0; }
+        double egress_bytes_per_s() const { return seconds > 0 ? served_bytes / seconds : 0; }
+    };
+    stats_t stats() const;
+
+private:
+    class reader;
+    using block = std::shared_ptr<const rtc::binary>;
+
+    shared_chunk_cache(std::unique_ptr<chunk_source> source, size_t capacity);
+
+    size_t read(uint64_t reader_id, uint64_t offset, size_t length, rtc::binary& out);
+    block find(uint64_t index);
+    block load(uint64_t index);
+    size_t read_direct(uint64_t offset, size_t length, rtc::binary& out);
+    uint64_t hole_end(uint64_t reader_id, uint64_t offset);
+    uint64_t data_end(uint64_t offset);
+    void advance(uint64_t reader_id, uint64_t offset, size_t served);
+    void close_reader(uint64_t reader_id);
+    void trim_locked();
+
+    std::mutex source_mutex_; // 원본은 한 번에 한 스레드만 읽는다
+    std::unique_ptr<chunk_source> source_;
+    const uint64_t size_;
+    const size_t capacity_;
+
+    mutable std::mutex mutex_;
+    std::map<uint64_t, block> blocks_;      // 블록 번호 -> 내용
+    std::map<uint64_t, uint64_t> cursors_;  // 캐시를 쓰는 reader -> 읽은 가장 먼 오프셋
+    std::set<uint64_t> detached_;           // 뒤처져 원본을 직접 읽는 reader
+    uint64_t next_reader_ = 1;
+    stats_t stats_;
+    std::chrono::steady_clock::time_point first_read_;
+    std::chrono::steady_clock::time_point last_read_;
+};
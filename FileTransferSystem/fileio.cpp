@@ -0,0 +1,218 @@
+﻿#include "fileio.h"
+
+#include <algorithm>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#include <winioctl.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+file_io::~file_io() {
+    close();
+}
+
+#ifdef _WIN32
+
+bool file_io::open_read(const std::filesystem::path& path) {
+    close();
+    HANDLE h = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (h == INVALID_HANDLE_VALUE) return false;
+    handle_ = h;
+    return true;
+}
+
+bool file_io::open_write(const std::filesystem::path& path, bool truncate) {
+    close();
+    HANDLE h = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                           truncate ? CREATE_ALWAYS : OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE) return false;
+    handle_ = h;
+    return true;
+}
+
+void file_io::close() {
+    if (handle_) {
+        CloseHandle(static_cast<HANDLE>(handle_));
+        handle_ = nullptr;
+    }
+    sparse_ = false;
+}
+
+bool file_io::is_open() const {
+    return handle_ != nullptr;
+}
+
+uint64_t file_io::size() const {
+    LARGE_INTEGER li;
+    if (!handle_ || !GetFileSizeEx(static_cast<HANDLE>(handle_), &li)) return 0;
+    return static_cast<uint64_t>(li.QuadPart);
+}
+
+size_t file_io::pread(void* buffer, size_t length, uint64_t offset) const {
+    size_t total = 0;
+    while (total < length) {
+        OVERLAPPED ov = {};
+        uint64_t pos = offset + total;
+        ov.Offset = static_cast<DWORD>(pos);
+        ov.OffsetHigh = static_cast<DWORD>(pos >> 32);
+        DWORD want = static_cast<DWORD>(std::min<size_t>(length - total, 1u << 30));
+        DWORD got = 0;
+        if (!ReadFile(static_cast<HANDLE>(handle_), static_cast<char*>(buffer) + total, want, &got, &ov) || got == 0)
+            break;
+        total += got;
+    }
+    return total;
+}
+
+bool file_io::pwrite(const void* buffer, size_t length, uint64_t offset) {
+    size_t total = 0;
+    while (total < length) {
+        OVERLAPPED ov = {};
+        uint64_t pos = offset + total;
+        ov.Offset = static_cast<DWORD>(pos);
+        ov.OffsetHigh = static_cast<DWORD>(pos >> 32);
+        DWORD want = static_cast<DWORD>(std::min<size_t>(length - total, 1u << 30));
+        DWORD put = 0;
+        if (!WriteFile(static_cast<HANDLE>(handle_), static_cast<const char*>(buffer) + total, want, &put, &ov))
+            return false;
+        total += put;
+    }
+    return true;
+}
+
+// 할당 크기는 파일 처음부터 센다. 이미 구멍을 뚫은 성긴 파일은 구멍까지 채우게 되므로 잡지 않는다
+bool file_io::preallocate(uint64_t offset, uint64_t length) {
+    if (sparse_) return false;
+    FILE_ALLOCATION_INFO info = {};
+    info.AllocationSize.QuadPart = static_cast<LONGLONG>(offset + length);
+    return SetFileInformationByHandle(static_cast<HANDLE>(handle_), FileAllocationInfo, &info, sizeof(info)) != 0;
+}
+
+// 성긴 파일로 표시해 두면 파일 끝을 늘린 부분과 FSCTL_SET_ZERO_DATA 로 지운 부분이 구멍이 된다
+bool file_io::zero_range(uint64_t offset, uint64_t length) {
+    if (length == 0) return true;
+    HANDLE h = static_cast<HANDLE>(handle_);
+    DWORD ignored = 0;
+    if (!sparse_) sparse_ = DeviceIoControl(h, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &ignored, nullptr) != 0;
+
+    uint64_t size = this->size();
+    uint64_t end = offset + length;
+    if (end > size) {
+        FILE_END_OF_FILE_INFO eof = {};
+        eof.EndOfFile.QuadPart = static_cast<LONGLONG>(end);
+        if (!SetFileInformationByHandle(h, FileEndOfFileInfo, &eof, sizeof(eof))) return false;
+    }
+    uint64_t inside = std::min(end, size);
+    if (offset >= inside) return true;
+    if (sparse_) {
+        FILE_ZERO_DATA_INFORMATION zero = {};
+        zero.FileOffset.QuadPart = static_cast<LONGLONG>(offset);
+        zero.BeyondFinalZero.QuadPart = static_cast<LONGLONG>(inside);
+        if (DeviceIoControl(h, FSCTL_SET_ZERO_DATA, &zero, sizeof(zero), nullptr, 0, &ignored, nullptr)) return true;
+    }
+    return write_zeros(offset, inside - offset);
+}
+
+bool file_io::sync() {
+    return FlushFileBuffers(static_cast<HANDLE>(handle_)) != 0;
+}
+
+#else
+
+bool file_io::open_read(const std::filesystem::path& path) {
+    close();
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    return fd_ >= 0;
+}
+
+bool file_io::open_write(const std::filesystem::path& path, bool truncate) {
+    close();
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC | (truncate ? O_TRUNC : 0), 0644);
+    return fd_ >= 0;
+}
+
+void file_io::close() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool file_io::is_open() const {
+    return fd_ >= 0;
+}
+
+uint64_t file_io::size() const {
+    struct stat st;
+    if (fd_ < 0 || fstat(fd_, &st) != 0) return 0;
+    return static_cast<uint64_t>(st.st_size);
+}
+
+size_t file_io::pread(void* buffer, size_t length, uint64_t offset) const {
+    size_t total = 0;
+    while (total < length) {
+        ssize_t got = ::pread(fd_, static_cast<char*>(buffer) + total, length - total, static_cast<off_t>(offset + total));
+        if (got <= 0) break;
+        total += static_cast<size_t>(got);
+    }
+    return total;
+}
+
+bool file_io::pwrite(const void* buffer, size_t length, uint64_t offset) {
+    size_t total = 0;
+    while (total < length) {
+        ssize_t put = ::pwrite(fd_, static_cast<const char*>(buffer) + total, length - total, static_cast<off_t>(offset + total));
+        if (put < 0) return false;
+        total += static_cast<size_t>(put);
+    }
+    return true;
+}
+
+bool file_io::preallocate(uint64_t offset, uint64_t length) {
+    if (length == 0) return true;
+#ifdef __linux__
+    if (fallocate(fd_, 0, static_cast<off_t>(offset), static_cast<off_t>(length)) == 0) return true;
+#endif
+    return posix_fallocate(fd_, static_cast<off_t>(offset), static_cast<off_t>(length)) == 0;
+}
+
+// 파일 끝 뒤는 늘리기만 하면 구멍이 되고, 안쪽은 구멍을 뚫는다.
+// 이어받기라면 안쪽에 이전 내용이 남아 있을 수 있으므로 뚫지 못하면 0 을 써 넣는다
+bool file_io::zero_range(uint64_t offset, uint64_t length) {
+    if (length == 0) return true;
+    uint64_t size = this->size();
+    uint64_t end = offset + length;
+    if (end > size && ftruncate(fd_, static_cast<off_t>(end)) != 0) return false;
+    uint64_t inside = std::min(end, size);
+    if (offset >= inside) return true;
+#ifdef __linux__
+    if (fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, static_cast<off_t>(offset),
+                  static_cast<off_t>(inside - offset)) == 0)
+        return true;
+#endif
+    return write_zeros(offset, inside - offset);
+}
+
+bool file_io::sync() {
+    return fsync(fd_) == 0;
+}
+
+#endif
+
+bool file_io::write_zeros(uint64_t offset, uint64_t length) {
+    static const std::vector<char> zeros(1 << 20);
+    while (length > 0) {
+        size_t n = static_cast<size_t>(std::min<uint64_t>(length, zeros.size()));
+        if (!pwrite(zeros.data(), n, offset)) return false;
+        offset += n;
+        length -= n;
+    }
+    return true;
+}
@@ -0,0 +1,56 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+// 오프셋으로 읽고 쓰는 저장소. 파일 하나(file_io) 또는 여러 파일을 이어 붙인 묶음(archive_writer).
+class random_access_file {
+public:
+    virtual ~random_access_file() = default;
+
+    // 읽은 바이트 수를 돌려준다. 0 이면 EOF 또는 오류
+    virtual size_t pread(void* buffer, size_t length, uint64_t offset) const = 0;
+    virtual bool pwrite(const void* buffer, size_t length, uint64_t offset) = 0;
+
+    // offset 부터 length 바이트의 디스크 공간을 미리 잡아 둔다. 파일이 offset + length 까지 늘어날 수 있다.
+    // 지원하지 않으면 false
+    virtual bool preallocate(uint64_t offset, uint64_t length) = 0;
+    // offset 부터 length 바이트를 0 으로 만든다. 할 수 있으면 디스크 공간을 쓰지 않는 구멍으로 남긴다
+    virtual bool zero_range(uint64_t offset, uint64_t length) = 0;
+    virtual bool sync() = 0;
+};
+
+// 위치 지정 읽기/쓰기(pread/pwrite)를 지원하는 파일 핸들.
+// 같은 핸들로 여러 스레드가 서로 다른 오프셋에 동시에 읽고 쓸 수 있다.
+class file_io : public random_access_file {
+public:
+    file_io() = default;
+    ~file_io() override;
+
+    file_io(const file_io&) = delete;
+    file_io& operator=(const file_io&) = delete;
+
+    bool open_read(const std::filesystem::path& path);
+    bool open_write(const std::filesystem::path& path, bool truncate);
+    void close();
+    bool is_open() const;
+
+    uint64_t size() const;
+
+    size_t pread(void* buffer, size_t length, uint64_t offset) const override;
+    bool pwrite(const void* buffer, size_t length, uint64_t offset) override;
+    bool preallocate(uint64_t offset, uint64_t length) override;
+    bool zero_range(uint64_t offset, uint64_t length) override;
+    bool sync() override;
+
+private:
+    bool write_zeros(uint64_t offset, uint64_t length);
+
+#ifdef _WIN32
+    void* handle_ = nullptr;
+    bool sparse_ = false; // FSCTL_SET_SPARSE 를 이미 했다
+#else
+    int fd_ = -1;
+#endif
+};
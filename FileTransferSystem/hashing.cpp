@@ -1,53 +1,124 @@
+﻿#include "hashing.h"
+#include "base64.h"
+
+#include <fstream>
 #include <iostream>
 #include <string>
 #include <vector>
 #include <sstream>
+#include <algorithm>
 
-static const std::string base64_chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-
-// Base64 ڵ Լ
-std::string base64_encode(const std::string& input) {
-    std::string result;
-    int val = 0, valb = -6;
-    for (unsigned char c : input) {
-        val = (val << 8) + c;
-        valb += 8;
-        while (valb >= 0) {
-            result.push_back(base64_chars[(val >> valb) & 0x3F]);
-            valb -= 6;
-        }
-    }
-    if (valb > -6) result.push_back(base64_chars[((val << 8) >> (valb + 8)) & 0x3F]);
-    while (result.size() % 4) result.push_back('=');
-    return result;
-}
-
-// Base64 ڵ Լ
-std::string base64_decode(const std::string& input) {
-    std::vector<int> T(256, -1);
-    for (int i = 0; i < 64; i++) T[base64_chars[i]] = i;
-
-    int val = 0, valb = -8;
-    std::string result;
-    for (unsigned char c : input) {
-        if (T[c] == -1) break;
-        val = (val << 6) + T[c];
-        valb += 6;
-        if (valb >= 0) {
-            result.push_back(char((val >> valb) & 0xFF));
-            valb -= 8;
-        }
-    }
-    return result;
-}
-
+// x86 에서는 SSE2/AVX2/AVX512 중 CPU 가 지원하는 구현을 실행 시점에 고른다.
+// 시스템 xxHash 에는 디스패처가 없을 수 있어 CMake 가 FTS_NO_XXH_DISPATCH 로 끈다
+#if (defined(_M_X64) || defined(__x86_64__)) && !defined(FTS_NO_XXH_DISPATCH)
+#include <xxh_x86dispatch.h>
+#else
+#include <xxhash.h>
+#endif
 
-// ü ڿ Base62 ڵϴ Լ
+// 전체 문자열을 Base62로 인코딩하는 함수
 std::string compress(const std::string& input) {
     return base64_encode(input);
 }
 
-// Base62 ڵ ڿ ڵϴ Լ
+// Base62로 인코딩된 문자열을 디코딩하는 함수
 std::string decompress(const std::string& encoded) {
     return base64_decode(encoded);
-}
\ No newline at end of file
+}
+
+uint64_t chunk_hash(const void* data, size_t length) {
+    return XXH3_64bits(data, length);
+}
+
+file_digest chunk_digest(const void* data, size_t length) {
+    XXH128_hash_t h = XXH3_128bits(data, length);
+    return { h.low64, h.high64 };
+}
+
+std::string file_digest::to_hex() const {
+    static const char digits[] = "0123456789abcdef";
+    std::string out(32, '0');
+    for (int i = 0; i < 16; ++i) {
+        out[15 - i] = digits[(high >> (i * 4)) & 0xF];
+        out[31 - i] = digits[(low >> (i * 4)) & 0xF];
+    }
+    return out;
+}
+
+bool file_digest::from_hex(const std::string& hex, file_digest& out) {
+    if (hex.size() != 32) return false;
+    uint64_t parts[2] = { 0, 0 };
+    for (size_t i = 0; i < 32; ++i) {
+        char c = hex[i];
+        int v = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+        if (v < 0) return false;
+        parts[i / 16] = (parts[i / 16] << 4) | static_cast<uint64_t>(v);
+    }
+    out.high = parts[0];
+    out.low = parts[1];
+    return true;
+}
+
+struct tree_hasher::state {
+    XXH3_state_t* block = XXH3_createState();
+    ~state() { XXH3_freeState(block); }
+};
+
+tree_hasher::tree_hasher()
+    : state_(std::make_unique<state>()) {
+    XXH3_64bits_reset(state_->block);
+}
+
+tree_hasher::~tree_hasher() = default;
+
+void tree_hasher::update(const void* data, size_t length) {
+    const char* p = static_cast<const char*>(data);
+    while (length > 0) {
+        size_t n = std::min(length, hash_block_size - in_block_);
+        XXH3_64bits_update(state_->block, p, n);
+        in_block_ += n;
+        consumed_ += n;
+        p += n;
+        length -= n;
+        if (in_block_ == hash_block_size) close_block();
+    }
+}
+
+void tree_hasher::close_block() {
+    block_hashes_.push_back(XXH3_64bits_digest(state_->block));
+    XXH3_64bits_reset(state_->block);
+    in_block_ = 0;
+}
+
+file_digest tree_hasher::finish() {
+    if (in_block_ > 0) close_block();
+    return digest_of_blocks(block_hashes_);
+}
+
+file_digest digest_of_blocks(const std::vector<uint64_t>& block_hashes) {
+    // 엔디언에 상관없이 같은 값이 나오도록 little endian 으로 풀어서 묶는다
+    XXH3_state_t* st = XXH3_createState();
+    XXH3_128bits_reset(st);
+    for (uint64_t h : block_hashes) {
+        unsigned char le[8];
+        for (int i = 0; i < 8; ++i) le[i] = static_cast<unsigned char>(h >> (i * 8));
+        XXH3_128bits_update(st, le, sizeof(le));
+    }
+    XXH128_hash_t h = XXH3_128bits_digest(st);
+    XXH3_freeState(st);
+    return { h.low64, h.high64 };
+}
+
+bool digest_file(const std::filesystem::path& path, file_digest& out) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    tree_hasher hasher;
+    std::vector<char> buffer(hash_block_size);
+    while (in) {
+        in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        if (in.gcount() > 0) hasher.update(buffer.data(), static_cast<size_t>(in.gcount()));
+    }
+    if (in.bad()) return false;
+    out = hasher.finish();
+    return true;
+}
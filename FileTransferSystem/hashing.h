@@ -1,6 +1,63 @@
-#pragma once
+﻿#pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
 #include <string>
+#include <vector>
 
 std::string compress(const std::string& in);
-std::string decompress(const std::string& in);
\ No newline at end of file
+std::string decompress(const std::string& in);
+
+// 파일 다이제스트는 hash_block_size 블록마다 구한 XXH3-64 값들을 다시 XXH3-128 로 묶은 것이다.
+// 블록 해시 목록만 있으면 블록 단위로 검증할 수 있다.
+constexpr size_t hash_block_size = 1 << 20;
+
+struct file_digest {
+    uint64_t low = 0;
+    uint64_t high = 0;
+
+    std::string to_hex() const;
+    static bool from_hex(const std::string& hex, file_digest& out);
+
+    bool operator==(const file_digest& other) const { return low == other.low && high == other.high; }
+    bool operator!=(const file_digest& other) const { return !(*this == other); }
+};
+
+// 청크 하나의 해시 (XXH3-64)
+uint64_t chunk_hash(const void* data, size_t length);
+
+// 청크 하나의 128 비트 해시 (XXH3-128). 중복 제거 저장소에서 청크를 찾는 키다
+file_digest chunk_digest(const void* data, size_t length);
+
+// 파일 내용을 앞에서부터 차례로 받아 블록 해시와 다이제스트를 만든다
+class tree_hasher {
+public:
+    tree_hasher();
+    ~tree_hasher();
+
+    tree_hasher(const tree_hasher&) = delete;
+    tree_hasher& operator=(const tree_hasher&) = delete;
+
+    void update(const void* data, size_t length);
+    uint64_t consumed() const { return consumed_; }
+
+    file_digest finish();
+    const std::vector<uint64_t>& block_hashes() const { return block_hashes_; }
+
+private:
+    void close_block();
+
+    struct state;
+    std::unique_ptr<state> state_;
+    size_t in_block_ = 0;
+    uint64_t consumed_ = 0;
+    std::vector<uint64_t> block_hashes_;
+};
+
+// 블록 해시 목록으로 다이제스트를 구한다
+file_digest digest_of_blocks(const std::vector<uint64_t>& block_hashes);
+
+// 파일 전체를 읽어 다이제스트를 구한다. 스웜 수신자에게 알려 줄 값이다
+bool digest_file(const std::filesystem::path& path, file_digest& out);
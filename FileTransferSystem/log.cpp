@@ -0,0 +1,103 @@
+#include "log.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+
+namespace {
+
+// 칸의 sequence: 2*index+1 이면 쓰는 중, 2*index+2 이면 index 번째 줄이 다 쓰인 것
+struct log_slot {
+    std::atomic<uint64_t> sequence{ 0 };
+    log_record record;
+};
+
+std::array<log_slot, log_capacity> log_ring;
+std::atomic<uint64_t> log_head{ 0 };
+std::atomic<log_sink> current_sink{ nullptr };
+
+// UTF-8 글자 중간에서 자르지 않는다
+size_t clip_utf8(std::string_view text, size_t limit) {
+    if (text.size() <= limit) return text.size();
+    size_t n = limit;
+    while (n > 0 && (static_cast<unsigned char>(text[n]) & 0xC0) == 0x80) --n;
+    return n;
+}
+
+void push_line(log_level level, uint64_t session, int64_t time_ns, std::string_view line) {
+    uint64_t index = log_head.fetch_add(1, std::memory_order_relaxed);
+    log_slot& slot = log_ring[index % log_capacity];
+
+    slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    log_record& r = slot.record;
+    r.time_ns = time_ns;
+    r.session = session;
+    r.level = level;
+    r.length = static_cast<uint16_t>(clip_utf8(line, log_record::text_capacity));
+    std::memcpy(r.text, line.data(), r.length);
+
+    slot.sequence.store(2 * index + 2, std::memory_order_release);
+
+    if (log_sink sink = current_sink.load(std::memory_order_acquire)) sink(r);
+}
+
+} // namespace
+
+const char* log_level_name(log_level level) {
+    switch (level) {
+    case log_level::debug: return "debug";
+    case log_level::info: return "info";
+    case log_level::warning: return "warning";
+    case log_level::error: return "error";
+    }
+    return "?";
+}
+
+void add_log(std::string_view msg) {
+    add_log(log_level::info, 0, msg);
+}
+
+void add_log(log_level level, uint64_t session, std::string_view msg) {
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    do {
+        size_t end = msg.find('\n');
+        std::string_view line = msg.substr(0, end);
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        push_line(level, session, now, line);
+        msg = end == std::string_view::npos ? std::string_view() : msg.substr(end + 1);
+    } while (!msg.empty());
+}
+
+uint64_t read_log(uint64_t from, std::vector<log_record>& out) {
+    uint64_t head = log_head.load(std::memory_order_acquire);
+    uint64_t index = std::max(from, head > log_capacity ? head - log_capacity : 0);
+    for (; index < head; ++index) {
+        const log_slot& slot = log_ring[index % log_capacity];
+        uint64_t before = slot.sequence.load(std::memory_order_acquire);
+        if (before != 2 * index + 2) {
+            // 아직 쓰는 중이면 여기서 멈추고 다음에 다시 읽는다. 이미 덮어쓴 줄은 건너뛴다
+            if (before < 2 * index + 2) break;
+            continue;
+        }
+        log_record copy = slot.record;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != before) continue; // 복사하는 사이 덮어써졌다
+        out.push_back(copy);
+    }
+    return index;
+}
+
+std::string format_log_record(const log_record& record) {
+    std::string line;
+    if (record.session != 0) line = u8"[세션 " + std::to_string(record.session) + "] ";
+    line.append(record.view());
+    return line;
+}
+
+void set_log_sink(log_sink sink) {
+    current_sink.store(sink, std::memory_order_release);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class log_level : uint8_t { debug, info, warning, error };
+
+const char* log_level_name(log_level level);
+
+// 미리 잡아 둔 고정 크기 로그 한 줄. 긴 줄은 text_capacity 에서 (UTF-8 글자 단위로) 자른다
+struct log_record {
+    static constexpr size_t text_capacity = 232;
+
+    int64_t time_ns = 0;   // system_clock, epoch 기준
+    uint64_t session = 0;  // 0 이면 세션과 무관
+    log_level level = log_level::info;
+    uint16_t length = 0;
+    char text[text_capacity];
+
+    std::string_view view() const { return std::string_view(text, length); }
+};
+
+// 여러 스레드가 동시에 쓰는 잠금 없는 링 (MPSC). 가득 차면 가장 오래된 줄을 덮어쓴다.
+// 쓰는 쪽은 자리 번호를 원자적으로 받아 칸에 복사만 하고, 읽는 쪽은 칸마다 붙은 순번으로
+// 다 쓰인 줄만 골라 복사하므로 어느 쪽도 상대를 기다리지 않는다.
+constexpr size_t log_capacity = 4096;
+
+// 여러 줄짜리 msg 는 줄마다 한 레코드가 된다
+void add_log(std::string_view msg);
+void add_log(log_level level, uint64_t session, std::string_view msg);
+
+// from 번째 줄부터 지금까지 쓰인 줄을 out 뒤에 붙이고, 다음에 넘길 from 을 돌려준다.
+// 이미 덮어쓴 줄이나 아직 쓰는 중인 줄은 건너뛴다
+uint64_t read_log(uint64_t from, std::vector<log_record>& out);
+
+// "[세션 N] " 을 붙인 한 줄
+std::string format_log_record(const log_record& record);
+
+// 레코드가 쌓일 때마다 쓴 스레드에서 부른다. 창이 없는 CLI 는 여기서 stderr 로 흘려보낸다
+using log_sink = void (*)(const log_record& record);
+void set_log_sink(log_sink sink);
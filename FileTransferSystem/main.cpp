@@ -1,14 +1,16 @@
-﻿#define STB_IMAGE_IMPLEMENTATION
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include <rtc/rtc.hpp>
+﻿#include <rtc/rtc.hpp>
 #include <rtc/datachannel.hpp>
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include <memory>
+#include <mutex>
 #include <thread>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <ctime>
+#include <deque>
 #include <filesystem>
 #include <cstddef>
 #include <GLFW/glfw3.h>
@@ -17,74 +19,43 @@
 #include <Windows.h>
 #include <ShlObj.h>
 #include "hashing.h"
+#include "log.h"
+#include "metrics.h"
+#include "peer_link.h"
+#include "scheduler.h"
+#include "session.h"
+#include "signal_image.h"
+#include "signaling.h"
+#include "texture_cache.h"
+#include "transfer.h"
 #include "../Dependancy/imgui/imgui.h"
 #include "../Dependancy/imgui/backends/imgui_impl_glfw.h"
 #include "../Dependancy/imgui/backends/imgui_impl_opengl3.h"
 
 namespace fs = std::filesystem;
 
-std::deque<std::string> log_buffer;
-std::mutex log_mutex;
-
 // 전역 변수
-std::function<void()> clipboard_task;
-std::mutex clipboard_mutex;
-
-void run_on_main_thread(std::function<void()> task) {
-    std::lock_guard<std::mutex> lock(clipboard_mutex);
-    clipboard_task = task;
-}
-
-
-void add_log(const std::string& msg) {
-    std::lock_guard<std::mutex> lock(log_mutex);
-    log_buffer.push_back(msg);
-    if (log_buffer.size() > 1000) log_buffer.pop_front(); // 오래된 로그 제거
+std::vector<std::function<void()>> main_thread_tasks;
+std::mutex main_thread_mutex;
+std::unique_ptr<session_manager> sessions;
+std::unique_ptr<transfer_scheduler> scheduler; // Host 로 넣은 송신 작업. sessions 보다 늦게 사라진다
+texture_cache textures;
+
+// 할 일이 없으면 메인 루프는 glfwWaitEventsTimeout 에서 잠들어 있다.
+// 다른 스레드가 화면에 보일 것을 바꾸면 빈 이벤트로 깨운다. 다음 프레임 전까지는 한 번만 보낸다
+std::atomic<bool> wake_pending{ false };
+
+void wake_main_thread() {
+    if (!wake_pending.exchange(true, std::memory_order_acq_rel)) glfwPostEmptyEvent();
 }
 
-bool encode_string_to_image_to_memory(const std::string& input, std::vector<unsigned char>& out_png_data) {
-    const int width = 64, height = 64;
-    std::vector<unsigned char> pixels(width * height * 4, 0);
-
-    for (size_t i = 0; i < input.size(); ++i) {
-        size_t pixel_index = i * 4;
-        pixels[pixel_index + 0] = input[i];   // R = 문자
-        pixels[pixel_index + 1] = 0;          // G
-        pixels[pixel_index + 2] = 0;          // B
-        pixels[pixel_index + 3] = 255;        // A (불투명)
-    }
-
-    out_png_data = pixels;
-
-    return !out_png_data.empty();
-}
-
-std::string decode_string_from_image_memory(std::vector<unsigned char> image_data) {
-    const int width = 64, height = 64;
-    unsigned char* data = image_data.data();
-
-    std::string result;
-    size_t total = width * height;
-    for (size_t i = 0; i < total; ++i) {
-        unsigned char r = data[i * 4];
-        if (r == 0) break; // padding or null
-        result += (char)r;
+// GL 텍스처처럼 메인 스레드에서만 만질 수 있는 일을 다음 프레임에 돌린다
+void run_on_main_thread(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(main_thread_mutex);
+        main_thread_tasks.push_back(std::move(task));
     }
-
-    return result;
-}
-
-GLuint create_texture_from_png_memory(const unsigned char* data, int width, int height) {
-    GLuint tex;
-    glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_2D, tex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    glBindTexture(GL_TEXTURE_2D, 0);
-    return tex;
+    wake_main_thread();
 }
 
 bool copy_image_to_clipboard() {
@@ -128,7 +99,7 @@ bool get_image_from_clipboard(std::vector<unsigned char>& out_rgba, int& width,
     std::string file_path = absPath.string();
 
     if (!OpenClipboard(nullptr)) {
-        add_log(u8"클립보드 열기 실패");
+        add_log(log_level::warning, 0, u8"클립보드 열기 실패");
         return false;
     }
 
@@ -141,7 +112,7 @@ bool get_image_from_clipboard(std::vector<unsigned char>& out_rgba, int& width,
 
     void* pData = GlobalLock(hData);
     if (!pData) {
-        add_log(u8"CF_DIB 잠금 실패");
+        add_log(log_level::warning, 0, u8"CF_DIB 잠금 실패");
         CloseClipboard();
         return false;
     }
@@ -158,267 +129,396 @@ bool get_image_from_clipboard(std::vector<unsigned char>& out_rgba, int& width,
         return false;
     }
 
-    const unsigned char* src = (unsigned char*)(bih + 1); // 픽셀 데이터 시작
-    std::vector<unsigned char> rgba(width * height * 4);
+    // 픽셀은 머리말 뒤에 온다. BI_BITFIELDS 면 그 사이에 색 마스크 3 개가 끼어 있다
+    size_t header = bih->biSize + (bih->biSize == sizeof(BITMAPINFOHEADER) && bih->biCompression == BI_BITFIELDS ? 12 : 0);
+    const unsigned char* src = (const unsigned char*)pData + header;
+    size_t row = static_cast<size_t>(width) * 4;
 
+    // 전에 쓰던 버퍼를 그대로 다시 쓴다. 크기가 같으면 새로 할당하지 않는다
+    out_rgba.resize(row * height);
     for (int y = 0; y < height; ++y) {
-        int src_y = bih->biHeight > 0 ? (height - 1 - y) : y;
-        for (int x = 0; x < width; ++x) {
-            const unsigned char* pixel = src + (src_y * width + x) * 4;
-            unsigned char* dst = &rgba[(y * width + x) * 4];
-            dst[0] = pixel[2]; // R
-            dst[1] = pixel[1]; // G
-            dst[2] = pixel[0]; // B
-            dst[3] = pixel[3]; // A
-        }
+        int src_y = bih->biHeight > 0 ? (height - 1 - y) : y; // 아래에서 위로 저장된 DIB 는 뒤집는다
+        bgra_to_rgba(src + src_y * row, out_rgba.data() + y * row, static_cast<size_t>(width));
     }
 
     GlobalUnlock(hData);
     CloseClipboard();
-
-    out_rgba = rgba;
     return true;
 }
 
 
-GLuint create_texture_from_rgba_memory(const unsigned char* data, int width, int height) {
-    GLuint texture;
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+std::vector<unsigned char> clipboard_data;
 
-    glBindTexture(GL_TEXTURE_2D, 0);
-    return texture;
+// SDP 를 이미지로 만들어 tmp.png 로 저장하고 클립보드에 올린다
+void publish_signal_image(texture_slot slot, const std::string& sdp) {
+    std::vector<unsigned char> rgba;
+    int width = 0, height = 0;
+    encode_string_to_image_to_memory(sdp, rgba, width, height);
+    add_log(u8"SDP " + std::to_string(sdp.size()) + u8" bytes -> " + std::to_string(width) + "x" +
+            std::to_string(height) + u8" 이미지");
+    textures.upload(slot, rgba.data(), width, height);
+    stbi_write_png("tmp.png", width, height, 4, rgba.data(), width * 4);
+    copy_image_to_clipboard();
 }
 
+// 만든 세션 id 들을 돌려준다. 열 수 없으면 비어 있다
+std::vector<uint64_t> send(const std::string& path, send_options options = {}, int peers = 1) {
+    // 폴더이거나 ';' 로 여러 이름을 넣으면 한 세션에 묶어서 보낸다
+    std::vector<std::string> names;
+    std::stringstream ss(path);
+    for (std::string name; std::getline(ss, name, ';');) {
+        if (!name.empty()) names.push_back(name);
+    }
+    if (options.seed && names.size() == 1) {
+        // 스웜 수신자는 연결하기 전에 다이제스트를 알아야 한다
+        file_digest digest;
+        if (digest_file(fs::current_path() / "Upload" / fs::u8path(names.front()), digest))
+            add_log(u8"[seed] 다이제스트: " + digest.to_hex());
+    }
+    if (peers > 1) return sessions->start_fanout(fs::current_path() / "Upload", names, options, peers);
+    uint64_t id = sessions->start_send_paths(fs::current_path() / "Upload", names, options);
+    if (id == 0) return {};
+    return { id };
+}
 
-GLuint offer_texture = 0;
-std::vector<unsigned char> clipboard_data;
 
-void send(std::string& path) {
-    fs::path absPath = fs::current_path() / "Upload" / path;
-    add_log(absPath.string());
+void recieve(receive_options options = {}) {
+    sessions->start_receive(fs::current_path() / "Download", options);
+    add_log(u8"[recv] Offer 입력(붙여넣기!):");
+}
 
-    auto file = std::make_shared<std::ifstream>(absPath, std::ios::binary);
-    if (!*file) {
-        add_log(u8"파일 열기 실패!");
+void recieve_swarm(const std::string& hex, int sources) {
+    file_digest digest;
+    if (!file_digest::from_hex(hex, digest)) {
+        add_log(log_level::error, 0, u8"다이제스트는 32자리 16진수입니다.");
         return;
     }
+    sessions->start_swarm(fs::current_path() / "Download", digest, sources);
+    add_log(u8"[recv] 송신자들의 Offer 를 차례로 붙여넣으세요:");
+}
 
-    rtc::Configuration config;
-    config.iceServers.emplace_back("stun:stun.l.google.com:19302");
+// 세션이 상대에게 넘길 SDP 를 이미지로 바꿔 클립보드에 올리고, Ctrl+V 로 붙여넣은 이미지를 세션에 넘긴다.
+// 팬아웃처럼 Offer 가 여러 개 나오면 클립보드는 하나뿐이므로 Answer 를 하나 붙여넣을 때마다 다음 Offer 를 올린다.
+class clipboard_signaling : public signaling {
+public:
+    void publish(session_role role, const std::string& sdp) override {
+        bool offer = role == session_role::send;
+        if (offer) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (showing_offer_) {
+                pending_offers_.push_back(sdp);
+                add_log(u8"Offer 대기 중: " + std::to_string(pending_offers_.size()) + u8"개");
+                return;
+            }
+            showing_offer_ = true;
+        }
+        show(offer, sdp);
+    }
 
-    auto pc = std::make_shared<rtc::PeerConnection>(config);
+    void listen(remote_handler handler) override { inbox_.set(std::move(handler)); }
 
-    pc->onStateChange([](rtc::PeerConnection::State state) {
-        add_log(u8"[send] Connection state: " + static_cast<int>(state));
-        if (state == rtc::PeerConnection::State::Connected) {
-            add_log(u8"연결됨!");
+    // 메인 스레드의 붙여넣기 처리에서 부른다
+    void paste(const std::vector<unsigned char>& rgba, int width, int height) {
+        std::string sdp;
+        if (!decode_string_from_image_memory(rgba, width, height, sdp)) {
+            add_log(u8"시그널링 이미지가 아닙니다. 다시 붙여넣어 주세요.");
+            return;
         }
-        else if (state == rtc::PeerConnection::State::Failed) {
-            add_log(u8"[send] 연결 실패!");
+        inbox_.deliver(sdp);
+
+        std::string next;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (pending_offers_.empty()) {
+                showing_offer_ = false;
+                return;
+            }
+            next = std::move(pending_offers_.front());
+            pending_offers_.pop_front();
         }
-    });
-
-    pc->onLocalCandidate([](const rtc::Candidate& cand) {
-        add_log(u8"Local Candidate: " + std::string(cand));
-    });
-
-    auto dc = pc->createDataChannel("file");
+        show(true, next);
+    }
 
-    dc->onOpen([dc, file, absPath]() {
-        add_log(u8"전송 시작...");
-        dc->send(absPath.filename().string());
+private:
+    void show(bool offer, const std::string& sdp) {
+        add_log(offer ? u8"=== SDP Offer (클립보드에 복사됨!) ===" : u8"=== SDP Answer (복사하기!) ===");
+        add_log(sdp);
+        add_log(u8"===========================");
 
-        const size_t chunkSize = 16384;
-        std::vector<std::byte> buffer(chunkSize);
+        run_on_main_thread([offer, sdp]() {
+            publish_signal_image(offer ? texture_slot::offer : texture_slot::answer, sdp);
+        });
+        add_log(offer ? u8"[send] Answer 입력(붙여넣기!):" : u8"[recv] 기다리는 중...");
+    }
 
-        while (file && !file->eof()) {
-            file->read(reinterpret_cast<char*>(buffer.data()), chunkSize);
-            std::streamsize readBytes = file->gcount();
-            if (readBytes > 0) {
-                dc->send(rtc::binary(buffer.data(), buffer.data() + readBytes));
-            }
-        }
+    signal_inbox inbox_;
+    std::mutex mutex_;
+    bool showing_offer_ = false;
+    std::deque<std::string> pending_offers_;
+};
 
-        dc->send("__EOF__"); // 전송 완료 표시
-        add_log(u8"전송 완료!\n창을 닫아도 좋습니다!");
-    });
+clipboard_signaling clipboard_signal;
+
+// 링에서 읽어 온 로그. 메인 스레드만 만진다
+std::deque<log_record> log_lines;
+uint64_t log_cursor = 0;
+static int log_filter = static_cast<int>(log_level::info);
+
+void draw_log_record(const log_record& record) {
+    time_t seconds = static_cast<time_t>(record.time_ns / 1000000000);
+    int millis = static_cast<int>(record.time_ns / 1000000 % 1000);
+    tm local{};
+    localtime_s(&local, &seconds);
+    ImGui::TextDisabled("%02d:%02d:%02d.%03d", local.tm_hour, local.tm_min, local.tm_sec, millis);
+    ImGui::SameLine();
+
+    bool colored = record.level != log_level::info;
+    if (colored) {
+        ImVec4 color = record.level == log_level::error ? ImVec4(1.0f, 0.4f, 0.4f, 1.0f)
+                     : record.level == log_level::warning ? ImVec4(1.0f, 0.8f, 0.3f, 1.0f)
+                     : ImVec4(0.6f, 0.6f, 0.6f, 1.0f);
+        ImGui::PushStyleColor(ImGuiCol_Text, color);
+    }
+    if (record.session != 0) {
+        ImGui::Text("[%llu]", static_cast<unsigned long long>(record.session));
+        ImGui::SameLine();
+    }
+    ImGui::TextUnformatted(record.text, record.text + record.length);
+    if (colored) ImGui::PopStyleColor();
+}
 
-    dc->onMessage([](std::variant<rtc::binary, std::string> data) {
-        if (std::holds_alternative<std::string>(data)) {
-            add_log(u8"[send] 받은 메시지: " + std::get<std::string>(data));
-        }
-    });
+void draw_log_window() {
+    ImGui::Begin("Log");
 
-    pc->onGatheringStateChange([pc](rtc::PeerConnection::GatheringState state) {
-        if (state == rtc::PeerConnection::GatheringState::Complete) {
-            auto desc = pc->localDescription();
-            if (!desc) return;
+    // 새로 쌓인 줄만 복사해 온다. 쓰는 스레드는 기다리지 않는다
+    thread_local std::vector<log_record> incoming;
+    incoming.clear();
+    log_cursor = read_log(log_cursor, incoming);
+    log_lines.insert(log_lines.end(), incoming.begin(), incoming.end());
+    while (log_lines.size() > log_capacity) log_lines.pop_front();
 
-            std::string sdp = std::string(*desc);
-            std::string encoded = compress(sdp);
-            encoded.erase(std::remove(encoded.begin(), encoded.end(), '\n'), encoded.end());
+    ImGui::SetNextItemWidth(120);
+    ImGui::Combo("Level", &log_filter, "debug\0info\0warning\0error\0");
 
-            add_log(u8"=== SDP Offer (클립보드에 복사됨!) ===");
-            add_log(encoded);
-            add_log(u8"===========================");
+    thread_local std::vector<int> visible;
+    visible.clear();
+    for (size_t i = 0; i < log_lines.size(); ++i) {
+        if (static_cast<int>(log_lines[i].level) >= log_filter) visible.push_back(static_cast<int>(i));
+    }
 
-            std::vector<unsigned char> png_data;
-            encode_string_to_image_to_memory(encoded, png_data);
-            offer_texture = create_texture_from_png_memory(png_data.data(), 64, 64);
-            stbi_write_png("tmp.png", 64, 64, 4, png_data.data(), 64*4);
-            copy_image_to_clipboard();
+    ImGui::BeginChild("lines", ImVec2(0, 0), false, ImGuiWindowFlags_HorizontalScrollbar);
+    bool at_bottom = ImGui::GetScrollY() >= ImGui::GetScrollMaxY();
 
-            add_log(u8"[send] Answer 입력(붙여넣기!):");
-            std::string encodedAnswer;
-            while(clipboard_data.empty()) std::this_thread::sleep_for(std::chrono::seconds(1));
-            encodedAnswer = decode_string_from_image_memory(clipboard_data);
-            std::string decodedAnswer = decompress(encodedAnswer);
+    // 보이는 줄만 그린다
+    ImGuiListClipper clipper;
+    clipper.Begin(static_cast<int>(visible.size()));
+    while (clipper.Step()) {
+        for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; ++row) draw_log_record(log_lines[visible[row]]);
+    }
+    clipper.End();
 
-            rtc::Description answer(decodedAnswer, rtc::Description::Type::Answer);
-            pc->setRemoteDescription(answer);
+    if (at_bottom) ImGui::SetScrollHereY(1.0f); // 자동 스크롤
+    ImGui::EndChild();
 
-            add_log(u8"[send] 기다리는 중...");
-        }
-    });
+    ImGui::End();
+}
 
-    pc->setLocalDescription();
 
-    add_log(u8"[send] 기다리는 중...");
-    while (true) {
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+// 바이트 수를 읽기 쉬운 단위로
+std::string format_bytes(double bytes) {
+    const char* units[] = { "B", "KB", "MB", "GB", "TB" };
+    int unit = 0;
+    while (bytes >= 1024 && unit < 4) {
+        bytes /= 1024;
+        ++unit;
     }
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), unit == 0 ? "%.0f %s" : "%.1f %s", bytes, units[unit]);
+    return buffer;
 }
 
-GLuint answer_texture = 0;
-
-void recieve() {
-    rtc::Configuration config;
-    config.iceServers.emplace_back("stun:stun.l.google.com:19302");
-
-    auto pc = std::make_shared<rtc::PeerConnection>(config);
+// 내보낸 파일 경로를 로그에 남긴다
+void export_metrics(const std::string& file_name, const std::string& text) {
+    std::ofstream out(file_name, std::ios::binary | std::ios::trunc);
+    out << text;
+    add_log(out ? u8"지표 저장: " + file_name : u8"지표 저장 실패: " + file_name);
+}
 
-    pc->onStateChange([](rtc::PeerConnection::State state) {
-        add_log(u8"[recv] Connection state: " + static_cast<int>(state));
-        if (state == rtc::PeerConnection::State::Connected) {
-            add_log(u8"연결됨!");
+// 송신 대기열. 전체 제한과 동시 전송 수를 바꾸고, 작업마다 우선순위를 바꾸거나 멈출 수 있다
+void draw_queue_window() {
+    ImGui::Begin("Queue");
+
+    int limit_mb = static_cast<int>(scheduler->global_rate() / (1024 * 1024));
+    if (ImGui::SliderInt("Limit MB/s", &limit_mb, 0, 1000, limit_mb == 0 ? "unlimited" : "%d"))
+        scheduler->set_global_rate(limit_mb * 1024.0 * 1024.0);
+    int active = static_cast<int>(scheduler->max_active());
+    if (ImGui::SliderInt("Active", &active, 1, 8)) scheduler->set_max_active(static_cast<size_t>(active));
+
+    std::vector<job_info> jobs = scheduler->jobs();
+    if (jobs.empty()) ImGui::TextUnformatted(u8"작업 없음");
+    for (const job_info& j : jobs) {
+        ImGui::PushID(static_cast<int>(j.id));
+        ImGui::Separator();
+        ImGui::Text("#%llu %s  [%s%s]", static_cast<unsigned long long>(j.id), j.name.c_str(), job_state_name(j.state),
+                    j.paused ? ", paused" : "");
+        int priority = static_cast<int>(j.priority);
+        ImGui::SetNextItemWidth(100);
+        if (ImGui::Combo("##priority", &priority, "low\0normal\0high\0"))
+            scheduler->set_priority(j.id, static_cast<transfer_priority>(priority));
+        ImGui::SameLine();
+        if (ImGui::Button(j.paused ? "Resume" : "Pause")) {
+            if (j.paused) scheduler->resume(j.id);
+            else scheduler->pause(j.id);
         }
-        else if (state == rtc::PeerConnection::State::Failed) {
-            add_log(u8"[recv] 연결 실패!");
+        if (j.state == job_state::queued) {
+            ImGui::SameLine();
+            if (ImGui::Button("Cancel")) scheduler->cancel(j.id);
         }
-    });
-
-    pc->onLocalCandidate([](const rtc::Candidate& cand) {
-        add_log(u8"Local Candidate: " + std::string(cand));
-    });
-
-    pc->onGatheringStateChange([pc](rtc::PeerConnection::GatheringState state) {
-        if (state == rtc::PeerConnection::GatheringState::Complete) {
-            auto desc = pc->localDescription();
-            if (!desc) return;
-
-            std::string sdp = std::string(*desc);
-            std::istringstream iss(sdp);
-            std::ostringstream oss;
-            std::string line;
-            while (std::getline(iss, line)) {
-                if (line.rfind("a=setup:actpass", 0) == 0) {
-                    oss << "a=setup:active\n";
-                }
-                else {
-                    oss << line << "\n";
-                }
-            }
-
-            std::string encoded = compress(oss.str());
-            encoded.erase(std::remove(encoded.begin(), encoded.end(), '\n'), encoded.end());
-
-            add_log(u8"=== SDP Answer (복사하기!) ===");
-            add_log(encoded);
-            add_log(u8"===========================");
-
-            std::vector<unsigned char> png_data;
-            encode_string_to_image_to_memory(encoded, png_data);
-            answer_texture = create_texture_from_png_memory(png_data.data(), 64, 64);
-            stbi_write_png("tmp.png", 64, 64, 4, png_data.data(), 64 * 4);
-            copy_image_to_clipboard();
+        if (j.state != job_state::queued) {
+            std::string line = format_bytes(static_cast<double>(j.bytes));
+            if (j.assured > 0) line += u8"  보장 " + format_bytes(j.assured) + "/s";
+            if (j.rate_limit > 0) line += u8"  상한 " + format_bytes(j.rate_limit) + "/s";
+            ImGui::TextUnformatted(line.c_str());
         }
-    });
+        ImGui::PopID();
+    }
 
-    pc->onDataChannel([](std::shared_ptr<rtc::DataChannel> dc) {
-        auto outFile = std::make_shared<std::ofstream>();
-        dc->onMessage([dc, outFile](std::variant<rtc::binary, std::string> data) mutable {
-            if (std::holds_alternative<std::string>(data)) {
-                auto str = std::get<std::string>(data);
-                if (str == "__EOF__") {
-                    add_log(u8"파일 수신 완료!\n창을 닫아도 좋습니다!");
-                    if (outFile->is_open()) outFile->close();
-                }
-                else {
-                    fs::path absPath = fs::current_path() / "Download";
-                    fs::create_directories(absPath);
-                    absPath /= str;
-                    outFile->open(absPath, std::ios::binary);
-                    if (!*outFile) {
-                        add_log(u8"파일 저장 실패!");
-                    }
-                    else {
-                        add_log(u8"파일 저장 시작: " + str);
-                    }
-                }
-            }
-            else if (std::holds_alternative<rtc::binary>(data)) {
-                const auto& bin = std::get<rtc::binary>(data);
-                if (outFile->is_open()) {
-                    outFile->write(reinterpret_cast<const char*>(bin.data()), bin.size());
-                }
-            }
-        });
-    });
+    ImGui::End();
+}
 
-    add_log(u8"[recv] Offer 입력(붙여넣기!):");
-    while (clipboard_data.empty()) {
-        std::this_thread::sleep_for(std::chrono::seconds(1));
-        //add_log(std::to_string(clipboard_data.size()));
+// 지속 연결. 한 번 연결해 두고 내놓는측의 Upload 목록에서 골라 당겨 받는다.
+// 끊기면 세션이 새 Offer 를 만들므로 처음처럼 클립보드로 다시 주고받는다
+uint64_t link_session = 0;
+
+void draw_link_window() {
+    ImGui::Begin("Link");
+
+    std::shared_ptr<peer_link> link = link_session != 0 ? sessions->link(link_session) : nullptr;
+    if (!link) {
+        link_session = 0;
+        if (ImGui::Button("Host link")) {
+            sessions->run([]() {
+                uint64_t id = sessions->start_link_host(fs::current_path() / "Upload");
+                if (auto link = sessions->link(id)) link->set_on_change(wake_main_thread);
+                run_on_main_thread([id]() { link_session = id; });
+            });
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Join link")) {
+            link_session = sessions->start_link_client(fs::current_path() / "Download");
+            if (auto link = sessions->link(link_session)) link->set_on_change(wake_main_thread);
+            add_log(u8"[link] Offer 입력(붙여넣기!):");
+        }
+        ImGui::End();
+        return;
     }
 
-    std::string encodedOffer = decode_string_from_image_memory(clipboard_data);
-    std::string decodedOffer = decompress(encodedOffer);
-    rtc::Description offer(decodedOffer, rtc::Description::Type::Offer);
-    pc->setRemoteDescription(offer);
+    bool client = link->role() == link_role::client;
+    double rtt = link->rtt_ms();
+    std::string rtt_text = rtt < 0 ? "-" : std::to_string(static_cast<long long>(rtt)) + "ms";
+    ImGui::Text("#%llu %s  [%s]  RTT %s", static_cast<unsigned long long>(link_session), client ? "client" : "host",
+                link->connected() ? "connected" : "waiting", rtt_text.c_str());
+    ImGui::SameLine();
+    if (ImGui::Button("Stop")) {
+        sessions->stop(link_session);
+        link_session = 0;
+    }
 
-    pc->setLocalDescription();
+    if (client) {
+        ImGui::Separator();
+        if (ImGui::Button("Refresh")) link->request_list();
+        std::vector<remote_entry> files = link->remote_files();
+        if (files.empty()) ImGui::TextUnformatted(u8"목록 없음");
+        for (const remote_entry& e : files) {
+            ImGui::PushID(e.name.c_str());
+            if (ImGui::Button("Pull")) link->pull(e.name);
+            ImGui::SameLine();
+            ImGui::Text("%s%s  %s", e.name.c_str(), e.directory ? "/" : "", format_bytes(static_cast<double>(e.size)).c_str());
+            ImGui::PopID();
+        }
 
-    add_log(u8"[recv] 기다리는 중...");
-    while (true) {
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+        for (const pull_info& p : link->pulls()) {
+            ImGui::PushID(static_cast<int>(p.id));
+            ImGui::Separator();
+            ImGui::Text("#%llu %s  [%s]", static_cast<unsigned long long>(p.id), p.name.c_str(), pull_state_name(p.state));
+            float progress = p.total_bytes > 0 ? static_cast<float>(p.bytes_written) / static_cast<float>(p.total_bytes) : 0.0f;
+            std::string overlay = format_bytes(static_cast<double>(p.bytes_written)) + " / " +
+                                  format_bytes(static_cast<double>(p.total_bytes));
+            ImGui::ProgressBar(progress, ImVec2(-1, 0), overlay.c_str());
+            std::string ttfb = p.first_byte_ms < 0 ? "-" : std::to_string(static_cast<long long>(p.first_byte_ms)) + "ms";
+            std::string total = p.done_ms < 0 ? "-" : std::to_string(static_cast<long long>(p.done_ms)) + "ms";
+            ImGui::Text(u8"첫 바이트 %s  전체 %s  시도 %d", ttfb.c_str(), total.c_str(), p.attempts);
+            ImGui::PopID();
+        }
     }
+
+    ImGui::End();
 }
 
-void draw_log_window() {
-    ImGui::Begin("Log");
+void draw_metrics_window() {
+    ImGui::Begin("Metrics");
+
+    std::vector<metrics_snapshot> snapshot = sessions->metrics().snapshot();
+    if (ImGui::Button("Export JSON")) export_metrics("metrics.json", metrics_to_json(snapshot));
+    ImGui::SameLine();
+    if (ImGui::Button("Export Prometheus")) export_metrics("metrics.prom", metrics_to_prometheus(snapshot));
+
+    if (snapshot.empty()) ImGui::TextUnformatted(u8"세션 없음");
+    for (const metrics_snapshot& m : snapshot) {
+        ImGui::PushID(static_cast<int>(m.id));
+        ImGui::Separator();
+        ImGui::Text("#%llu %s %s  [%s]", static_cast<unsigned long long>(m.id), m.role.c_str(), m.name.c_str(),
+                    m.state.c_str());
+
+        uint64_t done = (m.role == "send" ? m.bytes_acked : m.bytes_written) + m.bytes_sparse;
+        std::string overlay = format_bytes(static_cast<double>(done)) + " / " +
+                              format_bytes(static_cast<double>(m.total_bytes));
+        ImGui::ProgressBar(static_cast<float>(m.progress), ImVec2(-1, 0), overlay.c_str());
+
+        std::string eta = m.eta_s < 0 ? "-" : std::to_string(static_cast<long long>(m.eta_s)) + "s";
+        ImGui::Text("%s/s  ETA %s", format_bytes(m.rate).c_str(), eta.c_str());
+        if (m.bytes_sparse > 0)
+            ImGui::Text(u8"구멍/0 구간 %s 생략", format_bytes(static_cast<double>(m.bytes_sparse)).c_str());
+        if (m.bytes_retransmitted > 0 || m.fec_recovered > 0)
+            ImGui::Text(u8"재전송 %s  FEC 복구 %llu 청크", format_bytes(static_cast<double>(m.bytes_retransmitted)).c_str(),
+                        static_cast<unsigned long long>(m.fec_recovered));
+        if (m.role == "send") {
+            ImGui::Text(u8"버퍼 %s (최대 %s)  청크 %s", format_bytes(static_cast<double>(m.buffered)).c_str(),
+                        format_bytes(static_cast<double>(m.peak_buffered)).c_str(),
+                        format_bytes(static_cast<double>(m.chunk_size)).c_str());
+        }
+        ImGui::Text(u8"청크 p50 %llu us / p99 %llu us", static_cast<unsigned long long>(m.chunk_latency.percentile(0.5)),
+                    static_cast<unsigned long long>(m.chunk_latency.percentile(0.99)));
+        if (m.role == "receive") {
+            ImGui::Text(u8"디스크 쓰기 p50 %llu us / p99 %llu us",
+                        static_cast<unsigned long long>(m.write_latency.percentile(0.5)),
+                        static_cast<unsigned long long>(m.write_latency.percentile(0.99)));
+        }
 
-    std::lock_guard<std::mutex> lock(log_mutex);
-    for (const auto& line : log_buffer) {
-        ImGui::TextUnformatted(line.c_str());
+        std::string phases;
+        for (size_t p = 0; p < m.phase_ms.size(); ++p) {
+            if (m.phase_ms[p] < 0) continue;
+            phases += std::string(phases.empty() ? "" : "  ") + session_phase_name(static_cast<session_phase>(p)) +
+                      " " + std::to_string(static_cast<long long>(m.phase_ms[p])) + "ms";
+        }
+        if (!phases.empty()) ImGui::TextUnformatted(phases.c_str());
+        ImGui::PopID();
     }
 
-    if (ImGui::GetScrollY() >= ImGui::GetScrollMaxY())
-        ImGui::SetScrollHereY(1.0f); // 자동 스크롤
-
     ImGui::End();
 }
 
 
-GLuint clipboard_texture = 0;
-int clipboard_width, clipboard_height;
 static int mode = 0;
 
+void draw_texture(const char* label, texture_slot slot, bool thumbnail) {
+    const texture_cache::entry& tex = textures.get(slot);
+    if (tex.id == 0) return;
+    ImGui::Text("%s", label);
+    ImVec2 size = thumbnail ? ImVec2(64, 64) : ImVec2(static_cast<float>(tex.width), static_cast<float>(tex.height));
+    ImGui::Image((ImTextureID)(intptr_t)tex.id, size);
+}
+
 void draw_webrtc_ui() {
     ImGui::Begin("File Transfer System");
 
@@ -429,50 +529,85 @@ void draw_webrtc_ui() {
         add_log("loading from clipboard");
         int width = 0, height = 0;
         if (get_image_from_clipboard(clipboard_data, width, height)) {
-            clipboard_texture = create_texture_from_rgba_memory(clipboard_data.data(), width, height);
-            clipboard_width = width;
-            clipboard_height = height;
+            textures.upload(texture_slot::clipboard, clipboard_data.data(), width, height);
+
+            clipboard_signal.paste(clipboard_data, width, height);
         }
     }
 
     if (mode == 0) {
         static char filePath[256] = "";
         static std::string generatedOffer;
+        static int channels = 1;
+        static int source = 0;
+        static int compression = static_cast<int>(compression_mode::automatic);
+        static int chunk = 0;
+        static int peers = 1;
+        static bool seed = false;
+        static bool lossy = false;
+        static int fec = 0;
+        static int priority = static_cast<int>(transfer_priority::normal);
+        static int rate_mb = 0;
+        static const size_t chunk_sizes[] = { 0, 16 << 10, 64 << 10, 256 << 10 };
 
         ImGui::InputText("File Path", filePath, sizeof(filePath));
+        ImGui::SliderInt("Channels", &channels, 1, 8);
+        ImGui::SliderInt("Peers", &peers, 1, 16);
+        ImGui::Combo("Read", &source, "stream\0mmap\0async\0");
+        ImGui::Combo("Compress", &compression, "off\0auto\0on\0");
+        ImGui::Combo("Chunk", &chunk, "auto\0" "16K\0" "64K\0" "256K\0");
+        ImGui::Checkbox("Seed", &seed);
+        ImGui::Checkbox("Lossy", &lossy);
+        if (lossy) ImGui::SliderInt("FEC", &fec, 0, 16);
+        ImGui::Combo("Priority", &priority, "low\0normal\0high\0");
+        ImGui::SliderInt("Rate MB/s", &rate_mb, 0, 100, rate_mb == 0 ? "unlimited" : "%d");
         if (ImGui::Button("Host")) {
             std::string path = filePath;
-            std::thread([](std::string p) {
-                send(p);
-            }, path).detach();
+            send_options options;
+            options.channels = channels;
+            options.source = static_cast<source_kind>(source);
+            options.compression = static_cast<compression_mode>(compression);
+            options.chunk_size = chunk_sizes[chunk];
+            options.seed = seed;
+            options.lossy = lossy;
+            options.fec_group = static_cast<size_t>(fec);
+            int fanout = peers;
+            transfer_job job;
+            job.name = path;
+            job.priority = static_cast<transfer_priority>(priority);
+            job.rate_limit = rate_mb * 1024.0 * 1024.0;
+            job.start = [path, options, fanout](const std::shared_ptr<shaped_flow>& flow) {
+                send_options shaped = options;
+                shaped.flow = flow;
+                return send(path, shaped, fanout);
+            };
+            scheduler->enqueue(std::move(job));
         }
 
-        if (offer_texture != 0) {
-            ImGui::Text("Encoded PNG Image:");
-            ImGui::Image((ImTextureID)(intptr_t)offer_texture, ImVec2(64, 64));
-        }
-
-        if (clipboard_texture != 0) {
-            ImGui::Text("Answer Image:");
-            ImGui::Image((ImTextureID)(intptr_t)clipboard_texture, ImVec2(clipboard_width, clipboard_height));
-        }
+        draw_texture("Encoded PNG Image:", texture_slot::offer, true);
+        draw_texture("Answer Image:", texture_slot::clipboard, false);
     }
     else {
+        static char digest[40] = "";
+        static int sources = 2;
+        static bool dedup = false;
+
+        ImGui::Checkbox("Dedup", &dedup);
         if (ImGui::Button("Start")) {
-            std::thread([]() {
-                recieve();
-            }).detach();
+            receive_options options;
+            options.dedup = dedup;
+            recieve(options);
         }
-
-        if (clipboard_texture != 0) {
-            ImGui::Text("Offer Image (from Clipboard):");
-            ImGui::Image((ImTextureID)(intptr_t)clipboard_texture, ImVec2(clipboard_width, clipboard_height));
+        ImGui::InputText("Digest", digest, sizeof(digest));
+        ImGui::SliderInt("Sources", &sources, 1, 8);
+        if (ImGui::Button("Swarm")) {
+            std::string hex = digest;
+            int count = sources;
+            sessions->run([hex, count]() { recieve_swarm(hex, count); });
         }
 
-        if (answer_texture != 0) {
-            ImGui::Text("Generated Answer Image:");
-            ImGui::Image((ImTextureID)(intptr_t)answer_texture, ImVec2(64, 64));
-        }
+        draw_texture("Offer Image (from Clipboard):", texture_slot::clipboard, false);
+        draw_texture("Generated Answer Image:", texture_slot::answer, true);
     }
 
     ImGui::End();
@@ -480,11 +615,12 @@ void draw_webrtc_ui() {
 
 std::vector<const char*> send_tutorial = {
     u8"전송시 사용법!",
-    u8"1. Upload 폴더 내에 있는 파일명을 넣는다.",
+    u8"1. Upload 폴더 내에 있는 파일명을 넣는다. (폴더명, 또는 a.txt;b.txt 처럼 여러 개도 가능)",
     u8"2. Host 버튼을 누른다.",
     u8"3. 상대 DM에 Ctrl+V로 붙여넣는다.",
     u8"4. 상대가 보낸 사진을 복사하여 붙여넣는다.",
-    u8"5. 전송이 완료되었다는 메시지가 뜨면 종료한다."
+    u8"5. 전송이 완료되었다는 메시지가 뜨면 종료한다.",
+    u8"* Seed 를 켜면 여러 명이 나눠 보내는 스웜 송신자가 된다. 로그의 다이제스트를 상대에게 알려 준다."
 };
 
 std::vector<const char*> recieve_tutorial = {
@@ -493,7 +629,9 @@ std::vector<const char*> recieve_tutorial = {
     u8"2. 상대가 보낸 사진을 복사하여 붙여넣는다.",
     u8"3. 두번째 사진이 나오면 상대에게 Ctrl+V로 붙여넣는다.",
     u8"4. 전송이 완료되었다는 메시지가 뜨면 Download 폴더에",
-    u8"파일이 있는지 확인한다."
+    u8"파일이 있는지 확인한다.",
+    u8"* Dedup 을 켜면 Download 폴더의 다른 파일에 이미 있는 부분은 받지 않는다.",
+    u8"* 스웜: Digest 와 Sources(송신자 수)를 넣고 Swarm 을 누른 뒤 송신자들의 사진을 차례로 붙여넣는다."
 };
 
 void draw_tutorial_ui() {
@@ -516,6 +654,12 @@ void draw_tutorial_ui() {
     ImGui::End();
 }
 
+// 전송 중에는 진행률과 통계가 바뀌므로 자주 그리고, 아무 일도 없으면 거의 잠들어 있는다
+constexpr double busy_redraw_s = 0.1;
+constexpr double idle_redraw_s = 1.0;
+// 입력 하나를 처리한 뒤 ImGui 가 상태(호버, 눌림, 창 이동)를 정리할 수 있게 몇 프레임 더 그린다
+constexpr int frames_after_event = 3;
+
 int main() {
     if (!glfwInit()) return 1;
 
@@ -537,21 +681,51 @@ int main() {
     io.FontDefault = font_korean; // << 이거 추가!
     io.Fonts->Build();
 
+    rtc::Configuration config;
+    config.iceServers.emplace_back("stun:stun.l.google.com:19302");
+    sessions = std::make_unique<session_manager>(config);
+    connect_signaling(*sessions, clipboard_signal);
+    scheduler = std::make_unique<transfer_scheduler>(2, 0, [](std::function<void()> task) { sessions->run(std::move(task)); });
+
+    // 로그 창과 세션 상태가 바뀌면 잠든 루프를 깨운다. 둘 다 다른 스레드에서 불린다
+    set_log_sink([](const log_record&) { wake_main_thread(); });
+    sessions->set_on_state([](uint64_t id, session_state state) {
+        scheduler->on_session_state(id, state);
+        wake_main_thread();
+    });
+
+    int extra_frames = frames_after_event;
     while (!glfwWindowShouldClose(window)) {
-        glfwPollEvents();
+        if (extra_frames > 0) {
+            --extra_frames;
+            glfwPollEvents();
+        }
+        else {
+            bool busy = sessions->active_sessions() > 0 || io.WantTextInput;
+            double timeout = busy ? busy_redraw_s : idle_redraw_s;
+            double before = glfwGetTime();
+            glfwWaitEventsTimeout(timeout);
+            // 시간이 다 되기 전에 깼으면 입력이나 깨우기가 있었던 것이다
+            if (glfwGetTime() - before < timeout) extra_frames = frames_after_event;
+        }
+        wake_pending.store(false, std::memory_order_release);
 
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
 
-        std::lock_guard<std::mutex> lock(clipboard_mutex);
-        if (clipboard_task) {
-            clipboard_task();
-            clipboard_task = nullptr;
+        std::vector<std::function<void()>> tasks;
+        {
+            std::lock_guard<std::mutex> lock(main_thread_mutex);
+            tasks.swap(main_thread_tasks);
         }
+        for (auto& task : tasks) task();
 
         draw_webrtc_ui();
         draw_log_window();
+        draw_metrics_window();
+        draw_queue_window();
+        draw_link_window();
         draw_tutorial_ui();
 
         ImGui::Render();
@@ -565,6 +739,13 @@ int main() {
         glfwSwapBuffers(window);
     }
 
+    set_log_sink(nullptr);
+    // 닫히는 세션이 스케줄러를 불러 다음 작업을 시작하지 않도록 먼저 끊는다
+    sessions->set_on_state(nullptr);
+    sessions.reset();
+    scheduler.reset();
+
+    textures.clear();
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
@@ -0,0 +1,316 @@
+﻿#include "metrics.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+
+namespace {
+
+int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void update_max(std::atomic<uint64_t>& target, uint64_t value) {
+    uint64_t seen = target.load(std::memory_order_relaxed);
+    while (seen < value && !target.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+    }
+}
+
+// JSON 문자열 안에 넣을 수 있게 바꾼다
+std::string escape(const std::string& text) {
+    std::string out;
+    for (unsigned char c : text) {
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        default:
+            if (c < 0x20) {
+                char buffer[8];
+                std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                out += buffer;
+            }
+            else {
+                out += static_cast<char>(c);
+            }
+        }
+    }
+    return out;
+}
+
+} // namespace
+
+void histogram::record(uint64_t us) {
+    size_t bucket = 0;
+    while (bucket + 1 < bucket_count && us >= upper_bound(bucket)) ++bucket;
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(us, std::memory_order_relaxed);
+    update_max(max_, us);
+}
+
+histogram::snapshot_t histogram::snapshot() const {
+    snapshot_t s;
+    for (size_t i = 0; i < bucket_count; ++i) s.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+    s.count = count_.load(std::memory_order_relaxed);
+    s.sum = sum_.load(std::memory_order_relaxed);
+    s.max = max_.load(std::memory_order_relaxed);
+    return s;
+}
+
+uint64_t histogram::snapshot_t::percentile(double p) const {
+    uint64_t total = 0;
+    for (uint64_t b : buckets) total += b;
+    if (total == 0) return 0;
+
+    uint64_t rank = static_cast<uint64_t>(p * static_cast<double>(total));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < bucket_count; ++i) {
+        seen += buckets[i];
+        if (seen > rank) return std::min(upper_bound(i), max);
+    }
+    return max;
+}
+
+void rate_window::add(uint64_t bytes) {
+    int64_t second = now_ns() / 1000000000;
+    int64_t expected = -1;
+    first_second_.compare_exchange_strong(expected, second, std::memory_order_relaxed);
+
+    size_t slot = static_cast<size_t>(second) % slot_count;
+    int64_t seen = seconds_[slot].load(std::memory_order_relaxed);
+    if (seen != second && seconds_[slot].compare_exchange_strong(seen, second, std::memory_order_relaxed)) {
+        bytes_[slot].store(0, std::memory_order_relaxed); // 칸을 새 초로 돌려 쓴다
+    }
+    bytes_[slot].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+double rate_window::bytes_per_second() const {
+    int64_t first = first_second_.load(std::memory_order_relaxed);
+    if (first < 0) return 0;
+
+    // 지금 채우는 초는 빼고, 시작한 지 얼마 안 됐으면 지난 초만큼만 나눈다
+    int64_t now = now_ns() / 1000000000;
+    int64_t span = std::min(window, now - first);
+    if (span <= 0) return 0;
+
+    uint64_t total = 0;
+    for (size_t i = 0; i < slot_count; ++i) {
+        int64_t second = seconds_[i].load(std::memory_order_relaxed);
+        if (second < now && second >= now - span) total += bytes_[i].load(std::memory_order_relaxed);
+    }
+    return static_cast<double>(total) / static_cast<double>(span);
+}
+
+const char* session_phase_name(session_phase phase) {
+    switch (phase) {
+    case session_phase::local_description: return "local_description";
+    case session_phase::remote_description: return "remote_description";
+    case session_phase::connected: return "connected";
+    case session_phase::first_byte: return "first_byte";
+    case session_phase::done: return "done";
+    case session_phase::count: break;
+    }
+    return "?";
+}
+
+session_metrics::session_metrics() : created_ns_(now_ns()) {
+}
+
+void session_metrics::mark(session_phase phase) {
+    auto& slot = phase_ns_[static_cast<size_t>(phase)];
+    if (slot.load(std::memory_order_relaxed) != 0) return;
+    int64_t expected = 0;
+    slot.compare_exchange_strong(expected, std::max<int64_t>(1, now_ns() - created_ns_), std::memory_order_relaxed);
+}
+
+double session_metrics::phase_ms(session_phase phase) const {
+    int64_t ns = phase_ns_[static_cast<size_t>(phase)].load(std::memory_order_relaxed);
+    return ns == 0 ? -1 : ns / 1e6;
+}
+
+void session_metrics::set_name(std::string name) {
+    std::lock_guard<std::mutex> lock(name_mutex_);
+    name_ = std::move(name);
+}
+
+std::string session_metrics::name() const {
+    std::lock_guard<std::mutex> lock(name_mutex_);
+    return name_;
+}
+
+void metrics_registry::add(uint64_t id, const char* role, std::shared_ptr<session_metrics> metrics) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_[id] = entry{ role, std::move(metrics) };
+}
+
+void metrics_registry::retire(uint64_t id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(id);
+    if (it == entries_.end()) return;
+    it->second.retired = true;
+
+    size_t retired = 0;
+    for (const auto& [key, e] : entries_) retired += e.retired;
+    for (auto at = entries_.begin(); retired > keep_finished && at != entries_.end();) {
+        if (at->second.retired) {
+            at = entries_.erase(at);
+            --retired;
+        }
+        else {
+            ++at;
+        }
+    }
+}
+
+std::vector<metrics_snapshot> metrics_registry::snapshot() const {
+    std::vector<std::pair<uint64_t, entry>> entries;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries.assign(entries_.begin(), entries_.end());
+    }
+
+    std::vector<metrics_snapshot> out;
+    out.reserve(entries.size());
+    for (const auto& [id, e] : entries) {
+        const session_metrics& m = *e.metrics;
+        metrics_snapshot s;
+        s.id = id;
+        s.role = e.role;
+        s.state = m.state.load();
+        s.name = m.name();
+        s.total_bytes = m.total_bytes;
+        s.bytes_sent = m.bytes_sent;
+        s.bytes_received = m.bytes_received;
+        s.bytes_written = m.bytes_written;
+        s.bytes_sparse = m.bytes_sparse;
+        s.bytes_retransmitted = m.bytes_retransmitted;
+        s.bytes_wire = m.bytes_wire;
+        s.fec_recovered = m.fec_recovered;
+        s.buffered = m.buffered;
+        s.peak_buffered = m.peak_buffered;
+        s.chunk_size = m.chunk_size;
+        s.bytes_acked = s.bytes_sent > s.buffered ? s.bytes_sent - s.buffered : 0;
+        s.rate = m.rate.bytes_per_second();
+        for (size_t p = 0; p < s.phase_ms.size(); ++p) s.phase_ms[p] = m.phase_ms(static_cast<session_phase>(p));
+        s.chunk_latency = m.chunk_latency.snapshot();
+        s.write_latency = m.write_latency.snapshot();
+
+        uint64_t done = (s.role == "send" ? s.bytes_acked : s.bytes_written) + s.bytes_sparse;
+        if (s.total_bytes > 0) s.progress = std::min(1.0, static_cast<double>(done) / s.total_bytes);
+        if (s.total_bytes >= done && s.rate > 0) s.eta_s = (s.total_bytes - done) / s.rate;
+        if (s.state == "finished") {
+            s.progress = 1.0;
+            s.eta_s = 0;
+        }
+        out.push_back(std::move(s));
+    }
+    return out;
+}
+
+std::string metrics_to_json(const std::vector<metrics_snapshot>& sessions) {
+    std::ostringstream out;
+    auto write_histogram = [&out](const histogram::snapshot_t& h) {
+        out << "{\"count\": " << h.count << ", \"sum_us\": " << h.sum << ", \"max_us\": " << h.max
+            << ", \"p50_us\": " << h.percentile(0.5) << ", \"p99_us\": " << h.percentile(0.99) << "}";
+    };
+
+    out << "{\"sessions\": [";
+    for (size_t i = 0; i < sessions.size(); ++i) {
+        const metrics_snapshot& s = sessions[i];
+        out << (i ? ",\n" : "\n") << "  {\"id\": " << s.id << ", \"role\": \"" << s.role << "\", \"state\": \""
+            << s.state << "\", \"name\": \"" << escape(s.name) << "\", \"total_bytes\": " << s.total_bytes
+            << ", \"bytes_sent\": " << s.bytes_sent << ", \"bytes_acked\": " << s.bytes_acked
+            << ", \"bytes_received\": " << s.bytes_received << ", \"bytes_written\": " << s.bytes_written
+            << ", \"bytes_sparse\": " << s.bytes_sparse
+            << ", \"bytes_retransmitted\": " << s.bytes_retransmitted << ", \"bytes_wire\": " << s.bytes_wire
+            << ", \"fec_recovered\": " << s.fec_recovered
+            << ", \"buffered\": " << s.buffered << ", \"peak_buffered\": " << s.peak_buffered
+            << ", \"chunk_size\": " << s.chunk_size
+            << ", \"rate_bytes_per_s\": " << s.rate << ", \"progress\": " << s.progress << ", \"eta_s\": " << s.eta_s
+            << ", \"phases_ms\": {";
+        for (size_t p = 0; p < s.phase_ms.size(); ++p) {
+            out << (p ? ", " : "") << "\"" << session_phase_name(static_cast<session_phase>(p)) << "\": " << s.phase_ms[p];
+        }
+        out << "}, \"chunk_latency\": ";
+        write_histogram(s.chunk_latency);
+        out << ", \"write_latency\": ";
+        write_histogram(s.write_latency);
+        out << "}";
+    }
+    out << "\n]}\n";
+    return out.str();
+}
+
+std::string metrics_to_prometheus(const std::vector<metrics_snapshot>& sessions) {
+    std::ostringstream out;
+    auto labels = [](const metrics_snapshot& s) {
+        return "session=\"" + std::to_string(s.id) + "\",role=\"" + s.role + "\"";
+    };
+    auto family = [&](const char* name, const char* type, const char* help, auto value_of) {
+        out << "# HELP fts_" << name << " " << help << "\n# TYPE fts_" << name << " " << type << "\n";
+        for (const auto& s : sessions) out << "fts_" << name << "{" << labels(s) << "} " << value_of(s) << "\n";
+    };
+    auto histogram_family = [&](const char* name, const char* help, auto histogram_of) {
+        out << "# HELP fts_" << name << " " << help << "\n# TYPE fts_" << name << " histogram\n";
+        for (const auto& s : sessions) {
+            const histogram::snapshot_t& h = histogram_of(s);
+            uint64_t cumulative = 0;
+            for (size_t i = 0; i + 1 < histogram::bucket_count; ++i) {
+                cumulative += h.buckets[i];
+                out << "fts_" << name << "_bucket{" << labels(s) << ",le=\"" << histogram::upper_bound(i) << "\"} "
+                    << cumulative << "\n";
+            }
+            out << "fts_" << name << "_bucket{" << labels(s) << ",le=\"+Inf\"} " << h.count << "\n";
+            out << "fts_" << name << "_sum{" << labels(s) << "} " << h.sum << "\n";
+            out << "fts_" << name << "_count{" << labels(s) << "} " << h.count << "\n";
+        }
+    };
+
+    family("total_bytes", "gauge", "Size of the file or archive being transferred.",
+          [](const metrics_snapshot& s) { return s.total_bytes; });
+    family("sent_bytes_total", "counter", "Payload bytes handed to the DataChannels.",
+          [](const metrics_snapshot& s) { return s.bytes_sent; });
+    family("acked_bytes_total", "counter", "Payload bytes that left the local send buffer.",
+          [](const metrics_snapshot& s) { return s.bytes_acked; });
+    family("received_bytes_total", "counter", "Payload bytes received.",
+          [](const metrics_snapshot& s) { return s.bytes_received; });
+    family("written_bytes_total", "counter", "Bytes written to disk.",
+          [](const metrics_snapshot& s) { return s.bytes_written; });
+    family("sparse_bytes_total", "counter", "Bytes of holes and zero runs sent as extent markers instead of data.",
+          [](const metrics_snapshot& s) { return s.bytes_sparse; });
+    family("retransmitted_bytes_total", "counter", "Payload bytes sent again after loss on a partially reliable channel.",
+          [](const metrics_snapshot& s) { return s.bytes_retransmitted; });
+    family("wire_bytes_total", "counter", "Message bytes handed to the DataChannels after compression, headers included.",
+          [](const metrics_snapshot& s) { return s.bytes_wire; });
+    family("fec_recovered_chunks_total", "counter", "Chunks rebuilt from FEC parity instead of being retransmitted.",
+          [](const metrics_snapshot& s) { return s.fec_recovered; });
+    family("buffered_bytes", "gauge", "Sum of DataChannel bufferedAmount.",
+          [](const metrics_snapshot& s) { return s.buffered; });
+    family("buffered_bytes_peak", "gauge", "Highest observed bufferedAmount.",
+          [](const metrics_snapshot& s) { return s.peak_buffered; });
+    family("chunk_size_bytes", "gauge", "Payload bytes per data chunk currently in use.",
+          [](const metrics_snapshot& s) { return s.chunk_size; });
+    family("rate_bytes_per_second", "gauge", "Throughput over the last few seconds.",
+          [](const metrics_snapshot& s) { return s.rate; });
+    family("progress_ratio", "gauge", "Completed fraction of the transfer.",
+          [](const metrics_snapshot& s) { return s.progress; });
+
+    out << "# HELP fts_phase_milliseconds Time from session start to each handshake phase.\n"
+           "# TYPE fts_phase_milliseconds gauge\n";
+    for (const auto& s : sessions) {
+        for (size_t p = 0; p < s.phase_ms.size(); ++p) {
+            if (s.phase_ms[p] < 0) continue;
+            out << "fts_phase_milliseconds{" << labels(s) << ",phase=\""
+                << session_phase_name(static_cast<session_phase>(p)) << "\"} " << s.phase_ms[p] << "\n";
+        }
+    }
+
+    histogram_family("chunk_latency_microseconds", "Per-chunk handling time.",
+                     [](const metrics_snapshot& s) -> const histogram::snapshot_t& { return s.chunk_latency; });
+    histogram_family("write_latency_microseconds", "Duration of one disk write.",
+                     [](const metrics_snapshot& s) -> const histogram::snapshot_t& { return s.write_latency; });
+    return out.str();
+}
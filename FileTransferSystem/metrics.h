@@ -0,0 +1,146 @@
+﻿#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// 세션별 전송 지표. 송수신 경로에서는 원자 연산만 하고, 읽는 쪽(GUI, 내보내기)이 스냅샷을 떠서 계산한다.
+
+// 마이크로초 단위 log2 구간 히스토그램. 구간 i 는 [2^(i-1), 2^i), 0 은 [0, 1), 마지막 구간은 나머지 전부
+class histogram {
+public:
+    static constexpr size_t bucket_count = 32;
+
+    void record(uint64_t us);
+
+    struct snapshot_t {
+        std::array<uint64_t, bucket_count> buckets{};
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t max = 0;
+
+        // 구간 위쪽 경계로 어림한 백분위 (us). 기록이 없으면 0
+        uint64_t percentile(double p) const;
+    };
+    snapshot_t snapshot() const;
+
+    // 구간 i 의 위쪽 경계 (us)
+    static uint64_t upper_bound(size_t bucket) { return uint64_t(1) << bucket; }
+
+private:
+    std::array<std::atomic<uint64_t>, bucket_count> buckets_{};
+    std::atomic<uint64_t> count_{ 0 };
+    std::atomic<uint64_t> sum_{ 0 };
+    std::atomic<uint64_t> max_{ 0 };
+};
+
+// 최근 window 초의 처리량. 초마다 칸을 돌려 쓰므로 잠금이 없다
+class rate_window {
+public:
+    static constexpr int64_t window = 5;
+
+    void add(uint64_t bytes);
+    double bytes_per_second() const;
+
+private:
+    static constexpr size_t slot_count = 8;
+
+    std::array<std::atomic<int64_t>, slot_count> seconds_{};
+    std::array<std::atomic<uint64_t>, slot_count> bytes_{};
+    std::atomic<int64_t> first_second_{ -1 };
+};
+
+// 연결 과정의 각 단계. 세션이 만들어진 시각을 기준으로 처음 도달한 시각만 남긴다
+enum class session_phase { local_description, remote_description, connected, first_byte, done, count };
+
+const char* session_phase_name(session_phase phase);
+
+struct session_metrics {
+    session_metrics();
+
+    std::atomic<uint64_t> total_bytes{ 0 };
+    std::atomic<uint64_t> bytes_sent{ 0 };     // 송신: DataChannel 에 넘긴 본문
+    std::atomic<uint64_t> bytes_received{ 0 }; // 수신: 받은 본문 (압축 해제 후)
+    std::atomic<uint64_t> bytes_written{ 0 };  // 수신: 디스크에 쓴 바이트
+    std::atomic<uint64_t> bytes_sparse{ 0 };   // 구멍이나 0 으로만 된 구간이라 길이만 주고받은 바이트
+    std::atomic<uint64_t> bytes_retransmitted{ 0 }; // 송신: 부분 신뢰 전송에서 잃어버려 다시 보낸 본문
+    std::atomic<uint64_t> bytes_wire{ 0 };     // 송신: 압축 뒤 실제로 채널에 넘긴 메시지 (헤더 포함)
+    std::atomic<uint64_t> fec_recovered{ 0 };  // 수신: FEC 패리티로 되살린 청크 수
+    std::atomic<uint64_t> buffered{ 0 };       // 송신: 채널들의 bufferedAmount 합
+    std::atomic<uint64_t> peak_buffered{ 0 };
+    std::atomic<uint64_t> chunk_size{ 0 };     // 송신: 지금 쓰는 청크 크기
+    rate_window rate;                          // 송신은 보낸 양, 수신은 쓴 양
+    histogram chunk_latency;                   // 송신: 청크 읽기~send, 수신: 메시지 하나 처리
+    histogram write_latency;                   // 수신: pwrite 한 번
+    std::atomic<const char*> state{ "" };      // session_state_name
+
+    void mark(session_phase phase);
+    // 도달하지 않았으면 -1
+    double phase_ms(session_phase phase) const;
+
+    void set_name(std::string name);
+    std::string name() const;
+
+private:
+    int64_t created_ns_;
+    std::array<std::atomic<int64_t>, static_cast<size_t>(session_phase::count)> phase_ns_{};
+    mutable std::mutex name_mutex_;
+    std::string name_;
+};
+
+struct metrics_snapshot {
+    uint64_t id = 0;
+    std::string role;
+    std::string state;
+    std::string name;
+    uint64_t total_bytes = 0;
+    uint64_t bytes_sent = 0;
+    uint64_t bytes_acked = 0;  // 송신: 로컬 버퍼를 떠난 바이트 (보낸 양 - bufferedAmount)
+    uint64_t bytes_received = 0;
+    uint64_t bytes_written = 0;
+    uint64_t bytes_sparse = 0;
+    uint64_t bytes_retransmitted = 0;
+    uint64_t bytes_wire = 0;
+    uint64_t fec_recovered = 0;
+    uint64_t buffered = 0;
+    uint64_t peak_buffered = 0;
+    uint64_t chunk_size = 0;
+    double rate = 0;           // bytes/s
+    double progress = 0;       // 0 ~ 1
+    double eta_s = -1;         // 모르면 -1
+    std::array<double, static_cast<size_t>(session_phase::count)> phase_ms{};
+    histogram::snapshot_t chunk_latency;
+    histogram::snapshot_t write_latency;
+};
+
+// 세션 id -> 지표. 끝난 세션도 keep_finished 개까지는 남겨 둔다
+class metrics_registry {
+public:
+    static constexpr size_t keep_finished = 16;
+
+    void add(uint64_t id, const char* role, std::shared_ptr<session_metrics> metrics);
+    // 끝난 세션으로 표시하고 오래된 것부터 정리한다
+    void retire(uint64_t id);
+
+    std::vector<metrics_snapshot> snapshot() const;
+
+private:
+    struct entry {
+        const char* role;
+        std::shared_ptr<session_metrics> metrics;
+        bool retired = false;
+    };
+
+    mutable std::mutex mutex_;
+    std::map<uint64_t, entry> entries_;
+};
+
+std::string metrics_to_json(const std::vector<metrics_snapshot>& sessions);
+// Prometheus text exposition 형식 (node_exporter textfile 수집기에 그대로 둘 수 있다)
+std::string metrics_to_prometheus(const std::vector<metrics_snapshot>& sessions);
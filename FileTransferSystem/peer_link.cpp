@@ -0,0 +1,602 @@
+﻿#include "peer_link.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+// keepalive 스레드가 깨는 간격. 끊김은 keepalive_timeout 보다 이만큼 늦게 알 수 있다
+static constexpr std::chrono::milliseconds keepalive_tick{ 250 };
+
+const char* pull_state_name(pull_state state) {
+    switch (state) {
+    case pull_state::requested: return "requested";
+    case pull_state::transferring: return "transferring";
+    case pull_state::finished: return "finished";
+    case pull_state::failed: return "failed";
+    }
+    return "?";
+}
+
+static bool is_terminal(pull_state state) {
+    return state == pull_state::finished || state == pull_state::failed;
+}
+
+static double elapsed_ms(peer_link::clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(peer_link::clock::now() - since).count();
+}
+
+// 받는측이 보낸 이름이 Upload 밖(절대 경로, ..)을 가리키면 거절한다
+static bool is_safe_name(const std::string& name) {
+    fs::path path = fs::u8path(name);
+    if (path.empty() || path.has_root_name() || path.has_root_directory()) return false;
+    for (const fs::path& part : path) {
+        if (part == "..") return false;
+    }
+    return true;
+}
+
+std::vector<remote_entry> list_directory(const fs::path& dir) {
+    std::vector<remote_entry> out;
+    std::error_code ec;
+    for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        remote_entry entry;
+        entry.name = it->path().filename().u8string();
+        // 이름은 제어 메시지 한 줄에 실린다
+        if (entry.name.find('\n') != std::string::npos) continue;
+        std::error_code kind_ec;
+        if (it->is_directory(kind_ec)) {
+            entry.directory = true;
+            std::error_code walk_ec;
+            for (fs::recursive_directory_iterator r(it->path(), walk_ec), rend; !walk_ec && r != rend; r.increment(walk_ec)) {
+                std::error_code size_ec;
+                if (!r->is_regular_file(size_ec)) continue;
+                uintmax_t size = r->file_size(size_ec);
+                if (!size_ec) entry.size += size;
+            }
+        }
+        else if (it->is_regular_file(kind_ec)) {
+            uintmax_t size = it->file_size(kind_ec);
+            if (!kind_ec) entry.size = size;
+        }
+        else {
+            continue;
+        }
+        out.push_back(std::move(entry));
+    }
+    std::sort(out.begin(), out.end(), [](const remote_entry& a, const remote_entry& b) { return a.name < b.name; });
+    return out;
+}
+
+std::shared_ptr<peer_link> peer_link::create_host(fs::path upload_dir, source_opener open, send_options options,
+                                                  runner run) {
+    auto link = std::shared_ptr<peer_link>(new peer_link(link_role::host, std::move(run)));
+    link->upload_dir_ = std::move(upload_dir);
+    link->open_ = std::move(open);
+    link->send_options_ = std::move(options);
+    link->metrics_->set_name("link:" + link->upload_dir_.filename().u8string());
+    link->start_keepalive();
+    return link;
+}
+
+std::shared_ptr<peer_link> peer_link::create_client(fs::path download_dir, receive_options options, runner run) {
+    auto link = std::shared_ptr<peer_link>(new peer_link(link_role::client, std::move(run)));
+    link->download_dir_ = std::move(download_dir);
+    link->receive_options_ = options;
+    link->metrics_->set_name("link:" + link->download_dir_.filename().u8string());
+    link->start_keepalive();
+    return link;
+}
+
+peer_link::peer_link(link_role role, runner run) : role_(role), run_(std::move(run)) {
+}
+
+peer_link::~peer_link() {
+    // 마지막 참조가 keepalive 스레드 안에서 풀렸으면 자기 자신을 join 할 수 없다
+    if (!keepalive_.joinable()) return;
+    if (keepalive_.get_id() == std::this_thread::get_id()) keepalive_.detach();
+    else keepalive_.join();
+}
+
+void peer_link::start_keepalive() {
+    std::weak_ptr<peer_link> weak = weak_from_this();
+    keepalive_ = std::thread([weak]() {
+        for (;;) {
+            std::this_thread::sleep_for(keepalive_tick);
+            auto self = weak.lock();
+            if (!self) return;
+            self->tick();
+        }
+    });
+}
+
+void peer_link::attach(const std::shared_ptr<rtc::PeerConnection>& pc) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pc_ = pc;
+    }
+    if (role_ == link_role::host) {
+        auto control = pc->createDataChannel(control_label);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            control_ = control;
+            control_open_ = false;
+            control_lost_ = false;
+        }
+        bind_control(control);
+        return;
+    }
+    std::weak_ptr<peer_link> weak = weak_from_this();
+    pc->onDataChannel([weak](std::shared_ptr<rtc::DataChannel> dc) {
+        if (auto self = weak.lock()) self->on_data_channel(dc);
+    });
+}
+
+void peer_link::detach() {
+    std::shared_ptr<rtc::PeerConnection> pc;
+    std::shared_ptr<rtc::DataChannel> control;
+    std::map<uint64_t, std::shared_ptr<file_sender>> serving;
+    std::vector<std::shared_ptr<file_receiver>> receivers;
+    std::vector<std::shared_ptr<rtc::DataChannel>> channels;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pc = std::move(pc_);
+        control = std::move(control_);
+        control_open_ = false;
+        control_lost_ = false;
+        serving.swap(serving_);
+        listing_.clear();
+        listing_expected_ = 0;
+        listed_ = false;
+        for (auto& [id, p] : pulls_) {
+            if (p.receiver) receivers.push_back(std::move(p.receiver));
+            for (auto& dc : p.channels) channels.push_back(std::move(dc));
+            p.channels.clear();
+            if (p.info.state == pull_state::transferring) p.info.state = pull_state::requested;
+        }
+    }
+    if (pc && role_ == link_role::client) pc->onDataChannel(nullptr);
+    if (control) {
+        control->onOpen(nullptr);
+        control->onMessage(nullptr);
+        control->close();
+    }
+    // 받던 것은 체크포인트를 남긴다. 다시 연결되면 같은 번호로 다시 요청해 이어받는다
+    for (auto& receiver : receivers) {
+        receiver->set_on_complete(nullptr);
+        receiver->suspend();
+    }
+    for (auto& dc : channels) dc->close();
+    if (!serving.empty()) add_log(u8"[link] 보내던 " + std::to_string(serving.size()) + u8"개는 다시 요청하면 이어서 보냅니다");
+    changed();
+}
+
+void peer_link::set_on_lost(std::function<void()> handler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    on_lost_ = std::move(handler);
+}
+
+void peer_link::set_on_change(std::function<void()> handler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    on_change_ = std::move(handler);
+}
+
+bool peer_link::connected() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return control_open_;
+}
+
+double peer_link::rtt_ms() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return rtt_ms_;
+}
+
+bool peer_link::request_list() {
+    if (role_ != link_role::client || !connected()) return false;
+    send_control({ msg_list });
+    return true;
+}
+
+std::vector<remote_entry> peer_link::remote_files() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return remote_;
+}
+
+bool peer_link::listed() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return listed_;
+}
+
+uint64_t peer_link::pull(const std::string& name) {
+    if (role_ != link_role::client) return 0;
+    uint64_t id;
+    std::vector<std::string> out;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // 같은 파일을 두 수신기가 동시에 쓰지 않게 한다
+        for (const auto& [existing, p] : pulls_) {
+            if (p.info.name == name && !is_terminal(p.info.state)) return existing;
+        }
+        id = next_pull_++;
+        pull_job& p = pulls_[id];
+        p.info.id = id;
+        p.info.name = name;
+        p.requested = clock::now();
+        if (control_open_) request_locked(p, out);
+    }
+    add_log(u8"[link] 요청: " + name);
+    send_control(out);
+    changed();
+    return id;
+}
+
+std::vector<pull_info> peer_link::pulls() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<pull_info> out;
+    for (const auto& [id, p] : pulls_) {
+        pull_info info = p.info;
+        if (p.receiver) {
+            const session_metrics& m = *p.receiver->metrics();
+            info.total_bytes = m.total_bytes;
+            info.bytes_written = m.bytes_written;
+            info.first_byte_ms = m.phase_ms(session_phase::first_byte);
+        }
+        out.push_back(std::move(info));
+    }
+    return out;
+}
+
+// 매번 새 수신기를 만든다. 앞 연결에서 받다 만 것은 수신기가 체크포인트를 찾아 __READY__ 로 알린다
+void peer_link::request_locked(pull_job& p, std::vector<std::string>& out) {
+    p.receiver = file_receiver::create(download_dir_, receive_options_);
+    p.channels.clear();
+    p.info.state = pull_state::requested;
+    ++p.info.attempts;
+
+    std::weak_ptr<peer_link> weak = weak_from_this();
+    uint64_t id = p.info.id;
+    const file_receiver* receiver = p.receiver.get();
+    // 쓰기 스레드에서 불리므로 수신기 정리는 풀로 넘긴다
+    p.receiver->set_on_complete([weak, id, receiver](bool ok) {
+        if (auto self = weak.lock()) self->post([id, receiver, ok](peer_link& link) { link.on_pull_done(id, receiver, ok); });
+    });
+    out.push_back(make_pull_request(id, p.info.name));
+}
+
+void peer_link::on_pull_done(uint64_t id, const file_receiver* receiver, bool ok) {
+    std::shared_ptr<file_receiver> done;
+    std::vector<std::shared_ptr<rtc::DataChannel>> channels;
+    pull_info info;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = pulls_.find(id);
+        if (it == pulls_.end() || is_terminal(it->second.info.state)) return;
+        pull_job& p = it->second;
+        if (receiver && p.receiver.get() != receiver) return;
+        done = std::move(p.receiver);
+        channels.swap(p.channels);
+        if (done) {
+            const session_metrics& m = *done->metrics();
+            p.info.total_bytes = m.total_bytes;
+            p.info.bytes_written = m.bytes_written;
+            p.info.first_byte_ms = m.phase_ms(session_phase::first_byte);
+        }
+        p.info.state = ok ? pull_state::finished : pull_state::failed;
+        p.info.done_ms = elapsed_ms(p.requested);
+        info = p.info;
+
+        // 끝난 것은 오래된 것부터 지운다
+        size_t finished = 0;
+        for (const auto& [pid, q] : pulls_) finished += is_terminal(q.info.state) ? 1 : 0;
+        for (auto q = pulls_.begin(); q != pulls_.end() && finished > keep_finished;) {
+            if (!is_terminal(q->second.info.state)) {
+                ++q;
+                continue;
+            }
+            q = pulls_.erase(q);
+            --finished;
+        }
+    }
+    if (done) done->set_on_complete(nullptr);
+    send_control({ msg_pulled + " " + std::to_string(id) + (ok ? " ok" : " failed") });
+    for (auto& dc : channels) dc->close();
+
+    std::ostringstream line;
+    line.precision(1);
+    line << std::fixed << (ok ? u8"[link] 받음: " : u8"[link] 실패: ") << info.name;
+    if (info.first_byte_ms >= 0) line << u8" (첫 바이트 " << info.first_byte_ms << u8" ms, 전체 " << info.done_ms << " ms)";
+    add_log(ok ? log_level::info : log_level::warning, 0, line.str());
+    changed();
+}
+
+void peer_link::bind_control(const std::shared_ptr<rtc::DataChannel>& dc) {
+    std::weak_ptr<peer_link> weak = weak_from_this();
+    std::weak_ptr<rtc::DataChannel> weak_dc = dc;
+    dc->onOpen([weak, weak_dc]() {
+        auto self = weak.lock();
+        auto dc = weak_dc.lock();
+        if (self && dc) self->on_control_open(dc);
+    });
+    dc->onMessage([weak, weak_dc](std::variant<rtc::binary, std::string> data) {
+        auto self = weak.lock();
+        if (!self || !std::holds_alternative<std::string>(data)) return;
+        // 상대가 보냈으면 열린 것이다. onOpen 보다 먼저 와도 답을 버리지 않는다.
+        // 끊겼다고 알린 채널에 늦게 온 메시지는 버린다. 다시 열면 끝나지 않은 수신기를 덮어쓴다
+        auto dc = weak_dc.lock();
+        if (!dc || !self->on_control_open(dc)) return;
+        self->on_control(std::get<std::string>(data));
+    });
+}
+
+// 받는측은 목록을 달라고 하고, 앞 연결에서 끝나지 않은 당겨 받기를 다시 요청한다
+bool peer_link::on_control_open(const std::shared_ptr<rtc::DataChannel>& dc) {
+    std::vector<std::string> out;
+    size_t resumed = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (dc != control_ || control_lost_) return false;
+        if (control_open_) return true;
+        control_open_ = true;
+        last_heard_ = clock::now();
+        last_ping_ = last_heard_;
+        if (role_ == link_role::client) {
+            out.push_back(msg_list);
+            for (auto& [id, p] : pulls_) {
+                if (is_terminal(p.info.state)) continue;
+                request_locked(p, out);
+                ++resumed;
+            }
+        }
+    }
+    add_log(u8"[link] 연결됨. 다음 파일부터는 채널만 새로 엽니다");
+    if (resumed > 0) add_log(u8"[link] 끝나지 않은 " + std::to_string(resumed) + u8"개를 다시 요청합니다");
+    send_control(out);
+    changed();
+    return true;
+}
+
+void peer_link::on_control(const std::string& message) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        last_heard_ = clock::now();
+    }
+    if (starts_with(message, msg_ping + " ")) {
+        send_control({ msg_pong + message.substr(msg_ping.size()) });
+        return;
+    }
+    if (starts_with(message, msg_pong + " ")) {
+        uint64_t seq = std::strtoull(message.c_str() + msg_pong.size() + 1, nullptr, 10);
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (seq == ping_seq_) rtt_ms_ = elapsed_ms(last_ping_);
+        return;
+    }
+
+    uint64_t id = 0;
+    std::string name;
+    if (role_ == link_role::host) {
+        if (message == msg_list) {
+            post([](peer_link& link) { link.send_list(); });
+            return;
+        }
+        if (parse_pull_request(message, id, name)) {
+            // 파일 열기와 묶음 목록 만들기는 채널 스레드에서 하지 않는다
+            post([id, name](peer_link& link) { link.serve(id, name); });
+            return;
+        }
+        if (starts_with(message, msg_pulled + " ")) {
+            id = std::strtoull(message.c_str() + msg_pulled.size() + 1, nullptr, 10);
+            std::shared_ptr<file_sender> done;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                auto it = serving_.find(id);
+                if (it == serving_.end()) return;
+                done = std::move(it->second);
+                serving_.erase(it);
+            }
+            // 송신기의 스레드를 join 하므로 풀에서 놓는다
+            post([done](peer_link&) {});
+            return;
+        }
+    }
+    else {
+        size_t count = 0;
+        if (starts_with(message, msg_files + " ")) {
+            std::istringstream iss(message.substr(msg_files.size() + 1));
+            if (!(iss >> count)) return;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                listing_.clear();
+                listing_expected_ = count;
+                if (count == 0) {
+                    remote_.clear();
+                    listed_ = true;
+                }
+            }
+            if (count == 0) changed();
+            return;
+        }
+        remote_entry entry;
+        if (parse_entry_message(message, entry)) {
+            bool complete = false;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (listing_.size() >= listing_expected_) return;
+                listing_.push_back(std::move(entry));
+                if (listing_.size() == listing_expected_) {
+                    remote_.swap(listing_);
+                    listing_.clear();
+                    listed_ = true;
+                    complete = true;
+                }
+            }
+            if (complete) changed();
+            return;
+        }
+        if (starts_with(message, msg_nofile + " ")) {
+            id = std::strtoull(message.c_str() + msg_nofile.size() + 1, nullptr, 10);
+            add_log(log_level::warning, 0, u8"[link] 상대에게 없는 파일입니다 (" + std::to_string(id) + ")");
+            post([id](peer_link& link) { link.on_pull_done(id, nullptr, false); });
+            return;
+        }
+    }
+    add_log(log_level::debug, 0, u8"[link] 받은 메시지: " + message);
+}
+
+void peer_link::on_data_channel(const std::shared_ptr<rtc::DataChannel>& dc) {
+    if (dc->label() == control_label) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            control_ = dc;
+            control_open_ = false;
+            control_lost_ = false;
+        }
+        bind_control(dc);
+        // 상대가 연 채널은 열린 채로 넘어온다
+        if (dc->isOpen()) on_control_open(dc);
+        return;
+    }
+
+    uint64_t id = 0;
+    std::shared_ptr<file_receiver> receiver;
+    if (parse_pull_label(dc->label(), id)) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = pulls_.find(id);
+        if (it != pulls_.end() && it->second.receiver) {
+            pull_job& p = it->second;
+            receiver = p.receiver;
+            p.channels.push_back(dc);
+            p.info.state = pull_state::transferring;
+        }
+    }
+    if (!receiver) {
+        // 이미 끝났거나 모르는 당겨 받기
+        dc->close();
+        return;
+    }
+    receiver->attach(dc);
+    changed();
+}
+
+void peer_link::serve(uint64_t id, const std::string& name) {
+    std::shared_ptr<rtc::PeerConnection> pc;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!pc_ || serving_.count(id) > 0) return;
+        pc = pc_;
+    }
+    std::string display;
+    rtc::binary manifest;
+    std::unique_ptr<chunk_source> source;
+    if (is_safe_name(name)) source = open_(name, display, manifest);
+    if (!source) {
+        add_log(log_level::warning, 0, u8"[link] 보낼 수 없는 이름: " + name);
+        send_control({ msg_nofile + " " + std::to_string(id) });
+        return;
+    }
+
+    send_options options = send_options_;
+    options.label = make_pull_label(id);
+    auto sender = file_sender::create(pc, std::move(source), std::move(display), options, std::move(manifest));
+    // 원본을 읽지 못하면 받는측에 없는 파일이라고 알려 당겨 받기를 실패로 끝내게 한다
+    std::weak_ptr<peer_link> weak = weak_from_this();
+    const file_sender* raw = sender.get();
+    sender->set_on_failed([weak, id, raw]() {
+        auto self = weak.lock();
+        if (!self) return;
+        self->post([id, raw](peer_link& link) {
+            std::shared_ptr<file_sender> done;
+            {
+                std::lock_guard<std::mutex> lock(link.mutex_);
+                auto it = link.serving_.find(id);
+                if (it == link.serving_.end() || it->second.get() != raw) return;
+                done = std::move(it->second);
+                link.serving_.erase(it);
+            }
+            link.send_control({ msg_nofile + " " + std::to_string(id) });
+        });
+    });
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // 그 사이 다시 연결했으면 버린다. 받는측이 새 연결에서 다시 요청한다
+        if (pc_ != pc) return;
+        serving_[id] = sender;
+    }
+    add_log(u8"[link] 보내는 중: " + name);
+}
+
+void peer_link::send_list() {
+    std::vector<remote_entry> entries = list_directory(upload_dir_);
+    std::vector<std::string> messages;
+    messages.reserve(entries.size() + 1);
+    messages.push_back(msg_files + " " + std::to_string(entries.size()));
+    for (const remote_entry& entry : entries) messages.push_back(make_entry_message(entry));
+    send_control(messages);
+}
+
+// 끊긴 채널에 보내면 libdatachannel 이 예외를 던진다. 다시 연결하면 필요한 것은 다시 보낸다
+void peer_link::send_control(const std::vector<std::string>& messages) {
+    if (messages.empty()) return;
+    std::shared_ptr<rtc::DataChannel> control;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!control_open_) return;
+        control = control_;
+    }
+    try {
+        for (const std::string& message : messages) control->send(message);
+    }
+    catch (const std::exception& e) {
+        add_log(log_level::debug, 0, std::string(u8"[link] 제어 메시지를 보내지 못함: ") + e.what());
+    }
+}
+
+void peer_link::tick() {
+    std::string ping;
+    bool timed_out = false;
+    std::function<void()> lost;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!control_ || !control_open_) return;
+        auto now = clock::now();
+        if (now - last_heard_ > keepalive_timeout) {
+            // 이 연결에서는 한 번만 알린다. 다시 연결해 새 제어 채널이 열릴 때까지 이 채널은 다시 열지 않는다
+            control_open_ = false;
+            control_lost_ = true;
+            timed_out = true;
+            lost = on_lost_;
+        }
+        else if (now - last_ping_ >= keepalive_interval) {
+            ping = msg_ping + " " + std::to_string(++ping_seq_);
+            last_ping_ = now;
+        }
+    }
+    if (timed_out) {
+        add_log(log_level::warning, 0, u8"[link] 상대가 " +
+                std::to_string(std::chrono::duration_cast<std::chrono::seconds>(keepalive_timeout).count()) +
+                u8"초 동안 응답하지 않습니다");
+        if (lost) lost();
+        changed();
+        return;
+    }
+    if (!ping.empty()) send_control({ ping });
+}
+
+void peer_link::changed() {
+    std::function<void()> handler;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        handler = on_change_;
+    }
+    if (handler) handler();
+}
+
+void peer_link::post(std::function<void(peer_link&)> task) {
+    std::weak_ptr<peer_link> weak = weak_from_this();
+    auto job = [weak, task = std::move(task)]() {
+        if (auto self = weak.lock()) task(*self);
+    };
+    if (run_) run_(std::move(job));
+    else job();
+}
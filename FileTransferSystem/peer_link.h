@@ -0,0 +1,159 @@
+﻿#pragma once
+
+#include <rtc/rtc.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "metrics.h"
+#include "protocol.h"
+#include "transfer.h"
+
+// 한 번 맺은 PeerConnection 을 열어 두고 파일을 골라 당겨 받는 지속 연결 (protocol.h 의 __LIST__ / __PULL__).
+// 내놓는측(host)은 "control" 채널을 만들고, 받는측(client)의 __LIST__ 에 Upload 목록으로 답하고,
+// __PULL__ 마다 채널 이름이 "pull-<번호>" 인 file_sender 를 새로 연다. 두 번째 파일부터는 SDP 교환과 ICE 없이
+// 채널만 열면 되므로 첫 바이트가 빨리 온다.
+// 양쪽은 keepalive_interval 마다 __PING__ 을 보내고, keepalive_timeout 동안 아무것도 듣지 못하면 on_lost 를 부른다.
+// 새 PeerConnection 에 다시 붙으면(attach) 받는측은 끝나지 않은 당겨 받기를 다시 요청하고 수신기는 체크포인트로 이어받는다.
+// SDP 를 다시 주고받는 일은 session_manager 가 맡는다. 모든 함수는 아무 스레드에서나 불러도 된다.
+
+enum class link_role { host, client };
+
+enum class pull_state { requested, transferring, finished, failed };
+
+const char* pull_state_name(pull_state state);
+
+struct pull_info {
+    uint64_t id = 0;
+    std::string name;
+    pull_state state = pull_state::requested;
+    uint64_t total_bytes = 0;
+    uint64_t bytes_written = 0;
+    double first_byte_ms = -1; // 마지막 요청부터 첫 바이트까지. 아직이면 -1
+    double done_ms = -1;       // 처음 요청부터 다 받을 때까지. 아직이면 -1
+    int attempts = 0;          // 다시 연결되어 다시 요청한 것까지 센다
+};
+
+// dir 바로 아래 항목들. 폴더는 안에 든 파일 크기를 더한다. 이름 순
+std::vector<remote_entry> list_directory(const std::filesystem::path& dir);
+
+class peer_link : public std::enable_shared_from_this<peer_link> {
+public:
+    using clock = std::chrono::steady_clock;
+    // 송신기 생성, 다 받은 수신기 정리 등 채널 스레드에서 하지 않을 일을 돌릴 곳 (세션 풀)
+    using runner = std::function<void(std::function<void()> task)>;
+    // 받는측이 요청한 name 을 보낼 공급원으로 연다. 열 수 없으면 nullptr.
+    // display 는 수신측에 알릴 이름, 폴더면 manifest 를 채운다 (open_archive_source)
+    using source_opener = std::function<std::unique_ptr<chunk_source>(const std::string& name, std::string& display,
+                                                                      rtc::binary& manifest)>;
+
+    static constexpr std::chrono::milliseconds keepalive_interval{ 2000 };
+    static constexpr std::chrono::milliseconds keepalive_timeout{ 10000 };
+    static constexpr size_t keep_finished = 16; // 끝난 당겨 받기를 이만큼까지 목록에 남긴다
+
+    // upload_dir 은 __LIST__ 에 보여 줄 폴더. 요청한 이름이 그 밖을 가리키면 거절한다
+    static std::shared_ptr<peer_link> create_host(std::filesystem::path upload_dir, source_opener open,
+                                                  send_options options, runner run);
+    static std::shared_ptr<peer_link> create_client(std::filesystem::path download_dir, receive_options options,
+                                                    runner run);
+    ~peer_link();
+
+    peer_link(const peer_link&) = delete;
+    peer_link& operator=(const peer_link&) = delete;
+
+    link_role role() const { return role_; }
+
+    // 새 PeerConnection 에 붙는다. 내놓는측은 "control" 채널을 만들므로 setLocalDescription 전에 부른다
+    void attach(const std::shared_ptr<rtc::PeerConnection>& pc);
+    // 지금 연결에서 뗀다. 보내던 것은 버리고, 받던 것은 체크포인트를 남긴 뒤 다음 attach 를 기다린다
+    void detach();
+
+    // keepalive_timeout 동안 상대 소식이 없다. 연결마다 한 번, keepalive 스레드에서 불린다
+    void set_on_lost(std::function<void()> handler);
+    // 목록, 당겨 받기 상태가 바뀌었다 (GUI 를 깨운다)
+    void set_on_change(std::function<void()> handler);
+
+    bool connected() const;
+    // 마지막 __PING__ 왕복 시간. 아직 없으면 -1
+    double rtt_ms() const;
+    const std::shared_ptr<session_metrics>& metrics() const { return metrics_; }
+
+    // 아래는 받는측만 쓴다. 연결되기 전에 부른 pull 은 연결되면 요청한다
+    bool request_list();
+    std::vector<remote_entry> remote_files() const;
+    // 이 연결에서 목록을 한 번이라도 다 받았다 (비어 있는 목록도)
+    bool listed() const;
+    // 당겨 받기 번호. 같은 이름을 받는 중이면 그 번호를 돌려주고, 내놓는측이면 0
+    uint64_t pull(const std::string& name);
+    std::vector<pull_info> pulls() const;
+
+private:
+    struct pull_job {
+        pull_info info;
+        clock::time_point requested;                // 처음 요청한 시각
+        std::shared_ptr<file_receiver> receiver;    // 지금 연결에서 받는 수신기
+        std::vector<std::shared_ptr<rtc::DataChannel>> channels;
+    };
+
+    peer_link(link_role role, runner run);
+
+    void start_keepalive();
+    void tick();
+    void bind_control(const std::shared_ptr<rtc::DataChannel>& dc);
+    // dc 가 지금 쓰는 제어 채널이고 끊겼다고 알린 적이 없으면 true
+    bool on_control_open(const std::shared_ptr<rtc::DataChannel>& dc);
+    void on_control(const std::string& message);
+    void on_data_channel(const std::shared_ptr<rtc::DataChannel>& dc);
+    void serve(uint64_t id, const std::string& name);
+    void send_list();
+    void request_locked(pull_job& p, std::vector<std::string>& out);
+    // receiver 가 지금 수신기가 아니면(다시 연결되어 바뀌었으면) 무시한다. nullptr 이면 따지지 않는다
+    void on_pull_done(uint64_t id, const file_receiver* receiver, bool ok);
+    void send_control(const std::vector<std::string>& messages);
+    void changed();
+    // run_ 에서 돌린다. 그때까지 링크가 사라졌으면 하지 않는다
+    void post(std::function<void(peer_link&)> task);
+
+    const link_role role_;
+    runner run_;
+    std::shared_ptr<session_metrics> metrics_ = std::make_shared<session_metrics>();
+
+    // 내놓는측
+    std::filesystem::path upload_dir_;
+    source_opener open_;
+    send_options send_options_;
+
+    // 받는측
+    std::filesystem::path download_dir_;
+    receive_options receive_options_;
+
+    mutable std::mutex mutex_;
+    std::shared_ptr<rtc::PeerConnection> pc_;
+    std::shared_ptr<rtc::DataChannel> control_;
+    bool control_open_ = false;
+    bool control_lost_ = false; // keepalive 가 끊겼다고 알렸다. 다음 attach() 까지 이 채널의 메시지는 버린다
+    clock::time_point last_heard_;
+    clock::time_point last_ping_;
+    uint64_t ping_seq_ = 0;
+    double rtt_ms_ = -1;
+    std::function<void()> on_lost_;
+    std::function<void()> on_change_;
+
+    std::map<uint64_t, std::shared_ptr<file_sender>> serving_; // 당겨 받기 번호 -> 송신기
+    std::vector<remote_entry> remote_;
+    std::vector<remote_entry> listing_; // 받는 중인 __FILES__ 목록
+    size_t listing_expected_ = 0;
+    bool listed_ = false;
+    std::map<uint64_t, pull_job> pulls_;
+    uint64_t next_pull_ = 1;
+
+    std::thread keepalive_; // 마지막 참조가 풀리면 스스로 끝난다
+};
@@ -0,0 +1,160 @@
+﻿#include "protocol.h"
+
+#include <cstdlib>
+#include <sstream>
+
+void put_u32(std::byte* p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = std::byte((v >> (i * 8)) & 0xFF);
+}
+
+void put_u64(std::byte* p, uint64_t v) {
+    for (int i = 0; i < 8; ++i) p[i] = std::byte((v >> (i * 8)) & 0xFF);
+}
+
+uint32_t get_u32(const std::byte* p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; --i) v = (v << 8) | std::to_integer<uint32_t>(p[i]);
+    return v;
+}
+
+uint64_t get_u64(const std::byte* p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) v = (v << 8) | std::to_integer<uint64_t>(p[i]);
+    return v;
+}
+
+void write_chunk_header(std::byte* out, const chunk_header& header) {
+    out[0] = std::byte(static_cast<uint8_t>(header.type));
+    out[1] = std::byte(header.flags);
+    out[2] = std::byte(0);
+    out[3] = std::byte(0);
+    put_u32(out + 4, header.length);
+    put_u64(out + 8, header.offset);
+    put_u64(out + 16, header.hash);
+    put_u32(out + 24, header.raw_length);
+    put_u32(out + 28, header.group);
+}
+
+bool read_chunk_header(const rtc::binary& message, chunk_header& header) {
+    if (message.size() < chunk_header_size) return false;
+    const std::byte* p = message.data();
+    header.type = static_cast<message_type>(std::to_integer<uint8_t>(p[0]));
+    header.flags = std::to_integer<uint8_t>(p[1]);
+    header.length = get_u32(p + 4);
+    header.offset = get_u64(p + 8);
+    header.hash = get_u64(p + 16);
+    header.raw_length = get_u32(p + 24);
+    header.group = get_u32(p + 28);
+    return message.size() == chunk_header_size + header.length;
+}
+
+std::string make_file_announce(const file_announce& announce) {
+    std::string head = std::to_string(announce.size) + " " + std::to_string(announce.channels) + " ";
+    if (announce.manifest_size > 0)
+        return msg_archive + " " + head + std::to_string(announce.manifest_size) + " " + announce.name;
+    return msg_file + " " + head + announce.name;
+}
+
+bool parse_file_announce(const std::string& message, file_announce& announce) {
+    bool archive = starts_with(message, msg_archive + " ");
+    if (!archive && !starts_with(message, msg_file + " ")) return false;
+    std::istringstream iss(message.substr((archive ? msg_archive : msg_file).size() + 1));
+    if (!(iss >> announce.size >> announce.channels)) return false;
+    announce.manifest_size = 0;
+    if (archive && !(iss >> announce.manifest_size && announce.manifest_size > 0)) return false;
+    iss.get(); // 구분 공백
+    std::getline(iss, announce.name);
+    return !announce.name.empty() && announce.channels > 0;
+}
+
+std::string make_seed_announce(const seed_announce& announce) {
+    return msg_seed + " " + std::to_string(announce.size) + " " + announce.digest.to_hex() + " " + announce.name;
+}
+
+bool parse_seed_announce(const std::string& message, seed_announce& announce) {
+    if (!starts_with(message, msg_seed + " ")) return false;
+    std::istringstream iss(message.substr(msg_seed.size() + 1));
+    std::string digest;
+    if (!(iss >> announce.size >> digest) || !file_digest::from_hex(digest, announce.digest)) return false;
+    iss.get(); // 구분 공백
+    std::getline(iss, announce.name);
+    return !announce.name.empty();
+}
+
+void append_block_hashes(const uint64_t* hashes, size_t count, rtc::binary& out) {
+    size_t at = out.size();
+    out.resize(at + count * block_hash_entry_size);
+    for (size_t i = 0; i < count; ++i) put_u64(out.data() + at + i * block_hash_entry_size, hashes[i]);
+}
+
+bool parse_block_hashes(const std::byte* data, size_t length, std::vector<uint64_t>& out) {
+    if (length % block_hash_entry_size != 0) return false;
+    for (size_t at = 0; at < length; at += block_hash_entry_size) out.push_back(get_u64(data + at));
+    return true;
+}
+
+std::string make_signature_announce(size_t block, size_t count) {
+    return msg_sigs + " " + std::to_string(block) + " " + std::to_string(count);
+}
+
+bool parse_signature_announce(const std::string& message, size_t& block, size_t& count) {
+    if (!starts_with(message, msg_sigs + " ")) return false;
+    std::istringstream iss(message.substr(msg_sigs.size() + 1));
+    return static_cast<bool>(iss >> block >> count) && block > 0;
+}
+
+std::string make_chunks_announce(size_t count) {
+    return msg_chunks + " " + std::to_string(count);
+}
+
+bool parse_chunks_announce(const std::string& message, size_t& count) {
+    if (!starts_with(message, msg_chunks + " ")) return false;
+    std::istringstream iss(message.substr(msg_chunks.size() + 1));
+    return static_cast<bool>(iss >> count);
+}
+
+std::string make_entry_message(const remote_entry& entry) {
+    return msg_entry + " " + std::to_string(entry.size) + (entry.directory ? " d " : " f ") + entry.name;
+}
+
+bool parse_entry_message(const std::string& message, remote_entry& entry) {
+    if (!starts_with(message, msg_entry + " ")) return false;
+    std::istringstream iss(message.substr(msg_entry.size() + 1));
+    std::string kind;
+    if (!(iss >> entry.size >> kind) || (kind != "f" && kind != "d")) return false;
+    entry.directory = kind == "d";
+    iss.get(); // 구분 공백
+    std::getline(iss, entry.name);
+    return !entry.name.empty();
+}
+
+std::string make_pull_request(uint64_t pull, const std::string& name) {
+    return msg_pull + " " + std::to_string(pull) + " " + name;
+}
+
+bool parse_pull_request(const std::string& message, uint64_t& pull, std::string& name) {
+    if (!starts_with(message, msg_pull + " ")) return false;
+    std::istringstream iss(message.substr(msg_pull.size() + 1));
+    if (!(iss >> pull) || pull == 0) return false;
+    iss.get(); // 구분 공백
+    std::getline(iss, name);
+    return !name.empty();
+}
+
+std::string make_pull_label(uint64_t pull) {
+    return "pull-" + std::to_string(pull);
+}
+
+bool parse_pull_label(const std::string& label, uint64_t& pull) {
+    if (!starts_with(label, "pull-")) return false;
+    char* end = nullptr;
+    const char* digits = label.c_str() + 5;
+    unsigned long long value = std::strtoull(digits, &end, 10);
+    if (end == digits || (*end != '\0' && *end != '-') || value == 0) return false;
+    pull = value;
+    return true;
+}
+
+bool starts_with(const std::string& message, const std::string& prefix) {
+    return message.compare(0, prefix.size(), prefix) == 0;
+}
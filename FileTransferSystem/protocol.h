@@ -0,0 +1,147 @@
+﻿#pragma once
+
+#include <rtc/rtc.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "hashing.h"
+
+// 제어 메시지 (문자열, "file" 채널로만 오간다)
+//   송신 -> 수신 : __FILE__ <size> <channels> <name>
+//   묶음 전송이면 __ARCHIVE__ <size> <channels> <manifest bytes> <name> 뒤에 manifest 메시지들
+//   수신 -> 송신 : __READY__ [이미 받은 구간]   (이어받기면 "0-65536,131072-196608")
+//   델타 전송이면 수신 -> 송신 : __SIGS__ <block> <count>, signature 메시지들, __READY__ delta
+//                 송신 -> 수신 : copy 메시지들 + 나머지 구간의 data 메시지
+//   중복 제거면 수신 -> 송신 : __READY__ cdc
+//               송신 -> 수신 : __CHUNKS__ <count>, chunk_list 메시지들
+//               수신 -> 송신 : 저장소에 없는 구간마다 __WANT__ <구간>, 그리고 __READY__
+//   수신 -> 송신 : __RESEND__ <구간>            (청크 해시가 맞지 않은 구간)
+//   송신 -> 수신 : __EOF__ <파일 다이제스트>
+//   스웜 (send_options::seed):
+//   송신 -> 수신 : __SEED__ <size> <파일 다이제스트> <name>, hashes 메시지들
+//   수신 -> 송신 : __WANT__ <구간>  (보내 달라)   __CANCEL__ <구간>  (다른 송신자에게서 받았다)   __DONE__
+//   부분 신뢰 (send_options::lossy, arq.h): "file" 채널은 제어만 싣고 데이터는 재전송 없는 채널로 간다
+//   송신 -> 수신 : __FILE__ 앞에 __ARQ__ <FEC 묶음 크기, 0 이면 없음>,  응답이 늦으면 __POLL__
+//   수신 -> 송신 : __ACK__ <지금까지 받은 구간>
+//   지속 연결 (peer_link): 한 번 연결한 뒤 "control" 채널을 열어 두고 파일을 골라 당겨 받는다
+//   받는측 -> 내놓는측 : __LIST__   __PULL__ <번호> <이름>   __PULLED__ <번호> ok|failed
+//   내놓는측 -> 받는측 : __FILES__ <개수> 뒤에 __ENTRY__ <size> f|d <이름> 들   __NOFILE__ <번호>
+//   양쪽 : __PING__ <순번> 에 __PONG__ <순번> 으로 답한다
+//   당겨 받는 파일은 "pull-<번호>" 로 시작하는 채널들에서 위의 보통 전송으로 오간다
+const std::string msg_file = "__FILE__";
+const std::string msg_archive = "__ARCHIVE__";
+const std::string msg_ready = "__READY__";
+const std::string msg_resend = "__RESEND__";
+const std::string msg_sigs = "__SIGS__";
+const std::string ready_delta = "delta";
+const std::string ready_cdc = "cdc";
+const std::string msg_chunks = "__CHUNKS__";
+const std::string msg_eof = "__EOF__";
+const std::string msg_seed = "__SEED__";
+const std::string msg_want = "__WANT__";
+const std::string msg_cancel = "__CANCEL__";
+const std::string msg_done = "__DONE__";
+const std::string msg_arq = "__ARQ__";
+const std::string msg_ack = "__ACK__";
+const std::string msg_poll = "__POLL__";
+const std::string msg_list = "__LIST__";
+const std::string msg_files = "__FILES__";
+const std::string msg_entry = "__ENTRY__";
+const std::string msg_pull = "__PULL__";
+const std::string msg_pulled = "__PULLED__";
+const std::string msg_nofile = "__NOFILE__";
+const std::string msg_ping = "__PING__";
+const std::string msg_pong = "__PONG__";
+const std::string control_label = "control";
+
+// 바이너리 메시지 종류
+enum class message_type : uint8_t {
+    data = 1,
+    signature = 2, // 델타용 블록 서명 묶음 (수신 -> 송신)
+    copy = 3,      // 델타용 복사 명령 묶음 (송신 -> 수신)
+    manifest = 4,  // 묶음 전송의 파일 목록 (송신 -> 수신)
+    hashes = 5,    // 스웜용 블록 해시 목록 조각. offset 은 첫 블록 번호 (송신 -> 수신)
+    chunk_list = 6, // 중복 제거용 내용 기반 청크 목록 조각. offset 은 첫 청크 번호 (송신 -> 수신)
+    zero = 7,       // 구멍이나 0 으로만 된 구간. 본문은 구간 길이(u64), offset 은 시작 위치 (송신 -> 수신)
+    parity = 8,     // FEC 묶음의 XOR 패리티 (arq.h). group 은 묶음 번호 (송신 -> 수신)
+};
+
+// chunk_header::flags
+constexpr uint8_t chunk_flag_compressed = 0x01; // 본문이 LZ4 로 압축되어 있다
+
+// 모든 바이너리 메시지 앞에 붙는 고정 헤더 (little endian)
+//   [0] type  [1] flags  [2..3] reserved  [4..7] length  [8..15] offset  [16..23] hash
+//   [24..27] raw_length  [28..31] group
+struct chunk_header {
+    message_type type = message_type::data;
+    uint8_t flags = 0;
+    uint32_t length = 0;      // 본문(전송되는) 길이
+    uint64_t offset = 0;      // 파일 내 위치
+    uint64_t hash = 0;        // 원본 본문의 chunk_hash
+    uint32_t raw_length = 0;  // 압축 전 길이 (압축된 경우만)
+    uint32_t group = 0;       // 부분 신뢰 전송의 FEC 묶음 번호. 0 이면 묶음에 들지 않는다
+};
+
+constexpr size_t chunk_header_size = 32;
+
+void write_chunk_header(std::byte* out, const chunk_header& header);
+bool read_chunk_header(const rtc::binary& message, chunk_header& header);
+
+struct file_announce {
+    uint64_t size = 0;
+    int channels = 1;
+    std::string name;
+    uint64_t manifest_size = 0; // 0 이 아니면 묶음 전송. name 은 받을 폴더 이름
+};
+
+std::string make_file_announce(const file_announce& announce);
+bool parse_file_announce(const std::string& message, file_announce& announce);
+
+struct seed_announce {
+    uint64_t size = 0;
+    file_digest digest;
+    std::string name;
+};
+
+std::string make_seed_announce(const seed_announce& announce);
+bool parse_seed_announce(const std::string& message, seed_announce& announce);
+
+// 내놓는측 Upload 폴더의 항목 하나. 폴더면 size 는 안에 든 파일 크기의 합이다
+struct remote_entry {
+    uint64_t size = 0;
+    bool directory = false;
+    std::string name;
+};
+
+std::string make_entry_message(const remote_entry& entry);
+bool parse_entry_message(const std::string& message, remote_entry& entry);
+
+// __PULL__ <번호> <이름>
+std::string make_pull_request(uint64_t pull, const std::string& name);
+bool parse_pull_request(const std::string& message, uint64_t& pull, std::string& name);
+
+// 당겨 받기 번호가 pull 인 송신기의 채널 이름 (send_options::label). "pull-7", 둘째 채널부터 "pull-7-1" ...
+std::string make_pull_label(uint64_t pull);
+bool parse_pull_label(const std::string& label, uint64_t& pull);
+
+// 블록 해시 (little endian u64) 를 out 뒤에 붙인다 / 읽어 out 뒤에 붙인다
+constexpr size_t block_hash_entry_size = 8;
+void append_block_hashes(const uint64_t* hashes, size_t count, rtc::binary& out);
+bool parse_block_hashes(const std::byte* data, size_t length, std::vector<uint64_t>& out);
+
+// __SIGS__ <block> <count>
+std::string make_signature_announce(size_t block, size_t count);
+bool parse_signature_announce(const std::string& message, size_t& block, size_t& count);
+
+// __CHUNKS__ <count>
+std::string make_chunks_announce(size_t count);
+bool parse_chunks_announce(const std::string& message, size_t& count);
+
+void put_u32(std::byte* p, uint32_t v);
+void put_u64(std::byte* p, uint64_t v);
+uint32_t get_u32(const std::byte* p);
+uint64_t get_u64(const std::byte* p);
+
+bool starts_with(const std::string& message, const std::string& prefix);
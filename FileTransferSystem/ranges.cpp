@@ -0,0 +1,83 @@
+﻿#include "ranges.h"
+
+#include <sstream>
+
+void range_set::add(uint64_t begin, uint64_t end) {
+    if (begin >= end) return;
+
+    auto it = ranges_.upper_bound(begin);
+    if (it != ranges_.begin()) {
+        auto prev = std::prev(it);
+        if (prev->second >= begin) {
+            begin = prev->first;
+            end = std::max(end, prev->second);
+            it = ranges_.erase(prev);
+        }
+    }
+    while (it != ranges_.end() && it->first <= end) {
+        end = std::max(end, it->second);
+        it = ranges_.erase(it);
+    }
+    ranges_.emplace(begin, end);
+}
+
+bool range_set::contains(uint64_t begin, uint64_t end) const {
+    if (begin >= end) return true;
+    auto it = ranges_.upper_bound(begin);
+    if (it == ranges_.begin()) return false;
+    --it;
+    return it->first <= begin && it->second >= end;
+}
+
+uint64_t range_set::covered() const {
+    uint64_t total = 0;
+    for (const auto& r : ranges_) total += r.second - r.first;
+    return total;
+}
+
+uint64_t range_set::contiguous_prefix() const {
+    if (ranges_.empty() || ranges_.begin()->first != 0) return 0;
+    return ranges_.begin()->second;
+}
+
+std::vector<range_set::range> range_set::missing(uint64_t total) const {
+    std::vector<range> out;
+    uint64_t pos = 0;
+    for (const auto& r : ranges_) {
+        if (r.first >= total) break;
+        if (r.first > pos) out.emplace_back(pos, r.first);
+        pos = std::max(pos, r.second);
+    }
+    if (pos < total) out.emplace_back(pos, total);
+    return out;
+}
+
+std::vector<range_set::range> range_set::to_vector() const {
+    return std::vector<range>(ranges_.begin(), ranges_.end());
+}
+
+std::string range_set::to_string() const {
+    std::string out;
+    for (const auto& r : ranges_) {
+        if (!out.empty()) out += ',';
+        out += std::to_string(r.first) + '-' + std::to_string(r.second);
+    }
+    return out;
+}
+
+range_set range_set::parse(const std::string& text) {
+    range_set set;
+    std::istringstream iss(text);
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+        size_t dash = item.find('-');
+        if (dash == std::string::npos) continue;
+        try {
+            set.add(std::stoull(item.substr(0, dash)), std::stoull(item.substr(dash + 1)));
+        }
+        catch (...) {
+            // 잘못된 항목은 건너뛴다
+        }
+    }
+    return set;
+}
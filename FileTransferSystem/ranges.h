@@ -0,0 +1,31 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// [begin, end) 구간들의 합집합. 겹치거나 맞닿은 구간은 하나로 합친다.
+class range_set {
+public:
+    using range = std::pair<uint64_t, uint64_t>;
+
+    void add(uint64_t begin, uint64_t end);
+    bool contains(uint64_t begin, uint64_t end) const;
+    void clear() { ranges_.clear(); }
+
+    uint64_t covered() const;
+    // 0 부터 끊김 없이 채워진 길이
+    uint64_t contiguous_prefix() const;
+    // [0, total) 중 비어 있는 구간들
+    std::vector<range> missing(uint64_t total) const;
+    std::vector<range> to_vector() const;
+
+    // "0-65536,131072-196608" 형식
+    std::string to_string() const;
+    static range_set parse(const std::string& text);
+
+private:
+    std::map<uint64_t, uint64_t> ranges_; // begin -> end
+};
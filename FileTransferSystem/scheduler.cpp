@@ -0,0 +1,256 @@
+﻿#include "scheduler.h"
+#include "log.h"
+
+#include <algorithm>
+
+// 작업이 세션 id 를 알려 주기 전에 끝난 세션을 이만큼까지 기억한다
+static constexpr size_t max_early_sessions = 64;
+
+const char* transfer_priority_name(transfer_priority priority) {
+    switch (priority) {
+    case transfer_priority::low: return "low";
+    case transfer_priority::normal: return "normal";
+    case transfer_priority::high: return "high";
+    }
+    return "?";
+}
+
+// 대화형 전송(high)이 대량 전송(low)에 밀리지 않도록 차이를 크게 둔다
+double transfer_priority_weight(transfer_priority priority) {
+    switch (priority) {
+    case transfer_priority::low: return 1;
+    case transfer_priority::normal: return 4;
+    case transfer_priority::high: return 16;
+    }
+    return 1;
+}
+
+const char* job_state_name(job_state state) {
+    switch (state) {
+    case job_state::queued: return "queued";
+    case job_state::starting: return "starting";
+    case job_state::active: return "active";
+    }
+    return "?";
+}
+
+transfer_scheduler::transfer_scheduler(size_t max_active, double global_rate, runner run)
+    : run_(std::move(run)), shaper_(bandwidth_shaper::create(global_rate)), max_active_(std::max<size_t>(1, max_active)) {
+}
+
+uint64_t transfer_scheduler::enqueue(transfer_job job) {
+    uint64_t id;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        id = next_id_++;
+        add_log(u8"[queue] 대기열에 추가: " + job.name + " (" + transfer_priority_name(job.priority) + ")");
+        jobs_[id].id = id;
+        jobs_[id].spec = std::move(job);
+    }
+    admit();
+    return id;
+}
+
+bool transfer_scheduler::set_priority(uint64_t id, transfer_priority priority) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = jobs_.find(id);
+    if (it == jobs_.end()) return false;
+    it->second.spec.priority = priority;
+    if (it->second.flow) it->second.flow->set_weight(transfer_priority_weight(priority));
+    return true;
+}
+
+bool transfer_scheduler::set_rate_limit(uint64_t id, double bytes_per_s) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = jobs_.find(id);
+    if (it == jobs_.end()) return false;
+    it->second.spec.rate_limit = std::max(0.0, bytes_per_s);
+    if (it->second.flow) it->second.flow->set_ceil(it->second.spec.rate_limit);
+    return true;
+}
+
+bool transfer_scheduler::pause(uint64_t id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = jobs_.find(id);
+    if (it == jobs_.end()) return false;
+    it->second.paused = true;
+    if (it->second.flow) it->second.flow->set_paused(true);
+    return true;
+}
+
+bool transfer_scheduler::resume(uint64_t id) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = jobs_.find(id);
+        if (it == jobs_.end()) return false;
+        it->second.paused = false;
+        if (it->second.flow) it->second.flow->set_paused(false);
+    }
+    admit();
+    return true;
+}
+
+bool transfer_scheduler::cancel(uint64_t id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = jobs_.find(id);
+    if (it == jobs_.end() || it->second.state != job_state::queued) return false;
+    add_log(u8"[queue] 대기열에서 뺌: " + it->second.spec.name);
+    jobs_.erase(it);
+    return true;
+}
+
+void transfer_scheduler::set_max_active(size_t count) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        max_active_ = std::max<size_t>(1, count);
+    }
+    admit();
+}
+
+void transfer_scheduler::set_global_rate(double bytes_per_s) {
+    shaper_->set_rate(bytes_per_s);
+}
+
+size_t transfer_scheduler::max_active() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return max_active_;
+}
+
+double transfer_scheduler::global_rate() const {
+    return shaper_->rate();
+}
+
+void transfer_scheduler::on_session_state(uint64_t session, session_state state) {
+    if (state != session_state::finished && state != session_state::failed) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto owner = session_jobs_.find(session);
+        if (owner == session_jobs_.end()) {
+            // 작업의 start 가 아직 id 를 돌려주지 않았을 수 있다. 상관없는 세션(수신 등)도 들어오므로 오래된 것은 버린다
+            early_[session] = state;
+            if (early_.size() > max_early_sessions) early_.erase(early_.begin());
+            return;
+        }
+        auto it = jobs_.find(owner->second);
+        session_jobs_.erase(owner);
+        if (it == jobs_.end()) return;
+        it->second.failed |= state == session_state::failed;
+        it->second.sessions.erase(session);
+        if (!it->second.sessions.empty()) return;
+        finish_locked(it);
+    }
+    admit();
+}
+
+std::vector<job_info> transfer_scheduler::jobs() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<job_info> out;
+    for (const auto& [id, j] : jobs_) {
+        job_info info;
+        info.id = id;
+        info.name = j.spec.name;
+        info.priority = j.spec.priority;
+        info.state = j.state;
+        info.paused = j.paused;
+        info.rate_limit = j.spec.rate_limit;
+        if (j.flow) {
+            info.bytes = j.flow->bytes();
+            info.assured = j.flow->assured();
+        }
+        out.push_back(std::move(info));
+    }
+    // 전송 중인 것 먼저, 대기 중인 것은 시작할 순서대로
+    std::stable_sort(out.begin(), out.end(), [](const job_info& a, const job_info& b) {
+        bool ra = a.state != job_state::queued, rb = b.state != job_state::queued;
+        if (ra != rb) return ra;
+        if (ra) return false;
+        return a.priority > b.priority;
+    });
+    return out;
+}
+
+size_t transfer_scheduler::active() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return running_locked();
+}
+
+// 자리가 나는 만큼 대기 중인 작업을 시작한다. start 는 잠금 밖에서 run_ 으로 돌린다
+void transfer_scheduler::admit() {
+    struct launch {
+        uint64_t id;
+        std::function<std::vector<uint64_t>(const std::shared_ptr<shaped_flow>&)> start;
+        std::shared_ptr<shaped_flow> flow;
+    };
+    std::vector<launch> launches;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        while (running_locked() < max_active_) {
+            auto it = next_locked();
+            if (it == jobs_.end()) break;
+            job& j = it->second;
+            j.state = job_state::starting;
+            j.flow = shaper_->add_flow(transfer_priority_weight(j.spec.priority), j.spec.rate_limit);
+            add_log(u8"[queue] 시작: " + j.spec.name);
+            launches.push_back({ j.id, j.spec.start, j.flow });
+        }
+    }
+    for (launch& l : launches) {
+        auto task = [this, l]() {
+            std::vector<uint64_t> sessions;
+            if (l.start) sessions = l.start(l.flow);
+            started(l.id, sessions);
+        };
+        if (run_) run_(std::move(task));
+        else task();
+    }
+}
+
+void transfer_scheduler::started(uint64_t id, const std::vector<uint64_t>& sessions) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = jobs_.find(id);
+        if (it == jobs_.end()) return;
+        job& j = it->second;
+        j.state = job_state::active;
+        if (sessions.empty()) j.failed = true;
+        for (uint64_t s : sessions) {
+            auto early = early_.find(s);
+            if (early != early_.end()) {
+                j.failed |= early->second == session_state::failed;
+                early_.erase(early);
+                continue;
+            }
+            j.sessions.insert(s);
+            session_jobs_[s] = id;
+        }
+        if (!j.sessions.empty()) return;
+        finish_locked(it);
+    }
+    admit();
+}
+
+void transfer_scheduler::finish_locked(std::map<uint64_t, job>::iterator it) {
+    const job& j = it->second;
+    add_log(j.failed ? log_level::warning : log_level::info, 0,
+            (j.failed ? u8"[queue] 실패: " : u8"[queue] 끝: ") + j.spec.name);
+    jobs_.erase(it);
+}
+
+// 멈추지 않은 대기 작업 중 우선순위가 가장 높고 먼저 들어온 것
+std::map<uint64_t, transfer_scheduler::job>::iterator transfer_scheduler::next_locked() {
+    auto best = jobs_.end();
+    for (auto it = jobs_.begin(); it != jobs_.end(); ++it) {
+        const job& j = it->second;
+        if (j.state != job_state::queued || j.paused) continue;
+        if (best == jobs_.end() || j.spec.priority > best->second.spec.priority) best = it;
+    }
+    return best;
+}
+
+size_t transfer_scheduler::running_locked() const {
+    size_t n = 0;
+    for (const auto& [id, j] : jobs_) {
+        if (j.state != job_state::queued) ++n;
+    }
+    return n;
+}
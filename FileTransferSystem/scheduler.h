@@ -0,0 +1,109 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "session.h"
+#include "shaper.h"
+
+// 우선순위. 대기열에서는 높은 것부터 시작하고, 전송 중에는 가중치대로 전체 대역폭을 나눈다
+enum class transfer_priority { low, normal, high };
+
+const char* transfer_priority_name(transfer_priority priority);
+double transfer_priority_weight(transfer_priority priority);
+
+// 대기열에 넣을 전송 작업 하나
+struct transfer_job {
+    std::string name;
+    transfer_priority priority = transfer_priority::normal;
+    double rate_limit = 0; // 작업의 초당 바이트 상한. 0 이면 없다
+    // 세션을 시작하고 그 id 들을 돌려준다 (팬아웃이면 여럿). 비어 있으면 시작하지 못한 것이다.
+    // flow 는 send_options::flow 에 넣는다
+    std::function<std::vector<uint64_t>(const std::shared_ptr<shaped_flow>& flow)> start;
+};
+
+// queued -> starting -> active -> (목록에서 빠짐)
+enum class job_state { queued, starting, active };
+
+const char* job_state_name(job_state state);
+
+struct job_info {
+    uint64_t id = 0;
+    std::string name;
+    transfer_priority priority = transfer_priority::normal;
+    job_state state = job_state::queued;
+    bool paused = false;
+    double rate_limit = 0;
+    uint64_t bytes = 0;   // 지금까지 보낸 바이트
+    double assured = 0;   // 보장된 초당 바이트. 전체 제한이 없으면 0
+};
+
+// 전송 작업 대기열. 동시에 도는 작업을 max_active 개로 묶고, 전체 속도와 작업별 상한을 bandwidth_shaper 로 건다.
+// 세션이 모두 끝난(finished/failed) 작업은 목록에서 빠지고 다음 작업이 시작된다.
+// 멈춘 작업은 대기 중이면 시작하지 않고, 전송 중이면 보내지 않되 자리는 그대로 차지한다.
+// 모든 함수는 아무 스레드에서나 불러도 된다.
+class transfer_scheduler {
+public:
+    using runner = std::function<void(std::function<void()> task)>;
+
+    // run 은 job.start 를 돌릴 곳 (세션 풀 등). 비어 있으면 부른 스레드에서 바로 돌린다.
+    // run 에 넘긴 작업이 다 끝나기 전에 스케줄러를 없애면 안 된다
+    explicit transfer_scheduler(size_t max_active = 2, double global_rate = 0, runner run = {});
+
+    transfer_scheduler(const transfer_scheduler&) = delete;
+    transfer_scheduler& operator=(const transfer_scheduler&) = delete;
+
+    uint64_t enqueue(transfer_job job);
+    bool set_priority(uint64_t job, transfer_priority priority);
+    bool set_rate_limit(uint64_t job, double bytes_per_s);
+    bool pause(uint64_t job);
+    bool resume(uint64_t job);
+    // 대기 중인 작업만 뺄 수 있다
+    bool cancel(uint64_t job);
+
+    void set_max_active(size_t count);
+    void set_global_rate(double bytes_per_s);
+    size_t max_active() const;
+    double global_rate() const;
+
+    // session_manager::set_on_state 에서 그대로 넘긴다
+    void on_session_state(uint64_t session, session_state state);
+
+    // 전송 중인 작업, 그 뒤로 시작할 순서대로 대기 중인 작업
+    std::vector<job_info> jobs() const;
+    size_t active() const;
+
+private:
+    struct job {
+        uint64_t id = 0;
+        transfer_job spec;
+        job_state state = job_state::queued;
+        bool paused = false;
+        std::shared_ptr<shaped_flow> flow;
+        std::set<uint64_t> sessions; // 아직 끝나지 않은 세션
+        bool failed = false;
+    };
+
+    void admit();
+    void started(uint64_t id, const std::vector<uint64_t>& sessions);
+    void finish_locked(std::map<uint64_t, job>::iterator it);
+    std::map<uint64_t, job>::iterator next_locked();
+    size_t running_locked() const;
+
+    runner run_;
+    std::shared_ptr<bandwidth_shaper> shaper_;
+
+    mutable std::mutex mutex_;
+    size_t max_active_;
+    std::map<uint64_t, job> jobs_; // id 순 = 넣은 순서
+    std::map<uint64_t, uint64_t> session_jobs_; // 세션 id -> 작업 id
+    std::map<uint64_t, session_state> early_; // 작업이 id 를 알려 주기 전에 끝난 세션
+    uint64_t next_id_ = 1;
+};
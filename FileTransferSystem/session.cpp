@@ -0,0 +1,538 @@
+﻿#include "session.h"
+#include "archive.h"
+#include "fanout.h"
+#include "log.h"
+#include "swarm.h"
+
+#include <sstream>
+
+const char* session_state_name(session_state state) {
+    switch (state) {
+    case session_state::gathering: return "gathering";
+    case session_state::awaiting_remote: return "awaiting_remote";
+    case session_state::connecting: return "connecting";
+    case session_state::transferring: return "transferring";
+    case session_state::finished: return "finished";
+    case session_state::failed: return "failed";
+    }
+    return "?";
+}
+
+struct session_manager::session {
+    uint64_t id = 0;
+    session_role role = session_role::send;
+    session_state state = session_state::gathering; // manager 의 mutex_ 로 보호
+    std::shared_ptr<rtc::PeerConnection> pc;         // 지속 연결은 다시 연결할 때 바뀐다 (mutex_)
+    uint64_t generation = 0;                         // pc 를 바꿀 때마다 늘린다. 옛 pc 의 소식을 걸러낸다 (mutex_)
+    std::shared_ptr<file_sender> sender;
+    std::shared_ptr<file_receiver> receiver;
+    std::shared_ptr<file_swarm> swarm;        // 스웜 수신이면 여러 세션이 나눠 갖는다
+    size_t swarm_peer = 0;
+    std::shared_ptr<session_metrics> metrics; // 송수신기의 지표. 만들어지기 전에는 비어 있다
+    std::shared_ptr<peer_link> link;          // 지속 연결. 다시 연결해도 그대로 남는다
+};
+
+static bool is_terminal(session_state state) {
+    return state == session_state::finished || state == session_state::failed;
+}
+
+// 콜백을 끊고 닫는다. 이 PeerConnection 의 소식은 더 오지 않는다
+static void release_peer(rtc::PeerConnection& pc) {
+    pc.onStateChange(nullptr);
+    pc.onGatheringStateChange(nullptr);
+    pc.onDataChannel(nullptr);
+    pc.close();
+}
+
+session_manager::session_manager(rtc::Configuration config, size_t threads)
+    : config_(std::move(config)), pool_(threads) {
+}
+
+session_manager::~session_manager() {
+    std::map<uint64_t, std::shared_ptr<session>> sessions;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sessions.swap(sessions_);
+        // 풀에 남은 지속 연결의 소식은 버린다. 다시 연결하지 않는다
+        for (auto& [id, s] : sessions) {
+            if (s->link) ++s->generation;
+        }
+    }
+    for (auto& [id, s] : sessions) {
+        if (s->receiver) s->receiver->set_on_complete(nullptr);
+        if (s->swarm) s->swarm->set_on_complete(nullptr);
+        if (s->sender) s->sender->set_on_failed(nullptr);
+        if (s->link) {
+            s->link->set_on_lost(nullptr);
+            s->link->detach();
+        }
+        // watch() 가 건 콜백은 this 를 쥐고 있으므로 close() 처럼 먼저 떼어 낸다
+        release_peer(*peer(s));
+    }
+}
+
+void session_manager::set_on_local_description(description_handler handler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    on_local_description_ = std::move(handler);
+}
+
+void session_manager::set_on_state(state_handler handler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    on_state_ = std::move(handler);
+}
+
+std::shared_ptr<session_manager::session> session_manager::add_session(session_role role, session_state state) {
+    auto s = std::make_shared<session>();
+    s->role = role;
+    s->state = state;
+    s->pc = std::make_shared<rtc::PeerConnection>(config_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        s->id = next_id_++;
+        sessions_.emplace(s->id, s);
+    }
+    add_log(log_level::info, s->id, session_state_name(state));
+    return s;
+}
+
+// PeerConnection 콜백은 풀에 작업만 넘긴다. libdatachannel 스레드에서 연결을 닫지 않기 위해서다
+void session_manager::watch(const std::shared_ptr<session>& s) {
+    std::weak_ptr<session> weak = s;
+    std::shared_ptr<rtc::PeerConnection> pc;
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pc = s->pc;
+        generation = s->generation;
+    }
+    pc->onStateChange([this, weak, generation](rtc::PeerConnection::State state) {
+        pool_.post([this, weak, generation, state]() {
+            if (auto s = weak.lock()) on_peer_state(s, generation, state);
+        });
+    });
+    pc->onGatheringStateChange([this, weak, generation](rtc::PeerConnection::GatheringState state) {
+        if (state != rtc::PeerConnection::GatheringState::Complete) return;
+        pool_.post([this, weak, generation]() {
+            auto s = weak.lock();
+            if (!s) return;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (s->generation != generation) return; // 다시 연결하기 전 PeerConnection
+            }
+            on_gathered(s);
+        });
+    });
+}
+
+std::shared_ptr<rtc::PeerConnection> session_manager::peer(const std::shared_ptr<session>& s) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return s->pc;
+}
+
+uint64_t session_manager::start_send(std::unique_ptr<chunk_source> source, std::string name, send_options options,
+                                     rtc::binary manifest) {
+    auto s = add_session(session_role::send, session_state::gathering);
+    watch(s);
+    s->sender = file_sender::create(s->pc, std::move(source), std::move(name), options, std::move(manifest));
+    register_metrics(s);
+
+    std::weak_ptr<session> weak = s;
+    s->sender->set_on_failed([this, weak]() {
+        pool_.post([this, weak]() {
+            if (auto s = weak.lock()) close(s, session_state::failed);
+        });
+    });
+    s->pc->setLocalDescription();
+    return s->id;
+}
+
+// base 아래의 names 를 보낼 공급원으로 연다. 열 수 없으면 nullptr
+static std::unique_ptr<chunk_source> open_send_paths(const std::filesystem::path& base,
+                                                     const std::vector<std::string>& names, const send_options& options,
+                                                     std::string& name, rtc::binary& manifest) {
+    if (names.empty()) return nullptr;
+    std::filesystem::path first = base / std::filesystem::u8path(names.front());
+    add_log(first.u8string());
+
+    std::unique_ptr<chunk_source> source;
+    name = first.filename().u8string();
+    if (names.size() > 1 || std::filesystem::is_directory(first)) {
+        auto entries = collect_archive_entries(base, names);
+        if (entries.empty()) {
+            add_log(log_level::error, 0, u8"보낼 파일이 없습니다!");
+            return nullptr;
+        }
+        add_log(u8"묶음 전송: " + std::to_string(entries.size()) + u8"개 파일, " +
+                std::to_string(archive_size(entries)) + " bytes");
+        append_manifest(entries, manifest);
+        if (names.size() > 1) name = "batch-" + std::to_string(entries.size());
+        source = open_archive_source(base, std::move(entries));
+    }
+    else {
+        source = open_chunk_source(first, options.source);
+        if (!source) {
+            add_log(log_level::error, 0, u8"파일 열기 실패!");
+            return nullptr;
+        }
+        add_log(std::string(u8"읽기 방식: ") + source_kind_name(options.source));
+    }
+    return source;
+}
+
+uint64_t session_manager::start_send_paths(const std::filesystem::path& base, const std::vector<std::string>& names,
+                                          send_options options) {
+    std::string name;
+    rtc::binary manifest;
+    auto source = open_send_paths(base, names, options, name, manifest);
+    if (!source) return 0;
+    return start_send(std::move(source), std::move(name), options, std::move(manifest));
+}
+
+std::vector<uint64_t> session_manager::start_fanout(const std::filesystem::path& base,
+                                                    const std::vector<std::string>& names, send_options options,
+                                                    size_t peers) {
+    std::vector<uint64_t> ids;
+    std::string name;
+    rtc::binary manifest;
+    auto source = open_send_paths(base, names, options, name, manifest);
+    if (!source) return ids;
+
+    add_log(u8"팬아웃: " + std::to_string(peers) + u8"명에게 보냄");
+    auto cache = shared_chunk_cache::create(std::move(source));
+    for (size_t i = 0; i < peers; ++i) ids.push_back(start_send(cache->open_reader(), name, options, manifest));
+    return ids;
+}
+
+uint64_t session_manager::start_receive(std::filesystem::path download_dir, receive_options options) {
+    auto s = add_session(session_role::receive, session_state::awaiting_remote);
+    watch(s);
+    s->receiver = file_receiver::create(std::move(download_dir), options);
+    register_metrics(s);
+
+    std::weak_ptr<session> weak = s;
+    s->receiver->set_on_complete([this, weak](bool ok) {
+        pool_.post([this, weak, ok]() {
+            if (auto s = weak.lock()) close(s, ok ? session_state::finished : session_state::failed);
+        });
+    });
+    std::weak_ptr<file_receiver> receiver = s->receiver;
+    s->pc->onDataChannel([receiver](std::shared_ptr<rtc::DataChannel> dc) {
+        if (auto r = receiver.lock()) r->attach(dc);
+    });
+    return s->id;
+}
+
+std::vector<uint64_t> session_manager::start_swarm(std::filesystem::path download_dir, file_digest digest, size_t peers) {
+    auto swarm = file_swarm::create(std::move(download_dir), digest, peers);
+    std::vector<std::weak_ptr<session>> members;
+    std::vector<uint64_t> ids;
+    for (size_t i = 0; i < swarm->peer_count(); ++i) {
+        auto s = add_session(session_role::receive, session_state::awaiting_remote);
+        watch(s);
+        s->swarm = swarm;
+        s->swarm_peer = i;
+        register_metrics(s);
+        s->pc->onDataChannel([weak = std::weak_ptr<file_swarm>(swarm), i](std::shared_ptr<rtc::DataChannel> dc) {
+            if (auto swarm = weak.lock()) swarm->attach(i, dc);
+        });
+        members.push_back(s);
+        ids.push_back(s->id);
+    }
+    add_log(u8"스웜: " + digest.to_hex() + u8" 를 " + std::to_string(ids.size()) + u8"명에게서 받습니다");
+
+    // 파일을 다 받으면 아직 연결된 세션을 모두 닫는다. 이미 끊긴 송신자의 세션은 failed 로 남는다
+    swarm->set_on_complete([this, members](bool ok) {
+        pool_.post([this, members, ok]() {
+            for (const auto& weak : members) {
+                if (auto s = weak.lock()) close(s, ok ? session_state::finished : session_state::failed);
+            }
+        });
+    });
+    return ids;
+}
+
+uint64_t session_manager::start_link_host(std::filesystem::path upload_dir, send_options options) {
+    auto s = add_session(session_role::send, session_state::gathering);
+    watch(s);
+    auto open = [upload_dir, options](const std::string& name, std::string& display, rtc::binary& manifest) {
+        return open_send_paths(upload_dir, { name }, options, display, manifest);
+    };
+    s->link = peer_link::create_host(upload_dir, open, options,
+                                     [this](std::function<void()> task) { pool_.post(std::move(task)); });
+    register_metrics(s);
+    watch_link(s);
+    s->link->attach(s->pc);
+    s->pc->setLocalDescription();
+    add_log(u8"[link] " + upload_dir.u8string() + u8" 를 내놓습니다. 연결을 끊기 전까지 요청받는 대로 보냅니다");
+    return s->id;
+}
+
+uint64_t session_manager::start_link_client(std::filesystem::path download_dir, receive_options options) {
+    auto s = add_session(session_role::receive, session_state::awaiting_remote);
+    watch(s);
+    s->link = peer_link::create_client(std::move(download_dir), options,
+                                       [this](std::function<void()> task) { pool_.post(std::move(task)); });
+    register_metrics(s);
+    watch_link(s);
+    s->link->attach(s->pc);
+    return s->id;
+}
+
+// keepalive 가 끊김을 알리면 새 PeerConnection 으로 다시 연결한다
+void session_manager::watch_link(const std::shared_ptr<session>& s) {
+    std::weak_ptr<session> weak = s;
+    s->link->set_on_lost([this, weak]() {
+        auto s = weak.lock();
+        if (!s) return;
+        uint64_t generation;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            generation = s->generation;
+        }
+        pool_.post([this, weak, generation]() {
+            if (auto s = weak.lock()) reconnect(s, generation);
+        });
+    });
+}
+
+// 풀 스레드에서만 부른다. 같은 연결에 대한 두 번째 요청(generation 이 지난 것)은 무시한다.
+// 내놓는측은 새 Offer 를 내고 받는측은 그것을 기다린다. 시그널링 통로는 그대로 쓴다
+void session_manager::reconnect(const std::shared_ptr<session>& s, uint64_t generation) {
+    auto pc = std::make_shared<rtc::PeerConnection>(config_);
+    std::shared_ptr<rtc::PeerConnection> old;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (is_terminal(s->state) || s->generation != generation) return;
+        old = s->pc;
+        s->pc = pc;
+        ++s->generation;
+    }
+    add_log(log_level::warning, s->id, u8"[link] 연결이 끊겼습니다. 새 연결을 맺습니다");
+    s->link->detach();
+    release_peer(*old);
+    watch(s);
+    s->link->attach(pc);
+    if (s->role == session_role::send) {
+        transition(s, session_state::gathering);
+        pc->setLocalDescription();
+    }
+    else {
+        transition(s, session_state::awaiting_remote);
+    }
+}
+
+std::shared_ptr<peer_link> session_manager::link(uint64_t id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = sessions_.find(id);
+    return it == sessions_.end() ? nullptr : it->second->link;
+}
+
+bool session_manager::stop(uint64_t id) {
+    std::shared_ptr<session> s;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = sessions_.find(id);
+        if (it == sessions_.end()) return false;
+        s = it->second;
+    }
+    pool_.post([this, s]() { close(s, session_state::finished); });
+    return true;
+}
+
+bool session_manager::deliver_remote_description(const std::string& sdp) {
+    std::shared_ptr<session> target;
+    std::shared_ptr<session> link;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& [id, s] : sessions_) {
+            if (s->state == session_state::awaiting_remote) {
+                target = s;
+                break;
+            }
+            if (!link && s->link && s->role == session_role::receive) link = s;
+        }
+        if (!target && !link) return false;
+    }
+    if (target) deliver(target, sdp);
+    else redeliver(link, sdp);
+    return true;
+}
+
+bool session_manager::deliver_remote_description(uint64_t id, const std::string& sdp) {
+    std::shared_ptr<session> target;
+    bool waiting;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = sessions_.find(id);
+        if (it == sessions_.end()) return false;
+        target = it->second;
+        waiting = target->state == session_state::awaiting_remote;
+        if (!waiting && (!target->link || target->role != session_role::receive)) return false;
+    }
+    if (waiting) deliver(target, sdp);
+    else redeliver(target, sdp);
+    return true;
+}
+
+void session_manager::redeliver(const std::shared_ptr<session>& s, const std::string& sdp) {
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        generation = s->generation;
+    }
+    pool_.post([this, s, generation, sdp]() {
+        reconnect(s, generation);
+        {
+            // keepalive 가 먼저 다시 연결했으면 그 연결에 넘긴다
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (s->state != session_state::awaiting_remote) return;
+        }
+        deliver(s, sdp);
+    });
+}
+
+void session_manager::deliver(const std::shared_ptr<session>& s, const std::string& sdp) {
+    // 바로 다음 단계로 넘겨 두 번째 붙여넣기가 다음 세션으로 가게 한다
+    transition(s, s->role == session_role::send ? session_state::connecting : session_state::gathering);
+    pool_.post([this, s, sdp]() { apply_remote(s, sdp); });
+}
+
+void session_manager::register_metrics(const std::shared_ptr<session>& s) {
+    auto metrics = s->sender ? s->sender->metrics()
+                 : s->receiver ? s->receiver->metrics()
+                 : s->link ? s->link->metrics()
+                 : s->swarm->peer_metrics(s->swarm_peer);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        s->metrics = metrics;
+        metrics->state = session_state_name(s->state);
+    }
+    metrics_.add(s->id, s->link ? "link" : s->role == session_role::send ? "send" : "receive", metrics);
+}
+
+void session_manager::apply_remote(const std::shared_ptr<session>& s, const std::string& sdp) {
+    s->metrics->mark(session_phase::remote_description);
+    auto pc = peer(s);
+    try {
+        if (s->role == session_role::send) {
+            pc->setRemoteDescription(rtc::Description(sdp, rtc::Description::Type::Answer));
+        }
+        else {
+            pc->setRemoteDescription(rtc::Description(sdp, rtc::Description::Type::Offer));
+            pc->setLocalDescription();
+        }
+    }
+    catch (const std::exception& e) {
+        add_log(log_level::error, s->id, std::string(u8"잘못된 SDP: ") + e.what());
+        close(s, session_state::failed);
+    }
+}
+
+void session_manager::on_gathered(const std::shared_ptr<session>& s) {
+    auto desc = peer(s)->localDescription();
+    if (!desc) return;
+    std::string sdp = std::string(*desc);
+
+    if (s->role == session_role::receive) {
+        // 수신측은 항상 DTLS 클라이언트가 된다
+        std::istringstream iss(sdp);
+        std::ostringstream oss;
+        for (std::string line; std::getline(iss, line);) {
+            if (line.rfind("a=setup:actpass", 0) == 0) oss << "a=setup:active\n";
+            else oss << line << "\n";
+        }
+        sdp = oss.str();
+    }
+    s->metrics->mark(session_phase::local_description);
+    transition(s, s->role == session_role::send ? session_state::awaiting_remote : session_state::connecting);
+
+    description_handler handler;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        handler = on_local_description_;
+    }
+    if (handler) handler(s->id, s->role, sdp);
+}
+
+void session_manager::on_peer_state(const std::shared_ptr<session>& s, uint64_t generation,
+                                    rtc::PeerConnection::State state) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (s->generation != generation) return; // 다시 연결하기 전 PeerConnection
+    }
+    switch (state) {
+    case rtc::PeerConnection::State::Connected:
+        s->metrics->mark(session_phase::connected);
+        transition(s, session_state::transferring);
+        break;
+    case rtc::PeerConnection::State::Disconnected:
+        // 지속 연결은 ICE 가 다시 붙을 수 있으므로 keepalive 가 끊겼다고 할 때까지 기다린다
+        if (s->link) {
+            add_log(log_level::warning, s->id, u8"[link] 연결이 불안정합니다");
+            break;
+        }
+        [[fallthrough]];
+    case rtc::PeerConnection::State::Closed:
+        if (s->link) {
+            reconnect(s, generation);
+            break;
+        }
+        // 수신측이 다 받고 연결을 닫으면 송신측은 여기서 끝난다
+        close(s, (s->sender && s->sender->finished()) || (s->swarm && s->swarm->finished())
+                     ? session_state::finished : session_state::failed);
+        break;
+    case rtc::PeerConnection::State::Failed:
+        if (s->link) reconnect(s, generation);
+        else close(s, session_state::failed);
+        break;
+    default:
+        break;
+    }
+}
+
+void session_manager::transition(const std::shared_ptr<session>& s, session_state state) {
+    state_handler handler;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (is_terminal(s->state) || s->state == state) return;
+        s->state = state;
+        if (s->metrics) s->metrics->state = session_state_name(state);
+        handler = on_state_;
+    }
+    add_log(log_level::info, s->id, session_state_name(state));
+    if (handler) handler(s->id, state);
+}
+
+// 풀 스레드에서만 부른다. 목록에서 빼고 콜백을 끊은 뒤 연결을 닫는다
+void session_manager::close(const std::shared_ptr<session>& s, session_state state) {
+    state_handler handler;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (is_terminal(s->state)) return;
+        s->state = state;
+        sessions_.erase(s->id);
+        handler = on_state_;
+        s->metrics->state = session_state_name(state);
+    }
+    s->metrics->mark(session_phase::done);
+    if (state == session_state::finished) s->metrics->buffered = 0; // 수신측이 다 받았다
+    metrics_.retire(s->id);
+    add_log(log_level::info, s->id, session_state_name(state));
+
+    if (s->receiver) s->receiver->set_on_complete(nullptr);
+    // 스웜은 다른 세션이 이어 받는다
+    if (s->swarm && state == session_state::failed) s->swarm->detach(s->swarm_peer);
+    if (s->link) {
+        s->link->set_on_lost(nullptr);
+        s->link->detach();
+    }
+    release_peer(*peer(s));
+    // 송수신기와 PeerConnection 은 이 세션을 잡고 있는 마지막 작업이 끝나면 함께 풀린다
+
+    if (handler) handler(s->id, state);
+}
+
+size_t session_manager::active_sessions() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return sessions_.size();
+}
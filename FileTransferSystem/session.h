@@ -0,0 +1,115 @@
+﻿#pragma once
+
+#include <rtc/rtc.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "hashing.h"
+#include "metrics.h"
+#include "peer_link.h"
+#include "thread_pool.h"
+#include "transfer.h"
+
+enum class session_role { send, receive };
+
+// 송신: gathering -> awaiting_remote(answer) -> connecting -> transferring -> finished
+// 수신: awaiting_remote(offer) -> gathering -> connecting -> transferring -> finished
+// 어느 단계에서든 연결이 끊기거나 실패하면 failed. finished/failed 가 되면 세션을 정리한다.
+// 지속 연결(peer_link)은 transferring 에 머물며 파일을 당겨 받고, 끊기면 새 PeerConnection 으로
+// 내놓는측은 gathering, 받는측은 awaiting_remote 부터 다시 시작한다. stop() 으로만 끝난다.
+enum class session_state { gathering, awaiting_remote, connecting, transferring, finished, failed };
+
+const char* session_state_name(session_state state);
+
+// 여러 전송 세션을 작은 스레드 풀 위에서 이벤트로 돌린다.
+// libdatachannel 콜백과 붙여넣은 SDP 는 모두 풀 작업으로 넘어가므로 세션마다 스레드를 두지 않는다.
+// 끝난 세션은 PeerConnection 을 닫고 목록에서 빠진다.
+class session_manager {
+public:
+    using description_handler = std::function<void(uint64_t id, session_role role, const std::string& sdp)>;
+    using state_handler = std::function<void(uint64_t id, session_state state)>;
+
+    explicit session_manager(rtc::Configuration config, size_t threads = 2);
+    // 남은 세션을 모두 닫는다
+    ~session_manager();
+
+    session_manager(const session_manager&) = delete;
+    session_manager& operator=(const session_manager&) = delete;
+
+    // start_* 전에 설정한다. 풀 스레드에서 불린다
+    void set_on_local_description(description_handler handler); // 상대에게 넘길 SDP 가 준비됐다
+    void set_on_state(state_handler handler);
+
+    uint64_t start_send(std::unique_ptr<chunk_source> source, std::string name, send_options options,
+                        rtc::binary manifest = {});
+    // base 아래의 names 를 연다. 파일 하나면 그대로, 폴더이거나 여러 개면 묶음으로 보낸다.
+    // 열 수 없거나 보낼 파일이 없으면 0
+    uint64_t start_send_paths(const std::filesystem::path& base, const std::vector<std::string>& names,
+                              send_options options);
+    // 같은 내용을 peers 명에게 보낸다. 세션은 수신자마다 따로 만들지만 원본은 shared_chunk_cache 로 한 번만 읽는다.
+    // 만든 세션 id 들을 돌려주고, 열 수 없으면 비어 있다
+    std::vector<uint64_t> start_fanout(const std::filesystem::path& base, const std::vector<std::string>& names,
+                                       send_options options, size_t peers);
+    uint64_t start_receive(std::filesystem::path download_dir, receive_options options = {});
+    // 다이제스트가 digest 인 파일을 peers 명의 송신자(send_options::seed)에게서 나눠 받는다.
+    // 송신자마다 수신 세션을 하나씩 만들고 그 id 들을 돌려준다
+    std::vector<uint64_t> start_swarm(std::filesystem::path download_dir, file_digest digest, size_t peers);
+    // 지속 연결. 내놓는측은 upload_dir 의 항목을 요청받는 대로 options 로 보내고 Offer 를 낸다.
+    // 받는측은 Offer 를 기다렸다가 link(id)->pull() 로 받은 파일을 download_dir 에 쓴다
+    uint64_t start_link_host(std::filesystem::path upload_dir, send_options options = {});
+    uint64_t start_link_client(std::filesystem::path download_dir, receive_options options = {});
+    // 지속 연결 세션의 링크. 없거나 이미 끝났으면 nullptr
+    std::shared_ptr<peer_link> link(uint64_t id) const;
+    // 세션을 닫는다 (finished). 지속 연결을 끝낼 때 쓴다
+    bool stop(uint64_t id);
+
+    // 상대 SDP 를 기다리는 가장 오래된 세션에 넘긴다. 기다리는 세션이 없으면 지속 연결의 받는측에 넘기고
+    // (내놓는측이 먼저 다시 연결한 것이다), 그것도 없으면 false
+    bool deliver_remote_description(const std::string& sdp);
+    // 정해진 세션에 넘긴다. 그 세션이 상대 SDP 를 기다리고 있지 않으면 false (지속 연결의 받는측은 받는다)
+    bool deliver_remote_description(uint64_t id, const std::string& sdp);
+
+    // 풀에서 잠깐 돌릴 작업 (보낼 파일 목록 모으기 등)
+    void run(std::function<void()> task) { pool_.post(std::move(task)); }
+
+    size_t active_sessions() const;
+
+    // 진행 중인 세션과 최근에 끝난 세션의 지표
+    const metrics_registry& metrics() const { return metrics_; }
+
+private:
+    struct session;
+
+    std::shared_ptr<session> add_session(session_role role, session_state state);
+    void deliver(const std::shared_ptr<session>& s, const std::string& sdp);
+    void watch(const std::shared_ptr<session>& s);
+    std::shared_ptr<rtc::PeerConnection> peer(const std::shared_ptr<session>& s) const;
+    void apply_remote(const std::shared_ptr<session>& s, const std::string& sdp);
+    void on_gathered(const std::shared_ptr<session>& s);
+    void on_peer_state(const std::shared_ptr<session>& s, uint64_t generation, rtc::PeerConnection::State state);
+    void watch_link(const std::shared_ptr<session>& s);
+    void reconnect(const std::shared_ptr<session>& s, uint64_t generation);
+    // 끊김을 알아채기 전에 받은 새 Offer. 다시 연결한 뒤 넘긴다
+    void redeliver(const std::shared_ptr<session>& s, const std::string& sdp);
+    void transition(const std::shared_ptr<session>& s, session_state state);
+    void close(const std::shared_ptr<session>& s, session_state state);
+    void register_metrics(const std::shared_ptr<session>& s);
+
+    rtc::Configuration config_;
+    description_handler on_local_description_;
+    state_handler on_state_;
+
+    mutable std::mutex mutex_;
+    std::map<uint64_t, std::shared_ptr<session>> sessions_; // id 순 = 만든 순서
+    uint64_t next_id_ = 1;
+    metrics_registry metrics_;
+
+    thread_pool pool_; // 가장 먼저 소멸하며 남은 작업을 마저 돌린다
+};
@@ -0,0 +1,246 @@
+﻿#include "shaper.h"
+
+#include <algorithm>
+
+namespace {
+
+double burst_for(double rate) {
+    return std::max(bandwidth_shaper::min_burst,
+                    rate * std::chrono::duration<double>(bandwidth_shaper::burst_time).count());
+}
+
+} // namespace
+
+void token_bucket::configure(double rate, double burst) {
+    rate_ = std::max(0.0, rate);
+    burst_ = std::max(0.0, burst);
+    tokens_ = std::min(tokens_, burst_);
+}
+
+void token_bucket::refill(clock::time_point now) {
+    if (!started_) {
+        started_ = true;
+        last_ = now;
+        return;
+    }
+    if (now <= last_) return;
+    tokens_ = std::min(burst_, tokens_ + rate_ * std::chrono::duration<double>(now - last_).count());
+    last_ = now;
+}
+
+token_bucket::clock::duration token_bucket::wait() const {
+    if (tokens_ >= 0) return clock::duration::zero();
+    if (rate_ <= 0) return clock::duration::max();
+    return std::chrono::ceil<clock::duration>(std::chrono::duration<double>(-tokens_ / rate_));
+}
+
+shaped_flow::shaped_flow(std::shared_ptr<bandwidth_shaper> shaper) : shaper_(std::move(shaper)) {
+}
+
+shaped_flow::~shaped_flow() {
+    std::lock_guard<std::mutex> lock(shaper_->mutex_);
+    auto& flows = shaper_->flows_;
+    flows.erase(std::remove(flows.begin(), flows.end(), this), flows.end());
+    shaper_->rebalance_locked();
+}
+
+shaped_flow::clock::duration shaped_flow::ready(clock::time_point now) {
+    std::lock_guard<std::mutex> lock(shaper_->mutex_);
+    clock::duration wait = wait_locked(now);
+    if (wait != clock::duration::zero()) blocked_ = true;
+    return wait;
+}
+
+// 상한 통이 비었으면 기다리고, 아니면 보장 몫이나 전체 통 중 먼저 차는 쪽을 기다린다
+shaped_flow::clock::duration shaped_flow::wait_locked(clock::time_point now) {
+    if (paused_) return clock::duration::max();
+    clock::duration wait = clock::duration::zero();
+    if (ceil_rate_ > 0) {
+        ceil_.refill(now);
+        wait = ceil_.wait();
+    }
+    if (shaper_->rate_ > 0) {
+        shaper_->root_.refill(now);
+        assured_.refill(now);
+        wait = std::max(wait, std::min(assured_.wait(), shaper_->root_.wait()));
+    }
+    return wait;
+}
+
+void shaped_flow::consume(size_t bytes, clock::time_point now) {
+    std::lock_guard<std::mutex> lock(shaper_->mutex_);
+    double n = static_cast<double>(bytes);
+    bytes_ += bytes;
+    if (ceil_rate_ > 0) {
+        ceil_.refill(now);
+        ceil_.take(n);
+    }
+    if (shaper_->rate_ > 0) {
+        shaper_->root_.refill(now);
+        assured_.refill(now);
+        // 보장 몫이 남았으면 거기서 내고, 아니면 전체 통에서 빌린 것이다. 어느 쪽이든 전체 통에서는 빠진다
+        if (assured_.ready()) assured_.take(n);
+        shaper_->root_.take(n);
+    }
+}
+
+void shaped_flow::add_waiter(std::function<bool()> waiter) {
+    std::lock_guard<std::mutex> lock(shaper_->mutex_);
+    waiters_.push_back(std::move(waiter));
+}
+
+void shaped_flow::set_weight(double weight) {
+    std::lock_guard<std::mutex> lock(shaper_->mutex_);
+    weight_ = std::max(weight, 1e-3);
+    shaper_->rebalance_locked();
+}
+
+void shaped_flow::set_ceil(double bytes_per_s) {
+    std::lock_guard<std::mutex> lock(shaper_->mutex_);
+    ceil_rate_ = std::max(0.0, bytes_per_s);
+    ceil_.configure(ceil_rate_, burst_for(ceil_rate_));
+    shaper_->rebalance_locked();
+}
+
+void shaped_flow::set_paused(bool paused) {
+    std::lock_guard<std::mutex> lock(shaper_->mutex_);
+    paused_ = paused;
+    // 멈춰 있던 송신기는 blocked_ 이므로 다음 poll() 이 깨운다
+    shaper_->rebalance_locked();
+}
+
+bool shaped_flow::paused() const {
+    std::lock_guard<std::mutex> lock(shaper_->mutex_);
+    return paused_;
+}
+
+uint64_t shaped_flow::bytes() const {
+    std::lock_guard<std::mutex> lock(shaper_->mutex_);
+    return bytes_;
+}
+
+double shaped_flow::assured() const {
+    std::lock_guard<std::mutex> lock(shaper_->mutex_);
+    return shaper_->rate_ > 0 && !paused_ ? assured_.rate() : 0;
+}
+
+std::shared_ptr<bandwidth_shaper> bandwidth_shaper::create(double global_rate, bool timer) {
+    auto shaper = std::shared_ptr<bandwidth_shaper>(new bandwidth_shaper(global_rate));
+    if (timer) {
+        std::weak_ptr<bandwidth_shaper> weak = shaper;
+        shaper->timer_ = std::thread([weak]() {
+            for (;;) {
+                std::this_thread::sleep_for(tick);
+                auto self = weak.lock();
+                if (!self) return;
+                self->poll();
+            }
+        });
+    }
+    return shaper;
+}
+
+bandwidth_shaper::bandwidth_shaper(double global_rate) {
+    rate_ = std::max(0.0, global_rate);
+    root_.configure(rate_, burst_for(rate_));
+}
+
+bandwidth_shaper::~bandwidth_shaper() {
+    // 마지막 참조가 타이머 스레드 안에서 풀렸으면 자기 자신을 join 할 수 없다
+    if (!timer_.joinable()) return;
+    if (timer_.get_id() == std::this_thread::get_id()) timer_.detach();
+    else timer_.join();
+}
+
+std::shared_ptr<shaped_flow> bandwidth_shaper::add_flow(double weight, double ceil) {
+    auto flow = std::shared_ptr<shaped_flow>(new shaped_flow(shared_from_this()));
+    flow->weight_ = std::max(weight, 1e-3);
+    flow->ceil_rate_ = std::max(0.0, ceil);
+    flow->ceil_.configure(flow->ceil_rate_, burst_for(flow->ceil_rate_));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    flow->id_ = next_flow_++;
+    flows_.push_back(flow.get());
+    rebalance_locked();
+    return flow;
+}
+
+void bandwidth_shaper::set_rate(double global_rate) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    rate_ = std::max(0.0, global_rate);
+    root_.configure(rate_, burst_for(rate_));
+    rebalance_locked();
+}
+
+double bandwidth_shaper::rate() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return rate_;
+}
+
+void bandwidth_shaper::poll(clock::time_point now) {
+    struct due {
+        shaped_flow* flow;
+        uint64_t id;
+        std::vector<std::function<bool()>> waiters;
+    };
+    std::vector<due> woken;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (shaped_flow* f : flows_) {
+            if (!f->blocked_ || f->wait_locked(now) != clock::duration::zero()) continue;
+            f->blocked_ = false;
+            woken.push_back({ f, f->id_, std::move(f->waiters_) });
+            f->waiters_.clear();
+        }
+    }
+    if (woken.empty()) return;
+
+    // 콜백은 송신기의 pump 를 돌리므로 잠금 밖에서 부른다. 그 사이 흐름이 사라졌을 수도 있다
+    for (due& d : woken) {
+        auto& waiters = d.waiters;
+        waiters.erase(std::remove_if(waiters.begin(), waiters.end(), [](std::function<bool()>& w) { return !w(); }),
+                      waiters.end());
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (due& d : woken) {
+        auto it = std::find(flows_.begin(), flows_.end(), d.flow);
+        if (it == flows_.end() || (*it)->id_ != d.id) continue;
+        auto& waiters = (*it)->waiters_;
+        waiters.insert(waiters.end(), std::make_move_iterator(d.waiters.begin()), std::make_move_iterator(d.waiters.end()));
+    }
+}
+
+// 전체 속도를 멈추지 않은 흐름들에게 가중치대로 나눈다. 몫이 상한보다 큰 흐름은 상한만 받고
+// 남는 것을 나머지가 다시 나눈다 (water-filling)
+void bandwidth_shaper::rebalance_locked() {
+    std::vector<shaped_flow*> open;
+    for (shaped_flow* f : flows_) {
+        if (f->paused_ || rate_ <= 0) f->assured_.configure(0, burst_for(0));
+        else open.push_back(f);
+    }
+    double remaining = rate_;
+    while (!open.empty()) {
+        double total_weight = 0;
+        for (shaped_flow* f : open) total_weight += f->weight_;
+        bool capped = false;
+        for (auto it = open.begin(); it != open.end();) {
+            shaped_flow* f = *it;
+            double share = remaining * f->weight_ / total_weight;
+            if (f->ceil_rate_ > 0 && f->ceil_rate_ < share) {
+                f->assured_.configure(f->ceil_rate_, burst_for(f->ceil_rate_));
+                remaining -= f->ceil_rate_;
+                it = open.erase(it);
+                capped = true;
+            }
+            else {
+                ++it;
+            }
+        }
+        if (capped) continue;
+        for (shaped_flow* f : open) {
+            double share = remaining * f->weight_ / total_weight;
+            f->assured_.configure(share, burst_for(share));
+        }
+        break;
+    }
+}
@@ -0,0 +1,133 @@
+﻿#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 송신 대역폭 제한. 전체(global) 통 하나 아래에 흐름(보통 전송 작업 하나)마다 통 두 개를 둔다.
+//   ceil     흐름의 상한. 0 이면 없다
+//   assured  전체 속도를 흐름 가중치대로 나눈 보장 몫. 몫 안의 전송은 전체 통이 비어도 나간다
+// 보장 몫을 다 쓴 흐름은 전체 통에 남은 토큰을 빌려 쓴다. 보장 몫으로 나간 바이트도 전체 통에서 빠지므로
+// 다른 흐름이 몫을 다 쓰고 있으면 빌릴 것이 없고, 쉬는 흐름이 있으면 그 몫이 빌려 쓰는 흐름에게 간다.
+// 토큰은 보낸 뒤 빼므로 잔고가 음수(빚)일 수 있다. 압축 뒤 크기를 미리 몰라도 평균 속도가 맞는다.
+
+// 초당 rate 바이트씩 차오르고 burst 바이트까지 쌓이는 토큰 통. 잠금은 부르는 쪽 몫이다
+class token_bucket {
+public:
+    using clock = std::chrono::steady_clock;
+
+    // rate 가 0 이면 차오르지 않는다. 잔고는 그대로 두되 burst 를 넘으면 자른다
+    void configure(double rate, double burst);
+    void refill(clock::time_point now);
+    void take(double bytes) { tokens_ -= bytes; }
+
+    bool ready() const { return tokens_ >= 0; }
+    // 잔고가 0 이 될 때까지 남은 시간. 이미 0 이상이면 0, 차오르지 않으면 duration::max()
+    clock::duration wait() const;
+    double rate() const { return rate_; }
+    double tokens() const { return tokens_; }
+
+private:
+    double rate_ = 0;
+    double burst_ = 0;
+    double tokens_ = 0;
+    clock::time_point last_{};
+    bool started_ = false;
+};
+
+class bandwidth_shaper;
+
+// 송신기 하나 또는 여러 개(같은 작업의 팬아웃 세션들)가 나눠 쓰는 흐름. 여러 스레드에서 불러도 된다.
+// 송신기는 청크를 보내기 전에 ready() 를 보고, 보낸 뒤 consume() 으로 보낸 바이트를 알린다.
+// ready() 가 0 이 아니면 멈추고, 토큰이 차면 bandwidth_shaper 의 타이머가 깨우기 콜백을 부른다.
+class shaped_flow {
+public:
+    using clock = token_bucket::clock;
+
+    ~shaped_flow();
+
+    shaped_flow(const shaped_flow&) = delete;
+    shaped_flow& operator=(const shaped_flow&) = delete;
+
+    // 0 이면 지금 보내도 된다. 아니면 그만큼 기다려야 한다 (멈춰 있으면 duration::max())
+    clock::duration ready(clock::time_point now = clock::now());
+    void consume(size_t bytes, clock::time_point now = clock::now());
+    // 막혔던 흐름이 다시 보낼 수 있게 되면 부른다. false 를 돌려주면 목록에서 뺀다 (송신기가 사라졌을 때)
+    void add_waiter(std::function<bool()> waiter);
+
+    // 가중치와 상한을 바꾸면 모든 흐름의 보장 몫을 다시 나눈다
+    void set_weight(double weight);
+    void set_ceil(double bytes_per_s);
+    // 멈춘 흐름은 보내지 않고 보장 몫도 다른 흐름에게 넘긴다
+    void set_paused(bool paused);
+    bool paused() const;
+
+    uint64_t bytes() const;
+    // 지금 보장된 초당 바이트. 전체 제한이 없으면 0
+    double assured() const;
+
+private:
+    friend class bandwidth_shaper;
+
+    explicit shaped_flow(std::shared_ptr<bandwidth_shaper> shaper);
+
+    clock::duration wait_locked(clock::time_point now);
+
+    std::shared_ptr<bandwidth_shaper> shaper_;
+    // 아래는 모두 shaper_->mutex_ 로 지킨다
+    double weight_ = 1;
+    double ceil_rate_ = 0;
+    token_bucket ceil_;
+    token_bucket assured_;
+    uint64_t id_ = 0;      // 주소가 다시 쓰여도 다른 흐름과 헷갈리지 않게
+    bool paused_ = false;
+    bool blocked_ = false; // ready() 가 기다리라고 한 뒤 아직 깨우지 않았다
+    uint64_t bytes_ = 0;
+    std::vector<std::function<bool()>> waiters_;
+};
+
+class bandwidth_shaper : public std::enable_shared_from_this<bandwidth_shaper> {
+public:
+    using clock = token_bucket::clock;
+
+    static constexpr std::chrono::milliseconds tick{ 5 };          // 막힌 흐름을 살피는 간격
+    static constexpr std::chrono::milliseconds burst_time{ 50 };   // 통에 쌓을 수 있는 양 = 속도 * 이 시간
+    static constexpr double min_burst = 64.0 * 1024;
+
+    // global_rate 는 초당 바이트, 0 이면 전체 제한이 없다.
+    // timer 가 false 면 타이머 스레드를 만들지 않는다. 가상 시계로 시험할 때 poll() 을 직접 부른다
+    static std::shared_ptr<bandwidth_shaper> create(double global_rate = 0, bool timer = true);
+    ~bandwidth_shaper();
+
+    bandwidth_shaper(const bandwidth_shaper&) = delete;
+    bandwidth_shaper& operator=(const bandwidth_shaper&) = delete;
+
+    // ceil 은 초당 바이트, 0 이면 흐름 상한이 없다
+    std::shared_ptr<shaped_flow> add_flow(double weight = 1, double ceil = 0);
+
+    void set_rate(double global_rate);
+    double rate() const;
+
+    // 막혀 있던 흐름 중 다시 보낼 수 있게 된 것의 깨우기 콜백을 부른다
+    void poll(clock::time_point now = clock::now());
+
+private:
+    friend class shaped_flow;
+
+    explicit bandwidth_shaper(double global_rate);
+
+    void rebalance_locked();
+
+    mutable std::mutex mutex_;
+    double rate_ = 0;
+    token_bucket root_;
+    // 흐름은 소멸자에서 잠금을 잡고 스스로 빠지므로 잠금 안에서는 모두 살아 있다
+    std::vector<shaped_flow*> flows_;
+    uint64_t next_flow_ = 1;
+    std::thread timer_;
+};
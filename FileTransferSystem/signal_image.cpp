@@ -0,0 +1,178 @@
+﻿#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb/stb_image.h>
+#include <stb/stb_image_write.h>
+
+#include "signal_image.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <sstream>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define FTS_SWIZZLE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+constexpr unsigned char signal_magic[4] = { 'F', 'T', 'S', 'I' };
+constexpr uint8_t signal_version = 1;
+constexpr uint8_t signal_flag_deflated = 0x01;
+
+constexpr std::array<uint32_t, 256> make_crc_table() {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        table[i] = c;
+    }
+    return table;
+}
+
+constexpr std::array<uint32_t, 256> crc_table = make_crc_table();
+
+void put_le32(unsigned char* p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = static_cast<unsigned char>(v >> (i * 8));
+}
+
+uint32_t get_le32(const unsigned char* p) {
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+bool starts_with(const std::string& s, const char* prefix) {
+    return s.compare(0, std::char_traits<char>::length(prefix), prefix) == 0;
+}
+
+// a=candidate:<foundation> <component> <transport> <priority> <address> <port> typ <type> ...
+bool keep_candidate(const std::string& line, std::set<std::string>& seen) {
+    std::istringstream iss(line);
+    std::string foundation, component, transport, priority, address, port;
+    if (!(iss >> foundation >> component >> transport >> priority >> address >> port)) return true;
+
+    for (std::string* s : { &transport, &address })
+        std::transform(s->begin(), s->end(), s->begin(), [](unsigned char c) { return char(std::tolower(c)); });
+    if (transport == "tcp") return false; // libjuice 는 UDP 만 쓴다
+    if (starts_with(address, "fe80:")) return false;
+    return seen.insert(component + " " + transport + " " + address + " " + port).second;
+}
+
+} // namespace
+
+std::string minify_sdp(const std::string& sdp) {
+    std::istringstream iss(sdp);
+    std::string out;
+    std::set<std::string> candidates;
+    for (std::string line; std::getline(iss, line);) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+        if (starts_with(line, "a=msid-semantic") || line == "a=extmap-allow-mixed") continue;
+        if (starts_with(line, "a=candidate:") && !keep_candidate(line.substr(12), candidates)) continue;
+        out += line;
+        out += '\n';
+    }
+    return out;
+}
+
+uint32_t crc32(const void* data, size_t length, uint32_t crc) {
+    const auto* p = static_cast<const unsigned char*>(data);
+    uint32_t c = crc ^ 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; ++i) c = crc_table[(c ^ p[i]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+std::vector<unsigned char> encode_signal(const std::string& input) {
+    // 줄지 않으면 그냥 싣는다
+    int packed_length = 0;
+    unsigned char* packed = stbi_zlib_compress(reinterpret_cast<unsigned char*>(const_cast<char*>(input.data())),
+                                               static_cast<int>(input.size()), &packed_length, 9);
+    bool deflated = packed && static_cast<size_t>(packed_length) < input.size();
+    const unsigned char* payload = deflated ? packed : reinterpret_cast<const unsigned char*>(input.data());
+    size_t payload_length = deflated ? static_cast<size_t>(packed_length) : input.size();
+
+    std::vector<unsigned char> out(signal_header_size + payload_length);
+    unsigned char* p = out.data();
+    std::copy(std::begin(signal_magic), std::end(signal_magic), p);
+    p[4] = signal_version;
+    p[5] = deflated ? signal_flag_deflated : 0;
+    put_le32(p + 8, static_cast<uint32_t>(payload_length));
+    put_le32(p + 12, crc32(payload, payload_length, crc32(p, 12)));
+    std::copy(payload, payload + payload_length, p + signal_header_size);
+
+    free(packed);
+    return out;
+}
+
+bool decode_signal(const unsigned char* data, size_t length, std::string& out) {
+    if (length < signal_header_size) return false;
+
+    const unsigned char* p = data;
+    if (!std::equal(std::begin(signal_magic), std::end(signal_magic), p) || p[4] != signal_version) return false;
+    size_t payload_length = get_le32(p + 8);
+    if (payload_length > length - signal_header_size) return false;
+
+    const unsigned char* payload = p + signal_header_size;
+    if (crc32(payload, payload_length, crc32(p, 12)) != get_le32(p + 12)) return false;
+
+    if (!(p[5] & signal_flag_deflated)) {
+        out.assign(reinterpret_cast<const char*>(payload), payload_length);
+        return true;
+    }
+    int text_length = 0;
+    char* text = stbi_zlib_decode_malloc(reinterpret_cast<const char*>(payload), static_cast<int>(payload_length),
+                                         &text_length);
+    if (!text) return false;
+    out.assign(text, static_cast<size_t>(text_length));
+    free(text);
+    return true;
+}
+
+bool encode_string_to_image_to_memory(const std::string& input, std::vector<unsigned char>& out_rgba,
+                                      int& width, int& height) {
+    std::vector<unsigned char> frame = encode_signal(input);
+
+    size_t pixels = (frame.size() + 3) / 4;
+    int side = std::max(signal_min_side, static_cast<int>(std::ceil(std::sqrt(static_cast<double>(pixels)))));
+    width = height = side;
+
+    out_rgba.assign(static_cast<size_t>(side) * side * 4, 0);
+    std::copy(frame.begin(), frame.end(), out_rgba.begin());
+    return true;
+}
+
+bool decode_string_from_image_memory(const std::vector<unsigned char>& rgba, int width, int height,
+                                     std::string& out) {
+    if (width <= 0 || height <= 0) return false;
+    size_t capacity = std::min(rgba.size(), static_cast<size_t>(width) * static_cast<size_t>(height) * 4);
+    return decode_signal(rgba.data(), capacity, out);
+}
+
+void bgra_to_rgba(const unsigned char* src, unsigned char* dst, size_t pixels) {
+    // 픽셀 하나를 32 비트로 보면 B 와 R 은 0 번과 2 번 바이트다. 그 둘만 16 비트 돌려 자리를 바꾼다
+    size_t i = 0;
+#ifdef FTS_SWIZZLE_SSE2
+    const __m128i keep = _mm_set1_epi32(static_cast<int>(0xFF00FF00u));
+    for (; i + 8 <= pixels; i += 8) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4 + 16));
+        __m128i ra = _mm_andnot_si128(keep, a);
+        __m128i rb = _mm_andnot_si128(keep, b);
+        a = _mm_or_si128(_mm_and_si128(a, keep), _mm_or_si128(_mm_slli_epi32(ra, 16), _mm_srli_epi32(ra, 16)));
+        b = _mm_or_si128(_mm_and_si128(b, keep), _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), a);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4 + 16), b);
+    }
+#endif
+    for (; i < pixels; ++i) {
+        uint32_t v;
+        std::memcpy(&v, src + i * 4, 4);
+        uint32_t rb = v & 0x00FF00FFu;
+        v = (v & 0xFF00FF00u) | (rb << 16) | (rb >> 16);
+        std::memcpy(dst + i * 4, &v, 4);
+    }
+}
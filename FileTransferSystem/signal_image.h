@@ -0,0 +1,37 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// SDP 를 클립보드 이미지(또는 텍스트)로 주고받기 위한 코덱.
+// 텍스트를 deflate 한 바이트를 RGBA 네 채널에 빽빽하게 채우고, 앞에 길이와 CRC 를 붙인다.
+// 이미지 크기는 내용에 맞춰 정사각형으로 늘어나므로 잘리는 일이 없다.
+//
+//   헤더 (little endian, 16 바이트) : [0..3] "FTSI"  [4] version  [5] flags  [6..7] reserved
+//                                    [8..11] payload 길이  [12..15] 헤더 앞 12 바이트 + payload 의 CRC-32
+constexpr size_t signal_header_size = 16;
+constexpr int signal_min_side = 32;
+
+// 연결에 필요 없는 SDP 줄과 중복/쓸 수 없는 후보(TCP, IPv6 link-local)를 뺀다. 줄바꿈은 "\n" 으로 맞춘다
+std::string minify_sdp(const std::string& sdp);
+
+// crc 에 앞 조각의 결과를 넘기면 이어서 계산한다
+uint32_t crc32(const void* data, size_t length, uint32_t crc = 0);
+
+// 헤더 + payload 바이트. 이미지가 아닌 통로(파일, 표준 입출력)도 이 틀을 그대로 쓴다
+std::vector<unsigned char> encode_signal(const std::string& input);
+// encode_signal 의 역. 뒤에 남는 바이트는 무시한다. 우리 틀이 아니거나 손상됐으면 false
+bool decode_signal(const unsigned char* data, size_t length, std::string& out);
+
+// input 을 담은 width x height RGBA 픽셀을 만든다
+bool encode_string_to_image_to_memory(const std::string& input, std::vector<unsigned char>& out_rgba,
+                                      int& width, int& height);
+
+// encode_string_to_image_to_memory 의 역. 우리 이미지가 아니거나 손상됐으면 false
+bool decode_string_from_image_memory(const std::vector<unsigned char>& rgba, int width, int height,
+                                     std::string& out);
+
+// BGRA 픽셀(클립보드 DIB)을 RGBA 로 바꾼다. src 와 dst 가 같아도 된다
+void bgra_to_rgba(const unsigned char* src, unsigned char* dst, size_t pixels);
@@ -0,0 +1,136 @@
+﻿#include "signaling.h"
+#include "base64.h"
+#include "log.h"
+#include "signal_image.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+void connect_signaling(session_manager& sessions, signaling& channel) {
+    sessions.set_on_local_description([&channel](uint64_t, session_role role, const std::string& sdp) {
+        channel.publish(role, minify_sdp(sdp));
+    });
+    channel.listen([&sessions](const std::string& sdp) {
+        if (!sessions.deliver_remote_description(sdp))
+            add_log(u8"상대 SDP 를 기다리는 세션이 없습니다.");
+    });
+}
+
+std::string pack_signal(const std::string& sdp) {
+    std::vector<unsigned char> frame = encode_signal(sdp);
+    std::string out(base64_encoded_size(frame.size()), '\0');
+    out.resize(base64_encode(frame.data(), frame.size(), out.data()));
+    return out;
+}
+
+bool unpack_signal(const std::string& text, std::string& sdp) {
+    size_t begin = text.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) return false;
+    size_t end = text.find_last_not_of(" \t\r\n") + 1;
+
+    std::vector<unsigned char> frame(base64_decoded_max_size(end - begin));
+    frame.resize(base64_decode(text.data() + begin, end - begin, frame.data()));
+    return decode_signal(frame.data(), frame.size(), sdp);
+}
+
+void signal_inbox::set(signaling::remote_handler handler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    handler_ = std::move(handler);
+}
+
+void signal_inbox::deliver(const std::string& sdp) {
+    // 잠근 채로 불러서 끊긴 직후에 옛 handler 가 불리지 않게 한다
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (handler_) handler_(sdp);
+}
+
+file_signaling::file_signaling(fs::path out_path, fs::path in_path)
+    : out_path_(std::move(out_path)), in_path_(std::move(in_path)) {
+}
+
+file_signaling::~file_signaling() {
+    inbox_->set(nullptr);
+    stop_ = true;
+    if (thread_.joinable()) thread_.join();
+}
+
+void file_signaling::publish(session_role role, const std::string& sdp) {
+    fs::path temp = out_path_;
+    temp += ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        out << pack_signal(sdp) << '\n';
+        if (!out) {
+            add_log(log_level::error, 0, u8"SDP 파일 쓰기 실패: " + temp.u8string());
+            return;
+        }
+    }
+    std::error_code ec;
+    fs::rename(temp, out_path_, ec);
+    if (ec) {
+        add_log(log_level::error, 0, u8"SDP 파일 쓰기 실패: " + out_path_.u8string());
+        return;
+    }
+    add_log(std::string(role == session_role::send ? "Offer" : "Answer") + u8" 저장: " + out_path_.u8string());
+}
+
+void file_signaling::listen(remote_handler handler) {
+    inbox_->set(std::move(handler));
+    if (!thread_.joinable()) thread_ = std::thread([this]() { poll(); });
+}
+
+void file_signaling::poll() {
+    bool warned = false;
+    while (!stop_) {
+        std::error_code ec;
+        if (fs::exists(in_path_, ec)) {
+            std::ifstream in(in_path_, std::ios::binary);
+            std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            in.close();
+
+            std::string sdp;
+            if (unpack_signal(text, sdp)) {
+                fs::remove(in_path_, ec);
+                add_log(u8"상대 SDP 읽음: " + in_path_.u8string());
+                inbox_->deliver(sdp);
+                warned = false;
+            }
+            else if (!warned) {
+                // 아직 쓰는 중일 수 있으므로 지우지 않고 다시 본다
+                add_log(log_level::warning, 0, u8"SDP 파일을 읽을 수 없습니다. 다시 확인합니다: " + in_path_.u8string());
+                warned = true;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+}
+
+stdio_signaling::~stdio_signaling() {
+    inbox_->set(nullptr);
+}
+
+void stdio_signaling::publish(session_role, const std::string& sdp) {
+    static std::mutex stdout_mutex;
+    std::lock_guard<std::mutex> lock(stdout_mutex);
+    std::cout << pack_signal(sdp) << std::endl;
+}
+
+void stdio_signaling::listen(remote_handler handler) {
+    inbox_->set(std::move(handler));
+    if (listening_) return;
+    listening_ = true;
+
+    std::thread([inbox = inbox_]() {
+        for (std::string line; std::getline(std::cin, line);) {
+            if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+            std::string sdp;
+            if (unpack_signal(line, sdp)) inbox->deliver(sdp);
+            else add_log(log_level::warning, 0, u8"SDP 줄이 아닙니다. 다시 붙여넣어 주세요.");
+        }
+    }).detach();
+}
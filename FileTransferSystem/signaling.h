@@ -0,0 +1,82 @@
+﻿#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "session.h"
+
+// 세션이 만든 SDP 를 상대에게 건네고, 상대의 SDP 를 받아 세션에 넘기는 통로.
+// GUI 는 클립보드 이미지를, 창이 없는 CLI 는 파일이나 표준 입출력을 쓴다.
+class signaling {
+public:
+    using remote_handler = std::function<void(const std::string& sdp)>;
+
+    virtual ~signaling() = default;
+
+    // 상대에게 넘길 SDP 를 내보낸다. 세션 풀 스레드에서 불린다
+    virtual void publish(session_role role, const std::string& sdp) = 0;
+    // 상대 SDP 를 기다리기 시작한다. 받을 때마다 handler 를 부른다 (어느 스레드에서든)
+    virtual void listen(remote_handler handler) = 0;
+};
+
+// sessions 가 만든 SDP 를 minify 해 channel 로 내보내고, channel 로 들어온 SDP 를 sessions 에 넘긴다.
+// channel 은 sessions 보다 오래 살아야 한다
+void connect_signaling(session_manager& sessions, signaling& channel);
+
+// 텍스트 통로용 한 줄 형식: signal_image 의 헤더 + deflate payload 를 base64 로 감싼다.
+// 복사 중에 잘리거나 바뀌면 CRC 로 걸러진다
+std::string pack_signal(const std::string& sdp);
+// 앞뒤 공백과 줄바꿈은 무시한다. 우리 형식이 아니거나 손상됐으면 false
+bool unpack_signal(const std::string& text, std::string& sdp);
+
+// 받은 SDP 를 넘길 곳. listen 을 다시 부르거나 통로가 사라지면 끊긴다
+class signal_inbox {
+public:
+    void set(signaling::remote_handler handler);
+    // 끊긴 뒤에는 아무것도 하지 않는다
+    void deliver(const std::string& sdp);
+
+private:
+    std::mutex mutex_;
+    signaling::remote_handler handler_;
+};
+
+// out_path 에 로컬 SDP 를 쓰고, in_path 에 상대 SDP 파일이 생기면 읽은 뒤 지운다.
+// 공유 폴더나 scp 로 두 기계를 잇는 무인 전송용이다. 쓰기는 임시 파일 + 이름 바꾸기로 한 번에 보이게 한다
+class file_signaling : public signaling {
+public:
+    file_signaling(std::filesystem::path out_path, std::filesystem::path in_path);
+    ~file_signaling() override;
+
+    void publish(session_role role, const std::string& sdp) override;
+    void listen(remote_handler handler) override;
+
+private:
+    void poll();
+
+    std::filesystem::path out_path_;
+    std::filesystem::path in_path_;
+    std::shared_ptr<signal_inbox> inbox_ = std::make_shared<signal_inbox>();
+    std::atomic<bool> stop_{ false };
+    std::thread thread_;
+};
+
+// 로컬 SDP 를 stdout 에 한 줄로 쓰고, stdin 에서 한 줄씩 상대 SDP 를 읽는다.
+// 로그는 stderr 로 가므로 stdout 은 SDP 줄만 남아 다른 프로그램에 파이프로 넘길 수 있다
+class stdio_signaling : public signaling {
+public:
+    ~stdio_signaling() override;
+
+    void publish(session_role role, const std::string& sdp) override;
+    void listen(remote_handler handler) override;
+
+private:
+    // stdin 읽기는 깨울 수 없으므로 읽기 스레드는 떼어 두고 inbox 만 끊는다
+    std::shared_ptr<signal_inbox> inbox_ = std::make_shared<signal_inbox>();
+    bool listening_ = false;
+};
@@ -0,0 +1,366 @@
+﻿#include "source.h"
+#include "log.h"
+#include "sparse.h"
+
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef FTS_HAVE_LIBURING
+#include <liburing.h>
+#endif
+#endif
+
+namespace fs = std::filesystem;
+
+const char* source_kind_name(source_kind kind) {
+    switch (kind) {
+    case source_kind::stream: return "stream";
+    case source_kind::mmap: return "mmap";
+    case source_kind::async: return "async";
+    }
+    return "?";
+}
+
+// ---------------------------------------------------------------------------
+// stream: 기존 방식. 메시지 버퍼에 바로 읽어 넣는다.
+
+class stream_source : public chunk_source {
+public:
+    bool open(const fs::path& path) {
+        file_.open(path, std::ios::binary);
+        if (!file_) return false;
+        file_.seekg(0, std::ios::end);
+        size_ = static_cast<uint64_t>(file_.tellg());
+        file_.seekg(0, std::ios::beg);
+        return true;
+    }
+
+    uint64_t size() const override { return size_; }
+
+    size_t append(uint64_t offset, size_t length, rtc::binary& out) override {
+        if (position_ != offset) {
+            file_.clear();
+            file_.seekg(static_cast<std::streamoff>(offset));
+        }
+        size_t base = out.size();
+        out.resize(base + length);
+        file_.read(reinterpret_cast<char*>(out.data() + base), length);
+        size_t got = file_.gcount() > 0 ? static_cast<size_t>(file_.gcount()) : 0;
+        out.resize(base + got);
+        position_ = offset + got;
+        return got;
+    }
+
+private:
+    std::ifstream file_;
+    uint64_t size_ = 0;
+    uint64_t position_ = 0;
+};
+
+// ---------------------------------------------------------------------------
+// mmap: 매핑된 페이지에서 메시지로 한 번만 복사한다.
+
+class mmap_source : public chunk_source {
+public:
+    ~mmap_source() override {
+#ifdef _WIN32
+        if (view_) UnmapViewOfFile(view_);
+        if (mapping_) CloseHandle(mapping_);
+        if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+#else
+        if (view_) munmap(view_, static_cast<size_t>(size_));
+        if (fd_ >= 0) ::close(fd_);
+#endif
+    }
+
+    bool open(const fs::path& path) {
+#ifdef _WIN32
+        file_ = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER li;
+        if (!GetFileSizeEx(file_, &li)) return false;
+        size_ = static_cast<uint64_t>(li.QuadPart);
+        if (size_ == 0) return true;
+        mapping_ = CreateFileMappingW(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping_) return false;
+        view_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+        return view_ != nullptr;
+#else
+        fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd_ < 0) return false;
+        struct stat st;
+        if (fstat(fd_, &st) != 0) return false;
+        size_ = static_cast<uint64_t>(st.st_size);
+        if (size_ == 0) return true;
+        void* p = ::mmap(nullptr, static_cast<size_t>(size_), PROT_READ, MAP_PRIVATE, fd_, 0);
+        if (p == MAP_FAILED) return false;
+        view_ = p;
+        madvise(view_, static_cast<size_t>(size_), MADV_SEQUENTIAL);
+        return true;
+#endif
+    }
+
+    uint64_t size() const override { return size_; }
+
+    size_t append(uint64_t offset, size_t length, rtc::binary& out) override {
+        if (offset >= size_) return 0;
+        size_t n = static_cast<size_t>(std::min<uint64_t>(length, size_ - offset));
+        const std::byte* p = static_cast<const std::byte*>(view_) + offset;
+        out.insert(out.end(), p, p + n);
+#ifndef _WIN32
+        // 이미 보낸 구간은 페이지 캐시에서 놓아 준다. 재전송처럼 뒤로 돌아간 읽기는 놓지 않고,
+        // 매핑 밖은 건드리지 않는다
+        const uint64_t release = 8u << 20;
+        if (offset >= released_ && offset + n - released_ >= 2 * release && released_ + release <= size_) {
+            madvise(static_cast<char*>(view_) + released_, static_cast<size_t>(release), MADV_DONTNEED);
+            released_ += release;
+        }
+#endif
+        return n;
+    }
+
+private:
+    uint64_t size_ = 0;
+    void* view_ = nullptr;
+#ifdef _WIN32
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+#else
+    int fd_ = -1;
+    uint64_t released_ = 0;
+#endif
+};
+
+#if defined(_WIN32) || defined(FTS_HAVE_LIBURING)
+
+// ---------------------------------------------------------------------------
+// async: block_size 단위로 depth 개의 읽기를 미리 걸어 둔다.
+
+class async_source : public chunk_source {
+public:
+    static constexpr size_t block_size = 256 << 10;
+    static constexpr size_t depth = 8;
+
+    ~async_source() override {
+        drain();
+#ifdef _WIN32
+        for (auto& s : slots_) if (s.ov.hEvent) CloseHandle(s.ov.hEvent);
+        if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+#else
+        if (ring_ready_) io_uring_queue_exit(&ring_);
+        if (fd_ >= 0) ::close(fd_);
+#endif
+    }
+
+    bool open(const fs::path& path) {
+        slots_.resize(depth);
+        for (auto& s : slots_) s.data.resize(block_size);
+#ifdef _WIN32
+        file_ = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER li;
+        if (!GetFileSizeEx(file_, &li)) return false;
+        size_ = static_cast<uint64_t>(li.QuadPart);
+        for (auto& s : slots_) {
+            s.ov.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+            if (!s.ov.hEvent) return false;
+        }
+#else
+        fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd_ < 0) return false;
+        struct stat st;
+        if (fstat(fd_, &st) != 0) return false;
+        size_ = static_cast<uint64_t>(st.st_size);
+        if (io_uring_queue_init(depth, &ring_, 0) != 0) return false;
+        ring_ready_ = true;
+#endif
+        for (auto& s : slots_) free_.push_back(&s);
+        return true;
+    }
+
+    uint64_t size() const override { return size_; }
+
+    size_t append(uint64_t offset, size_t length, rtc::binary& out) override {
+        size_t total = 0;
+        while (total < length && offset + total < size_) {
+            uint64_t pos = offset + total;
+
+            // 요청 위치가 미리 읽어 둔 구간 밖이면 처음부터 다시 건다
+            while (!window_.empty() && window_.front()->offset + block_size <= pos) recycle_front();
+            if (!window_.empty() && window_.front()->offset > pos) drain();
+            if (window_.empty()) next_block_ = pos - pos % block_size;
+            fill();
+
+            slot& s = *window_.front();
+            if (s.pending) wait(s);
+            if (s.result == 0) break;
+
+            size_t skip = static_cast<size_t>(pos - s.offset);
+            if (skip >= s.result) break;
+            size_t n = std::min(length - total, s.result - skip);
+            out.insert(out.end(), s.data.begin() + skip, s.data.begin() + skip + n);
+            total += n;
+            if (skip + n == s.result) recycle_front();
+        }
+        return total;
+    }
+
+private:
+    struct slot {
+        std::vector<std::byte> data;
+        uint64_t offset = 0;
+        size_t result = 0;
+        bool pending = false;
+#ifdef _WIN32
+        OVERLAPPED ov = {};
+#endif
+    };
+
+    void fill() {
+        while (!free_.empty() && next_block_ < size_) {
+            slot* s = free_.front();
+            free_.pop_front();
+            s->offset = next_block_;
+            s->result = 0;
+            s->pending = true;
+            size_t want = static_cast<size_t>(std::min<uint64_t>(block_size, size_ - s->offset));
+            next_block_ += block_size;
+            submit(*s, want);
+            window_.push_back(s);
+        }
+    }
+
+    void recycle_front() {
+        slot* s = window_.front();
+        window_.pop_front();
+        if (s->pending) wait(*s);
+        free_.push_back(s);
+    }
+
+    void drain() {
+        while (!window_.empty()) recycle_front();
+    }
+
+#ifdef _WIN32
+    void submit(slot& s, size_t want) {
+        ResetEvent(s.ov.hEvent);
+        s.ov.Offset = static_cast<DWORD>(s.offset);
+        s.ov.OffsetHigh = static_cast<DWORD>(s.offset >> 32);
+        if (!ReadFile(file_, s.data.data(), static_cast<DWORD>(want), nullptr, &s.ov) &&
+            GetLastError() != ERROR_IO_PENDING) {
+            s.pending = false;
+        }
+    }
+
+    void wait(slot& s) {
+        DWORD got = 0;
+        s.result = GetOverlappedResult(file_, &s.ov, &got, TRUE) ? got : 0;
+        s.pending = false;
+    }
+
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+#else
+    void submit(slot& s, size_t want) {
+        io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+        io_uring_prep_read(sqe, fd_, s.data.data(), static_cast<unsigned>(want), s.offset);
+        io_uring_sqe_set_data(sqe, &s);
+        io_uring_submit(&ring_);
+    }
+
+    // 완료 순서는 제출 순서와 다를 수 있으므로 s 가 끝날 때까지 다른 완료도 거둔다
+    void wait(slot& s) {
+        while (s.pending) {
+            io_uring_cqe* cqe = nullptr;
+            if (io_uring_wait_cqe(&ring_, &cqe) != 0) {
+                s.pending = false;
+                break;
+            }
+            slot* done = static_cast<slot*>(io_uring_cqe_get_data(cqe));
+            done->result = cqe->res > 0 ? static_cast<size_t>(cqe->res) : 0;
+            done->pending = false;
+            io_uring_cqe_seen(&ring_, cqe);
+        }
+    }
+
+    int fd_ = -1;
+    io_uring ring_ = {};
+    bool ring_ready_ = false;
+#endif
+
+    uint64_t size_ = 0;
+    uint64_t next_block_ = 0;
+    std::vector<slot> slots_;
+    std::deque<slot*> free_;
+    std::deque<slot*> window_;
+};
+
+#endif
+
+// ---------------------------------------------------------------------------
+// 구멍이 있는 파일: 읽기는 원래 방식에 맡기고 구멍 위치만 덧붙인다.
+
+class sparse_source : public chunk_source {
+public:
+    sparse_source(std::unique_ptr<chunk_source> inner, std::unique_ptr<extent_map> extents)
+        : inner_(std::move(inner)), extents_(std::move(extents)) {}
+
+    uint64_t size() const override { return inner_->size(); }
+
+    size_t append(uint64_t offset, size_t length, rtc::binary& out) override {
+        return inner_->append(offset, length, out);
+    }
+
+    uint64_t hole_end(uint64_t offset) override { return extents_->hole_end(offset); }
+    uint64_t data_end(uint64_t offset) override { return extents_->data_end(offset); }
+
+private:
+    std::unique_ptr<chunk_source> inner_;
+    std::unique_ptr<extent_map> extents_;
+};
+
+// ---------------------------------------------------------------------------
+
+template <typename T>
+static std::unique_ptr<chunk_source> try_open(const fs::path& path) {
+    auto source = std::make_unique<T>();
+    if (!source->open(path)) return nullptr;
+    return source;
+}
+
+std::unique_ptr<chunk_source> open_chunk_source(const fs::path& path, source_kind kind) {
+    std::unique_ptr<chunk_source> source;
+    switch (kind) {
+    case source_kind::mmap:
+        source = try_open<mmap_source>(path);
+        break;
+    case source_kind::async:
+#if defined(_WIN32) || defined(FTS_HAVE_LIBURING)
+        source = try_open<async_source>(path);
+#endif
+        break;
+    case source_kind::stream:
+        break;
+    }
+
+    if (!source) {
+        if (kind != source_kind::stream)
+            add_log(std::string(source_kind_name(kind)) + u8" 읽기를 쓸 수 없어 stream 으로 읽습니다");
+        source = try_open<stream_source>(path);
+    }
+
+    auto extents = std::make_unique<extent_map>();
+    if (source && extents->open(path)) source = std::make_unique<sparse_source>(std::move(source), std::move(extents));
+    return source;
+}
@@ -0,0 +1,38 @@
+﻿#pragma once
+
+#include <rtc/rtc.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+// 송신기가 파일 내용을 가져오는 방식
+enum class source_kind {
+    stream,  // std::ifstream::read
+    mmap,    // 파일 전체를 매핑하고 순차 readahead 힌트를 준다
+    async,   // 여러 블록을 미리 읽어 둔다 (Linux: io_uring, Windows: overlapped I/O)
+};
+
+const char* source_kind_name(source_kind kind);
+
+// 송신기의 청크 공급원. 한 번에 한 스레드에서만 부른다.
+class chunk_source {
+public:
+    virtual ~chunk_source() = default;
+
+    virtual uint64_t size() const = 0;
+
+    // offset 부터 최대 length 바이트를 out 뒤에 덧붙이고, 덧붙인 바이트 수를 돌려준다.
+    // out 에는 보통 청크 헤더가 먼저 들어 있다.
+    virtual size_t append(uint64_t offset, size_t length, rtc::binary& out) = 0;
+
+    // offset 이 구멍(디스크에 할당되지 않은 구간) 안이면 구멍이 끝나는 위치를 돌려준다. 구멍이 아니거나 모르면 offset
+    virtual uint64_t hole_end(uint64_t offset) { return offset; }
+    // offset 부터 데이터가 이어지는 끝 (다음 구멍의 시작). 모르면 size()
+    virtual uint64_t data_end(uint64_t) { return size(); }
+};
+
+// 실패하면 nullptr. 요청한 방식을 쓸 수 없는 환경이면 stream 으로 대신 연다.
+// 구멍이 있는 파일이면 hole_end/data_end 가 파일 시스템이 알려 준 구간을 돌려준다.
+std::unique_ptr<chunk_source> open_chunk_source(const std::filesystem::path& path, source_kind kind);
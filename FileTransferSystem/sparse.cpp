@@ -0,0 +1,155 @@
+﻿#include "sparse.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#include <winioctl.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define FTS_SPARSE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+bool is_all_zero(const std::byte* data, size_t length) {
+    size_t i = 0;
+#ifdef FTS_SPARSE_SSE2
+    // x86-64 는 SSE2 가 기본이라 따로 고를 필요가 없다
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 128 <= length; i += 128) {
+        const __m128i* p = reinterpret_cast<const __m128i*>(data + i);
+        __m128i a = _mm_or_si128(_mm_loadu_si128(p), _mm_loadu_si128(p + 1));
+        __m128i b = _mm_or_si128(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3));
+        __m128i c = _mm_or_si128(_mm_loadu_si128(p + 4), _mm_loadu_si128(p + 5));
+        __m128i d = _mm_or_si128(_mm_loadu_si128(p + 6), _mm_loadu_si128(p + 7));
+        __m128i all = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(all, zero)) != 0xFFFF) return false;
+    }
+#else
+    // 컴파일러가 벡터화할 수 있게 분기 없이 모은다
+    for (; i + 64 <= length; i += 64) {
+        uint64_t w[8];
+        std::memcpy(w, data + i, sizeof(w));
+        if ((w[0] | w[1] | w[2] | w[3] | w[4] | w[5] | w[6] | w[7]) != 0) return false;
+    }
+#endif
+    for (; i < length; ++i) {
+        if (data[i] != std::byte{ 0 }) return false;
+    }
+    return true;
+}
+
+extent_map::~extent_map() {
+#ifdef _WIN32
+    if (handle_) CloseHandle(static_cast<HANDLE>(handle_));
+#else
+    if (fd_ >= 0) ::close(fd_);
+#endif
+}
+
+uint64_t extent_map::hole_end(uint64_t offset) {
+    if (offset >= size_) return offset;
+    locate(offset);
+    return hole_ ? end_ : offset;
+}
+
+uint64_t extent_map::data_end(uint64_t offset) {
+    if (offset >= size_) return offset;
+    locate(offset);
+    return hole_ ? offset : end_;
+}
+
+#ifdef _WIN32
+
+bool extent_map::open(const std::filesystem::path& path) {
+    HANDLE h = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE) return false;
+    handle_ = h;
+
+    FILE_BASIC_INFO basic = {};
+    LARGE_INTEGER li;
+    if (!GetFileInformationByHandleEx(h, FileBasicInfo, &basic, sizeof(basic)) ||
+        !(basic.FileAttributes & FILE_ATTRIBUTE_SPARSE_FILE) || !GetFileSizeEx(h, &li))
+        return false;
+    size_ = static_cast<uint64_t>(li.QuadPart);
+    // 성긴 파일 표시만 있고 실제 구멍이 없을 수도 있다
+    return size_ > 0 && (hole_end(0) > 0 || data_end(0) < size_);
+}
+
+void extent_map::locate(uint64_t offset) {
+    if (offset >= begin_ && offset < end_) return;
+    FILE_ALLOCATED_RANGE_BUFFER query = {};
+    query.FileOffset.QuadPart = static_cast<LONGLONG>(offset);
+    query.Length.QuadPart = static_cast<LONGLONG>(size_ - offset);
+    FILE_ALLOCATED_RANGE_BUFFER first = {};
+    DWORD got = 0;
+    // 결과가 많으면 ERROR_MORE_DATA 지만 필요한 것은 첫 구간뿐이다
+    BOOL ok = DeviceIoControl(static_cast<HANDLE>(handle_), FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query),
+                              &first, sizeof(first), &got, nullptr);
+    begin_ = offset;
+    if (!ok && GetLastError() != ERROR_MORE_DATA) {
+        end_ = size_; // 모르면 데이터로 본다
+        hole_ = false;
+        return;
+    }
+    if (got < sizeof(first)) {
+        end_ = size_; // offset 뒤로는 할당된 곳이 없다
+        hole_ = true;
+        return;
+    }
+    uint64_t start = static_cast<uint64_t>(first.FileOffset.QuadPart);
+    uint64_t stop = start + static_cast<uint64_t>(first.Length.QuadPart);
+    hole_ = start > offset;
+    end_ = std::min(size_, hole_ ? start : stop);
+}
+
+#else
+
+bool extent_map::open(const std::filesystem::path& path) {
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) return false;
+    struct stat st;
+    if (fstat(fd_, &st) != 0 || !S_ISREG(st.st_mode)) return false;
+    size_ = static_cast<uint64_t>(st.st_size);
+    // 할당된 블록이 크기보다 적을 때만 구멍이 있을 수 있다. 압축하는 파일 시스템도 적게 나오므로 SEEK_HOLE 로 확인한다
+    if (size_ == 0 || static_cast<uint64_t>(st.st_blocks) * 512 >= size_) return false;
+#ifdef SEEK_HOLE
+    return hole_end(0) > 0 || data_end(0) < size_;
+#else
+    return false;
+#endif
+}
+
+void extent_map::locate(uint64_t offset) {
+    if (offset >= begin_ && offset < end_) return;
+    begin_ = offset;
+    end_ = size_;
+    hole_ = false;
+#ifdef SEEK_HOLE
+    off_t data = lseek(fd_, static_cast<off_t>(offset), SEEK_DATA);
+    if (data < 0) {
+        // ENXIO: offset 뒤로는 데이터가 없다. 다른 오류면 모르므로 데이터로 본다
+        hole_ = errno == ENXIO;
+        return;
+    }
+    if (static_cast<uint64_t>(data) > offset) {
+        end_ = std::min(size_, static_cast<uint64_t>(data));
+        hole_ = true;
+        return;
+    }
+    off_t hole = lseek(fd_, static_cast<off_t>(offset), SEEK_HOLE);
+    if (hole >= 0) end_ = std::min(size_, static_cast<uint64_t>(hole));
+    if (end_ <= offset) end_ = size_;
+#endif
+}
+
+#endif
@@ -0,0 +1,42 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+// data 가 모두 0 인지. 128 바이트씩 OR 로 모아 한 번에 비교하므로 0 이 아닌 데이터는 첫 블록에서 바로 끝난다
+bool is_all_zero(const std::byte* data, size_t length);
+
+// 성긴(sparse) 파일의 데이터 구간과 구멍(디스크에 할당되지 않은 구간)을 묻는다.
+// POSIX 는 lseek(SEEK_DATA / SEEK_HOLE), Windows 는 FSCTL_QUERY_ALLOCATED_RANGES 를 쓴다.
+// 마지막으로 물은 구간을 기억해 두므로 앞에서부터 차례로 물으면 구간마다 시스템 호출이 한두 번이다.
+// 한 번에 한 스레드에서만 부른다.
+class extent_map {
+public:
+    extent_map() = default;
+    ~extent_map();
+
+    extent_map(const extent_map&) = delete;
+    extent_map& operator=(const extent_map&) = delete;
+
+    // 구멍이 하나도 없거나 파일 시스템이 알려 주지 않으면 false
+    bool open(const std::filesystem::path& path);
+
+    // offset 이 구멍 안이면 구멍이 끝나는 위치를, 데이터 안이면 offset 을 돌려준다
+    uint64_t hole_end(uint64_t offset);
+    // offset 이 데이터 안이면 그 데이터가 끝나는(다음 구멍이 시작하는) 위치를, 구멍 안이면 offset 을 돌려준다
+    uint64_t data_end(uint64_t offset);
+
+private:
+    void locate(uint64_t offset);
+
+#ifdef _WIN32
+    void* handle_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+    uint64_t size_ = 0;
+    uint64_t begin_ = 0; // 마지막으로 찾은 구간 [begin_, end_)
+    uint64_t end_ = 0;
+    bool hole_ = false;
+};
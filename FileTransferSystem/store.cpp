@@ -0,0 +1,354 @@
+﻿#include "store.h"
+#include "log.h"
+#include "protocol.h"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char index_magic[8] = { 'F', 'T', 'S', 'C', 'I', 'D', 'X', '1' };
+constexpr uint64_t header_every = 4096; // 이만큼 넣을 때마다 항목 수를 머리말에 남긴다
+constexpr size_t grow_batch = 256;      // 옮기는 동안 메모리에 모아 둘 버킷 수
+constexpr size_t max_open_files = 64;
+
+bool has_suffix(const std::string& name, const std::string& suffix) {
+    return name.size() >= suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+int64_t mtime_of(const fs::path& path) {
+    std::error_code ec;
+    auto t = fs::last_write_time(path, ec);
+    return ec ? 0 : static_cast<int64_t>(t.time_since_epoch().count());
+}
+
+} // namespace
+
+chunk_index::~chunk_index() {
+    close();
+}
+
+bool chunk_index::open(const fs::path& path) {
+    close();
+    path_ = path;
+    if (!file_.open_write(path, false)) return false;
+    std::byte header[24] = {};
+    if (file_.pread(header, sizeof(header), 0) == sizeof(header) && std::memcmp(header, index_magic, 8) == 0) {
+        buckets_ = get_u64(header + 8);
+        entries_ = get_u64(header + 16);
+        if (buckets_ > 0) return true;
+    }
+    // 새 색인이거나 알아볼 수 없는 파일이면 비운다
+    if (!file_.open_write(path, true)) return false;
+    buckets_ = initial_buckets;
+    entries_ = 0;
+    return write_header();
+}
+
+void chunk_index::close() {
+    if (!file_.is_open()) return;
+    write_header();
+    file_.close();
+}
+
+bool chunk_index::write_header() {
+    std::byte header[24];
+    std::memcpy(header, index_magic, 8);
+    put_u64(header + 8, buckets_);
+    put_u64(header + 16, entries_);
+    return file_.pwrite(header, sizeof(header), 0);
+}
+
+// 아직 쓰지 않은 버킷은 파일 끝 너머라 짧게 읽히므로 빈 버킷으로 본다
+bool chunk_index::read_bucket(uint64_t bucket, std::byte* out) const {
+    std::memset(out, 0, page_size);
+    file_.pread(out, page_size, page_size * (1 + bucket));
+    return true;
+}
+
+bool chunk_index::find(const file_digest& key, location& out) const {
+    if (!file_.is_open()) return false;
+    std::byte page[page_size];
+    uint64_t bucket = key.low % buckets_;
+    for (uint64_t probe = 0; probe < buckets_; ++probe, bucket = (bucket + 1) % buckets_) {
+        read_bucket(bucket, page);
+        for (size_t s = 0; s < slots_per_bucket; ++s) {
+            const std::byte* slot = page + s * slot_size;
+            uint32_t length = get_u32(slot + 20);
+            // 칸은 앞에서부터 채우고 지우지 않으므로 빈 칸 뒤에는 없다
+            if (length == 0) return false;
+            if (get_u64(slot) == key.low && get_u64(slot + 8) == key.high) {
+                out.file = get_u32(slot + 16);
+                out.length = length;
+                out.offset = get_u64(slot + 24);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool chunk_index::insert(const file_digest& key, const location& at) {
+    if (!file_.is_open() || at.length == 0) return false;
+    if (static_cast<double>(entries_ + 1) > max_load * static_cast<double>(buckets_ * slots_per_bucket) && !grow())
+        return false;
+
+    std::byte page[page_size];
+    uint64_t bucket = key.low % buckets_;
+    for (uint64_t probe = 0; probe < buckets_; ++probe, bucket = (bucket + 1) % buckets_) {
+        read_bucket(bucket, page);
+        for (size_t s = 0; s < slots_per_bucket; ++s) {
+            std::byte* slot = page + s * slot_size;
+            uint32_t length = get_u32(slot + 20);
+            bool same = length != 0 && get_u64(slot) == key.low && get_u64(slot + 8) == key.high;
+            if (length != 0 && !same) continue;
+            put_u64(slot, key.low);
+            put_u64(slot + 8, key.high);
+            put_u32(slot + 16, at.file);
+            put_u32(slot + 20, at.length);
+            put_u64(slot + 24, at.offset);
+            if (!file_.pwrite(slot, slot_size, page_size * (1 + bucket) + s * slot_size)) return false;
+            if (!same && ++entries_ % header_every == 0) write_header();
+            return true;
+        }
+    }
+    return false;
+}
+
+// 버킷 수를 두 배로 늘린 새 파일로 옮긴 뒤 바꿔치기한다.
+// 옛 버킷 b 의 항목은 새 버킷 b 나 b + buckets_ 근처로만 가므로 최근에 건드린 버킷만 모아 두었다가 한꺼번에 쓴다
+bool chunk_index::grow() {
+    const uint64_t next_buckets = buckets_ * 2;
+    fs::path next_path = path_;
+    next_path += ".grow";
+    file_io next;
+    if (!next.open_write(next_path, true)) return false;
+
+    std::map<uint64_t, std::vector<std::byte>> pending;
+    bool ok = true;
+    auto flush = [&]() {
+        for (auto& [bucket, page] : pending) ok = ok && next.pwrite(page.data(), page_size, page_size * (1 + bucket));
+        pending.clear();
+    };
+    auto page_of = [&](uint64_t bucket) -> std::vector<std::byte>& {
+        auto it = pending.find(bucket);
+        if (it != pending.end()) return it->second;
+        auto& page = pending[bucket];
+        page.assign(page_size, std::byte{ 0 });
+        next.pread(page.data(), page_size, page_size * (1 + bucket));
+        return page;
+    };
+
+    uint64_t moved = 0;
+    std::byte old_page[page_size];
+    for (uint64_t b = 0; b < buckets_ && ok; ++b) {
+        read_bucket(b, old_page);
+        for (size_t s = 0; s < slots_per_bucket; ++s) {
+            const std::byte* slot = old_page + s * slot_size;
+            if (get_u32(slot + 20) == 0) break;
+            uint64_t target = get_u64(slot) % next_buckets;
+            for (;; target = (target + 1) % next_buckets) {
+                auto& page = page_of(target);
+                size_t free_slot = 0;
+                while (free_slot < slots_per_bucket && get_u32(page.data() + free_slot * slot_size + 20) != 0) ++free_slot;
+                if (free_slot == slots_per_bucket) continue;
+                std::memcpy(page.data() + free_slot * slot_size, slot, slot_size);
+                break;
+            }
+            ++moved;
+        }
+        if (pending.size() >= grow_batch) flush();
+    }
+    flush();
+
+    std::byte header[24];
+    std::memcpy(header, index_magic, 8);
+    put_u64(header + 8, next_buckets);
+    put_u64(header + 16, moved);
+    ok = ok && next.pwrite(header, sizeof(header), 0);
+    next.close();
+
+    std::error_code ec;
+    if (!ok) {
+        fs::remove(next_path, ec);
+        return false;
+    }
+    file_.close();
+    fs::rename(next_path, path_, ec);
+    if (!file_.open_write(path_, false)) return false;
+    if (!ec) {
+        buckets_ = next_buckets;
+        entries_ = moved;
+    }
+    return !ec;
+}
+
+std::shared_ptr<chunk_store> chunk_store::open(const fs::path& download_dir) {
+    static std::mutex registry_mutex;
+    static std::map<fs::path, std::weak_ptr<chunk_store>> registry;
+
+    std::error_code ec;
+    fs::create_directories(download_dir, ec);
+    fs::path key = fs::weakly_canonical(download_dir, ec);
+    if (ec) key = download_dir;
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    if (auto store = registry[key].lock()) return store;
+    auto store = std::shared_ptr<chunk_store>(new chunk_store(key));
+    if (!store->load()) return nullptr;
+    registry[key] = store;
+    return store;
+}
+
+chunk_store::chunk_store(fs::path download_dir)
+    : dir_(std::move(download_dir)), root_(dir_ / directory_name) {
+}
+
+chunk_store::~chunk_store() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    save_files_locked();
+    index_.close();
+}
+
+// 파일 목록은 한 줄에 "<크기> <수정 시각> <폴더 기준 경로>" 이다. 줄 번호가 파일 번호다
+bool chunk_store::load() {
+    std::error_code ec;
+    fs::create_directories(root_, ec);
+    if (!index_.open(root_ / "index")) {
+        add_log(log_level::error, 0, u8"중복 제거 색인을 열 수 없습니다: " + (root_ / "index").u8string());
+        return false;
+    }
+    std::ifstream in(root_ / "files");
+    for (std::string line; std::getline(in, line);) {
+        std::istringstream iss(line);
+        file_record record;
+        std::string relative;
+        if (!(iss >> record.size >> record.mtime) || !std::getline(iss >> std::ws, relative)) relative.clear();
+        record.relative = fs::u8path(relative);
+        files_.push_back(std::move(record)); // 깨진 줄도 번호를 지키려고 자리는 남긴다
+    }
+    return true;
+}
+
+bool chunk_store::save_files_locked() const {
+    fs::path temp = root_ / "files.tmp";
+    {
+        std::ofstream out(temp, std::ios::trunc);
+        for (const auto& record : files_)
+            out << record.size << ' ' << record.mtime << ' ' << record.relative.u8string() << '\n';
+        if (!out) return false;
+    }
+    std::error_code ec;
+    fs::rename(temp, root_ / "files", ec);
+    return !ec;
+}
+
+// path 의 번호. 처음 보는 파일이면 새로 붙이고, 알던 파일이면 크기와 수정 시각을 새로 적는다
+uint32_t chunk_store::record_locked(const fs::path& path) {
+    fs::path relative = path.lexically_relative(dir_);
+    std::error_code ec;
+    uint64_t size = fs::file_size(path, ec);
+    int64_t mtime = mtime_of(path);
+    for (size_t i = 0; i < files_.size(); ++i) {
+        if (files_[i].relative == relative) {
+            files_[i].size = size;
+            files_[i].mtime = mtime;
+            readers_.erase(static_cast<uint32_t>(i));
+            return static_cast<uint32_t>(i);
+        }
+    }
+    files_.push_back({ relative, size, mtime });
+    return static_cast<uint32_t>(files_.size() - 1);
+}
+
+void chunk_store::insert_locked(uint32_t file, const std::vector<cdc_chunk>& chunks) {
+    for (const cdc_chunk& chunk : chunks) index_.insert(chunk.digest, { file, chunk.length, chunk.offset });
+}
+
+size_t chunk_store::scan() {
+    std::vector<fs::path> changed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::error_code ec;
+        for (auto it = fs::recursive_directory_iterator(dir_, fs::directory_options::skip_permission_denied, ec);
+             !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+            std::string name = it->path().filename().u8string();
+            if (it->is_directory(ec)) {
+                if (name == directory_name) it.disable_recursion_pending();
+                continue;
+            }
+            // 받는 중인 파일, 체크포인트, 검증에 실패한 파일은 빼고 본다
+            if (!it->is_regular_file(ec) || has_suffix(name, ".fts-new") || has_suffix(name, ".fts-part") ||
+                has_suffix(name, ".fts-corrupt"))
+                continue;
+            fs::path relative = it->path().lexically_relative(dir_);
+            uint64_t size = it->file_size(ec);
+            int64_t mtime = mtime_of(it->path());
+            bool known = false;
+            for (const auto& record : files_) {
+                if (record.relative == relative) {
+                    known = record.size == size && record.mtime == mtime;
+                    break;
+                }
+            }
+            if (!known) changed.push_back(it->path());
+        }
+    }
+
+    // 파일 전체를 읽어야 하므로 잠금 밖에서 나눈다
+    uint64_t chunk_count = 0;
+    for (const auto& path : changed) {
+        auto source = open_chunk_source(path, source_kind::stream);
+        if (!source) continue;
+        std::vector<cdc_chunk> chunks = cdc_split(*source);
+        chunk_count += chunks.size();
+        add_file(path, chunks);
+    }
+    if (!changed.empty())
+        add_log(u8"중복 제거 저장소: 파일 " + std::to_string(changed.size()) + u8"개 색인 (청크 " +
+                std::to_string(chunk_count) + u8"개, 전체 " + std::to_string(stats().entries) + u8"개)");
+    return changed.size();
+}
+
+void chunk_store::add_file(const fs::path& path, const std::vector<cdc_chunk>& chunks) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint32_t file = record_locked(path);
+    insert_locked(file, chunks);
+    save_files_locked();
+}
+
+file_io* chunk_store::open_file_locked(uint32_t file) {
+    if (file >= files_.size() || files_[file].relative.empty()) return nullptr;
+    auto it = readers_.find(file);
+    if (it != readers_.end()) return it->second.get();
+    if (readers_.size() >= max_open_files) readers_.clear();
+    auto reader = std::make_unique<file_io>();
+    if (!reader->open_read(dir_ / files_[file].relative)) return nullptr;
+    return (readers_[file] = std::move(reader)).get();
+}
+
+bool chunk_store::read(const file_digest& digest, uint32_t length, std::vector<std::byte>& out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.lookups;
+    chunk_index::location at;
+    if (!index_.find(digest, at) || at.length != length) return false;
+    file_io* file = open_file_locked(at.file);
+    out.resize(length);
+    if (!file || file->pread(out.data(), length, at.offset) != length || chunk_digest(out.data(), length) != digest) {
+        ++stats_.stale;
+        return false;
+    }
+    ++stats_.hits;
+    return true;
+}
+
+chunk_store::stats_t chunk_store::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_t s = stats_;
+    s.entries = index_.entries();
+    s.files = files_.size();
+    return s;
+}
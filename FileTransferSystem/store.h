@@ -0,0 +1,115 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "cdc.h"
+#include "fileio.h"
+#include "hashing.h"
+
+// 청크 다이제스트 -> 위치를 담는 디스크 해시 테이블.
+// 파일은 4KB 머리말 뒤에 4KB 버킷이 이어지고, 버킷마다 32 바이트 칸이 128 개 있다
+//   칸: [0..7] 키 low  [8..15] 키 high  [16..19] 파일 번호  [20..23] 길이(0 이면 빈 칸)  [24..31] 오프셋
+// 키는 이미 고르게 퍼진 해시이므로 low % 버킷 수로 버킷을 고르고, 꽉 차 있으면 다음 버킷으로 넘어간다.
+// 찾기는 대개 pread 한 번이라 항목이 수백만 개여도 메모리에 올리지 않는다.
+// 채운 비율이 max_load 를 넘으면 버킷 수를 두 배로 늘린 새 파일로 옮긴다.
+class chunk_index {
+public:
+    static constexpr size_t page_size = 4096;
+    static constexpr size_t slot_size = 32;
+    static constexpr size_t slots_per_bucket = page_size / slot_size;
+    static constexpr uint64_t initial_buckets = 64;
+    static constexpr double max_load = 0.75;
+
+    struct location {
+        uint32_t file = 0;
+        uint32_t length = 0;
+        uint64_t offset = 0;
+    };
+
+    chunk_index() = default;
+    ~chunk_index();
+
+    chunk_index(const chunk_index&) = delete;
+    chunk_index& operator=(const chunk_index&) = delete;
+
+    // 없으면 빈 색인을 만든다
+    bool open(const std::filesystem::path& path);
+    void close();
+
+    bool find(const file_digest& key, location& out) const;
+    // 같은 키가 있으면 위치를 바꾼다
+    bool insert(const file_digest& key, const location& at);
+
+    uint64_t entries() const { return entries_; }
+    uint64_t buckets() const { return buckets_; }
+
+private:
+    bool read_bucket(uint64_t bucket, std::byte* out) const;
+    bool write_header();
+    bool grow();
+
+    std::filesystem::path path_;
+    file_io file_;
+    uint64_t buckets_ = 0;
+    uint64_t entries_ = 0;
+};
+
+// 받을 폴더 안의 파일들을 내용 기반 청크(cdc.h)로 색인해 두고, 새로 받는 파일의 청크를 거기서 찾는다.
+// 청크 내용을 따로 복사해 두지 않고 "어느 파일의 어디"만 기억한다. 그 사이 파일이 바뀌었을 수 있으므로
+// 읽을 때마다 다이제스트를 다시 확인하고, 다르면 없는 것으로 본다.
+// 색인과 파일 목록은 <폴더>/.fts-store 아래에 있다.
+class chunk_store {
+public:
+    static constexpr const char* directory_name = ".fts-store";
+
+    // 같은 폴더는 한 프로세스 안에서 저장소 하나를 나눠 쓴다
+    static std::shared_ptr<chunk_store> open(const std::filesystem::path& download_dir);
+    ~chunk_store();
+
+    // 마지막으로 본 뒤 새로 생기거나 바뀐 파일을 색인한다. 색인한 파일 수를 돌려준다
+    size_t scan();
+
+    // 내용을 이미 아는 파일(방금 받아 검증한 파일)을 청크 목록으로 바로 색인한다
+    void add_file(const std::filesystem::path& path, const std::vector<cdc_chunk>& chunks);
+
+    // digest 인 청크를 out 에 읽는다. 없거나 내용이 달라졌으면 false
+    bool read(const file_digest& digest, uint32_t length, std::vector<std::byte>& out);
+
+    struct stats_t {
+        uint64_t entries = 0;
+        size_t files = 0;
+        uint64_t lookups = 0;
+        uint64_t hits = 0;
+        uint64_t stale = 0; // 색인에는 있었지만 파일이 바뀌어 쓰지 못한 청크
+    };
+    stats_t stats() const;
+
+private:
+    struct file_record {
+        std::filesystem::path relative;
+        uint64_t size = 0;
+        int64_t mtime = 0;
+    };
+
+    explicit chunk_store(std::filesystem::path download_dir);
+
+    bool load();
+    bool save_files_locked() const;
+    uint32_t record_locked(const std::filesystem::path& path);
+    void insert_locked(uint32_t file, const std::vector<cdc_chunk>& chunks);
+    file_io* open_file_locked(uint32_t file);
+
+    std::filesystem::path dir_;
+    std::filesystem::path root_;
+    mutable std::mutex mutex_;
+    chunk_index index_;
+    std::vector<file_record> files_;                       // 번호 = 위치
+    std::map<uint32_t, std::unique_ptr<file_io>> readers_; // 읽으려고 열어 둔 파일
+    stats_t stats_;
+};
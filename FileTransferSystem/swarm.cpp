@@ -0,0 +1,439 @@
+﻿#include "swarm.h"
+#include "codec.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace fs = std::filesystem;
+
+double file_swarm::peer::rate(std::chrono::steady_clock::time_point now) const {
+    if (received == 0) return 0;
+    // 첫 조각 직후의 값은 믿을 수 없으므로 최소 100ms 로 나눈다
+    double seconds = std::max(0.1, std::chrono::duration<double>(now - first_data).count());
+    return received / seconds;
+}
+
+std::shared_ptr<file_swarm> file_swarm::create(fs::path download_dir, file_digest digest, size_t peers) {
+    return std::shared_ptr<file_swarm>(new file_swarm(std::move(download_dir), digest, peers));
+}
+
+file_swarm::file_swarm(fs::path download_dir, file_digest digest, size_t peers)
+    : download_dir_(std::move(download_dir)), digest_(digest), peers_(std::max<size_t>(1, peers)) {
+}
+
+file_swarm::~file_swarm() {
+    // 끝나기 전에 풀리면 쓰다 만 임시 파일을 지운다
+    if (writer_ && !finished_) {
+        writer_.reset();
+        file_.close();
+        std::error_code ec;
+        fs::remove(temp_path_, ec);
+    }
+}
+
+void file_swarm::set_on_complete(std::function<void(bool ok)> on_complete) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    on_complete_ = std::move(on_complete);
+}
+
+void file_swarm::attach(size_t index, std::shared_ptr<rtc::DataChannel> dc) {
+    if (index >= peers_.size()) return;
+    if (dc->label() == "file") {
+        std::lock_guard<std::mutex> lock(mutex_);
+        peers_[index].control = dc;
+    }
+
+    std::weak_ptr<file_swarm> weak = weak_from_this();
+    std::weak_ptr<rtc::DataChannel> weak_dc = dc;
+    dc->onMessage([weak, weak_dc, index](std::variant<rtc::binary, std::string> data) {
+        auto self = weak.lock();
+        if (!self) return;
+        if (std::holds_alternative<std::string>(data)) {
+            if (auto dc = weak_dc.lock()) self->on_control(index, dc, std::get<std::string>(data));
+        }
+        else {
+            self->on_data(index, std::get<rtc::binary>(data));
+        }
+    });
+}
+
+void file_swarm::detach(size_t index) {
+    if (index >= peers_.size() || finished_) return;
+    outbox out;
+    bool all_gone;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (peers_[index].gone) return;
+        drop_locked(index, u8"연결 끊김");
+        schedule_locked(out);
+        all_gone = std::all_of(peers_.begin(), peers_.end(), [](const peer& p) { return p.gone; });
+    }
+    flush(out);
+    if (all_gone) fail(u8"스웜: 남은 송신자가 없습니다");
+}
+
+void file_swarm::on_control(size_t index, const std::shared_ptr<rtc::DataChannel>& dc, const std::string& message) {
+    seed_announce announce;
+    if (!parse_seed_announce(message, announce)) {
+        add_log(log_level::debug, 0, u8"[swarm] 받은 메시지: " + message);
+        return;
+    }
+
+    outbox out;
+    bool complete = false, failed = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        peer& p = peers_[index];
+        p.control = dc;
+        if (announce.digest != digest_) {
+            drop_locked(index, u8"다른 파일 (" + announce.digest.to_hex() + ")");
+        }
+        else {
+            p.announced = true;
+            if (!started_) announce_ = announce;
+            // 빈 파일은 해시 목록 메시지가 없다
+            if (announce.size == 0) {
+                p.seeding = true;
+                if (!started_) {
+                    failed = !start_locked();
+                    complete = !failed;
+                }
+            }
+        }
+        schedule_locked(out);
+    }
+    flush(out);
+    if (failed) fail(u8"파일 저장 실패!");
+    else if (complete) finish();
+}
+
+uint64_t file_swarm::block_length(uint64_t block) const {
+    return std::min<uint64_t>(block_size, announce_.size - block * block_size);
+}
+
+// mutex_ 를 잡은 채로 부른다. 첫 송신자의 해시 목록이 확인되면 임시 파일을 열고 블록을 나눠 주기 시작한다
+bool file_swarm::start_locked() {
+    std::string name = fs::u8path(announce_.name).filename().u8string();
+    std::error_code ec;
+    fs::create_directories(download_dir_, ec);
+    path_ = download_dir_ / fs::u8path(name);
+    temp_path_ = path_;
+    temp_path_ += ".fts-new";
+    if (!file_.open_write(temp_path_, true)) return false;
+    writer_ = std::make_unique<write_behind>(file_, announce_.size);
+
+    uint64_t count = (announce_.size + block_size - 1) / block_size;
+    blocks_.assign(static_cast<size_t>(count), block_state::missing);
+    started_ = true;
+    started_at_ = std::chrono::steady_clock::now();
+    for (peer& p : peers_) {
+        p.metrics->total_bytes = announce_.size;
+        p.metrics->set_name(name);
+    }
+    add_log(u8"스웜 받기 시작: " + name + " (" + std::to_string(announce_.size) + u8" bytes, 블록 " +
+            std::to_string(count) + u8"개, 송신자 " + std::to_string(peers_.size()) + u8"명)");
+    return true;
+}
+
+// mutex_ 를 잡은 채로 부른다. 이 송신자에게만 맡겨 둔 블록은 다시 나눠 줄 수 있게 되돌린다
+void file_swarm::drop_locked(size_t index, const std::string& reason) {
+    peer& p = peers_[index];
+    if (p.gone) return;
+    p.gone = true;
+    p.seeding = false;
+    for (const auto& [block, a] : p.inflight) {
+        bool others = std::any_of(peers_.begin(), peers_.end(),
+                                  [&, b = block](const peer& q) { return &q != &p && q.inflight.count(b); });
+        if (!others && blocks_[block] == block_state::requested) {
+            blocks_[block] = block_state::missing;
+            next_missing_ = std::min(next_missing_, block);
+        }
+    }
+    p.inflight.clear();
+    add_log(log_level::warning, 0, u8"[swarm] 송신자 " + std::to_string(index + 1) + u8" 제외: " + reason);
+}
+
+// mutex_ 를 잡은 채로 부른다. 송신자마다 비어 있는 자리만큼 블록을 요청한다
+void file_swarm::schedule_locked(outbox& out) {
+    if (!started_ || done_blocks_ == blocks_.size()) return;
+    auto now = std::chrono::steady_clock::now();
+
+    // 빠른 송신자가 앞쪽 블록을 먼저 가져간다
+    std::vector<size_t> order;
+    for (size_t i = 0; i < peers_.size(); ++i) {
+        if (peers_[i].seeding && !peers_[i].gone && peers_[i].control) order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return peers_[a].rate(now) > peers_[b].rate(now); });
+
+    // 요청했지만 아직 안 온 바이트. bytes 를 rate 로 나누면 그 송신자가 다 보내는 데 걸리는 시간이다
+    auto queued = [&](const peer& p, uint64_t up_to) {
+        uint64_t bytes = 0;
+        for (const auto& [block, a] : p.inflight) {
+            if (block > up_to) break;
+            bytes += block_length(block) - a.got.covered();
+        }
+        return static_cast<double>(bytes);
+    };
+
+    for (size_t i : order) {
+        peer& p = peers_[i];
+        double rate = p.rate(now);
+        size_t depth = rate > 0 ? static_cast<size_t>(rate * pipeline_seconds / block_size) + 1 : min_pipeline;
+        depth = std::clamp(depth, min_pipeline, max_pipeline);
+
+        range_set want;
+        while (p.inflight.size() < depth) {
+            while (next_missing_ < blocks_.size() && blocks_[next_missing_] != block_state::missing) ++next_missing_;
+            uint64_t pick = next_missing_;
+            if (pick < blocks_.size()) {
+                blocks_[pick] = block_state::requested;
+            }
+            else {
+                // end-game: 다른 송신자 하나만 붙잡고 있는 블록 중 그쪽이 가장 늦게 끝낼 블록을
+                // 이 송신자가 더 빨리 끝낼 수 있을 때만 한 번 더 요청한다
+                if (rate <= 0) break;
+                double best_time = (queued(p, std::numeric_limits<uint64_t>::max()) + block_size) / rate;
+                pick = blocks_.size();
+                for (size_t j = 0; j < peers_.size(); ++j) {
+                    const peer& q = peers_[j];
+                    if (j == i || q.gone) continue;
+                    double q_rate = q.rate(now);
+                    for (const auto& [block, a] : q.inflight) {
+                        if (p.inflight.count(block)) continue;
+                        size_t owners = std::count_if(peers_.begin(), peers_.end(),
+                                                      [b = block](const peer& r) { return r.inflight.count(b) != 0; });
+                        if (owners > 1) continue;
+                        double t = q_rate > 0 ? queued(q, block) / q_rate : std::numeric_limits<double>::infinity();
+                        if (t > best_time) {
+                            best_time = t;
+                            pick = block;
+                        }
+                    }
+                }
+                if (pick >= blocks_.size()) break;
+            }
+            p.inflight[pick];
+            want.add(pick * block_size, pick * block_size + block_length(pick));
+        }
+        if (want.covered() > 0) out.emplace_back(p.control, msg_want + " " + want.to_string());
+    }
+}
+
+void file_swarm::on_data(size_t index, const rtc::binary& message) {
+    chunk_header header;
+    if (!read_chunk_header(message, header)) {
+        add_log(log_level::warning, 0, u8"[swarm] 잘못된 청크");
+        return;
+    }
+    const std::byte* payload = message.data() + chunk_header_size;
+    outbox out;
+
+    if (header.type == message_type::hashes) {
+        bool failed = false, complete = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            peer& p = peers_[index];
+            if (p.gone || p.seeding) return;
+            uint64_t size = announce_.size;
+            uint64_t count = (size + block_size - 1) / block_size;
+            if (!p.announced || header.offset != p.hashes.size() || chunk_hash(payload, header.length) != header.hash ||
+                !parse_block_hashes(payload, header.length, p.hashes) || p.hashes.size() > count) {
+                drop_locked(index, u8"잘못된 해시 목록");
+            }
+            else if (p.hashes.size() == count) {
+                // 목록이 다이제스트와 맞아야 이 목록으로 블록을 검증할 수 있다
+                if (digest_of_blocks(p.hashes) != digest_) {
+                    drop_locked(index, u8"해시 목록이 다이제스트와 다릅니다");
+                }
+                else {
+                    p.seeding = true;
+                    if (!started_) {
+                        hashes_ = p.hashes;
+                        failed = !start_locked();
+                        complete = !failed && blocks_.empty();
+                    }
+                    std::vector<uint64_t>().swap(p.hashes);
+                    schedule_locked(out);
+                }
+            }
+        }
+        flush(out);
+        if (failed) fail(u8"파일 저장 실패!");
+        else if (complete) finish();
+        return;
+    }
+    if (header.type != message_type::data) return;
+
+    bool compressed = (header.flags & chunk_flag_compressed) != 0;
+    size_t length = compressed ? header.raw_length : header.length;
+    thread_local rtc::binary unpacked;
+    bool intact = true;
+    if (compressed) {
+        intact = decode_chunk(payload, header.length, length, unpacked);
+        payload = unpacked.data();
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(mutex_);
+    peer& p = peers_[index];
+    uint64_t block = header.offset / block_size;
+    if (!started_ || p.gone || block >= blocks_.size()) return;
+    uint64_t block_begin = block * block_size;
+    uint64_t block_len = block_length(block);
+
+    if (!intact || chunk_hash(payload, length) != header.hash || header.offset + length > block_begin + block_len) {
+        // 전송 중에 깨진 조각은 같은 송신자에게 다시 달라고 한다
+        range_set again;
+        again.add(header.offset, header.offset + length);
+        add_log(log_level::warning, 0, u8"[swarm] 손상된 청크 다시 요청: " + again.to_string());
+        auto control = p.control;
+        lock.unlock();
+        if (control) control->send(msg_want + " " + again.to_string());
+        return;
+    }
+
+    if (p.received == 0) p.first_data = now;
+    p.received += length;
+    p.metrics->bytes_received += length;
+    p.metrics->mark(session_phase::first_byte);
+
+    auto it = p.inflight.find(block);
+    if (blocks_[block] == block_state::done || it == p.inflight.end()) {
+        duplicate_bytes_ += length; // 다른 송신자에게서 먼저 받아 취소한 블록
+        return;
+    }
+    assembly& a = it->second;
+    if (a.data.empty()) a.data.resize(static_cast<size_t>(block_len));
+    uint64_t at = header.offset - block_begin;
+    std::memcpy(a.data.data() + at, payload, length);
+    a.got.add(at, at + length);
+    if (!a.got.contains(0, block_len)) return;
+
+    rtc::binary data = std::move(a.data);
+    p.inflight.erase(it);
+    if (chunk_hash(data.data(), data.size()) != hashes_[block]) {
+        // 해시 목록과 다른 블록은 쓰지 않는다. 다른 송신자가 받고 있지 않으면 다시 나눠 준다
+        ++p.strikes;
+        add_log(log_level::warning, 0, u8"[swarm] 송신자 " + std::to_string(index + 1) + u8"의 블록 " +
+                std::to_string(block) + u8" 검증 실패");
+        bool others = std::any_of(peers_.begin(), peers_.end(), [&](const peer& q) { return q.inflight.count(block) != 0; });
+        if (!others) {
+            blocks_[block] = block_state::missing;
+            next_missing_ = std::min(next_missing_, block);
+        }
+        if (p.strikes >= max_strikes) drop_locked(index, u8"검증 실패가 너무 많습니다");
+        schedule_locked(out);
+        bool all_gone = std::all_of(peers_.begin(), peers_.end(), [](const peer& q) { return q.gone; });
+        lock.unlock();
+        flush(out);
+        if (all_gone) fail(u8"스웜: 남은 송신자가 없습니다");
+        return;
+    }
+
+    blocks_[block] = block_state::done;
+    ++done_blocks_;
+    p.metrics->bytes_written += block_len;
+    p.metrics->rate.add(block_len);
+    for (peer& q : peers_) {
+        if (q.inflight.erase(block) && q.control && !q.gone) {
+            out.emplace_back(q.control, msg_cancel + " " + std::to_string(block_begin) + "-" +
+                                            std::to_string(block_begin + block_len));
+        }
+    }
+    ++pushing_;
+    schedule_locked(out);
+    lock.unlock();
+
+    flush(out);
+    bool pushed = writer_->push(block_begin, data.data(), data.size());
+    // 다른 스레드가 아직 블록을 넣는 중이면 finish 는 그쪽이 부른다
+    lock.lock();
+    bool complete = --pushing_ == 0 && done_blocks_ == blocks_.size();
+    lock.unlock();
+    if (!pushed) fail(u8"파일 쓰기 실패!");
+    else if (complete) finish();
+}
+
+void file_swarm::flush(outbox& out) {
+    for (auto& [dc, message] : out) {
+        if (dc && dc->isOpen()) dc->send(message);
+    }
+    out.clear();
+}
+
+void file_swarm::finish() {
+    if (finished_.exchange(true)) return;
+
+    outbox out;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const peer& p : peers_) {
+            if (!p.gone && p.control) out.emplace_back(p.control, msg_done);
+        }
+    }
+    flush(out);
+
+    std::weak_ptr<file_swarm> weak = weak_from_this();
+    writer_->finish([weak](bool ok) {
+        auto self = weak.lock();
+        if (!self) return;
+        std::function<void(bool)> on_complete;
+        std::vector<std::string> lines;
+        {
+            std::lock_guard<std::mutex> lock(self->mutex_);
+            on_complete = self->on_complete_;
+            self->file_.close();
+            std::error_code ec;
+            if (ok) fs::rename(self->temp_path_, self->path_, ec);
+            else fs::remove(self->temp_path_, ec);
+            ok = ok && !ec;
+
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - self->started_at_).count();
+            lines.push_back(u8"스웜 받기 완료: " + std::to_string(self->announce_.size) + " bytes, " +
+                            std::to_string(static_cast<uint64_t>(seconds * 1000)) + " ms, " + u8"중복 " +
+                            std::to_string(self->duplicate_bytes_) + " bytes");
+            for (size_t i = 0; i < self->peers_.size(); ++i) {
+                lines.push_back(u8"  송신자 " + std::to_string(i + 1) + ": " +
+                                std::to_string(self->peers_[i].metrics->bytes_written.load()) + " bytes");
+            }
+        }
+        if (on_complete) on_complete(ok);
+        if (!ok) {
+            add_log(log_level::error, 0, u8"파일 쓰기 실패!");
+            return;
+        }
+        for (const auto& line : lines) add_log(line);
+        add_log(u8"무결성 확인: " + self->digest_.to_hex());
+    });
+}
+
+void file_swarm::fail(const std::string& reason) {
+    if (finished_.exchange(true)) return;
+    failed_ = true;
+    add_log(log_level::error, 0, reason);
+
+    std::function<void(bool)> on_complete;
+    bool opened;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        on_complete = on_complete_;
+        opened = writer_ != nullptr;
+    }
+    if (!opened) {
+        if (on_complete) on_complete(false);
+        return;
+    }
+    // 다른 스레드가 push 하는 중일 수 있으므로 쓰기 스레드를 세운 뒤 그 스레드에서 쓰다 만 파일을 지운다
+    std::weak_ptr<file_swarm> weak = weak_from_this();
+    writer_->finish([weak, on_complete](bool) {
+        if (auto self = weak.lock()) {
+            std::lock_guard<std::mutex> lock(self->mutex_);
+            self->file_.close();
+            std::error_code ec;
+            fs::remove(self->temp_path_, ec);
+        }
+        if (on_complete) on_complete(false);
+    });
+}
@@ -0,0 +1,117 @@
+﻿#pragma once
+
+#include <rtc/rtc.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "fileio.h"
+#include "hashing.h"
+#include "metrics.h"
+#include "protocol.h"
+#include "ranges.h"
+#include "writer.h"
+
+// 같은 파일을 가진 여러 송신자(send_options::seed)에게서 블록을 나눠 받는 수신기.
+// 파일은 다이제스트로 찾는다. 송신자가 보낸 블록 해시 목록이 다이제스트와 맞으면 그 목록으로
+// 블록(hash_block_size)마다 검증한 뒤에만 디스크에 쓴다.
+//
+// 블록은 앞에서부터 차례로 나눠 주고, 송신자마다 지금까지의 속도로 pipeline_seconds 만큼 채울 수 있는
+// 블록 수까지만 동시에 요청한다. 그래서 빠른 송신자가 더 많은 블록을 가져간다.
+// 남은 블록이 없으면(end-game) 느린 송신자가 붙잡고 있는 블록을 더 빨리 끝낼 수 있는 송신자에게 한 번 더 요청하고,
+// 먼저 도착한 쪽을 쓴 뒤 나머지에는 __CANCEL__ 을 보낸다.
+class file_swarm : public std::enable_shared_from_this<file_swarm> {
+public:
+    static constexpr size_t block_size = hash_block_size;
+    static constexpr double pipeline_seconds = 0.5;
+    static constexpr size_t min_pipeline = 2;
+    static constexpr size_t max_pipeline = 16;
+    static constexpr int max_strikes = 3; // 검증에 실패한 블록이 이만큼이면 그 송신자를 뺀다
+
+    // peers 명의 송신자에게서 digest 인 파일을 받는다
+    static std::shared_ptr<file_swarm> create(std::filesystem::path download_dir, file_digest digest, size_t peers);
+    ~file_swarm();
+
+    // peer 번째 송신자 연결에서 넘어온 채널을 붙인다
+    void attach(size_t peer, std::shared_ptr<rtc::DataChannel> dc);
+    // 연결이 끊긴 송신자. 맡겨 둔 블록은 다른 송신자에게 다시 나눠 준다
+    void detach(size_t peer);
+
+    // 모든 블록을 검증까지 마쳤다 (파일을 닫는 중일 수 있다)
+    bool finished() const { return finished_ && !failed_; }
+    size_t peer_count() const { return peers_.size(); }
+    // 송신자별 지표. bytes_written 은 그 송신자에게서 받아 검증을 통과한 양이다
+    const std::shared_ptr<session_metrics>& peer_metrics(size_t peer) const { return peers_[peer].metrics; }
+
+    // 파일을 다 쓰면 쓰기 스레드에서, 남은 송신자가 없으면 그 자리에서 on_complete(성공 여부)를 부른다
+    void set_on_complete(std::function<void(bool ok)> on_complete);
+
+private:
+    struct assembly {
+        rtc::binary data;
+        range_set got;
+    };
+
+    struct peer {
+        std::shared_ptr<rtc::DataChannel> control; // "file" 채널
+        std::vector<uint64_t> hashes;             // 이 송신자가 보낸 블록 해시 목록
+        bool announced = false;                   // __SEED__ 의 다이제스트가 맞았다
+        bool seeding = false;                     // 해시 목록까지 맞아 요청을 받을 수 있다
+        bool gone = false;
+        int strikes = 0;
+        std::map<uint64_t, assembly> inflight;    // 요청한 블록 -> 받는 중인 내용
+        uint64_t received = 0;
+        std::chrono::steady_clock::time_point first_data;
+        std::shared_ptr<session_metrics> metrics = std::make_shared<session_metrics>();
+
+        double rate(std::chrono::steady_clock::time_point now) const;
+    };
+
+    enum class block_state : uint8_t { missing, requested, done };
+    using outbox = std::vector<std::pair<std::shared_ptr<rtc::DataChannel>, std::string>>;
+
+    file_swarm(std::filesystem::path download_dir, file_digest digest, size_t peers);
+
+    void on_control(size_t index, const std::shared_ptr<rtc::DataChannel>& dc, const std::string& message);
+    void on_data(size_t index, const rtc::binary& message);
+    bool start_locked();
+    void drop_locked(size_t index, const std::string& reason);
+    void schedule_locked(outbox& out);
+    uint64_t block_length(uint64_t block) const;
+    void flush(outbox& out);
+    void finish();
+    void fail(const std::string& reason);
+
+    std::filesystem::path download_dir_;
+    const file_digest digest_;
+
+    std::mutex mutex_;
+    std::vector<peer> peers_;             // 크기는 만들 때 정해진다
+    seed_announce announce_;
+    std::vector<uint64_t> hashes_;        // 다이제스트와 맞는 것으로 확인된 블록 해시 목록
+    std::vector<block_state> blocks_;
+    size_t done_blocks_ = 0;
+    uint64_t next_missing_ = 0;           // 이 앞의 블록은 missing 이 아니다
+    bool started_ = false;
+    size_t pushing_ = 0;                  // 검증을 마치고 writer_ 에 넣는 중인 블록 수
+    uint64_t duplicate_bytes_ = 0;        // end-game 에서 두 번 받은 양
+    std::chrono::steady_clock::time_point started_at_;
+
+    file_io file_;
+    std::unique_ptr<write_behind> writer_;
+    std::filesystem::path path_;
+    std::filesystem::path temp_path_;
+
+    std::function<void(bool)> on_complete_;
+    std::atomic<bool> finished_{ false }; // finish() 나 fail() 을 지났다
+    std::atomic<bool> failed_{ false };
+};
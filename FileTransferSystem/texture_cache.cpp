@@ -0,0 +1,44 @@
+﻿#include "texture_cache.h"
+
+#include <GLFW/glfw3.h>
+
+const texture_cache::entry& texture_cache::upload(texture_slot slot, const unsigned char* rgba, int width, int height) {
+    entry& e = entries_[static_cast<size_t>(slot)];
+    bool fresh = e.id == 0;
+    if (fresh) {
+        GLuint id = 0;
+        glGenTextures(1, &id);
+        e.id = id;
+    }
+    glBindTexture(GL_TEXTURE_2D, e.id);
+    // 행 길이가 4 의 배수라 기본 정렬로 충분하지만 다른 코드가 바꿔 두었을 수 있다
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    if (fresh) {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+    if (!fresh && e.width == width && e.height == height) {
+        // 저장 공간은 그대로 두고 내용만 바꾼다
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+    }
+    else {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+        e.width = width;
+        e.height = height;
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return e;
+}
+
+void texture_cache::release(texture_slot slot) {
+    entry& e = entries_[static_cast<size_t>(slot)];
+    if (e.id != 0) {
+        GLuint id = e.id;
+        glDeleteTextures(1, &id);
+    }
+    e = {};
+}
+
+void texture_cache::clear() {
+    for (size_t i = 0; i < entries_.size(); ++i) release(static_cast<texture_slot>(i));
+}
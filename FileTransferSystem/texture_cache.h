@@ -0,0 +1,40 @@
+﻿#pragma once
+
+#include <array>
+#include <cstddef>
+
+// GUI 가 띄우는 이미지마다 GL 텍스처를 하나씩만 두고 다시 쓴다.
+// 크기가 같으면 glTexSubImage2D 로 내용만 바꾸고, 다르면 같은 이름에 새로 올린다.
+// 그래서 SDP 이미지를 몇 번을 새로 만들어도 텍스처 수와 GPU 메모리가 늘지 않는다.
+// GL 문맥이 있는 메인 스레드에서만 부른다. 다른 스레드에서는 run_on_main_thread 로 넘긴다.
+enum class texture_slot {
+    offer,      // 내가 만든 Offer 이미지
+    answer,     // 내가 만든 Answer 이미지
+    clipboard,  // 클립보드에서 붙여 넣은 상대 이미지
+    count
+};
+
+class texture_cache {
+public:
+    struct entry {
+        unsigned int id = 0; // GLuint. 0 이면 아직 없다
+        int width = 0;
+        int height = 0;
+    };
+
+    texture_cache() = default;
+    ~texture_cache() = default; // GL 문맥이 먼저 사라질 수 있으므로 clear() 를 직접 부른다
+
+    texture_cache(const texture_cache&) = delete;
+    texture_cache& operator=(const texture_cache&) = delete;
+
+    // rgba 는 width * height * 4 바이트
+    const entry& upload(texture_slot slot, const unsigned char* rgba, int width, int height);
+    const entry& get(texture_slot slot) const { return entries_[static_cast<size_t>(slot)]; }
+    void release(texture_slot slot);
+    // GL 문맥을 닫기 전에 부른다
+    void clear();
+
+private:
+    std::array<entry, static_cast<size_t>(texture_slot::count)> entries_{};
+};
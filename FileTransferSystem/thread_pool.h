@@ -0,0 +1,32 @@
+﻿#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 정해진 수의 작업 스레드. post 한 작업은 들어온 순서대로 꺼내 아무 스레드에서나 돈다.
+class thread_pool {
+public:
+    explicit thread_pool(size_t threads);
+    // 남은 작업을 마저 돌린 뒤 스레드를 join 한다
+    ~thread_pool();
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    void post(std::function<void()> task);
+    size_t size() const { return threads_.size(); }
+
+private:
+    void run();
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> tasks_;
+    bool stopping_ = false;
+    std::vector<std::thread> threads_;
+};
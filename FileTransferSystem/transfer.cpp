@@ -0,0 +1,1152 @@
+﻿#include "transfer.h"
+#include "archive.h"
+#include "checkpoint.h"
+#include "log.h"
+#include "protocol.h"
+
+#include <algorithm>
+
+namespace fs = std::filesystem;
+
+// 파일 목록과 복사 명령은 청크 크기와 상관없이 이 크기로 잘라 제어 채널에 싣는다
+static constexpr size_t control_chunk_size = 16384;
+
+// 부분 신뢰 전송에서 잃어버린 구간을 살피는 간격
+static constexpr std::chrono::milliseconds arq_interval{ 5 };
+
+// message 앞쪽 헤더 자리를 type 과 본문 길이/해시로 채운다
+static void seal_message(rtc::binary& message, message_type type, uint64_t offset = 0, uint32_t group = 0) {
+    chunk_header header;
+    header.type = type;
+    header.offset = offset;
+    header.group = group;
+    header.length = static_cast<uint32_t>(message.size() - chunk_header_size);
+    header.hash = chunk_hash(message.data() + chunk_header_size, header.length);
+    write_chunk_header(message.data(), header);
+}
+
+// 마지막 참조가 그 스레드 안에서 풀렸으면 자기 자신을 join 할 수 없다
+static void join_worker(std::thread& worker) {
+    if (!worker.joinable()) return;
+    if (worker.get_id() == std::this_thread::get_id()) worker.detach();
+    else worker.join();
+}
+
+std::shared_ptr<file_sender> file_sender::create(const std::shared_ptr<rtc::PeerConnection>& pc,
+                                                 std::unique_ptr<chunk_source> source,
+                                                 std::string name,
+                                                 send_options options,
+                                                 rtc::binary manifest) {
+    auto sender = std::shared_ptr<file_sender>(new file_sender(std::move(source), std::move(name), options));
+    sender->manifest_ = std::move(manifest);
+
+    // 첫 채널("file")은 제어 메시지도 함께 싣는다. 부분 신뢰면 제어만 싣고 데이터 채널을 따로 channels 개 연다
+    bool lossy = sender->arq_ != nullptr;
+    int count = sender->options_.channels + (lossy ? 1 : 0);
+    const std::string& base = sender->options_.label;
+    for (int i = 0; i < count; ++i) {
+        auto l = std::make_unique<lane>();
+        std::string label = i == 0 ? base : base + "-" + std::to_string(i);
+        if (lossy && i > 0) {
+            rtc::DataChannelInit init;
+            init.reliability.unordered = true;
+            init.reliability.maxRetransmits = 0;
+            l->dc = pc->createDataChannel(label, init);
+        }
+        else {
+            l->dc = pc->createDataChannel(label);
+        }
+        sender->lanes_.push_back(std::move(l));
+    }
+    for (size_t i = 0; i < sender->lanes_.size(); ++i) sender->bind(i);
+
+    if (sender->options_.flow) {
+        std::weak_ptr<file_sender> weak = sender;
+        sender->options_.flow->add_waiter([weak]() {
+            auto self = weak.lock();
+            if (!self || (self->finished_ && !self->resending_)) return false;
+            for (auto& l : self->lanes_) self->pump(*l);
+            return true;
+        });
+    }
+    if (lossy) {
+        std::weak_ptr<file_sender> weak = sender;
+        sender->arq_thread_ = std::thread([weak]() {
+            for (;;) {
+                std::this_thread::sleep_for(arq_interval);
+                auto self = weak.lock();
+                if (!self || self->finished_) return;
+                self->arq_tick();
+            }
+        });
+    }
+    return sender;
+}
+
+file_sender::file_sender(std::unique_ptr<chunk_source> source, std::string name, send_options options)
+    : source_(std::move(source)), name_(std::move(name)), options_(options), tuner_(options.chunk_size),
+      compressor_(options.compression) {
+    size_ = source_->size();
+    plan_.emplace_back(0, size_);
+    metrics_->total_bytes = size_;
+    metrics_->set_name(name_);
+    options_.channels = std::max(1, options_.channels);
+    if (options_.low_watermark >= options_.high_watermark)
+        options_.low_watermark = options_.high_watermark / 2;
+    // 스웜 수신측은 송신자마다 __WANT__ 로 다시 달라고 하므로 따로 재전송을 관리하지 않는다
+    if (options_.lossy && !options_.seed) {
+        arq_ = std::make_unique<arq_sender>();
+        if (options_.fec_group >= 2) fec_ = std::make_unique<fec_encoder>(options_.fec_group);
+    }
+}
+
+file_sender::~file_sender() {
+    join_worker(delta_thread_);
+    join_worker(seed_thread_);
+    join_worker(arq_thread_);
+}
+
+void file_sender::bind(size_t index) {
+    std::weak_ptr<file_sender> weak = weak_from_this();
+    lane& l = *lanes_[index];
+
+    l.dc->setBufferedAmountLowThreshold(options_.low_watermark);
+
+    l.dc->onOpen([weak, index]() {
+        auto self = weak.lock();
+        if (!self) return;
+        lane& l = *self->lanes_[index];
+        l.open = true;
+        if (index == 0) {
+            // 상대가 받을 수 있는 메시지 크기는 SCTP 협상으로 정해진다
+            self->tuner_.set_max_message(l.dc->maxMessageSize(), chunk_header_size);
+            self->metrics_->chunk_size = self->tuner_.chunk_size();
+            add_log(u8"전송 시작...");
+            self->announce(*l.dc);
+        }
+        self->pump(l);
+    });
+
+    l.dc->onBufferedAmountLow([weak, index]() {
+        auto self = weak.lock();
+        if (!self) return;
+        self->update_buffered();
+        self->pump(*self->lanes_[index]);
+    });
+
+    l.dc->onMessage([weak](std::variant<rtc::binary, std::string> data) {
+        auto self = weak.lock();
+        if (!self) return;
+        if (std::holds_alternative<std::string>(data)) self->on_control(std::get<std::string>(data));
+        else self->on_control_binary(std::get<rtc::binary>(data));
+    });
+}
+
+// 묶음 전송이면 알림 뒤에 파일 목록을 잘라 보낸다. 수신측은 목록을 다 받고 나서 __READY__ 를 보낸다.
+void file_sender::announce(rtc::DataChannel& dc) {
+    if (options_.seed) {
+        // 파일 전체를 해시해야 하므로 채널 스레드를 막지 않게 따로 돌린다
+        if (!seed_thread_.joinable())
+            seed_thread_ = std::thread([self = shared_from_this()]() { self->prepare_seed(); });
+        return;
+    }
+    if (arq_) dc.send(msg_arq + " " + std::to_string(fec_ ? options_.fec_group : 0));
+    dc.send(make_file_announce({ size_, options_.channels, name_, manifest_.size() }));
+    for (size_t at = 0; at < manifest_.size(); at += control_chunk_size) {
+        size_t n = std::min(control_chunk_size, manifest_.size() - at);
+        rtc::binary message(chunk_header_size);
+        message.insert(message.end(), manifest_.begin() + at, manifest_.begin() + at + n);
+        seal_message(message, message_type::manifest);
+        dc.send(std::move(message));
+    }
+}
+
+void file_sender::on_control(const std::string& message) {
+    size_t block = 0, count = 0;
+    if (parse_signature_announce(message, block, count)) {
+        std::lock_guard<std::mutex> lock(read_mutex_);
+        delta_block_ = block;
+        signatures_.clear();
+        signatures_.reserve(std::min<size_t>(count, 1 << 20));
+    }
+    else if (message == msg_ready + " " + ready_delta) {
+        // 새 파일 전체를 훑어야 하므로 네트워크 스레드를 막지 않게 따로 돌린다
+        if (delta_thread_.joinable()) return;
+        delta_thread_ = std::thread([self = shared_from_this()]() { self->prepare_delta(); });
+    }
+    else if (message == msg_ready + " " + ready_cdc) {
+        // 델타와 같은 자리에서 돈다. 한 세션에서 둘 중 하나만 온다
+        if (delta_thread_.joinable()) return;
+        delta_thread_ = std::thread([self = shared_from_this()]() { self->prepare_cdc(); });
+    }
+    else if (message == msg_ready || starts_with(message, msg_ready + " ")) {
+        if (message.size() > msg_ready.size()) {
+            range_set have = range_set::parse(message.substr(msg_ready.size() + 1));
+            std::lock_guard<std::mutex> lock(read_mutex_);
+            plan_ = have.missing(size_);
+            next_offset_ = plan_.empty() ? size_ : plan_[0].first;
+            add_log(u8"이어받기: " + std::to_string(have.covered()) + u8" bytes 건너뜀");
+        }
+        ready_ = true;
+        for (auto& l : lanes_) pump(*l);
+    }
+    else if (starts_with(message, msg_resend + " ") || starts_with(message, msg_want + " ")) {
+        bool want = starts_with(message, msg_want + " ");
+        range_set again = range_set::parse(message.substr((want ? msg_want : msg_resend).size() + 1));
+        // 손상된 구간만 다시 보낸다. 다이제스트와 __EOF__ 는 이미 보냈으므로 다시 만들지 않는다
+        requeue(again.to_vector(), false, !want);
+        if (!want) add_log(log_level::warning, 0, u8"[send] 손상된 구간 다시 보냄: " + again.to_string());
+        for (auto& l : lanes_) pump(*l);
+    }
+    else if (starts_with(message, msg_ack + " ")) {
+        if (!arq_) return;
+        arq_->on_ack(range_set::parse(message.substr(msg_ack.size() + 1)));
+        std::vector<range_set::range> lost = arq_->take_lost();
+        if (!lost.empty()) requeue(lost, true);
+        for (auto& l : lanes_) pump(*l);
+    }
+    else if (starts_with(message, msg_cancel + " ")) {
+        range_set cancel = range_set::parse(message.substr(msg_cancel.size() + 1));
+        std::lock_guard<std::mutex> lock(read_mutex_);
+        for (const auto& r : cancel.to_vector()) cancelled_.add(r.first, r.second);
+    }
+    else if (message == msg_done) {
+        finished_ = true;
+        add_log(u8"스웜: 수신측이 다 받았습니다. 보낸 데이터: " + std::to_string(metrics_->bytes_sent) + " bytes");
+    }
+    else {
+        add_log(log_level::debug, 0, u8"[send] 받은 메시지: " + message);
+    }
+}
+
+// 수신측이 보낸 옛 파일 서명 묶음
+void file_sender::on_control_binary(const rtc::binary& message) {
+    chunk_header header;
+    if (!read_chunk_header(message, header) || header.type != message_type::signature ||
+        chunk_hash(message.data() + chunk_header_size, header.length) != header.hash) {
+        add_log(log_level::warning, 0, u8"[send] 잘못된 서명 메시지");
+        return;
+    }
+    std::lock_guard<std::mutex> lock(read_mutex_);
+    parse_signatures(message.data() + chunk_header_size, header.length, signatures_);
+}
+
+// 델타 스레드에서 돈다. 복사 명령을 먼저 보내고 남은 리터럴 구간만 plan_ 으로 보낸다.
+// 새 파일을 훑는 김에 다이제스트도 끝까지 계산해 두므로 이후 청크는 다시 해시하지 않는다.
+// 훑는 동안은 read_mutex_ 를 잡지 않는다. ready_ 전이라 채널은 원본과 hasher_ 를 건드리지 않는다
+void file_sender::prepare_delta() {
+    std::vector<block_signature> signatures;
+    size_t block;
+    {
+        std::lock_guard<std::mutex> lock(read_mutex_);
+        signatures.swap(signatures_);
+        block = delta_block_;
+    }
+    delta_plan plan = compute_delta(*source_, signatures, block, &hasher_);
+    {
+        std::lock_guard<std::mutex> lock(read_mutex_);
+        plan_ = plan.literals.to_vector();
+        plan_index_ = 0;
+        next_offset_ = plan_.empty() ? size_ : plan_[0].first;
+        copied_bytes_ = plan.copied_bytes;
+    }
+    size_t signature_count = signatures.size();
+    std::vector<block_signature>().swap(signatures);
+
+    // 복사 명령은 제어 채널로 보내 __EOF__ 보다 먼저 도착하게 한다
+    const size_t per_message = std::max<size_t>(1, control_chunk_size / copy_entry_size);
+    for (size_t i = 0; i < plan.copies.size(); i += per_message) {
+        rtc::binary message(chunk_header_size);
+        append_copies(plan.copies.data() + i, std::min(per_message, plan.copies.size() - i), message);
+        seal_message(message, message_type::copy);
+        lanes_[0]->dc->send(std::move(message));
+    }
+    add_log(u8"델타: 서명 " + std::to_string(signature_count) + u8"개, 복사 " + std::to_string(plan.copied_bytes) +
+            u8" bytes, 보낼 데이터 " + std::to_string(plan.literals.covered()) + " bytes");
+
+    ready_ = true;
+    for (auto& l : lanes_) pump(*l);
+}
+
+// 델타 스레드에서 돈다. 파일을 내용 기반 청크로 나눠 목록만 먼저 보낸다.
+// 보낼 구간은 수신측이 저장소에서 찾지 못한 청크의 __WANT__ 로 채워지고, 이어지는 __READY__ 에 보내기 시작한다.
+void file_sender::prepare_cdc() {
+    std::vector<cdc_chunk> chunks;
+    {
+        std::lock_guard<std::mutex> lock(read_mutex_);
+        chunks = cdc_split(*source_, {}, &hasher_);
+        plan_.clear();
+        plan_index_ = 0;
+        next_offset_ = size_;
+    }
+
+    auto& dc = lanes_[0]->dc;
+    dc->send(make_chunks_announce(chunks.size()));
+    const size_t per_message = control_chunk_size / cdc_entry_size;
+    for (size_t i = 0; i < chunks.size(); i += per_message) {
+        rtc::binary message(chunk_header_size);
+        append_cdc_chunks(chunks.data() + i, std::min(per_message, chunks.size() - i), message);
+        seal_message(message, message_type::chunk_list, i);
+        dc->send(std::move(message));
+    }
+    add_log(u8"중복 제거: 청크 " + std::to_string(chunks.size()) + u8"개 목록을 보냈습니다 (평균 " +
+            std::to_string(chunks.empty() ? 0 : size_ / chunks.size()) + " bytes)");
+}
+
+// 스웜 송신 스레드에서 돈다. 수신측은 이 다이제스트로 파일을 찾고, 블록 해시 목록으로 받은 블록을 하나씩 검증한다.
+void file_sender::prepare_seed() {
+    file_digest digest;
+    std::vector<uint64_t> hashes;
+    {
+        std::lock_guard<std::mutex> lock(read_mutex_);
+        hash_until(size_);
+        digest = hasher_.finish();
+        hashes = hasher_.block_hashes();
+        // 처음에는 보낼 것이 없다. __WANT__ 가 올 때마다 plan_ 에 붙는다
+        plan_.clear();
+        plan_index_ = 0;
+        next_offset_ = size_;
+    }
+    // 목록을 받은 수신측의 __WANT__ 가 이 스레드보다 먼저 펌프를 돌릴 수 있으므로 보내기 전에 연다
+    ready_ = true;
+
+    auto& dc = lanes_[0]->dc;
+    dc->send(make_seed_announce({ size_, digest, name_ }));
+    const size_t per_message = control_chunk_size / block_hash_entry_size;
+    for (size_t i = 0; i < hashes.size(); i += per_message) {
+        rtc::binary message(chunk_header_size);
+        append_block_hashes(hashes.data() + i, std::min(per_message, hashes.size() - i), message);
+        seal_message(message, message_type::hashes, i);
+        dc->send(std::move(message));
+    }
+    add_log(u8"스웜 제공: " + name_ + " (" + digest.to_hex() + ")");
+}
+
+// 여러 스레드에서 동시에 불릴 수 있다. 이미 누가 돌고 있으면 rerun 만 세우고 빠진다.
+void file_sender::pump(lane& l) {
+    // 부분 신뢰면 "file" 채널은 제어 메시지만 싣는다
+    if (arq_ && &l == lanes_[0].get()) return;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(l.mutex, std::try_to_lock);
+            if (!lock.owns_lock()) {
+                l.rerun = true;
+                return;
+            }
+            l.rerun = false;
+
+            while (ready_ && l.open && (!finished_ || resending_) && l.dc->bufferedAmount() < options_.high_watermark) {
+                auto started = std::chrono::steady_clock::now();
+                // 대역폭 제한에 걸렸다. 토큰이 차면 흐름이 pump 를 다시 부른다
+                if (options_.flow && options_.flow->ready(started) != shaped_flow::clock::duration::zero()) break;
+                // 보내기 직전 버퍼가 비어 있었는지를 봐야 송신측이 링크를 못 채우는지 알 수 있다
+                tuner_.observe(metrics_->bytes_sent, update_buffered(), started);
+                metrics_->chunk_size = tuner_.chunk_size();
+                rtc::binary message;
+                if (!next_chunk(message)) {
+                    if (read_failed_) {
+                        fail();
+                        break;
+                    }
+                    // 다시 보낸 구간까지 끝났으면 finish() 는 아무것도 하지 않는다
+                    // 스웜 송신은 다음 __WANT__ 를, 부분 신뢰 송신은 보낸 구간이 모두 확인되기를 기다린다
+                    if (!options_.seed && !(arq_ && arq_->pending())) finish();
+                    break;
+                }
+                // 압축은 채널 스레드마다 따로 돌도록 읽기 잠금 밖에서 한다
+                compressor_.encode(message, l.dc->bufferedAmount() == 0);
+                size_t wire = message.size();
+                metrics_->bytes_wire += wire;
+                l.dc->send(std::move(message));
+                if (options_.flow) options_.flow->consume(wire);
+                metrics_->chunk_latency.record(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count()));
+                update_buffered();
+            }
+        }
+        if ((finished_ && !resending_) || !l.rerun) return;
+    }
+}
+
+// 다음 청크를 헤더와 함께 out 에 채운다. 읽을 것이 없으면 false
+bool file_sender::next_chunk(rtc::binary& out) {
+    std::lock_guard<std::mutex> lock(read_mutex_);
+    uint32_t group = 0;
+    if (fec_ && fec_->take_parity(out, group)) {
+        seal_message(out, message_type::parity, 0, group);
+        return true;
+    }
+    size_t want;
+    for (;;) {
+        while (plan_index_ < plan_.size() && next_offset_ >= plan_[plan_index_].second) {
+            if (++plan_index_ < plan_.size()) next_offset_ = plan_[plan_index_].first;
+        }
+        if (plan_index_ >= plan_.size()) {
+            // 덜 찬 마지막 묶음의 패리티
+            if (fec_) fec_->flush();
+            if (!fec_ || !fec_->take_parity(out, group)) {
+                resending_ = false;
+                return false;
+            }
+            seal_message(out, message_type::parity, 0, group);
+            return true;
+        }
+        want = static_cast<size_t>(std::min<uint64_t>(tuner_.chunk_size(), plan_[plan_index_].second - next_offset_));
+        // 스웜 수신측은 블록을 넘는 청크를 버린다. 청크 크기가 블록 중간에 바뀌어도 블록 끝에서 자른다
+        if (options_.seed) want = static_cast<size_t>(std::min<uint64_t>(want, hash_block_size - next_offset_ % hash_block_size));
+        // 스웜 수신측이 다른 송신자에게서 이미 받은 구간
+        if (!cancelled_.contains(next_offset_, next_offset_ + want)) break;
+        next_offset_ += want;
+    }
+
+    // 이어받기로 건너뛴 구간도 다이제스트에는 들어가야 한다
+    hash_until(next_offset_);
+
+    // 구멍은 읽지 않고 길이만 보낸다. 스웜 수신측은 블록마다 해시를 검증하므로 그대로 보낸다
+    if (!options_.seed) {
+        uint64_t hole = std::min(source_->hole_end(next_offset_), plan_[plan_index_].second);
+        if (hole > next_offset_) {
+            if (hasher_.consumed() == next_offset_) {
+                hash_scratch_.assign(static_cast<size_t>(std::min<uint64_t>(hole - next_offset_, hash_block_size)), std::byte{ 0 });
+                for (uint64_t left = hole - next_offset_; left > 0;) {
+                    size_t n = static_cast<size_t>(std::min<uint64_t>(left, hash_scratch_.size()));
+                    hasher_.update(hash_scratch_.data(), n);
+                    left -= n;
+                }
+            }
+            seal_zero(hole - next_offset_, out);
+            return true;
+        }
+        // 청크가 다음 구멍에 걸치지 않게 자른다
+        uint64_t data_end = source_->data_end(next_offset_);
+        if (data_end > next_offset_) want = static_cast<size_t>(std::min<uint64_t>(want, data_end - next_offset_));
+    }
+
+    out.reserve(chunk_header_size + want);
+    out.resize(chunk_header_size);
+    size_t readBytes = source_->append(next_offset_, want, out);
+    if (readBytes == 0) {
+        // 파일이 줄었거나 읽기 오류. 여기서 끝내면 수신측은 덜 받은 파일을 성공으로 안다
+        add_log(log_level::error, 0, u8"파일 읽기 실패: " + name_ + " (" + std::to_string(next_offset_) + " / " +
+                                         std::to_string(size_) + " bytes)");
+        read_failed_ = true;
+        return false;
+    }
+
+    const std::byte* payload = out.data() + chunk_header_size;
+    if (hasher_.consumed() == next_offset_) hasher_.update(payload, readBytes);
+
+    // 할당은 되어 있지만 0 뿐인 청크 (미리 잡아 둔 데이터베이스 파일, 디스크 이미지의 빈 곳)
+    if (!options_.seed && is_all_zero(payload, readBytes)) {
+        seal_zero(readBytes, out);
+        return true;
+    }
+
+    chunk_header header;
+    header.length = static_cast<uint32_t>(readBytes);
+    header.offset = next_offset_;
+    header.hash = chunk_hash(payload, readBytes);
+    if (arq_) {
+        bool again = retransmit_.contains(next_offset_, next_offset_ + readBytes);
+        // 패리티는 처음 보내는 청크로만 만든다. 다시 보내는 청크는 이미 지난 묶음에 들어 있었다
+        if (fec_ && !again) header.group = fec_->add(next_offset_, payload, readBytes, header.hash);
+        arq_->on_sent(next_offset_, next_offset_ + readBytes, again);
+        if (again) metrics_->bytes_retransmitted += readBytes;
+    }
+    write_chunk_header(out.data(), header);
+
+    next_offset_ += readBytes;
+    metrics_->bytes_sent += readBytes;
+    metrics_->rate.add(readBytes);
+    metrics_->mark(session_phase::first_byte);
+    return true;
+}
+
+// read_mutex_ 를 잡은 채로 부른다. next_offset_ 부터 length 바이트가 0 이라는 메시지를 out 에 채운다
+void file_sender::seal_zero(uint64_t length, rtc::binary& out) {
+    out.assign(chunk_header_size + 8, std::byte{ 0 });
+    put_u64(out.data() + chunk_header_size, length);
+    seal_message(out, message_type::zero, next_offset_);
+    bool again = arq_ && retransmit_.contains(next_offset_, next_offset_ + length);
+    if (arq_) arq_->on_sent(next_offset_, next_offset_ + length, again);
+    next_offset_ += length;
+    if (!again) metrics_->bytes_sparse += length;
+    metrics_->mark(session_phase::first_byte);
+}
+
+// 모든 채널의 bufferedAmount 합을 지표에 남기고 돌려준다
+uint64_t file_sender::update_buffered() {
+    uint64_t total = 0;
+    for (auto& l : lanes_) total += l->dc->bufferedAmount();
+    metrics_->buffered = total;
+    if (total > metrics_->peak_buffered) metrics_->peak_buffered = total;
+    return total;
+}
+
+// read_mutex_ 를 잡은 채로 부른다. 보내지 않는 구간을 읽어 해시만 한다.
+void file_sender::hash_until(uint64_t offset) {
+    while (hasher_.consumed() < offset) {
+        size_t want = static_cast<size_t>(std::min<uint64_t>(hash_block_size, offset - hasher_.consumed()));
+        hash_scratch_.clear();
+        if (source_->append(hasher_.consumed(), want, hash_scratch_) == 0) break;
+        hasher_.update(hash_scratch_.data(), hash_scratch_.size());
+    }
+}
+
+// ranges 를 보낼 구간에 더한다. lost 이면 잃어버린 구간이라 지금 보내던 구간보다 먼저 다시 보낸다
+// resend 이면 __EOF__ 를 보낸 뒤에도 pump 가 그 구간을 보내도록 resending_ 을 같은 잠금 안에서 세운다
+void file_sender::requeue(const std::vector<range_set::range>& ranges, bool lost, bool resend) {
+    std::lock_guard<std::mutex> lock(read_mutex_);
+    if (resend && !failed_) resending_ = true;
+    bool was_done = plan_index_ >= plan_.size();
+    if (lost && !was_done) {
+        // 지금 구간을 next_offset_ 에서 끊고 그 사이에 끼운다. 수신측의 받은 구간이 덜 쪼개진다
+        range_set::range rest(next_offset_, plan_[plan_index_].second);
+        plan_[plan_index_].second = next_offset_;
+        std::vector<range_set::range> inserted(ranges);
+        inserted.push_back(rest);
+        plan_.insert(plan_.begin() + plan_index_ + 1, inserted.begin(), inserted.end());
+    }
+    else {
+        plan_.insert(plan_.end(), ranges.begin(), ranges.end());
+    }
+    if (lost) {
+        for (const auto& r : ranges) retransmit_.add(r.first, r.second);
+    }
+    if (was_done && plan_index_ < plan_.size()) next_offset_ = plan_[plan_index_].first;
+}
+
+// arq_thread_ 에서 arq_interval 마다 돈다
+void file_sender::arq_tick() {
+    if (!ready_) return;
+    std::vector<range_set::range> lost = arq_->take_lost();
+    if (!lost.empty()) requeue(lost, true);
+    // 마지막 몇 청크는 __ACK__ 을 채울 만큼 메시지가 가지 않으므로 재촉한다
+    if (arq_->poll_due()) lanes_[0]->dc->send(msg_poll);
+    if (!lost.empty() || !arq_->pending()) {
+        for (auto& l : lanes_) pump(*l);
+    }
+}
+
+// 더 보내지 않고 __EOF__ 없이 그만둔다. 세션은 on_failed_ 에서 실패로 닫는다
+void file_sender::fail() {
+    std::function<void()> on_failed;
+    {
+        std::lock_guard<std::mutex> lock(read_mutex_);
+        on_failed = on_failed_;
+        resending_ = false;
+    }
+    if (failed_.exchange(true)) return;
+    finished_ = true;
+    add_log(log_level::error, 0, u8"전송 실패: " + name_);
+    if (on_failed) on_failed();
+}
+
+void file_sender::set_on_failed(std::function<void()> on_failed) {
+    std::lock_guard<std::mutex> lock(read_mutex_);
+    on_failed_ = std::move(on_failed);
+}
+
+void file_sender::finish() {
+    if (finished_.exchange(true)) return;
+
+    file_digest digest;
+    {
+        std::lock_guard<std::mutex> lock(read_mutex_);
+        hash_until(size_);
+        digest = hasher_.finish();
+    }
+    lanes_[0]->dc->send(msg_eof + " " + digest.to_hex()); // 전송 완료 표시
+    compression_stats cs = compressor_.stats();
+    add_log(u8"보낸 데이터: " + std::to_string(metrics_->bytes_sent) + " bytes, " +
+            u8"최대 송신 버퍼: " + std::to_string(metrics_->peak_buffered) + " bytes");
+    if (metrics_->bytes_sparse > 0)
+        add_log(u8"구멍/0 구간: " + std::to_string(metrics_->bytes_sparse) + u8" bytes 는 길이만 보냄");
+    if (arq_)
+        add_log(u8"부분 신뢰: 다시 보낸 데이터 " + std::to_string(metrics_->bytes_retransmitted) + " bytes, RTO " +
+                std::to_string(arq_->rto().count() / 1000) + " ms");
+    if (cs.compressed_chunks > 0)
+        add_log(u8"압축: " + std::to_string(cs.raw_bytes) + " -> " + std::to_string(cs.wire_bytes) + " bytes (" +
+                std::to_string(cs.compressed_chunks) + " / " + std::to_string(cs.compressed_chunks + cs.stored_chunks) +
+                u8" 청크 압축)");
+    add_log(u8"전송 완료!\n창을 닫아도 좋습니다!");
+}
+
+std::shared_ptr<file_receiver> file_receiver::create(fs::path download_dir, receive_options options) {
+    return std::shared_ptr<file_receiver>(new file_receiver(std::move(download_dir), options));
+}
+
+file_receiver::file_receiver(fs::path download_dir, receive_options options)
+    : download_dir_(std::move(download_dir)), options_(options) {
+}
+
+file_receiver::~file_receiver() {
+    // 쓰기 스레드가 on_written 으로 this 를 쓰므로 다른 멤버보다 먼저 멈춘다
+    writer_.reset();
+    join_worker(signature_thread_);
+    join_worker(store_thread_);
+}
+
+void file_receiver::attach(std::shared_ptr<rtc::DataChannel> dc) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        channels_.push_back(dc);
+    }
+
+    std::weak_ptr<file_receiver> weak = weak_from_this();
+    std::weak_ptr<rtc::DataChannel> weak_dc = dc;
+    dc->onClosed([weak]() {
+        if (auto self = weak.lock()) self->suspend();
+    });
+    dc->onMessage([weak, weak_dc](std::variant<rtc::binary, std::string> data) {
+        auto self = weak.lock();
+        if (!self) return;
+        if (std::holds_alternative<std::string>(data)) {
+            if (auto dc = weak_dc.lock()) self->on_control(dc, std::get<std::string>(data));
+        }
+        else {
+            self->on_data(std::get<rtc::binary>(data));
+        }
+    });
+}
+
+void file_receiver::on_control(const std::shared_ptr<rtc::DataChannel>& dc, const std::string& message) {
+    if (message == msg_eof || starts_with(message, msg_eof + " ")) {
+        if (message.size() > msg_eof.size()) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            has_expected_digest_ = file_digest::from_hex(message.substr(msg_eof.size() + 1), expected_digest_);
+        }
+        eof_ = true;
+        check_complete();
+        return;
+    }
+    if (starts_with(message, msg_arq + " ")) {
+        // __FILE__ 보다 먼저 오므로 데이터가 오기 전에 만들어진다
+        std::lock_guard<std::mutex> lock(mutex_);
+        arq_ = std::make_unique<arq_receiver>();
+        add_log(u8"부분 신뢰 전송 (FEC 묶음 " + message.substr(msg_arq.size() + 1) + ")");
+        return;
+    }
+    if (message == msg_poll) {
+        send_ack();
+        return;
+    }
+
+    size_t count = 0;
+    if (parse_chunks_announce(message, count)) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cdc_expected_ = count;
+        cdc_next_offset_ = 0;
+        cdc_chunks_.clear();
+        cdc_chunks_.reserve(std::min<size_t>(count, 1 << 20));
+        control_ = dc;
+        if (count == 0) add_log(log_level::warning, 0, u8"[recv] 빈 청크 목록");
+        return;
+    }
+
+    file_announce announce;
+    if (!parse_file_announce(message, announce)) {
+        add_log(log_level::debug, 0, u8"[recv] 받은 메시지: " + message);
+        return;
+    }
+    if (announce.manifest_size > 0) {
+        // 파일 목록을 다 받은 뒤에 시작한다 (on_manifest)
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_ = announce;
+        manifest_.clear();
+        control_ = dc;
+        return;
+    }
+    start(dc, announce, {});
+}
+
+// 파일 하나면 entries 는 비어 있다. 묶음이면 download_dir_ 아래에 entries 를 만들고 name 은 체크포인트 이름으로만 쓴다
+void file_receiver::start(const std::shared_ptr<rtc::DataChannel>& dc, const file_announce& announce,
+                          std::vector<archive_entry> entries) {
+    range_set have;
+    uint64_t old_size = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        fs::create_directories(download_dir_);
+        // 상대가 보낸 이름에서 경로는 떼어낸다
+        name_ = fs::u8path(announce.name).filename().u8string();
+        path_ = download_dir_ / fs::u8path(name_);
+        temp_path_ = path_;
+        temp_path_ += ".fts-new";
+        checkpoint_ = checkpoint_path(path_);
+        size_ = announce.size;
+        control_ = dc;
+        metrics_->total_bytes = size_;
+        metrics_->set_name(name_);
+
+        is_archive_ = announce.manifest_size > 0;
+        bool resume = (is_archive_ || fs::exists(path_)) && load_checkpoint(checkpoint_, size_, have);
+
+        // 중복 제거 저장소가 같은 이름의 옛 파일까지 찾아 쓰므로 델타보다 먼저 고른다
+        dedup_ = options_.dedup && !is_archive_ && !resume && size_ > 0;
+
+        // 체크포인트 없이 같은 이름의 파일이 있으면 그 파일을 바탕으로 델타를 받는다
+        std::error_code ec;
+        if (!dedup_ && !is_archive_ && !resume && size_ > 0 && fs::is_regular_file(path_, ec)) old_size = fs::file_size(path_, ec);
+        delta_ = !ec && old_size > 0 && old_.open_read(path_);
+
+        bool opened = is_archive_ ? archive_.open(download_dir_, std::move(entries), !resume)
+                                  : file_.open_write(delta_ || dedup_ ? temp_path_ : path_, !resume);
+        if (!opened) {
+            add_log(log_level::error, 0, u8"파일 저장 실패!");
+            return;
+        }
+        target_ = is_archive_ ? static_cast<random_access_file*>(&archive_) : &file_;
+        if (!resume) have.clear();
+        written_ = have;
+        received_ = have.covered();
+        last_save_ = std::chrono::steady_clock::now();
+        if (!delta_ && !dedup_) save_checkpoint(checkpoint_, size_, written_);
+
+        writer_ = std::make_unique<write_behind>(*target_, size_);
+        writer_->set_write_latency(&metrics_->write_latency);
+        // 쓰기 스레드가 마지막 참조를 쥐면 그 스레드에서 writer_ 를 지우게 되므로 weak_ptr 을 잡지 않는다.
+        // 소멸자가 writer_ 를 먼저 멈추므로 this 는 살아 있다
+        writer_->set_on_written([this](uint64_t offset, const std::byte* data, size_t length) {
+            on_written(offset, data, length);
+        });
+
+        if (is_archive_)
+            add_log(u8"묶음 저장 시작: " + name_ + " (" + std::to_string(archive_.file_count()) + u8"개 파일, " +
+                    std::to_string(announce.channels) + u8"개 채널)");
+        else
+            add_log(u8"파일 저장 시작: " + name_ + " (" + std::to_string(announce.channels) + u8"개 채널)");
+        if (resume)
+            add_log(u8"이어받기: " + std::to_string(received_) + " / " + std::to_string(size_) + " bytes");
+    }
+
+    if (delta_) {
+        // 옛 파일을 읽어 서명을 만드는 동안 네트워크 스레드를 막지 않는다
+        join_worker(signature_thread_);
+        signature_thread_ = std::thread([self = shared_from_this(), dc, old_size]() {
+            self->send_signatures(dc, old_size);
+        });
+        return;
+    }
+
+    if (dedup_) {
+        dc->send(msg_ready + " " + ready_cdc);
+        return;
+    }
+
+    dc->send(have.covered() > 0 ? msg_ready + " " + have.to_string() : msg_ready);
+    check_complete(); // 빈 파일이거나 이미 다 받은 파일
+}
+
+// 서명 스레드에서 돈다. 서명을 다 보낸 뒤 __READY__ delta 로 송신을 시작시킨다.
+void file_receiver::send_signatures(std::shared_ptr<rtc::DataChannel> dc, uint64_t old_size) {
+    size_t block = delta_block_size(old_size);
+    std::vector<block_signature> signatures = compute_signatures(old_, old_size, block);
+
+    dc->send(make_signature_announce(block, signatures.size()));
+    const size_t per_message = 16384 / signature_entry_size;
+    for (size_t i = 0; i < signatures.size(); i += per_message) {
+        rtc::binary message(chunk_header_size);
+        append_signatures(signatures.data() + i, std::min(per_message, signatures.size() - i), message);
+        seal_message(message, message_type::signature);
+        dc->send(std::move(message));
+    }
+    dc->send(msg_ready + " " + ready_delta);
+    add_log(u8"델타 받기: 기존 파일 " + std::to_string(old_size) + u8" bytes, 블록 " + std::to_string(block) +
+            u8" bytes, 서명 " + std::to_string(signatures.size()) + u8"개");
+}
+
+// 쓰기 스레드에서 불린다. 체크포인트는 64MB 또는 2초마다 갱신한다.
+// data 가 nullptr 이면 구멍으로 남긴 구간이다.
+void file_receiver::on_written(uint64_t offset, const std::byte* data, size_t length) {
+    if (data) {
+        metrics_->bytes_written += length;
+        metrics_->rate.add(length);
+    }
+    else {
+        metrics_->bytes_sparse += length;
+    }
+    uint64_t prefix;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        written_.add(offset, offset + length);
+        unsaved_bytes_ += length;
+        prefix = written_.contiguous_prefix();
+
+        auto now = std::chrono::steady_clock::now();
+        // 델타와 중복 제거는 옛 파일을 기준으로 하므로 체크포인트를 남기지 않는다
+        if (!delta_ && !dedup_ && (suspended_ || unsaved_bytes_ >= (64u << 20) || now - last_save_ >= std::chrono::seconds(2))) {
+            save_checkpoint(checkpoint_, size_, written_);
+            unsaved_bytes_ = 0;
+            last_save_ = now;
+        }
+    }
+    advance_hash(prefix, offset, data, length);
+}
+
+// 쓰기 스레드에서만 부른다. 다이제스트를 target 까지 진행한다.
+// 방금 쓴 버퍼에 있는 부분은 그대로 쓰고, 없는 부분(순서가 어긋났던 청크, 이어받기 전 데이터)은 파일에서 읽는다.
+void file_receiver::advance_hash(uint64_t target, uint64_t offset, const std::byte* data, size_t length) {
+    while (hasher_.consumed() < target) {
+        uint64_t pos = hasher_.consumed();
+        if (data && pos >= offset && pos < offset + length) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(offset + length, target) - pos);
+            hasher_.update(data + (pos - offset), n);
+            continue;
+        }
+        size_t n = static_cast<size_t>(std::min<uint64_t>(target - pos, hash_block_size));
+        if (data && pos < offset) n = static_cast<size_t>(std::min<uint64_t>(n, offset - pos));
+        hash_scratch_.resize(n);
+        size_t got = target_->pread(hash_scratch_.data(), n, pos);
+        if (got == 0) break;
+        hasher_.update(hash_scratch_.data(), got);
+    }
+}
+
+void file_receiver::suspend() {
+    if (finished_) return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (suspended_ || !writer_) return;
+    suspended_ = true;
+    if (!delta_ && !dedup_) save_checkpoint(checkpoint_, size_, written_);
+    add_log(u8"[recv] 연결 끊김, 다시 연결하면 이어받습니다 (" +
+            std::to_string(written_.covered()) + " / " + std::to_string(size_) + " bytes)");
+}
+
+void file_receiver::on_data(const rtc::binary& message) {
+    chunk_header header;
+    if (!read_chunk_header(message, header) || header.type == message_type::signature) {
+        add_log(log_level::warning, 0, u8"[recv] 잘못된 청크");
+        return;
+    }
+    if (header.type == message_type::manifest) {
+        on_manifest(header, message.data() + chunk_header_size);
+        return;
+    }
+    if (!writer_) return;
+    if (header.type == message_type::copy) {
+        on_copy(header, message.data() + chunk_header_size);
+        return;
+    }
+    if (header.type == message_type::chunk_list) {
+        on_chunk_list(header, message.data() + chunk_header_size);
+        return;
+    }
+    if (header.type == message_type::zero) {
+        on_zero(header, message.data() + chunk_header_size);
+        return;
+    }
+    if (header.type == message_type::parity) {
+        on_parity(header, message.data() + chunk_header_size);
+        return;
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    bool compressed = (header.flags & chunk_flag_compressed) != 0;
+    size_t length = compressed ? header.raw_length : header.length;
+    const std::byte* payload = message.data() + chunk_header_size;
+    // 파일 밖을 가리키는 청크는 쓰지 않는다. 받은 바이트 수로 완료를 판단하므로 세지도 않는다
+    if (header.offset > size_ || length > size_ - header.offset) {
+        add_log(log_level::warning, 0, u8"[recv] 파일 밖을 가리키는 청크");
+        return;
+    }
+    metrics_->mark(session_phase::first_byte);
+
+    thread_local rtc::binary unpacked;
+    bool intact = true;
+    if (compressed) {
+        intact = decode_chunk(payload, header.length, length, unpacked);
+        payload = unpacked.data();
+    }
+
+    if (!intact || chunk_hash(payload, length) != header.hash) {
+        // 손상된 청크는 쓰지 않고 그 구간만 다시 받는다
+        ++corrupt_chunks_;
+        // 부분 신뢰 전송이면 __ACK__ 에서 빠진 구간으로 보이므로 송신측이 알아서 다시 보낸다
+        if (arq_) return;
+        range_set again;
+        again.add(header.offset, header.offset + length);
+        add_log(log_level::warning, 0, u8"[recv] 손상된 청크 다시 요청: " + again.to_string());
+        if (control_) control_->send(msg_resend + " " + again.to_string());
+        return;
+    }
+
+    // 부분 신뢰 전송은 같은 구간이 두 번 올 수 있다. 처음 받은 바이트만 센다
+    uint64_t fresh = length;
+    std::vector<arq_receiver::recovered_chunk> recovered;
+    if (arq_) fresh = arq_->on_data(header.offset, payload, length, header.group, recovered);
+
+    if (fresh > 0 && !writer_->push(header.offset, payload, length)) {
+        add_log(log_level::error, 0, u8"파일 쓰기 실패!");
+        return;
+    }
+    received_ += fresh;
+    metrics_->bytes_received += length;
+    if (arq_) {
+        push_recovered(recovered);
+        if (arq_->ack_due()) send_ack();
+    }
+    metrics_->chunk_latency.record(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count()));
+    check_complete();
+}
+
+// 묶음 전송의 파일 목록 조각. 다 모이면 폴더를 만들고 __READY__ 를 보낸다.
+void file_receiver::on_manifest(const chunk_header& header, const std::byte* payload) {
+    file_announce announce;
+    std::shared_ptr<rtc::DataChannel> dc;
+    std::vector<archive_entry> entries;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (pending_.manifest_size == 0 || chunk_hash(payload, header.length) != header.hash) {
+            add_log(log_level::warning, 0, u8"[recv] 잘못된 파일 목록");
+            return;
+        }
+        manifest_.insert(manifest_.end(), payload, payload + header.length);
+        if (manifest_.size() < pending_.manifest_size) return;
+
+        announce = pending_;
+        pending_ = {};
+        dc = control_;
+        bool ok = manifest_.size() == announce.manifest_size &&
+                  parse_manifest(manifest_.data(), manifest_.size(), entries) && archive_size(entries) == announce.size;
+        std::vector<std::byte>().swap(manifest_);
+        if (!ok) {
+            add_log(log_level::warning, 0, u8"[recv] 잘못된 파일 목록");
+            return;
+        }
+    }
+    start(dc, announce, std::move(entries));
+}
+
+// 옛 파일에서 읽어 새 파일 위치로 넣는다. 쓰기는 일반 청크와 같은 write_behind 를 거친다.
+void file_receiver::on_copy(const chunk_header& header, const std::byte* payload) {
+    std::vector<delta_copy> copies;
+    if (!delta_ || chunk_hash(payload, header.length) != header.hash ||
+        !parse_copies(payload, header.length, copies)) {
+        add_log(log_level::warning, 0, u8"[recv] 잘못된 복사 명령");
+        return;
+    }
+    // 새 파일 밖으로 복사하라는 명령이 하나라도 있으면 묶음 전체를 버린다
+    for (const delta_copy& copy : copies) {
+        if (copy.dst > size_ || copy.length > size_ - copy.dst) {
+            add_log(log_level::warning, 0, u8"[recv] 파일 밖을 가리키는 복사 명령");
+            return;
+        }
+    }
+
+    thread_local std::vector<std::byte> buffer;
+    buffer.resize(hash_block_size);
+    for (const delta_copy& copy : copies) {
+        for (uint64_t done = 0; done < copy.length;) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(buffer.size(), copy.length - done));
+            if (old_.pread(buffer.data(), n, copy.src + done) != n || !writer_->push(copy.dst + done, buffer.data(), n)) {
+                add_log(log_level::error, 0, u8"델타 복사 실패!");
+                return;
+            }
+            done += n;
+        }
+        received_ += copy.length;
+        copied_bytes_ += copy.length;
+    }
+    check_complete();
+}
+
+// 구멍이나 0 뿐인 구간. 데이터처럼 write_behind 순서를 따라 쓰기 스레드에서 구멍을 낸다
+void file_receiver::on_zero(const chunk_header& header, const std::byte* payload) {
+    uint64_t length = header.length == 8 ? get_u64(payload) : 0;
+    if (length == 0 || chunk_hash(payload, header.length) != header.hash || header.offset > size_ ||
+        length > size_ - header.offset) {
+        add_log(log_level::warning, 0, u8"[recv] 잘못된 구멍 표시");
+        return;
+    }
+    metrics_->mark(session_phase::first_byte);
+    uint64_t fresh = arq_ ? arq_->on_range(header.offset, header.offset + length) : length;
+    if (fresh > 0 && !writer_->push_zero(header.offset, length)) {
+        add_log(log_level::error, 0, u8"파일 쓰기 실패!");
+        return;
+    }
+    received_ += fresh;
+    if (arq_ && arq_->ack_due()) send_ack();
+    check_complete();
+}
+
+// FEC 패리티. 묶음에서 하나만 빠졌으면 그 청크를 되살려 받은 것처럼 쓴다
+void file_receiver::on_parity(const chunk_header& header, const std::byte* payload) {
+    std::vector<arq_receiver::recovered_chunk> recovered;
+    if (!arq_ || chunk_hash(payload, header.length) != header.hash ||
+        !arq_->on_parity(header.group, payload, header.length, recovered)) {
+        add_log(log_level::warning, 0, u8"[recv] 잘못된 패리티");
+        return;
+    }
+    push_recovered(recovered);
+    if (arq_->ack_due()) send_ack();
+    check_complete();
+}
+
+void file_receiver::push_recovered(std::vector<arq_receiver::recovered_chunk>& recovered) {
+    for (const auto& chunk : recovered) {
+        if (!writer_->push(chunk.offset, chunk.data.data(), chunk.data.size())) {
+            add_log(log_level::error, 0, u8"파일 쓰기 실패!");
+            return;
+        }
+        received_ += chunk.fresh;
+        ++metrics_->fec_recovered;
+    }
+}
+
+// 지금까지 받은 구간 전체를 알린다. 하나가 사라져도 다음 __ACK__ 가 같은 내용을 담는다
+void file_receiver::send_ack() {
+    if (arq_ && control_) control_->send(msg_ack + " " + arq_->ack());
+}
+
+// 송신측의 청크 목록 조각. 다 모이면 저장소 스레드가 있는 청크를 채운다
+void file_receiver::on_chunk_list(const chunk_header& header, const std::byte* payload) {
+    std::shared_ptr<rtc::DataChannel> dc;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!dedup_ || header.offset != cdc_chunks_.size() || chunk_hash(payload, header.length) != header.hash ||
+            !parse_cdc_chunks(payload, header.length, cdc_next_offset_, cdc_chunks_) || cdc_chunks_.size() > cdc_expected_ ||
+            cdc_next_offset_ > size_) {
+            add_log(log_level::warning, 0, u8"[recv] 잘못된 청크 목록");
+            return;
+        }
+        if (cdc_chunks_.size() < cdc_expected_) return;
+        if (cdc_next_offset_ != size_) {
+            add_log(log_level::warning, 0, u8"[recv] 청크 목록이 파일 크기와 다릅니다");
+            return;
+        }
+        dc = control_;
+    }
+    // 폴더를 색인하고 청크를 읽는 동안 네트워크 스레드를 막지 않는다
+    join_worker(store_thread_);
+    store_thread_ = std::thread([self = shared_from_this(), dc]() { self->fill_from_store(dc); });
+}
+
+// 저장소 스레드에서 돈다. 찾은 청크는 일반 청크처럼 write_behind 로 넣고, 없는 구간만 달라고 한 뒤 __READY__ 를 보낸다.
+void file_receiver::fill_from_store(std::shared_ptr<rtc::DataChannel> dc) {
+    store_ = chunk_store::open(download_dir_);
+    if (store_) store_->scan();
+
+    range_set missing;
+    uint64_t reused = 0;
+    size_t reused_chunks = 0;
+    std::vector<std::byte> buffer;
+    for (const cdc_chunk& chunk : cdc_chunks_) {
+        if (store_ && store_->read(chunk.digest, chunk.length, buffer)) {
+            if (!writer_->push(chunk.offset, buffer.data(), chunk.length)) {
+                add_log(log_level::error, 0, u8"파일 쓰기 실패!");
+                return;
+            }
+            reused += chunk.length;
+            ++reused_chunks;
+            continue;
+        }
+        missing.add(chunk.offset, chunk.offset + chunk.length);
+    }
+    received_ += reused;
+    copied_bytes_ += reused;
+
+    // 제어 메시지 하나가 너무 커지지 않게 구간 목록을 나눠 보낸다
+    range_set batch;
+    size_t in_batch = 0;
+    for (const auto& r : missing.to_vector()) {
+        batch.add(r.first, r.second);
+        if (++in_batch == 512) {
+            dc->send(msg_want + " " + batch.to_string());
+            batch.clear();
+            in_batch = 0;
+        }
+    }
+    if (batch.covered() > 0) dc->send(msg_want + " " + batch.to_string());
+    dc->send(msg_ready);
+    add_log(u8"중복 제거: 청크 " + std::to_string(reused_chunks) + " / " + std::to_string(cdc_chunks_.size()) +
+            u8"개를 저장소에서 찾음, 받을 데이터 " + std::to_string(missing.covered()) + " bytes");
+    check_complete();
+}
+
+void file_receiver::check_complete() {
+    if (!eof_ || !writer_ || received_ < size_) return;
+    if (finished_.exchange(true)) return;
+
+    std::weak_ptr<file_receiver> weak = weak_from_this();
+    writer_->finish([weak](bool ok) {
+        auto self = weak.lock();
+        if (!self) return;
+        writer_stats stats = self->writer_->stats();
+
+        // 끝까지 이어진 뒤에도 남은 부분이 있으면 여기서 마저 해시한다
+        self->advance_hash(self->size_, 0, nullptr, 0);
+        file_digest digest = self->hasher_.finish();
+
+        bool verified;
+        size_t files = 1;
+        std::function<void(bool)> on_complete;
+        {
+            std::lock_guard<std::mutex> lock(self->mutex_);
+            on_complete = self->on_complete_;
+            verified = !self->has_expected_digest_ || digest == self->expected_digest_;
+            if (self->is_archive_) files = self->archive_.file_count();
+            if (self->is_archive_) self->archive_.close();
+            else self->file_.close();
+            // 다 받았으면 체크포인트는 필요 없다. 다이제스트가 다르면 그 블록을 믿을 수 없으므로 다음에는 처음부터 받는다.
+            // 쓰기만 실패했으면 남겨 두고 이어받는다
+            if (ok || !verified) remove_checkpoint(self->checkpoint_);
+            if (self->delta_ || self->dedup_) {
+                // 검증된 새 파일로 옛 파일을 바꾼다. 실패하면 옛 파일은 그대로 둔다
+                self->old_.close();
+                std::error_code ec;
+                if (ok && verified) fs::rename(self->temp_path_, self->path_, ec);
+                else fs::remove(self->temp_path_, ec);
+                ok = ok && !ec;
+            }
+            else if (!verified && !self->is_archive_) {
+                // 원래 이름에 두면 다음 세션이 온전한 사본으로 알고 델타의 바탕으로 쓴다
+                fs::path corrupt = self->path_;
+                corrupt += ".fts-corrupt";
+                std::error_code ec;
+                fs::rename(self->path_, corrupt, ec);
+                if (ec) fs::remove(self->path_, ec);
+            }
+        }
+        if (on_complete) on_complete(ok && verified);
+        if (!ok) {
+            add_log(log_level::error, 0, u8"파일 쓰기 실패!");
+            return;
+        }
+        if (!verified) {
+            add_log(log_level::error, 0, u8"무결성 검사 실패! 받은 파일이 원본과 다릅니다 (" + digest.to_hex() + ")");
+            return;
+        }
+        add_log(u8"무결성 확인: " + digest.to_hex() +
+                (self->corrupt_chunks_ > 0 ? u8" (다시 받은 청크 " + std::to_string(self->corrupt_chunks_) + u8"개)" : std::string()));
+        if (self->arq_ && self->arq_->recovered() > 0)
+            add_log(u8"FEC: " + std::to_string(self->arq_->recovered()) + u8"개 청크를 재전송 없이 되살림");
+        if (self->delta_)
+            add_log(u8"델타: " + std::to_string(self->copied_bytes_) + " / " + std::to_string(self->size_) +
+                    u8" bytes 를 기존 파일에서 재사용");
+        if (self->dedup_) {
+            add_log(u8"중복 제거: " + std::to_string(self->copied_bytes_) + " / " + std::to_string(self->size_) +
+                    u8" bytes 를 저장소에서 재사용");
+            // 다음에 받을 파일이 이 파일의 청크도 쓸 수 있게 한다. 목록은 다이제스트로 검증된 내용과 같다
+            if (self->store_) self->store_->add_file(self->path_, self->cdc_chunks_);
+        }
+        add_log(u8"디스크 쓰기 " + std::to_string(stats.writes) + u8"회, 최대 대기 청크 " +
+                std::to_string(stats.peak_queue_depth) + u8"개, 디스크 대기 " +
+                std::to_string(stats.backpressure_events) + u8"회 (" +
+                std::to_string(stats.backpressure_ns / 1000000) + " ms)");
+        if (stats.zeroed_bytes > 0)
+            add_log(u8"구멍으로 남긴 구간: " + std::to_string(stats.zeroed_bytes) + " bytes");
+        if (self->is_archive_) add_log(std::to_string(files) + u8"개 파일을 받았습니다");
+        add_log(u8"파일 수신 완료!\n창을 닫아도 좋습니다!");
+    });
+}
+
+void file_receiver::set_on_complete(std::function<void(bool ok)> on_complete) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    on_complete_ = std::move(on_complete);
+}
+
+writer_stats file_receiver::disk_stats() const {
+    return writer_ ? writer_->stats() : writer_stats{};
+}
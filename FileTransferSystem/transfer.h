@@ -0,0 +1,248 @@
+﻿#pragma once
+
+#include <rtc/rtc.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "archive.h"
+#include "arq.h"
+#include "cdc.h"
+#include "codec.h"
+#include "delta.h"
+#include "fileio.h"
+#include "hashing.h"
+#include "metrics.h"
+#include "protocol.h"
+#include "ranges.h"
+#include "shaper.h"
+#include "source.h"
+#include "sparse.h"
+#include "store.h"
+#include "tuner.h"
+#include "writer.h"
+
+// 송신 흐름 제어 설정
+struct send_options {
+    size_t chunk_size = 0;             // 0 이면 chunk_tuner 가 고르고, 아니면 그 크기로 고정
+    size_t high_watermark = 1 << 20;   // 채널별 bufferedAmount 가 이 값 이상이면 읽기를 멈춘다
+    size_t low_watermark = 256 << 10;  // bufferedAmount 가 이 값 아래로 내려가면 다시 보낸다
+    int channels = 1;                  // 청크를 나눠 실을 DataChannel 수
+    source_kind source = source_kind::stream;
+    compression_mode compression = compression_mode::automatic;
+    bool seed = false;                 // 스웜: 해시 목록만 먼저 보내고 수신측이 __WANT__ 로 요청한 구간만 보낸다
+    bool lossy = false;                // 부분 신뢰: 데이터 채널을 순서 없이, 재전송 없이 열고 빠진 구간은 __ACK__ 를 보고 다시 보낸다 (arq.h)
+    size_t fec_group = 0;              // lossy 일 때 청크 이만큼마다 XOR 패리티를 보낸다. 2 보다 작으면 FEC 를 쓰지 않는다
+    std::shared_ptr<shaped_flow> flow; // 있으면 청크마다 이 흐름의 토큰을 쓴다 (bandwidth_shaper). 팬아웃 세션들은 하나를 나눠 쓴다
+    std::string label = "file";        // 첫 채널 이름. 나머지 채널은 뒤에 -1, -2 ... 가 붙는다 (peer_link 는 당겨 받기마다 다르게 준다)
+};
+
+struct receive_options {
+    bool dedup = false;                // 받을 폴더의 파일들에 이미 있는 청크는 받지 않고 거기서 가져온다 (chunk_store)
+};
+
+// DataChannel 의 bufferedAmount 를 보며 파일을 조금씩 흘려보내는 송신기.
+// channels 개의 DataChannel 에 청크를 나눠 싣고, 각 청크에는 파일 오프셋이 붙는다.
+// 채널마다 큐에 쌓이는 양은 high_watermark + 청크 하나를 넘지 않는다.
+// 수신측이 옛 파일의 서명을 보내 오면 델타를 계산해 바뀐 구간만 보낸다.
+// seed 이면 file_swarm 의 여러 송신자 중 하나로, 수신측이 __DONE__ 을 보내야 끝난다.
+// 파일의 구멍과 0 으로만 된 청크는 내용 대신 구간 길이만 zero 메시지로 보낸다.
+// lossy 이면 "file" 채널은 제어 메시지만 싣고, 데이터는 그 뒤의 재전송 없는 채널들로 보낸다.
+// flow 가 있으면 토큰이 모자랄 때 보내기를 멈추고, 토큰이 차서 흐름이 깨우면 다시 보낸다.
+class file_sender : public std::enable_shared_from_this<file_sender> {
+public:
+    // pc->setLocalDescription() 전에 불러야 채널이 offer 에 포함된다.
+    // manifest 가 있으면 묶음 전송이다 (source 는 open_archive_source, name 은 묶음 이름).
+    static std::shared_ptr<file_sender> create(const std::shared_ptr<rtc::PeerConnection>& pc,
+                                               std::unique_ptr<chunk_source> source,
+                                               std::string name,
+                                               send_options options = {},
+                                               rtc::binary manifest = {});
+    ~file_sender();
+
+    bool finished() const { return finished_ && !failed_; }
+    bool failed() const { return failed_; }
+    uint64_t bytes_sent() const { return metrics_->bytes_sent; }
+    size_t peak_buffered() const { return metrics_->peak_buffered; }
+    const std::shared_ptr<session_metrics>& metrics() const { return metrics_; }
+
+    // 원본을 읽지 못해 전송을 그만두면 채널 스레드에서 on_failed() 를 부른다
+    void set_on_failed(std::function<void()> on_failed);
+
+private:
+    struct lane {
+        std::shared_ptr<rtc::DataChannel> dc;
+        std::mutex mutex;
+        std::atomic<bool> rerun{ false };
+        std::atomic<bool> open{ false };
+    };
+
+    file_sender(std::unique_ptr<chunk_source> source, std::string name, send_options options);
+
+    void bind(size_t index);
+    void announce(rtc::DataChannel& dc);
+    void on_control(const std::string& message);
+    void on_control_binary(const rtc::binary& message);
+    void prepare_delta();
+    void prepare_seed();
+    void prepare_cdc();
+    void pump(lane& l);
+    uint64_t update_buffered();
+    bool next_chunk(rtc::binary& out);
+    void seal_zero(uint64_t length, rtc::binary& out);
+    void hash_until(uint64_t offset);
+    void requeue(const std::vector<range_set::range>& ranges, bool lost, bool resend = false);
+    void arq_tick();
+    void finish();
+    void fail();
+
+    std::vector<std::unique_ptr<lane>> lanes_;
+    std::unique_ptr<chunk_source> source_;
+    std::string name_;
+    uint64_t size_;
+    send_options options_;
+    rtc::binary manifest_;
+    chunk_tuner tuner_;
+
+    std::mutex read_mutex_;
+    std::vector<range_set::range> plan_; // 보낼 구간. 수신측이 이미 가진 구간은 빠진다
+    size_t plan_index_ = 0;
+    uint64_t next_offset_ = 0;
+    tree_hasher hasher_;      // 읽는 순서대로 파일 다이제스트를 만든다
+    rtc::binary hash_scratch_;
+    chunk_compressor compressor_;
+    std::atomic<bool> read_failed_{ false }; // 원본을 끝까지 읽지 못했다. 끝난 것이 아니므로 __EOF__ 를 보내지 않는다
+    std::function<void()> on_failed_;
+
+    // 델타: 수신측 서명을 모은 뒤 별도 스레드에서 새 파일을 훑는다
+    size_t delta_block_ = 0;
+    std::vector<block_signature> signatures_;
+    std::thread delta_thread_;
+    uint64_t copied_bytes_ = 0;
+
+    // 스웜: 해시를 먼저 다 구해 보내고, 다른 송신자에게서 이미 받았다는 구간은 건너뛴다
+    std::thread seed_thread_;
+    range_set cancelled_;
+
+    // 부분 신뢰: 보낸 구간을 확인될 때까지 기억하고, 잃어버린 구간은 plan_ 에서 남은 첫 전송보다 앞에 끼운다
+    std::unique_ptr<arq_sender> arq_;
+    std::unique_ptr<fec_encoder> fec_;
+    range_set retransmit_;    // 다시 보내는 구간. FEC 묶음에 넣지 않는다
+    std::thread arq_thread_;  // 확인이 오지 않는 구간을 시간으로 잃어버림 처리하고 __POLL__ 을 보낸다
+
+    std::atomic<bool> ready_{ false };
+    std::atomic<bool> failed_{ false };
+    std::atomic<bool> finished_{ false };  // __EOF__ 와 다이제스트는 한 번만 보낸다
+    std::atomic<bool> resending_{ false }; // __RESEND__ 로 받은 구간을 보내는 중. finished_ 뒤에도 pump 가 돈다
+    std::shared_ptr<session_metrics> metrics_ = std::make_shared<session_metrics>();
+};
+
+// 송신기가 여는 모든 채널을 받아 오프셋 위치에 써 넣는 수신기.
+// 채널 사이의 순서는 보장되지 않으므로 받은 바이트 수로 완료를 판단한다.
+// 실제 디스크 쓰기는 write_behind 가 맡으므로 네트워크 스레드는 디스크를 기다리지 않는다.
+// 디스크에 쓰인 구간은 체크포인트로 남겨 두었다가 같은 파일을 다시 받을 때 이어받는다.
+// 묶음 전송이면 받은 파일 목록대로 download_dir 아래에 폴더 트리를 다시 만든다.
+// 체크포인트 없이 같은 이름의 파일이 이미 있으면 델타 전송으로 바뀐 부분만 받아 새 파일을 만든다.
+// zero 메시지로 온 구간은 쓰지 않고 구멍으로 남긴다 (random_access_file::zero_range).
+// receive_options::dedup 이면 델타 대신 송신측의 내용 기반 청크 목록을 받아 폴더 안 어느 파일에든 있는 청크를 재사용한다.
+// 송신측이 __ARQ__ 를 보내면 같은 구간이 여러 번 올 수 있으므로 처음 받은 바이트만 세고, 받은 구간을 __ACK__ 로 알린다.
+class file_receiver : public std::enable_shared_from_this<file_receiver> {
+public:
+    static std::shared_ptr<file_receiver> create(std::filesystem::path download_dir, receive_options options = {});
+    ~file_receiver();
+
+    // pc->onDataChannel 에서 넘어온 채널을 붙인다
+    void attach(std::shared_ptr<rtc::DataChannel> dc);
+
+    bool finished() const { return finished_; }
+    writer_stats disk_stats() const;
+    const std::shared_ptr<session_metrics>& metrics() const { return metrics_; }
+
+    // 파일을 다 쓰고 검증까지 끝나면 쓰기 스레드에서 on_complete(성공 여부)를 부른다
+    void set_on_complete(std::function<void(bool ok)> on_complete);
+
+    // 연결이 끊겼을 때 지금까지 쓴 구간을 체크포인트에 남긴다
+    void suspend();
+
+private:
+    file_receiver(std::filesystem::path download_dir, receive_options options);
+
+    void on_control(const std::shared_ptr<rtc::DataChannel>& dc, const std::string& message);
+    void start(const std::shared_ptr<rtc::DataChannel>& dc, const file_announce& announce,
+               std::vector<archive_entry> entries);
+    void on_data(const rtc::binary& message);
+    void on_manifest(const chunk_header& header, const std::byte* payload);
+    void on_copy(const chunk_header& header, const std::byte* payload);
+    void on_zero(const chunk_header& header, const std::byte* payload);
+    void on_parity(const chunk_header& header, const std::byte* payload);
+    void push_recovered(std::vector<arq_receiver::recovered_chunk>& recovered);
+    void send_ack();
+    void send_signatures(std::shared_ptr<rtc::DataChannel> dc, uint64_t old_size);
+    void on_chunk_list(const chunk_header& header, const std::byte* payload);
+    void fill_from_store(std::shared_ptr<rtc::DataChannel> dc);
+    void check_complete();
+    void on_written(uint64_t offset, const std::byte* data, size_t length);
+    void advance_hash(uint64_t target, uint64_t offset, const std::byte* data, size_t length);
+
+    std::filesystem::path download_dir_;
+    std::shared_ptr<session_metrics> metrics_ = std::make_shared<session_metrics>();
+    std::mutex mutex_;
+    std::vector<std::shared_ptr<rtc::DataChannel>> channels_;
+    std::shared_ptr<rtc::DataChannel> control_;
+    file_io file_;
+    archive_writer archive_;
+    random_access_file* target_ = &file_; // file_ 또는 archive_
+    bool is_archive_ = false;
+    file_announce pending_;               // 파일 목록을 기다리는 묶음 전송 알림
+    std::vector<std::byte> manifest_;
+    std::unique_ptr<write_behind> writer_;
+    std::string name_;
+    uint64_t size_ = 0;
+
+    std::filesystem::path checkpoint_;
+    range_set written_;
+    uint64_t unsaved_bytes_ = 0;
+    std::chrono::steady_clock::time_point last_save_;
+    bool suspended_ = false;
+
+    // 델타: 옛 파일(path_)에서 복사하고 나머지를 받아 temp_path_ 에 쓴 뒤 바꿔치기한다
+    bool delta_ = false;
+    file_io old_;
+    std::filesystem::path path_;
+    std::filesystem::path temp_path_;
+    std::thread signature_thread_;
+    std::atomic<uint64_t> copied_bytes_{ 0 };
+
+    // 중복 제거: 청크 목록을 다 받으면 저장소에 있는 청크를 채우고 나머지만 __WANT__ 로 받는다. 델타처럼 temp_path_ 에 쓴다
+    receive_options options_;
+    bool dedup_ = false;
+    size_t cdc_expected_ = 0;
+    uint64_t cdc_next_offset_ = 0;
+    std::vector<cdc_chunk> cdc_chunks_;
+    std::shared_ptr<chunk_store> store_;
+    std::thread store_thread_;
+
+    // 부분 신뢰: __ARQ__ 를 받으면 만든다
+    std::unique_ptr<arq_receiver> arq_;
+
+    // 쓰기 스레드만 건드린다. 앞에서부터 이어진 만큼 해시하고, 순서가 어긋난 구간은 나중에 디스크에서 다시 읽는다
+    tree_hasher hasher_;
+    std::vector<std::byte> hash_scratch_;
+    file_digest expected_digest_;
+    bool has_expected_digest_ = false;
+    std::atomic<uint64_t> corrupt_chunks_{ 0 };
+
+    std::function<void(bool)> on_complete_;
+
+    std::atomic<uint64_t> received_{ 0 };
+    std::atomic<bool> eof_{ false };
+    std::atomic<bool> finished_{ false };
+};
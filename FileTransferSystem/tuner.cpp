@@ -0,0 +1,87 @@
+﻿#include "tuner.h"
+
+#include <algorithm>
+
+namespace {
+
+size_t floor_pow2(size_t value) {
+    size_t out = 1;
+    while (out <= value / 2) out <<= 1;
+    return out;
+}
+
+} // namespace
+
+chunk_tuner::chunk_tuner(size_t pinned)
+    : pinned_(pinned), size_(pinned != 0 ? pinned : initial_chunk) {
+}
+
+void chunk_tuner::set_max_message(size_t max_message, size_t header_size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (max_message <= header_size) return;
+    size_t room = max_message - header_size;
+    if (pinned_ != 0) {
+        size_ = std::min(pinned_, room);
+        return;
+    }
+    limit_ = std::max(min_chunk, std::min(max_chunk, floor_pow2(room)));
+    if (size_ > limit_) size_ = limit_;
+}
+
+void chunk_tuner::observe(uint64_t bytes_sent, uint64_t buffered, clock::time_point now) {
+    if (pinned_ != 0) return;
+    std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+    if (!lock.owns_lock()) return; // 다른 채널 스레드가 보고 있다
+
+    uint64_t drained = bytes_sent > buffered ? bytes_sent - buffered : 0;
+    if (!started_) {
+        started_ = true;
+        window_start_ = now;
+        drained_at_start_ = drained;
+    }
+    ++observations_;
+    if (buffered == 0) ++idle_observations_;
+
+    auto elapsed = now - window_start_;
+    if (elapsed < interval) return;
+
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    double rate = drained > drained_at_start_ ? (drained - drained_at_start_) / seconds : 0;
+    double idle_ratio = static_cast<double>(idle_observations_) / observations_;
+    decide(rate, idle_ratio);
+
+    window_start_ = now;
+    drained_at_start_ = drained;
+    observations_ = idle_observations_ = 0;
+}
+
+// mutex_ 를 잡은 채로 부른다
+void chunk_tuner::decide(double rate, double idle_ratio) {
+    size_t size = size_;
+    // 지금 속도로 청크 하나가 target_latency 안에 빠지는 크기
+    double latency_bytes = rate * std::chrono::duration<double>(target_latency).count();
+    size_t latency_cap = std::max(min_chunk, floor_pow2(static_cast<size_t>(std::max(1.0, latency_bytes))));
+    size_t upper = std::min(limit_, latency_cap);
+
+    if (grew_) {
+        grew_ = false;
+        if (rate < rate_before_grow_ * worse_ratio && size > min_chunk) {
+            size_ = size / 2;
+            hold_ = hold_intervals;
+            return;
+        }
+    }
+    if (rate > 0 && size > upper) {
+        size_ = std::max(min_chunk, size / 2);
+        return;
+    }
+    if (hold_ > 0) {
+        --hold_;
+        return;
+    }
+    if (idle_ratio >= starved_ratio && size * 2 <= upper) {
+        rate_before_grow_ = rate;
+        grew_ = true;
+        size_ = size * 2;
+    }
+}
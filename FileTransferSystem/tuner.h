@@ -0,0 +1,59 @@
+﻿#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+// 전송 중에 청크 크기를 고른다.
+// 빠른 링크에서는 메시지당 비용 때문에 작은 청크가 CPU 를 태우고, 느린 링크에서는 큰 청크 하나가
+// 오래 버퍼를 붙잡아 지연이 커진다. interval 마다 채널 버퍼가 빠져나간 속도와 버퍼가 비어 있던 비율을 보고
+//  - 청크 하나를 내보내는 데 target_latency 보다 오래 걸리면 반으로 줄이고,
+//  - 버퍼가 자주 비면(송신측이 링크를 못 채우면) 두 배로 늘리고,
+//  - 늘렸는데 오히려 느려졌으면 되돌린 뒤 hold_intervals 동안 그대로 둔다.
+// 크기는 2 의 거듭제곱이며 [min_chunk, 상대가 받을 수 있는 최대 메시지 - 헤더] 안에 있다.
+class chunk_tuner {
+public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr size_t min_chunk = 4 << 10;
+    static constexpr size_t max_chunk = 256 << 10;
+    static constexpr size_t initial_chunk = 16 << 10;
+    static constexpr std::chrono::milliseconds interval{ 200 };
+    static constexpr std::chrono::milliseconds target_latency{ 10 };
+    static constexpr double starved_ratio = 0.5;   // 버퍼가 빈 관측이 이 비율 이상이면 송신측이 병목
+    static constexpr double worse_ratio = 0.95;    // 늘린 뒤 속도가 이 비율 아래면 되돌린다
+    static constexpr int hold_intervals = 10;
+
+    // pinned 가 0 이 아니면 그 크기로 고정한다 (최대 메시지 크기 안으로만 줄인다)
+    explicit chunk_tuner(size_t pinned = 0);
+
+    // 상대와 합의한 최대 메시지 크기. 첫 채널이 열리면 알려 준다
+    void set_max_message(size_t max_message, size_t header_size);
+
+    size_t chunk_size() const { return size_.load(std::memory_order_relaxed); }
+    bool pinned() const { return pinned_ != 0; }
+
+    // 청크를 보내기 직전에 보낸 누적 바이트와 채널 버퍼 합을 알려 준다. 여러 스레드에서 불러도 되고,
+    // interval 이 지났을 때만 크기를 다시 정한다
+    void observe(uint64_t bytes_sent, uint64_t buffered, clock::time_point now = clock::now());
+
+private:
+    void decide(double rate, double idle_ratio);
+
+    const size_t pinned_;
+    std::atomic<size_t> size_;
+    size_t limit_ = max_chunk;        // 최대 메시지에 맞춘 상한
+
+    std::mutex mutex_;
+    bool started_ = false;
+    clock::time_point window_start_;
+    uint64_t drained_at_start_ = 0;   // 창 시작 때의 (보낸 양 - 버퍼)
+    uint64_t observations_ = 0;
+    uint64_t idle_observations_ = 0;
+
+    bool grew_ = false;               // 지난 결정이 늘리기였는지
+    double rate_before_grow_ = 0;
+    int hold_ = 0;
+};
@@ -0,0 +1,201 @@
+﻿#include "writer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+write_behind::write_behind(random_access_file& file, uint64_t expected_size)
+    : file_(file), expected_size_(expected_size), slots_(slot_count) {
+    coalesce_.reserve(coalesce_limit);
+    thread_ = std::thread([this]() { run(); });
+}
+
+write_behind::~write_behind() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        finishing_ = true;
+    }
+    not_empty_.notify_all();
+    if (!thread_.joinable()) return;
+    // on_done 안에서 마지막 참조가 풀린 경우
+    if (thread_.get_id() == std::this_thread::get_id()) thread_.detach();
+    else thread_.join();
+}
+
+void write_behind::set_on_written(std::function<void(uint64_t, const std::byte*, size_t)> on_written) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    on_written_ = std::move(on_written);
+}
+
+write_behind::slot* write_behind::reserve(std::unique_lock<std::mutex>& lock) {
+    if (count_ == slots_.size()) {
+        // 디스크가 네트워크를 못 따라가고 있다
+        ++stats_.backpressure_events;
+        auto begin = std::chrono::steady_clock::now();
+        not_full_.wait(lock, [this]() { return count_ < slots_.size() || failed_; });
+        stats_.backpressure_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - begin).count();
+    }
+    if (failed_ || finishing_) return nullptr;
+    return &slots_[(head_ + count_) % slots_.size()];
+}
+
+void write_behind::commit(std::unique_lock<std::mutex>& lock) {
+    ++count_;
+    stats_.peak_queue_depth = std::max(stats_.peak_queue_depth, count_);
+    lock.unlock();
+    not_empty_.notify_one();
+}
+
+bool write_behind::push(uint64_t offset, const void* data, size_t length) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    slot* s = reserve(lock);
+    if (!s) return false;
+    s->data.resize(length); // 용량은 유지되므로 한 번 커진 뒤로는 할당이 없다
+    std::memcpy(s->data.data(), data, length);
+    s->offset = offset;
+    s->length = length;
+    s->zero = false;
+    commit(lock);
+    return true;
+}
+
+// 슬롯 하나가 맡는 구간은 size_t 에 들어가게 1GB 씩 나눈다
+bool write_behind::push_zero(uint64_t offset, uint64_t length) {
+    const uint64_t piece = 1u << 30;
+    while (length > 0) {
+        uint64_t n = std::min(length, piece);
+        std::unique_lock<std::mutex> lock(mutex_);
+        slot* s = reserve(lock);
+        if (!s) return false;
+        s->offset = offset;
+        s->length = static_cast<size_t>(n);
+        s->zero = true;
+        commit(lock);
+        offset += n;
+        length -= n;
+    }
+    return true;
+}
+
+void write_behind::finish(std::function<void(bool)> on_done) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        on_done_ = std::move(on_done);
+        finishing_ = true;
+    }
+    not_empty_.notify_all();
+}
+
+writer_stats write_behind::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    writer_stats s = stats_;
+    s.queue_depth = count_;
+    return s;
+}
+
+void write_behind::run() {
+    for (;;) {
+        size_t first, count;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            not_empty_.wait(lock, [this]() { return count_ > 0 || finishing_; });
+            if (count_ == 0) break;
+            first = head_;
+            count = count_;
+        }
+
+        // first 부터 count 개는 push() 가 건드리지 않으므로 잠금 없이 쓴다
+        size_t done = write_batch(first, count);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            head_ = (head_ + count) % slots_.size();
+            count_ -= count;
+            if (done != count) failed_ = true;
+        }
+        not_full_.notify_all();
+    }
+
+    bool failed;
+    std::function<void(bool)> on_done;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        failed = failed_;
+        on_done = std::move(on_done_);
+    }
+    bool ok = !failed && file_.sync();
+    if (on_done) on_done(ok);
+}
+
+// 파일 전체를 한 번에 잡으면 구멍과 0 구간으로 남길 곳까지 디스크 공간이 있어야 한다.
+// 데이터를 쓰는 곳에서만 앞서 잡으므로 성긴 파일은 데이터와 창 하나만큼만 쓴다
+void write_behind::allocate_ahead(uint64_t offset, uint64_t end) {
+    if (end <= allocated_ || allocated_ >= expected_size_) return;
+    uint64_t from = std::max(offset, allocated_);
+    uint64_t to = std::min(expected_size_, std::max(end, from + preallocate_window));
+    if (to > from) file_.preallocate(from, to - from);
+    allocated_ = to;
+}
+
+// 오프셋이 이어지는 슬롯끼리 묶어 쓴다. 성공적으로 쓴 슬롯 수를 돌려준다.
+size_t write_behind::write_batch(size_t first, size_t count) {
+    size_t written = 0;
+    size_t i = 0;
+    while (i < count) {
+        const slot& start = slots_[(first + i) % slots_.size()];
+        if (start.zero) {
+            if (!file_.zero_range(start.offset, start.length)) return written;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stats_.zeroed_bytes += start.length;
+            }
+            if (on_written_) on_written_(start.offset, nullptr, start.length);
+            ++written;
+            ++i;
+            continue;
+        }
+        uint64_t run_offset = start.offset;
+        uint64_t run_end = start.offset + start.length;
+        size_t run = 1;
+        while (i + run < count) {
+            const slot& next = slots_[(first + i + run) % slots_.size()];
+            if (next.zero || next.offset != run_end || run_end - run_offset + next.length > coalesce_limit) break;
+            run_end += next.length;
+            ++run;
+        }
+
+        allocate_ahead(run_offset, run_end);
+        bool ok;
+        const std::byte* data;
+        auto started = std::chrono::steady_clock::now();
+        if (run == 1) {
+            data = start.data.data();
+            ok = file_.pwrite(data, start.length, start.offset);
+        }
+        else {
+            coalesce_.clear();
+            for (size_t k = 0; k < run; ++k) {
+                const slot& s = slots_[(first + i + k) % slots_.size()];
+                coalesce_.insert(coalesce_.end(), s.data.begin(), s.data.begin() + s.length);
+            }
+            data = coalesce_.data();
+            ok = file_.pwrite(data, coalesce_.size(), run_offset);
+        }
+        if (!ok) return written;
+        if (write_latency_) {
+            write_latency_->record(static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count()));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++stats_.writes;
+            stats_.bytes_written += run_end - run_offset;
+        }
+        if (on_written_) on_written_(run_offset, data, static_cast<size_t>(run_end - run_offset));
+        written += run;
+        i += run;
+    }
+    return written;
+}
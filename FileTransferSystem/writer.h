@@ -0,0 +1,95 @@
+﻿#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "fileio.h"
+#include "metrics.h"
+
+struct writer_stats {
+    size_t queue_depth = 0;          // 지금 쓰기를 기다리는 청크 수
+    size_t peak_queue_depth = 0;
+    uint64_t backpressure_events = 0; // 큐가 가득 차서 수신 스레드가 기다린 횟수
+    uint64_t backpressure_ns = 0;     // 그렇게 기다린 시간의 합
+    uint64_t writes = 0;              // 실제로 나간 pwrite 수
+    uint64_t bytes_written = 0;
+    uint64_t zeroed_bytes = 0;        // 쓰지 않고 구멍으로 남긴 바이트 (push_zero)
+};
+
+// 수신 콜백과 디스크 쓰기를 떼어 놓는 write-behind 단계.
+// push() 는 청크를 재사용 버퍼 링에 복사만 하고 돌아가며, 링이 가득 차면 빈자리가 날 때까지 기다린다.
+// 쓰기 스레드는 오프셋이 이어지는 청크를 묶어 큰 쓰기 한 번으로 내보낸다.
+class write_behind {
+public:
+    static constexpr size_t slot_count = 256;
+    static constexpr size_t coalesce_limit = 1 << 20;
+    // 데이터가 닿는 곳부터 이만큼 앞서 디스크 공간을 잡는다
+    static constexpr uint64_t preallocate_window = 64 << 20;
+
+    // file 은 write_behind 보다 오래 살아 있어야 한다
+    write_behind(random_access_file& file, uint64_t expected_size);
+    ~write_behind();
+
+    write_behind(const write_behind&) = delete;
+    write_behind& operator=(const write_behind&) = delete;
+
+    // 디스크에 쓰인 구간마다 쓰기 스레드에서 방금 쓴 내용과 함께 불린다. push 전에 설정한다.
+    // push_zero 로 넣은 구간은 data 가 nullptr 이다.
+    void set_on_written(std::function<void(uint64_t offset, const std::byte* data, size_t length)> on_written);
+
+    // pwrite 한 번에 걸린 시간을 latency 에 남긴다. push 전에 설정하고, latency 는 write_behind 보다 오래 살아야 한다
+    void set_write_latency(histogram* latency) { write_latency_ = latency; }
+
+    // 여러 스레드에서 불러도 된다
+    bool push(uint64_t offset, const void* data, size_t length);
+    // offset 부터 length 바이트를 0 으로 만든다 (random_access_file::zero_range). 앞뒤 쓰기와 같은 순서로 처리된다
+    bool push_zero(uint64_t offset, uint64_t length);
+
+    // 남은 청크를 모두 쓰고 fsync 한 뒤 쓰기 스레드에서 on_done(성공 여부)을 부른다
+    void finish(std::function<void(bool)> on_done);
+
+    writer_stats stats() const;
+
+private:
+    struct slot {
+        std::vector<std::byte> data;
+        uint64_t offset = 0;
+        size_t length = 0;
+        bool zero = false; // data 없이 구간만 0 으로 만든다
+    };
+
+    // mutex_ 를 잡은 채로 부른다. 빈 슬롯이 날 때까지 기다렸다가 돌려주고, 쓸 수 없으면 nullptr
+    slot* reserve(std::unique_lock<std::mutex>& lock);
+    void commit(std::unique_lock<std::mutex>& lock);
+
+    void run();
+    size_t write_batch(size_t first, size_t count);
+    // 쓰기 스레드에서만 부른다. [offset, end) 를 쓰기 전에 아직 잡지 않았으면 preallocate_window 만큼 잡는다
+    void allocate_ahead(uint64_t offset, uint64_t end);
+
+    random_access_file& file_;
+    const uint64_t expected_size_;
+    uint64_t allocated_ = 0; // 여기까지 잡았다 (쓰기 스레드만 쓴다)
+    std::vector<slot> slots_;
+    std::vector<std::byte> coalesce_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    size_t head_ = 0;   // 쓰기 스레드가 가져갈 위치
+    size_t count_ = 0;  // head_ 부터 차 있는 슬롯 수
+    bool finishing_ = false;
+    bool failed_ = false;
+    std::function<void(bool)> on_done_;
+    std::function<void(uint64_t, const std::byte*, size_t)> on_written_;
+    histogram* write_latency_ = nullptr;
+    writer_stats stats_;
+
+    std::thread thread_;
+};
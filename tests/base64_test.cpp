@@ -0,0 +1,131 @@
+﻿#include "base64.h"
+#include "test.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+// SIMD 경로(AVX2/SSSE3)가 고른 구현을 비트 단위로 한 글자씩 푸는 기준 구현과 맞대어 본다.
+// 길이는 SIMD 블록 경계 앞뒤를 모두 지나도록 0 부터 촘촘히, 그 뒤로는 띄엄띄엄 고른다.
+
+namespace {
+
+const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+constexpr char canary = '\x7e';
+constexpr size_t slack = 64; // 출력 뒤에 남겨 두고 덮어쓰지 않았는지 본다
+
+std::string reference_encode(const std::string& in) {
+    std::string out;
+    uint32_t v = 0;
+    int bits = 0;
+    for (unsigned char c : in) {
+        v = (v << 8) | c;
+        bits += 8;
+        while (bits >= 6) {
+            bits -= 6;
+            out += alphabet[(v >> bits) & 0x3F];
+        }
+    }
+    if (bits > 0) out += alphabet[(v << (6 - bits)) & 0x3F];
+    while (out.size() % 4) out += '=';
+    return out;
+}
+
+// 알파벳이 아닌 첫 글자에서 멈추고, 채워진 바이트만 낸다
+std::string reference_decode(const std::string& in) {
+    std::string out;
+    uint32_t v = 0;
+    int bits = 0;
+    for (char c : in) {
+        const char* at = c ? std::strchr(alphabet, c) : nullptr;
+        if (!at) break;
+        v = (v << 6) | static_cast<uint32_t>(at - alphabet);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out += static_cast<char>((v >> bits) & 0xFF);
+        }
+    }
+    return out;
+}
+
+// 호출자 버퍼 API 로 인코딩한다. 크기 함수가 말한 자리만 쓰는지도 본다
+std::string encode_into_buffer(const std::string& raw) {
+    size_t capacity = base64_encoded_size(raw.size());
+    std::vector<char> out(capacity + slack, canary);
+    size_t n = base64_encode(raw.data(), raw.size(), out.data());
+    CHECK(n == capacity);
+    for (size_t i = capacity; i < out.size(); ++i) {
+        if (out[i] != canary) {
+            CHECK(out[i] == canary);
+            break;
+        }
+    }
+    return std::string(out.data(), std::min(n, capacity));
+}
+
+std::string decode_into_buffer(const std::string& text) {
+    size_t capacity = base64_decoded_max_size(text.size());
+    std::vector<char> out(capacity + slack, canary);
+    size_t n = base64_decode(text.data(), text.size(), out.data());
+    CHECK(n <= capacity);
+    for (size_t i = capacity; i < out.size(); ++i) {
+        if (out[i] != canary) {
+            CHECK(out[i] == canary);
+            break;
+        }
+    }
+    return std::string(out.data(), std::min(n, capacity));
+}
+
+void check_round_trip(const std::string& raw) {
+    std::string expected = reference_encode(raw);
+    std::string encoded = encode_into_buffer(raw);
+    CHECK(encoded == expected);
+    CHECK(base64_encode(raw) == expected);
+    CHECK(decode_into_buffer(expected) == raw);
+    CHECK(base64_decode(expected) == raw);
+    // 패딩 없이 와도 같은 바이트가 나와야 한다
+    std::string unpadded = expected.substr(0, expected.find('='));
+    CHECK(decode_into_buffer(unpadded) == raw);
+}
+
+} // namespace
+
+int main() {
+    std::mt19937_64 rng(2024);
+
+    // 모든 바이트 값이 모든 자리(3 바이트 묶음의 0/1/2 번째)에 온다
+    std::string all_bytes;
+    for (int shift = 0; shift < 3; ++shift) {
+        for (int b = 0; b < 256; ++b) all_bytes += static_cast<char>((b + shift) & 0xFF);
+        all_bytes += std::string(static_cast<size_t>(shift + 1), '\0');
+    }
+    check_round_trip(all_bytes);
+
+    size_t cases = 0;
+    for (size_t length = 0; length <= 1024; ++length, ++cases) check_round_trip(random_string(length, rng()));
+    for (int i = 0; i < 200; ++i, ++cases) check_round_trip(random_string(1025 + rng() % (256 << 10), rng()));
+
+    // 알파벳이 아닌 글자가 끼면 그 앞까지만 풀린다. SIMD 블록 안쪽과 꼬리 쪽을 모두 건드린다
+    const char bad[] = { '=', '-', '_', ' ', '\n', '\0', '.', '\x80', '\xff' };
+    for (int i = 0; i < 2000; ++i, ++cases) {
+        std::string text = reference_encode(random_string(1 + rng() % 4096, rng()));
+        size_t at = rng() % text.size();
+        text[at] = bad[rng() % sizeof(bad)];
+        std::string expected = reference_decode(text);
+        CHECK(expected.size() == std::min(at, text.find('=')) * 6 / 8);
+        CHECK(decode_into_buffer(text) == expected);
+        CHECK(base64_decode(text) == expected);
+    }
+
+    // 알파벳 글자를 아무렇게나 늘어놓아도 (길이가 4 의 배수가 아니어도) 기준과 같다
+    for (int i = 0; i < 2000; ++i, ++cases) {
+        std::string text(rng() % 2048, 'A');
+        for (char& c : text) c = alphabet[rng() % 64];
+        CHECK(decode_into_buffer(text) == reference_decode(text));
+    }
+
+    std::printf("base64: %zu cases\n", cases);
+    return test_result();
+}
@@ -0,0 +1,80 @@
+﻿#include "delta.h"
+#include "test.h"
+
+#include <cstring>
+
+// 옛 파일에 끼워 넣고, 지우고, 덧붙인 새 파일을 델타로 만든 뒤 복사 명령과 리터럴만으로 되살려 본다.
+
+namespace {
+
+struct delta_case {
+    const char* name;
+    std::string old_data;
+    std::string new_data;
+    uint64_t min_copied; // 바뀐 곳 주변 블록만 빼고는 복사로 가야 한다
+};
+
+// 받는측이 하는 일을 그대로 한다: 옛 파일에서 복사하고 나머지는 새 파일(보낸 리터럴)에서 채운다
+std::string rebuild(const std::string& old_data, const std::string& new_data, const delta_plan& plan) {
+    std::string out(new_data.size(), '\x5a');
+    for (const delta_copy& copy : plan.copies) {
+        REQUIRE(copy.src + copy.length <= old_data.size());
+        REQUIRE(copy.dst + copy.length <= out.size());
+        std::memcpy(&out[copy.dst], &old_data[copy.src], copy.length);
+    }
+    for (const auto& r : plan.literals.to_vector()) {
+        REQUIRE(r.second <= out.size());
+        std::memcpy(&out[r.first], &new_data[r.first], r.second - r.first);
+    }
+    return out;
+}
+
+void run_case(const test_dir& dir, const delta_case& c) {
+    auto old_path = dir / (std::string(c.name) + ".old");
+    auto new_path = dir / (std::string(c.name) + ".new");
+    REQUIRE(write_file(old_path, c.old_data));
+    REQUIRE(write_file(new_path, c.new_data));
+
+    size_t block = delta_block_size(c.old_data.size());
+    file_io old_file;
+    REQUIRE(old_file.open_read(old_path));
+    std::vector<block_signature> signatures = compute_signatures(old_file, c.old_data.size(), block);
+
+    auto source = open_chunk_source(new_path, source_kind::stream);
+    REQUIRE(source);
+    delta_plan plan = compute_delta(*source, signatures, block, nullptr);
+
+    std::printf("%s: block %zu, copied %llu / %zu bytes\n", c.name, block,
+                static_cast<unsigned long long>(plan.copied_bytes), c.new_data.size());
+    // 복사와 리터럴이 새 파일을 겹치지 않고 정확히 덮는다
+    CHECK(plan.copied_bytes + plan.literals.covered() == c.new_data.size());
+    CHECK(plan.copied_bytes >= c.min_copied);
+    CHECK(rebuild(c.old_data, c.new_data, plan) == c.new_data);
+}
+
+} // namespace
+
+int main() {
+    test_dir dir("delta");
+    const std::string base = random_string(3 << 20, 8);
+    const size_t block = delta_block_size(base.size());
+    const size_t middle = base.size() / 2 + 123; // 블록 경계가 아닌 곳
+
+    std::vector<delta_case> cases;
+    cases.push_back({ "same", base, base, base.size() });
+    cases.push_back({ "insert", base, base.substr(0, middle) + random_string(777, 9) + base.substr(middle),
+                      base.size() - 2 * block });
+    cases.push_back({ "delete", base, base.substr(0, middle) + base.substr(middle + 5000), base.size() - 5000 - 2 * block });
+    cases.push_back({ "append", base, base + random_string(100000, 10), base.size() - block });
+    cases.push_back({ "prepend", base, random_string(4321, 11) + base, base.size() - block });
+    cases.push_back({ "truncate", base, base.substr(0, middle), middle - block });
+    cases.push_back({ "edits", base,
+                      base.substr(0, 1000) + "inserted" + base.substr(1000, middle - 1000) + base.substr(middle + 64) + "tail",
+                      base.size() - 4 * block });
+    cases.push_back({ "unrelated", base, random_string(1 << 20, 12), 0 });
+    cases.push_back({ "empty_old", std::string(), base.substr(0, 1 << 20), 0 });
+    cases.push_back({ "empty_new", base, std::string(), 0 });
+
+    for (const delta_case& c : cases) run_case(dir, c);
+    return test_result();
+}
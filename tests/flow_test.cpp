@@ -0,0 +1,41 @@
+﻿#include "loopback.h"
+#include "test.h"
+
+// 송신 버퍼가 파일 크기와 상관없이 high_watermark 근처에 머무는지 본다.
+// 워터마크보다 수백 배 큰 파일을 루프백으로 보내고, 채널 bufferedAmount 합의 최댓값과 받은 파일을 확인한다.
+
+int main() {
+    test_dir dir("flow");
+    const uint64_t size = 96 << 20;
+    std::filesystem::create_directories(dir / "dst");
+    const std::string data = random_string(size, 1);
+    REQUIRE(write_file(dir / "big.bin", data));
+
+    for (int channels : { 1, 4 }) {
+        send_options options;
+        options.high_watermark = 256 << 10;
+        options.low_watermark = 64 << 10;
+        options.channels = channels;
+        options.compression = compression_mode::off;
+
+        test_loopback link;
+        uint64_t receive_id = link.receive(dir / "dst");
+        uint64_t send_id = link.send(dir / "big.bin", options);
+        REQUIRE(send_id != 0);
+        REQUIRE(link.wait({ send_id, receive_id }, std::chrono::seconds(120)));
+        CHECK(link.finished(receive_id));
+
+        // 채널마다 high_watermark 에 청크 하나(헤더 포함)까지 더 쌓일 수 있다
+        metrics_snapshot sent = link.metrics(send_id);
+        uint64_t ceiling = channels * (options.high_watermark + chunk_tuner::max_chunk + chunk_header_size);
+        std::printf("channels %d: peak buffered %llu bytes (ceiling %llu), sent %llu bytes\n", channels,
+                    static_cast<unsigned long long>(sent.peak_buffered), static_cast<unsigned long long>(ceiling),
+                    static_cast<unsigned long long>(sent.bytes_sent));
+        CHECK(sent.peak_buffered > 0);
+        CHECK(sent.peak_buffered <= ceiling);
+        CHECK(sent.bytes_sent == size);
+        CHECK(read_file(dir / "dst" / "big.bin") == data);
+        std::filesystem::remove(dir / "dst" / "big.bin");
+    }
+    return test_result();
+}
@@ -0,0 +1,105 @@
+﻿#pragma once
+
+#include <rtc/rtc.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "session.h"
+#include "source.h"
+
+// 한 session_manager 안의 송신 세션과 수신 세션을 127.0.0.1 로 잇는다 (fts_bench 의 loopback 과 같은 방식).
+// 수신 세션을 먼저 만들어 두면 송신 세션의 Offer 가 나올 때 놀고 있는 수신 세션과 짝을 지어 SDP 를 넘긴다.
+class test_loopback {
+public:
+    explicit test_loopback(size_t threads = 2) {
+        rtc::Configuration config;
+        config.bindAddress = "127.0.0.1";
+        sessions_ = std::make_unique<session_manager>(config, threads);
+        sessions_->set_on_local_description([this](uint64_t id, session_role role, const std::string& sdp) {
+            uint64_t peer = 0;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (role == session_role::send && !idle_receivers_.empty()) {
+                    peer = idle_receivers_.front();
+                    idle_receivers_.pop_front();
+                    peer_of_[peer] = id;
+                }
+                else if (role == session_role::receive && peer_of_.count(id)) {
+                    peer = peer_of_[id];
+                }
+            }
+            if (peer != 0) sessions_->deliver_remote_description(peer, sdp);
+        });
+        sessions_->set_on_state([this](uint64_t id, session_state state) {
+            if (state != session_state::finished && state != session_state::failed) return;
+            std::lock_guard<std::mutex> lock(mutex_);
+            states_[id] = state;
+            cv_.notify_all();
+        });
+    }
+
+    session_manager& sessions() { return *sessions_; }
+
+    uint64_t receive(const std::filesystem::path& download_dir, receive_options options = {}) {
+        uint64_t id = sessions_->start_receive(download_dir, options);
+        std::lock_guard<std::mutex> lock(mutex_);
+        idle_receivers_.push_back(id);
+        return id;
+    }
+
+    // 송신자(send_options::seed) peers 명에게서 나눠 받는다. 수신 세션마다 송신자 하나가 짝을 짓는다
+    std::vector<uint64_t> swarm(const std::filesystem::path& download_dir, const file_digest& digest, size_t peers) {
+        std::vector<uint64_t> ids = sessions_->start_swarm(download_dir, digest, peers);
+        std::lock_guard<std::mutex> lock(mutex_);
+        idle_receivers_.insert(idle_receivers_.end(), ids.begin(), ids.end());
+        return ids;
+    }
+
+    // receive() 나 swarm() 으로 만든 수신 세션이 있어야 짝이 맞는다
+    uint64_t send(const std::filesystem::path& path, send_options options = {}) {
+        auto source = open_chunk_source(path, options.source);
+        if (!source) return 0;
+        return sessions_->start_send(std::move(source), path.filename().u8string(), options);
+    }
+
+    // ids 가 모두 끝나거나 timeout 이 지나면 돌아온다. 모두 끝났으면 true
+    bool wait(const std::vector<uint64_t>& ids, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return cv_.wait_for(lock, timeout, [&]() {
+            for (uint64_t id : ids) {
+                if (!states_.count(id)) return false;
+            }
+            return true;
+        });
+    }
+
+    bool finished(uint64_t id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = states_.find(id);
+        return it != states_.end() && it->second == session_state::finished;
+    }
+
+    // 끝난 세션도 metrics_registry::keep_finished 개까지는 남아 있다
+    metrics_snapshot metrics(uint64_t id) {
+        for (const auto& m : sessions_->metrics().snapshot()) {
+            if (m.id == id) return m;
+        }
+        return {};
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::map<uint64_t, session_state> states_;
+    std::deque<uint64_t> idle_receivers_;  // 아직 Offer 를 받지 않은 수신 세션
+    std::map<uint64_t, uint64_t> peer_of_; // 수신 세션 -> 짝지은 송신 세션
+    std::unique_ptr<session_manager> sessions_; // 풀 스레드가 위 멤버를 쓰므로 가장 먼저 소멸한다
+};
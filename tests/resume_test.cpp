@@ -0,0 +1,67 @@
+﻿#include "checkpoint.h"
+#include "loopback.h"
+#include "shaper.h"
+#include "test.h"
+
+#include <thread>
+
+// 루프백 전송을 중간에 끊고 다시 보낸다.
+// 두 번째 전송은 체크포인트에 없는 구간만 보내야 하고, 받은 파일은 원본과 바이트 단위로 같아야 한다.
+
+int main() {
+    test_dir dir("resume");
+    const uint64_t size = 64 << 20;
+    std::filesystem::create_directories(dir / "dst");
+    const std::string data = random_string(size, 5);
+    REQUIRE(write_file(dir / "big.bin", data));
+    const auto received = dir / "dst" / "big.bin";
+
+    send_options options;
+    options.compression = compression_mode::off;
+    options.chunk_size = 64 << 10;
+
+    // 첫 전송은 16 MiB/s 로 묶어 체크포인트가 몇 번 저장된 뒤 (2 초마다) 끊는다
+    {
+        auto shaper = bandwidth_shaper::create(16 << 20);
+        send_options slow = options;
+        slow.flow = shaper->add_flow();
+
+        test_loopback link;
+        uint64_t receive_id = link.receive(dir / "dst");
+        uint64_t send_id = link.send(dir / "big.bin", slow);
+        REQUIRE(send_id != 0);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+        while (link.metrics(receive_id).bytes_written < size * 3 / 4 && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        link.sessions().stop(send_id);
+        link.sessions().stop(receive_id);
+        REQUIRE(link.wait({ send_id, receive_id }, std::chrono::seconds(30)));
+    }
+
+    range_set have;
+    REQUIRE(load_checkpoint(checkpoint_path(received), size, have));
+    std::printf("checkpoint after kill: %llu / %llu bytes\n", static_cast<unsigned long long>(have.covered()),
+                static_cast<unsigned long long>(size));
+    REQUIRE(have.covered() > 0);
+    REQUIRE(have.covered() < size);
+
+    // 다시 보내면 수신측이 __READY__ 에 가진 구간을 실어 보내고 송신측은 그 구간을 건너뛴다
+    {
+        test_loopback link;
+        uint64_t receive_id = link.receive(dir / "dst");
+        uint64_t send_id = link.send(dir / "big.bin", options);
+        REQUIRE(send_id != 0);
+        REQUIRE(link.wait({ send_id, receive_id }, std::chrono::seconds(120)));
+        CHECK(link.finished(receive_id));
+
+        metrics_snapshot sent = link.metrics(send_id);
+        std::printf("resumed: sent %llu bytes, missing %llu bytes\n", static_cast<unsigned long long>(sent.bytes_sent),
+                    static_cast<unsigned long long>(size - have.covered()));
+        CHECK(sent.bytes_sent == size - have.covered());
+    }
+
+    CHECK(read_file(received) == data);
+    // 검증까지 끝나면 체크포인트는 지운다
+    CHECK(!std::filesystem::exists(checkpoint_path(received)));
+    return test_result();
+}
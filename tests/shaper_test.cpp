@@ -0,0 +1,221 @@
+﻿#include "scheduler.h"
+#include "shaper.h"
+#include "test.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// bandwidth_shaper 를 가상 시계 위에서 돌려 흐름별 속도가 제 몫에서 tolerance 안에 드는지,
+// 가중치를 준 흐름 사이의 Jain 공정성 지수가 1 에 가까운지 본다 (fts_bench --shaping 의 가상 시계 시나리오와 같다).
+// transfer_scheduler 는 세션 없이 작업만 돌려 max_active 와 우선순위 순서를 본다.
+
+namespace {
+
+using clock_type = shaped_flow::clock;
+
+constexpr double mb = 1024.0 * 1024.0;
+constexpr double tolerance = 0.02;   // 가상 시계라 청크 하나만큼의 오차만 남는다
+constexpr double min_jain = 0.999;
+
+// 욕심 많은 송신자들이 1 ms 마다 흐름이 허락하는 만큼 chunk 바이트씩 보낸다.
+// senders 는 보내는 흐름의 수 (뒤쪽 흐름은 쉰다). 흐름마다 초당 MB 를 돌려준다
+std::vector<double> simulate(const std::vector<std::shared_ptr<shaped_flow>>& flows, size_t senders,
+                             clock_type::time_point& now, double seconds, size_t chunk) {
+    std::vector<uint64_t> before;
+    for (const auto& f : flows) before.push_back(f->bytes());
+    for (int64_t ms = 0; ms < static_cast<int64_t>(seconds * 1000); ++ms) {
+        now += std::chrono::milliseconds(1);
+        for (bool sent = true; sent;) {
+            sent = false;
+            for (size_t i = 0; i < senders; ++i) {
+                if (flows[i]->ready(now) != clock_type::duration::zero()) continue;
+                flows[i]->consume(chunk, now);
+                sent = true;
+            }
+        }
+    }
+    std::vector<double> rates;
+    for (size_t i = 0; i < flows.size(); ++i) rates.push_back((flows[i]->bytes() - before[i]) / mb / seconds);
+    return rates;
+}
+
+// 기대값에 맞춘 비율의 Jain 지수. 1 이면 모두 정확히 제 몫을 받았다
+double jain_index(const std::vector<double>& measured, const std::vector<double>& expected) {
+    double sum = 0, squares = 0;
+    size_t n = 0;
+    for (size_t i = 0; i < measured.size(); ++i) {
+        if (expected[i] <= 0) continue;
+        double x = measured[i] / expected[i];
+        sum += x;
+        squares += x * x;
+        ++n;
+    }
+    return n == 0 || squares == 0 ? 0 : sum * sum / (n * squares);
+}
+
+// 흐름마다 기대 몫에서 tolerance 안에 들고 (쉬는 흐름은 보내지 않고), 몫이 큰 흐름이 더 빠르며, 공정성 지수가 1 에 가깝다
+void check_shares(const char* scenario, const std::vector<double>& expected, const std::vector<double>& measured) {
+    REQUIRE(measured.size() == expected.size());
+    double largest = *std::max_element(expected.begin(), expected.end());
+    double jain = jain_index(measured, expected);
+    std::printf("%-14s", scenario);
+    for (size_t i = 0; i < measured.size(); ++i) std::printf(" %.3f/%.3f", measured[i], expected[i]);
+    std::printf("  jain %.5f\n", jain);
+    for (size_t i = 0; i < expected.size(); ++i) {
+        if (expected[i] > 0) CHECK(std::abs(measured[i] - expected[i]) <= expected[i] * tolerance);
+        else CHECK(measured[i] <= largest * tolerance);
+        for (size_t j = 0; j < expected.size(); ++j) {
+            if (expected[i] > expected[j]) CHECK(measured[i] > measured[j]);
+        }
+    }
+    CHECK(jain >= min_jain);
+}
+
+void shaper_scenarios() {
+    const double rate = 10 * mb;
+    const double high = transfer_priority_weight(transfer_priority::high);
+    const double normal = transfer_priority_weight(transfer_priority::normal);
+    const double low = transfer_priority_weight(transfer_priority::low);
+    clock_type::time_point now = clock_type::time_point{} + std::chrono::hours(1);
+
+    {
+        // 청크 크기가 토큰 단위와 맞지 않아도 평균이 맞는다
+        auto shaper = bandwidth_shaper::create(rate, false);
+        std::vector<std::shared_ptr<shaped_flow>> flows = { shaper->add_flow() };
+        check_shares("single", { 10 }, simulate(flows, 1, now, 10, 50000));
+    }
+    {
+        auto shaper = bandwidth_shaper::create(rate, false);
+        std::vector<std::shared_ptr<shaped_flow>> flows = { shaper->add_flow(normal), shaper->add_flow(normal) };
+        check_shares("equal", { 5, 5 }, simulate(flows, 2, now, 10, 64 << 10));
+    }
+    {
+        auto shaper = bandwidth_shaper::create(rate, false);
+        std::vector<std::shared_ptr<shaped_flow>> flows = { shaper->add_flow(high), shaper->add_flow(low) };
+        double share = 10 * high / (high + low);
+        check_shares("high_vs_low", { share, 10 - share }, simulate(flows, 2, now, 10, 64 << 10));
+    }
+    {
+        auto shaper = bandwidth_shaper::create(rate, false);
+        std::vector<std::shared_ptr<shaped_flow>> flows = { shaper->add_flow(high), shaper->add_flow(normal),
+                                                             shaper->add_flow(low) };
+        double sum = high + normal + low;
+        check_shares("three_weights", { 10 * high / sum, 10 * normal / sum, 10 * low / sum },
+                     simulate(flows, 3, now, 10, 64 << 10));
+    }
+    {
+        // 상한 2 MB/s 인 흐름은 상한만 받고 남는 8 MB/s 를 나머지 둘이 나눈다
+        auto shaper = bandwidth_shaper::create(rate, false);
+        std::vector<std::shared_ptr<shaped_flow>> flows = { shaper->add_flow(normal, 2 * mb), shaper->add_flow(normal),
+                                                             shaper->add_flow(normal) };
+        check_shares("ceil", { 2, 4, 4 }, simulate(flows, 3, now, 10, 64 << 10));
+    }
+    {
+        // 쉬는 흐름의 몫은 보내는 흐름이 빌려 쓴다. 멈춘 흐름은 몫을 내놓고, 다시 돌면 되찾는다
+        auto shaper = bandwidth_shaper::create(rate, false);
+        std::vector<std::shared_ptr<shaped_flow>> flows = { shaper->add_flow(normal), shaper->add_flow(normal) };
+        check_shares("borrow_idle", { 10, 0 }, simulate(flows, 1, now, 5, 64 << 10));
+        flows[1]->set_paused(true);
+        check_shares("paused", { 10, 0 }, simulate(flows, 2, now, 5, 64 << 10));
+        flows[1]->set_paused(false);
+        check_shares("resumed", { 5, 5 }, simulate(flows, 2, now, 5, 64 << 10));
+        flows[0]->set_weight(low);
+        flows[1]->set_weight(high);
+        double share = 10 * low / (high + low);
+        check_shares("reprioritized", { share, 10 - share }, simulate(flows, 2, now, 5, 64 << 10));
+        shaper->set_rate(4 * mb);
+        share = 4 * low / (high + low);
+        check_shares("rate_changed", { share, 4 - share }, simulate(flows, 2, now, 5, 64 << 10));
+    }
+}
+
+// 작업마다 세션 하나를 가짜 id 로 돌려주고, 시작한 차례를 적는다
+struct fake_jobs {
+    std::vector<std::string> started;
+
+    transfer_job make(const std::string& name, transfer_priority priority, uint64_t session) {
+        transfer_job job;
+        job.name = name;
+        job.priority = priority;
+        job.start = [this, name, session](const std::shared_ptr<shaped_flow>& flow) {
+            CHECK(flow != nullptr);
+            started.push_back(name);
+            return std::vector<uint64_t>{ session };
+        };
+        return job;
+    }
+};
+
+size_t running(const transfer_scheduler& scheduler) {
+    std::vector<job_info> jobs = scheduler.jobs();
+    return static_cast<size_t>(std::count_if(jobs.begin(), jobs.end(), [](const job_info& j) { return j.state != job_state::queued; }));
+}
+
+void scheduler_order() {
+    // runner 가 없으면 작업은 enqueue/on_session_state 를 부른 스레드에서 바로 시작한다
+    fake_jobs fake;
+    transfer_scheduler scheduler(1, 8 * mb);
+    scheduler.enqueue(fake.make("a-low", transfer_priority::low, 101));
+    scheduler.enqueue(fake.make("b-low", transfer_priority::low, 102));
+    scheduler.enqueue(fake.make("c-high", transfer_priority::high, 103));
+    scheduler.enqueue(fake.make("d-normal", transfer_priority::normal, 104));
+    // 첫 작업은 넣자마자 시작하고 나머지는 자리가 날 때까지 기다린다
+    CHECK(fake.started == std::vector<std::string>{ "a-low" });
+    CHECK(running(scheduler) == 1);
+
+    for (uint64_t session : { 101, 103, 104 }) {
+        scheduler.on_session_state(session, session_state::finished);
+        CHECK(running(scheduler) <= scheduler.max_active());
+    }
+    // 먼저 넣은 low 보다 high, normal 이 먼저 시작한다
+    CHECK((fake.started == std::vector<std::string>{ "a-low", "c-high", "d-normal", "b-low" }));
+    scheduler.on_session_state(102, session_state::finished);
+    CHECK(scheduler.jobs().empty());
+}
+
+void scheduler_max_active() {
+    fake_jobs fake;
+    transfer_scheduler scheduler(2, 8 * mb);
+    for (uint64_t i = 0; i < 6; ++i) scheduler.enqueue(fake.make("job" + std::to_string(i), transfer_priority::normal, 200 + i));
+    CHECK(fake.started.size() == 2);
+    CHECK(running(scheduler) == 2);
+
+    // 자리를 늘리면 곧바로 더 시작하고, 줄이면 돌고 있는 작업은 두고 새로 시작하지 않는다
+    scheduler.set_max_active(3);
+    CHECK(fake.started.size() == 3);
+    scheduler.set_max_active(1);
+    scheduler.on_session_state(200, session_state::finished);
+    CHECK(fake.started.size() == 3);
+    CHECK(running(scheduler) == 2);
+    scheduler.on_session_state(201, session_state::failed);
+    CHECK(fake.started.size() == 3);
+    scheduler.on_session_state(202, session_state::finished);
+    CHECK(fake.started.size() == 4);
+    CHECK(running(scheduler) == 1);
+
+    // 멈춘 대기 작업은 건너뛴다
+    std::vector<job_info> jobs = scheduler.jobs();
+    REQUIRE(jobs.size() == 3);
+    uint64_t next = 0;
+    for (const job_info& j : jobs) {
+        if (j.state == job_state::queued) {
+            next = j.id;
+            break;
+        }
+    }
+    CHECK(scheduler.pause(next));
+    scheduler.on_session_state(203, session_state::finished);
+    CHECK(fake.started.size() == 5);
+    CHECK(fake.started.back() == "job5");
+    CHECK(running(scheduler) == 1);
+}
+
+} // namespace
+
+int main() {
+    shaper_scenarios();
+    scheduler_order();
+    scheduler_max_active();
+    return test_result();
+}
@@ -0,0 +1,135 @@
+﻿#include "signal_image.h"
+#include "test.h"
+
+#include <algorithm>
+#include <vector>
+
+// SDP 를 이미지로 싣고 되읽는 길을 아무렇게나 만든 입력으로 돌린다.
+// 되읽은 글이 한 바이트도 다르지 않아야 하고, 손상되거나 잘린 틀은 CRC 와 길이 검사에서 걸러져야 한다.
+
+namespace {
+
+// 브라우저와 libdatachannel 이 내는 SDP 와 비슷한 줄을 섞는다. 같은 후보가 두 번 나오기도 한다
+std::string random_sdp(std::mt19937_64& rng, size_t lines) {
+    static const char* kinds[] = { "a=ice-ufrag:", "a=ice-pwd:", "a=fingerprint:sha-256 ", "a=mid:", "a=setup:actpass",
+                                   "a=sctp-port:5000", "a=max-message-size:262144", "a=msid-semantic: WMS",
+                                   "a=extmap-allow-mixed", "m=application 9 UDP/DTLS/SCTP webrtc-datachannel" };
+    std::string sdp = "v=0\r\no=- " + std::to_string(rng()) + " 2 IN IP4 127.0.0.1\r\ns=-\r\nt=0 0\r\n";
+    for (size_t i = 0; i < lines; ++i) {
+        if (rng() % 3 == 0) {
+            const char* transport = rng() % 4 == 0 ? "TCP" : "UDP";
+            std::string address = rng() % 5 == 0 ? "fe80::" + std::to_string(rng() % 0xffff)
+                                                 : "192.168." + std::to_string(rng() % 4) + "." + std::to_string(rng() % 4);
+            sdp += "a=candidate:" + std::to_string(rng() % 8) + " 1 " + transport + " " + std::to_string(rng() % 2130706431) +
+                   " " + address + " " + std::to_string(50000 + rng() % 4) + " typ host\r\n";
+        }
+        else {
+            sdp += kinds[rng() % (sizeof(kinds) / sizeof(kinds[0]))];
+            size_t tail = rng() % 48;
+            for (size_t j = 0; j < tail; ++j) sdp += static_cast<char>('!' + rng() % 94);
+            sdp += rng() % 2 ? "\r\n" : "\n";
+        }
+    }
+    return sdp;
+}
+
+// 클립보드는 BGRA 로 돌려준다. 받는 쪽과 같은 길(bgra_to_rgba)로 되돌린다
+std::vector<unsigned char> through_clipboard(const std::vector<unsigned char>& rgba) {
+    std::vector<unsigned char> bgra(rgba);
+    for (size_t i = 0; i + 3 < bgra.size(); i += 4) std::swap(bgra[i], bgra[i + 2]);
+    std::vector<unsigned char> back(bgra.size());
+    bgra_to_rgba(bgra.data(), back.data(), bgra.size() / 4);
+    return back;
+}
+
+void check_round_trip(const std::string& input) {
+    std::vector<unsigned char> frame = encode_signal(input);
+    std::string out;
+    CHECK(decode_signal(frame.data(), frame.size(), out) && out == input);
+
+    // 뒤에 붙은 바이트(이미지의 남는 픽셀)는 무시한다
+    frame.resize(frame.size() + 37, 0xA5);
+    out.clear();
+    CHECK(decode_signal(frame.data(), frame.size(), out) && out == input);
+
+    std::vector<unsigned char> rgba;
+    int width = 0, height = 0;
+    REQUIRE(encode_string_to_image_to_memory(input, rgba, width, height));
+    CHECK(width == height && width >= signal_min_side);
+    CHECK(rgba.size() == static_cast<size_t>(width) * height * 4);
+    out.clear();
+    CHECK(decode_string_from_image_memory(through_clipboard(rgba), width, height, out) && out == input);
+}
+
+// 틀의 한 비트를 뒤집거나 끝을 잘라 내면 받아들이지 않아야 한다
+size_t check_rejects_damage(const std::string& input, std::mt19937_64& rng) {
+    const std::vector<unsigned char> frame = encode_signal(input);
+    size_t cases = 0;
+    for (int i = 0; i < 32; ++i, ++cases) {
+        std::vector<unsigned char> damaged = frame;
+        size_t bit = rng() % (damaged.size() * 8);
+        damaged[bit / 8] ^= static_cast<unsigned char>(1u << (bit % 8));
+        std::string out;
+        if (decode_signal(damaged.data(), damaged.size(), out)) {
+            std::fprintf(stderr, "bit %zu / %zu 를 뒤집은 틀을 받아들였다\n", bit, damaged.size() * 8);
+            CHECK(false);
+        }
+    }
+    for (int i = 0; i < 8; ++i, ++cases) {
+        size_t keep = rng() % frame.size();
+        std::string out;
+        CHECK(!decode_signal(frame.data(), keep, out));
+    }
+    return cases;
+}
+
+// 헤더와 CRC 는 맞는데 deflate 본문이 엉터리인 틀. 거절하든 받아들이든 터지지만 않으면 된다
+void check_garbage_payload(std::mt19937_64& rng) {
+    std::vector<unsigned char> frame = encode_signal(random_sdp(rng, 40));
+    for (size_t i = signal_header_size; i < frame.size(); ++i) {
+        if (rng() % 8 == 0) frame[i] = static_cast<unsigned char>(rng());
+    }
+    uint32_t crc = crc32(frame.data() + signal_header_size, frame.size() - signal_header_size, crc32(frame.data(), 12));
+    for (int i = 0; i < 4; ++i) frame[12 + i] = static_cast<unsigned char>(crc >> (i * 8));
+    std::string out;
+    decode_signal(frame.data(), frame.size(), out);
+}
+
+} // namespace
+
+int main() {
+    std::mt19937_64 rng(7);
+    size_t cases = 0;
+
+    check_round_trip("");
+    check_round_trip("v=0");
+    for (int i = 0; i < 300; ++i, ++cases) {
+        std::string sdp = random_sdp(rng, rng() % 200);
+        check_round_trip(sdp);
+        // 실제로 싣는 것은 줄인 SDP 다. 두 번 줄여도 같아야 한다
+        std::string minified = minify_sdp(sdp);
+        CHECK(minify_sdp(minified) == minified);
+        CHECK(minified.find('\r') == std::string::npos);
+        check_round_trip(minified);
+        cases += check_rejects_damage(minified, rng);
+    }
+    // 줄지 않는 입력은 deflate 없이 실린다
+    for (int i = 0; i < 100; ++i, ++cases) {
+        std::string raw = random_string(rng() % (64 << 10), rng());
+        check_round_trip(raw);
+        if (!raw.empty()) cases += check_rejects_damage(raw, rng);
+    }
+    for (int i = 0; i < 200; ++i, ++cases) check_garbage_payload(rng);
+
+    // 크기가 맞지 않는 이미지
+    std::string out;
+    std::vector<unsigned char> rgba;
+    int width = 0, height = 0;
+    REQUIRE(encode_string_to_image_to_memory(random_sdp(rng, 20), rgba, width, height));
+    CHECK(!decode_string_from_image_memory(rgba, 0, height, out));
+    CHECK(!decode_string_from_image_memory(rgba, 1, 1, out));
+    CHECK(!decode_string_from_image_memory(std::vector<unsigned char>(rgba.size(), 0), width, height, out));
+
+    std::printf("signal_image: %zu cases\n", cases);
+    return test_result();
+}
@@ -0,0 +1,97 @@
+﻿#include "fileio.h"
+#include "hashing.h"
+#include "loopback.h"
+#include "sparse.h"
+#include "test.h"
+#include "writer.h"
+
+#include <sys/stat.h>
+
+// 구멍과 0 으로 채운 구간이 섞인 파일을 루프백으로 보낸다.
+// 받은 파일은 다이제스트가 원본과 같아야 하고, 구멍과 0 구간을 실제 0 으로 써 넣지 않았으므로
+// 디스크에서 차지하는 크기가 원본에서 미리 잡는 창 하나 이상 늘면 안 된다.
+
+namespace {
+
+constexpr uint64_t file_size = 256 << 20;
+constexpr uint64_t stride = 16 << 20;      // 이 간격마다 데이터가 data_length 만큼 있고 나머지는 구멍이다
+constexpr uint64_t data_length = 1 << 20;
+constexpr uint64_t zero_begin = 128 << 20; // [zero_begin, zero_end) 는 0 을 실제로 써 넣어 원본에서는 할당돼 있다
+constexpr uint64_t zero_end = 160 << 20;
+
+uint64_t allocated_bytes(const std::filesystem::path& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return 0;
+    return static_cast<uint64_t>(st.st_blocks) * 512;
+}
+
+// bench 의 write_content("sparse") 처럼 건너뛴 곳은 쓰지 않아 구멍으로 남긴다
+bool write_holey(const std::filesystem::path& path) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    for (uint64_t at = 0; at < file_size; at += stride) {
+        if (at >= zero_begin && at < zero_end) continue;
+        std::string block = random_string(data_length, at);
+        out.seekp(static_cast<std::streamoff>(at));
+        out.write(block.data(), static_cast<std::streamsize>(block.size()));
+    }
+    const std::string zeros(1 << 20, '\0');
+    for (uint64_t at = zero_begin; at < zero_end; at += zeros.size()) {
+        out.seekp(static_cast<std::streamoff>(at));
+        out.write(zeros.data(), static_cast<std::streamsize>(zeros.size()));
+    }
+    out.close();
+    std::error_code ec;
+    std::filesystem::resize_file(path, file_size, ec);
+    return !ec && static_cast<bool>(out);
+}
+
+// 파일 시스템이 구멍을 알려 주고(SEEK_HOLE) 받는 쪽이 쓰는 zero_range 로 구멍을 뚫을 수 있는지
+bool holes_supported(const test_dir& dir) {
+    auto probe = dir / "probe.bin";
+    REQUIRE(write_file(probe, random_string(4 << 20, 9)));
+    file_io file;
+    if (!file.open_write(probe, false) || !file.zero_range(0, 2 << 20)) return false;
+    file.close();
+    extent_map extents;
+    return allocated_bytes(probe) < (4 << 20) && extents.open(probe) && extents.hole_end(0) >= (2 << 20);
+}
+
+} // namespace
+
+int main() {
+    test_dir dir("sparse");
+    std::filesystem::create_directories(dir / "dst");
+    const auto source = dir / "holey.bin";
+    const auto received = dir / "dst" / "holey.bin";
+    REQUIRE(write_holey(source));
+
+    test_loopback link;
+    uint64_t receive_id = link.receive(dir / "dst");
+    uint64_t send_id = link.send(source);
+    REQUIRE(send_id != 0);
+    REQUIRE(link.wait({ send_id, receive_id }, std::chrono::seconds(120)));
+    REQUIRE(link.finished(receive_id));
+
+    file_digest expected, actual;
+    REQUIRE(digest_file(source, expected));
+    REQUIRE(digest_file(received, actual));
+    REQUIRE(actual == expected);
+    CHECK(std::filesystem::file_size(received) == file_size);
+
+    metrics_snapshot sent = link.metrics(send_id);
+    uint64_t src_allocated = allocated_bytes(source);
+    uint64_t dst_allocated = allocated_bytes(received);
+    std::printf("size %llu, sparse %llu bytes, allocated src %llu dst %llu\n", static_cast<unsigned long long>(file_size),
+                static_cast<unsigned long long>(sent.bytes_sparse), static_cast<unsigned long long>(src_allocated),
+                static_cast<unsigned long long>(dst_allocated));
+    // 0 구간은 데이터로 보내지 않는다
+    CHECK(sent.bytes_sparse >= zero_end - zero_begin);
+
+    if (!holes_supported(dir)) {
+        std::printf("이 파일 시스템은 구멍을 알려 주지 않거나 뚫지 못하므로 할당 크기는 보지 않는다\n");
+        return test_result();
+    }
+    REQUIRE(src_allocated < file_size);
+    CHECK(dst_allocated <= src_allocated + write_behind::preallocate_window);
+    return test_result();
+}
@@ -0,0 +1,91 @@
+﻿#include "loopback.h"
+#include "test.h"
+
+#include <thread>
+
+// 작은 파일을 수백 번 연달아 보내며 세션이 끝날 때마다 스레드와 PeerConnection 이 거둬지는지 본다.
+// 처음 몇 바퀴는 풀, 할당자, libdatachannel 의 전역 스레드가 자리 잡는 데 쓰고, 그 뒤로는 스레드 수와 RSS 가 늘면 안 된다.
+
+namespace {
+
+constexpr int warmup_rounds = 10;
+constexpr int rounds = 100;
+constexpr int pairs_per_round = 4; // 바퀴마다 동시에 도는 송수신 쌍
+constexpr int thread_slack = 2;
+constexpr uint64_t rss_slack_kb = 16 << 10;
+
+int thread_count() {
+    std::ifstream status("/proc/self/status");
+    for (std::string line; std::getline(status, line);) {
+        if (line.compare(0, 8, "Threads:") == 0) return std::atoi(line.c_str() + 8);
+    }
+    return -1;
+}
+
+uint64_t rss_kb() {
+    std::ifstream statm("/proc/self/statm");
+    uint64_t pages = 0, resident = 0;
+    if (!(statm >> pages >> resident)) return 0;
+    return resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE)) / 1024;
+}
+
+// 끝난 세션의 정리는 풀에서 돌므로 잠깐 기다려 준다
+bool drained(session_manager& sessions) {
+    for (int i = 0; i < 200 && sessions.active_sessions() != 0; ++i) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    return sessions.active_sessions() == 0;
+}
+
+} // namespace
+
+int main() {
+    test_dir dir("stress");
+    std::vector<std::string> data;
+    for (int i = 0; i < pairs_per_round; ++i) {
+        data.push_back(random_string(64 << 10, 100 + i));
+        REQUIRE(write_file(dir / ("f" + std::to_string(i)), data.back()));
+    }
+
+    test_loopback link;
+    int threads_before = 0;
+    uint64_t rss_before = 0;
+    int sessions = 0;
+    for (int round = 0; round < warmup_rounds + rounds; ++round) {
+        if (round == warmup_rounds) {
+            threads_before = thread_count();
+            rss_before = rss_kb();
+        }
+        // 같은 이름이 남아 있으면 델타 전송이 되므로 바퀴마다 새 폴더에 받는다
+        auto download_dir = dir / ("dst" + std::to_string(round));
+        std::filesystem::create_directories(download_dir);
+
+        std::vector<uint64_t> ids;
+        for (int i = 0; i < pairs_per_round; ++i) ids.push_back(link.receive(download_dir));
+        for (int i = 0; i < pairs_per_round; ++i) {
+            uint64_t id = link.send(dir / ("f" + std::to_string(i)));
+            REQUIRE(id != 0);
+            ids.push_back(id);
+        }
+        REQUIRE(link.wait(ids, std::chrono::seconds(30)));
+        for (uint64_t id : ids) CHECK(link.finished(id));
+        for (int i = 0; i < pairs_per_round; ++i) CHECK(read_file(download_dir / ("f" + std::to_string(i))) == data[i]);
+        CHECK(drained(link.sessions()));
+
+        std::error_code ec;
+        std::filesystem::remove_all(download_dir, ec);
+        sessions += pairs_per_round * 2;
+    }
+
+    // libdatachannel 은 닫힌 연결의 스레드를 조금 늦게 거둔다
+    int threads_after = thread_count();
+    for (int i = 0; i < 200 && threads_after > threads_before + thread_slack; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        threads_after = thread_count();
+    }
+    uint64_t rss_after = rss_kb();
+    std::printf("%d sessions: threads %d -> %d, rss %llu -> %llu KiB\n", sessions, threads_before, threads_after,
+                static_cast<unsigned long long>(rss_before), static_cast<unsigned long long>(rss_after));
+    CHECK(threads_before > 0);
+    CHECK(threads_after <= threads_before + thread_slack);
+    CHECK(rss_after <= rss_before + rss_slack_kb);
+    return test_result();
+}
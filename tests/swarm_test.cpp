@@ -0,0 +1,59 @@
+﻿#include "hashing.h"
+#include "loopback.h"
+#include "shaper.h"
+#include "test.h"
+
+// 속도를 묶은 송신자 셋에게서 나눠 받으면 가장 빠른 송신자 하나에게서 받을 때보다 빨라야 한다.
+// 송신자 속도는 8, 4, 2 MiB/s 이므로 이상적으로는 1.75 배이고, 연결과 해시 목록 교환을 감안해 1.2 배만 요구한다.
+
+namespace {
+
+constexpr uint64_t file_size = 24 << 20;
+constexpr double fastest_rate = 8.0 * 1024 * 1024;
+constexpr double min_speedup = 1.2;
+
+// 받은 파일이 원본과 같으면 걸린 시간(초), 실패면 0
+double fetch(const test_dir& dir, const std::string& name, const file_digest& digest, const std::vector<double>& rates,
+             const std::string& dst) {
+    std::filesystem::create_directories(dir / dst);
+    test_loopback link(4);
+    // 송신자마다 따로 묶어야 송신자별 속도가 된다
+    std::vector<std::shared_ptr<bandwidth_shaper>> shapers;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<uint64_t> ids = link.swarm(dir / dst, digest, rates.size());
+    REQUIRE(ids.size() == rates.size());
+    for (double rate : rates) {
+        shapers.push_back(bandwidth_shaper::create(rate));
+        send_options options;
+        options.seed = true;
+        options.compression = compression_mode::off;
+        options.flow = shapers.back()->add_flow();
+        uint64_t id = link.send(dir / name, options);
+        REQUIRE(id != 0);
+        ids.push_back(id);
+    }
+    if (!link.wait(ids, std::chrono::seconds(60))) return 0;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    bool received = false;
+    for (size_t i = 0; i < rates.size(); ++i) received |= link.finished(ids[i]);
+    CHECK(received);
+    file_digest actual;
+    CHECK(digest_file(dir / dst / name, actual) && actual == digest);
+    return received && actual == digest ? seconds : 0;
+}
+
+} // namespace
+
+int main() {
+    test_dir dir("swarm");
+    REQUIRE(write_file(dir / "seeded.bin", random_string(file_size, 19)));
+    file_digest digest;
+    REQUIRE(digest_file(dir / "seeded.bin", digest));
+
+    double single = fetch(dir, "seeded.bin", digest, { fastest_rate }, "single");
+    double swarm = fetch(dir, "seeded.bin", digest, { fastest_rate, fastest_rate / 2, fastest_rate / 4 }, "swarm");
+    std::printf("single %.2f s, swarm %.2f s, speedup %.2f\n", single, swarm, swarm > 0 ? single / swarm : 0.0);
+    REQUIRE(single > 0 && swarm > 0);
+    CHECK(single / swarm >= min_speedup);
+    return test_result();
+}
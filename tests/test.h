@@ -0,0 +1,85 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <system_error>
+#include <unistd.h>
+
+// 시험 실행 파일이 함께 쓰는 작은 검사 도구. ctest 는 끝 코드로 성공과 실패를 가른다.
+// CHECK 는 실패를 세고 계속 가며, REQUIRE 는 더 볼 것이 없으므로 바로 끝낸다.
+
+inline int& test_failures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(cond)                                                                   \
+    do {                                                                              \
+        if (!(cond)) {                                                                \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) 실패\n", __FILE__, __LINE__, #cond); \
+            ++test_failures();                                                        \
+        }                                                                             \
+    } while (0)
+
+#define REQUIRE(cond)                                                                   \
+    do {                                                                                \
+        if (!(cond)) {                                                                  \
+            std::fprintf(stderr, "%s:%d: REQUIRE(%s) 실패\n", __FILE__, __LINE__, #cond); \
+            std::exit(1);                                                               \
+        }                                                                               \
+    } while (0)
+
+// main 의 마지막에 돌려준다
+inline int test_result() {
+    if (test_failures() == 0) return 0;
+    std::fprintf(stderr, "%d개 검사 실패\n", test_failures());
+    return 1;
+}
+
+// 시험마다 쓰는 임시 폴더. 끝나면 지운다
+class test_dir {
+public:
+    explicit test_dir(const std::string& name)
+        : path_(std::filesystem::temp_directory_path() / ("fts-test-" + name + "-" + std::to_string(getpid()))) {
+        std::error_code ec;
+        std::filesystem::remove_all(path_, ec);
+        std::filesystem::create_directories(path_);
+    }
+    ~test_dir() {
+        std::error_code ec;
+        std::filesystem::remove_all(path_, ec);
+    }
+
+    const std::filesystem::path& path() const { return path_; }
+    std::filesystem::path operator/(const std::string& name) const { return path_ / name; }
+
+private:
+    std::filesystem::path path_;
+};
+
+// seed 가 같으면 같은 바이트열
+inline std::string random_string(size_t size, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::string out(size, '\0');
+    for (size_t i = 0; i < size; i += 8) {
+        uint64_t v = rng();
+        for (size_t j = 0; j < 8 && i + j < size; ++j) out[i + j] = static_cast<char>(v >> (j * 8));
+    }
+    return out;
+}
+
+inline bool write_file(const std::filesystem::path& path, const std::string& data) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+    return static_cast<bool>(out);
+}
+
+inline std::string read_file(const std::filesystem::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}